@@ -0,0 +1,529 @@
+/*
+ * bench.c - Program for benchmarking pseudo-hilbert curve generation and catching regressions
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * Runs every mode (an engine or a writer) on every order a number of times and reports points per second, MB per
+ * second and the peak RSS of a run. Every run is a child process of its own, so the RSS that wait4 reports is the
+ * RSS of that run alone, and a run can't warm up or fragment memory for the next one. A run repeats its mode for
+ * at least BENCH_MIN_SECONDS and reports the average of one curve.
+ *
+ * The results can be saved as a baseline JSON file and compared with later on. A mode is a regression when its
+ * mean throughput is below the baseline by more than the tolerance with 95% confidence (a one sided Welch's t-test
+ * over the runs of both), or when its peak RSS grew by more than the RSS tolerance, and the exit status is 1 then
+ *
+ * SEGMENTS:
+ *  Modes - What is measured, every mode generates or writes a whole curve
+ *  Baselines - Writing and reading the JSON files and comparing results against them
+ *  Bench - Parses the options, runs every mode and reports
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "hilbert.h"
+
+/* MODES */
+
+// points handed to an engine at once
+#define BENCH_CHUNK_POINTS ((size_t) 1 << 16)
+// highest order that hilbert_create is run on, it needs about four times the curve in memory
+#define BENCH_CREATE_MAX_ORDER 12
+// most runs of a mode on an order
+#define BENCH_MAX_RUNS 64
+// a run repeats its mode until this much time has passed, so small orders aren't lost in timer noise
+#define BENCH_MIN_SECONDS 0.2
+
+// settings that every mode runs with
+struct bench_settings {
+    int threads;
+    const char *dir; // where the writers put their files
+};
+
+// runs a mode on a whole curve, returns the number of bytes it produced
+typedef size_t (*bench_fn)(int order, const struct bench_settings *settings);
+
+// a file for a writer, which is unlinked right away so nothing is left behind
+static FILE *bench_file(const struct bench_settings *settings) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/hilbert_bench_XXXXXX", settings->dir);
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    unlink(path);
+    FILE *fp = fdopen(fd, "w+b");
+    assert(fp != NULL);
+    return fp;
+}
+
+static size_t bench_file_size(FILE *fp) {
+    struct stat st;
+    fflush(fp);
+    fstat(fileno(fp), &st);
+    fclose(fp);
+    return (size_t) st.st_size;
+}
+
+static size_t bench_create(int order, const struct bench_settings *settings) {
+    (void) settings;
+    struct space_vec2 *points;
+    size_t len = hilbert_create(order, &points);
+    free(points);
+    return len * sizeof(struct space_vec2);
+}
+
+static size_t bench_range(int order, const struct bench_settings *settings) {
+    (void) settings;
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    struct space_vec2 *buf = (struct space_vec2 *) malloc(BENCH_CHUNK_POINTS * sizeof(struct space_vec2));
+    assert(buf != NULL);
+    for (size_t i = 0; i < num_points; i += BENCH_CHUNK_POINTS) {
+        hilbert_range(order, i, num_points - i < BENCH_CHUNK_POINTS ? num_points - i : BENCH_CHUNK_POINTS, buf);
+    }
+    free(buf);
+    return num_points * sizeof(struct space_vec2);
+}
+
+static size_t bench_range_float(int order, const struct bench_settings *settings) {
+    (void) settings;
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    struct space_vec2f *buf = (struct space_vec2f *) malloc(BENCH_CHUNK_POINTS * sizeof(struct space_vec2f));
+    assert(buf != NULL);
+    for (size_t i = 0; i < num_points; i += BENCH_CHUNK_POINTS) {
+        hilbert_range_float(order, i, num_points - i < BENCH_CHUNK_POINTS ? num_points - i : BENCH_CHUNK_POINTS, buf);
+    }
+    free(buf);
+    return num_points * sizeof(struct space_vec2f);
+}
+
+static size_t bench_range_fixed(int order, const struct bench_settings *settings) {
+    (void) settings;
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    struct hilbert_fixed_vec2 *buf =
+            (struct hilbert_fixed_vec2 *) malloc(BENCH_CHUNK_POINTS * sizeof(struct hilbert_fixed_vec2));
+    assert(buf != NULL);
+    for (size_t i = 0; i < num_points; i += BENCH_CHUNK_POINTS) {
+        hilbert_range_fixed(order, i, num_points - i < BENCH_CHUNK_POINTS ? num_points - i : BENCH_CHUNK_POINTS, buf);
+    }
+    free(buf);
+    return num_points * sizeof(struct hilbert_fixed_vec2);
+}
+
+static size_t bench_view(int order, const struct bench_settings *settings) {
+    (void) settings;
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    struct hilbert_view *view = hilbert_view_create(order, 0);
+    struct space_vec2 *buf = (struct space_vec2 *) malloc(BENCH_CHUNK_POINTS * sizeof(struct space_vec2));
+    assert(view != NULL && buf != NULL);
+    for (size_t i = 0; i < num_points; i += BENCH_CHUNK_POINTS) {
+        hilbert_view_get_range(view, i, BENCH_CHUNK_POINTS, buf);
+    }
+    free(buf);
+    hilbert_view_destroy(view);
+    return num_points * sizeof(struct space_vec2);
+}
+
+static size_t bench_write_fd(int order, const struct bench_settings *settings) {
+    FILE *fp = bench_file(settings);
+    write_hilbert_curve_fd(order, settings->threads, 0, fileno(fp));
+    return bench_file_size(fp);
+}
+
+static size_t bench_stream(int order, const struct bench_settings *settings) {
+    (void) settings;
+    FILE *fp = fopen("/dev/null", "wb");
+    assert(fp != NULL);
+    write_hilbert_curve_stream(order, fileno(fp));
+    fclose(fp);
+    return HILBERT_NUM_POINTS(order) * sizeof(struct space_vec2);
+}
+
+static size_t bench_npy(int order, const struct bench_settings *settings) {
+    FILE *fp = bench_file(settings);
+    write_hilbert_npy(order, HILBERT_DTYPE_F8, fp);
+    return bench_file_size(fp);
+}
+
+static size_t bench_text(int order, const struct bench_settings *settings) {
+    FILE *fp = bench_file(settings);
+    struct hilbert_text_options text = {order, HILBERT_TEXT_TXT, 0, settings->threads};
+    write_hilbert_text_fd(&text, fileno(fp));
+    return bench_file_size(fp);
+}
+
+static size_t bench_delta(int order, const struct bench_settings *settings) {
+    FILE *fp = bench_file(settings);
+    write_hilbert_delta(order, settings->threads, fp);
+    return bench_file_size(fp);
+}
+
+static const struct {
+    const char *name;
+    bench_fn run;
+    int max_order;
+} bench_modes[] = {
+        {"create", bench_create, BENCH_CREATE_MAX_ORDER},
+        {"range", bench_range, HILBERT_MAX_ORDER},
+        {"range_float", bench_range_float, HILBERT_FLOAT_MAX_ORDER},
+        {"range_fixed", bench_range_fixed, HILBERT_MAX_ORDER},
+        {"view", bench_view, HILBERT_MAX_ORDER},
+        {"write_fd", bench_write_fd, HILBERT_MAX_ORDER},
+        {"stream", bench_stream, HILBERT_MAX_ORDER},
+        {"npy", bench_npy, HILBERT_MAX_ORDER},
+        {"text", bench_text, HILBERT_MAX_ORDER},
+        {"delta", bench_delta, HILBERT_MAX_ORDER},
+};
+#define BENCH_NUM_MODES (sizeof(bench_modes) / sizeof(bench_modes[0]))
+
+// the runs of one mode on one order
+struct bench_result {
+    char mode[32];
+    int order;
+    int runs;
+    double *points_per_sec; // one per run
+    double mb_per_sec; // mean
+    size_t peak_rss; // highest of every run, in bytes
+};
+
+// runs a mode in a child process, returns the seconds and bytes of one whole curve or -1 if the child failed
+static int bench_run(size_t mode, int order, const struct bench_settings *settings, double *seconds, size_t *bytes,
+                     size_t *rss) {
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        close(fds[0]);
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        double result[2], elapsed;
+        int iterations = 0;
+        do {
+            result[1] = (double) bench_modes[mode].run(order, settings);
+            iterations++;
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            elapsed = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+        } while (elapsed < BENCH_MIN_SECONDS);
+        result[0] = elapsed / iterations;
+        _exit(write(fds[1], result, sizeof(result)) == sizeof(result) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    double result[2];
+    ssize_t len = read(fds[0], result, sizeof(result));
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+        len != sizeof(result)) return -1;
+
+    *seconds = result[0];
+    *bytes = (size_t) result[1];
+    *rss = (size_t) usage.ru_maxrss * 1024;
+    return 0;
+}
+
+/* BASELINES */
+
+// mean and sample variance of some values
+static void bench_stats(const double *values, int n, double *mean, double *variance) {
+    double sum = 0, squares = 0;
+    for (int i = 0; i < n; i++) sum += values[i];
+    *mean = sum / n;
+    for (int i = 0; i < n; i++) squares += (values[i] - *mean) * (values[i] - *mean);
+    *variance = n > 1 ? squares / (n - 1) : 0;
+}
+
+// critical values of a one sided t-test at 95% confidence, by degrees of freedom, the normal one after 30
+static const double t_critical[] = {
+        6.314, 2.920, 2.353, 2.132, 2.015, 1.943, 1.895, 1.860, 1.833, 1.812, 1.796, 1.782, 1.771, 1.761, 1.753,
+        1.746, 1.740, 1.734, 1.729, 1.725, 1.721, 1.717, 1.714, 1.711, 1.708, 1.706, 1.703, 1.701, 1.699, 1.697,
+};
+
+// whether the runs of 'current' are slower than 'tolerated' times the runs of 'base' with 95% confidence
+// compares the means with Welch's t-test, which doesn't need both to have the same variance or number of runs
+static int bench_slower(const struct bench_result *current, const struct bench_result *base, double tolerated) {
+    double cur_mean, cur_var, base_mean, base_var;
+    bench_stats(current->points_per_sec, current->runs, &cur_mean, &cur_var);
+    bench_stats(base->points_per_sec, base->runs, &base_mean, &base_var);
+
+    double threshold = tolerated * base_mean;
+    double a = cur_var / current->runs, b = tolerated * tolerated * base_var / base->runs;
+    if (a + b == 0) return cur_mean < threshold;
+
+    double t = (cur_mean - threshold) / sqrt(a + b);
+    double df = (a + b) * (a + b) / ((current->runs > 1 ? a * a / (current->runs - 1) : 0) +
+                                     (base->runs > 1 ? b * b / (base->runs - 1) : 0));
+    int d = (int) df;
+    double critical = d < 1 ? t_critical[0] : d <= 30 ? t_critical[d - 1] : 1.645;
+    return t < -critical;
+}
+
+static int bench_save(const char *path, const struct bench_result *results, size_t num_results) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) return -1;
+    fputs("{\"benchmarks\": [\n", fp);
+    for (size_t r = 0; r < num_results; r++) {
+        const struct bench_result *result = &results[r];
+        fprintf(fp, "  {\"mode\": \"%s\", \"order\": %d, \"mb_per_sec\": %.3f, \"peak_rss\": %zu, "
+                    "\"points_per_sec\": [", result->mode, result->order, result->mb_per_sec, result->peak_rss);
+        for (int i = 0; i < result->runs; i++) fprintf(fp, "%s%.1f", i ? ", " : "", result->points_per_sec[i]);
+        fprintf(fp, "]}%s\n", r + 1 < num_results ? "," : "");
+    }
+    fputs("]}\n", fp);
+    return fclose(fp);
+}
+
+// skips whitespace and one expected character, returns NULL if it isn't there
+static const char *json_expect(const char *p, char c) {
+    while (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t') p++;
+    return *p == c ? p + 1 : NULL;
+}
+
+// reads the benchmarks of a baseline file, in the layout that bench_save writes (with any whitespace)
+// returns the number of results or -1 if the file can't be read or isn't a baseline
+static long bench_load(const char *path, struct bench_result **out) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return -1;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+    char *text = (char *) malloc((size_t) size + 1);
+    assert(text != NULL);
+    size_t len = fread(text, 1, (size_t) size, fp);
+    fclose(fp);
+    text[len] = '\0';
+
+    size_t num = 0, cap = 0;
+    struct bench_result *results = NULL;
+    const char *p = strstr(text, "\"benchmarks\"");
+    if (p != NULL) p = json_expect(p + 12, ':');
+    if (p != NULL) p = json_expect(p, '[');
+
+    // every benchmark is an object of keys with a string, a number or an array of numbers
+    while (p != NULL && json_expect(p, '{') != NULL) {
+        p = json_expect(p, '{');
+        if (num == cap) {
+            cap = cap ? cap * 2 : 64;
+            results = (struct bench_result *) realloc(results, cap * sizeof(struct bench_result));
+            assert(results != NULL);
+        }
+        struct bench_result *result = &results[num];
+        memset(result, 0, sizeof(struct bench_result));
+        result->points_per_sec = (double *) malloc(BENCH_MAX_RUNS * sizeof(double));
+        assert(result->points_per_sec != NULL);
+
+        char key[32];
+        int n;
+        while (p != NULL && sscanf(p, " \"%31[^\"]\" : %n", key, &n) == 1) {
+            p += n;
+            char *end;
+            if (strcmp(key, "mode") == 0) {
+                if (sscanf(p, "\"%31[^\"]\"%n", result->mode, &n) != 1) p = NULL;
+                else p += n;
+            } else if (strcmp(key, "points_per_sec") == 0) {
+                p = json_expect(p, '[');
+                while (p != NULL && json_expect(p, ']') == NULL) {
+                    double val = strtod(p, &end);
+                    if (end == p || result->runs == BENCH_MAX_RUNS) {
+                        p = NULL;
+                        break;
+                    }
+                    result->points_per_sec[result->runs++] = val;
+                    p = json_expect(end, ',') != NULL ? json_expect(end, ',') : end;
+                }
+                if (p != NULL) p = json_expect(p, ']');
+            } else {
+                double val = strtod(p, &end);
+                if (end == p) {
+                    p = NULL;
+                    break;
+                }
+                if (strcmp(key, "order") == 0) result->order = (int) val;
+                else if (strcmp(key, "mb_per_sec") == 0) result->mb_per_sec = val;
+                else if (strcmp(key, "peak_rss") == 0) result->peak_rss = (size_t) val;
+                p = end;
+            }
+            if (p != NULL && json_expect(p, ',') != NULL) p = json_expect(p, ',');
+        }
+        if (p != NULL) p = json_expect(p, '}');
+        if (p == NULL || result->runs == 0) {
+            free(result->points_per_sec);
+            p = NULL;
+            break;
+        }
+        num++;
+        if (json_expect(p, ',') != NULL) p = json_expect(p, ',');
+    }
+    free(text);
+
+    if (p == NULL || json_expect(p, ']') == NULL) {
+        for (size_t r = 0; r < num; r++) free(results[r].points_per_sec);
+        free(results);
+        return -1;
+    }
+    *out = results;
+    return (long) num;
+}
+
+/* BENCH */
+
+static void print_usage(const char *program) {
+    fprintf(stderr, "usage: %s [--orders=FIRST:LAST] [--modes=MODE,...] [--runs=N] [--threads=N] [--save=FILE]\n"
+                    "       [--baseline=FILE] [--tolerance=PERCENT] [--rss-tolerance=PERCENT]\n", program);
+    fprintf(stderr, "  --orders=FIRST:LAST\n"
+                    "                   orders to run every mode on (default 10:12)\n");
+    fprintf(stderr, "  --modes=MODE,... modes to run (default all): create, range, range_float, range_fixed, view,\n"
+                    "                   write_fd, stream, npy, text, delta\n");
+    fprintf(stderr, "  --runs=N         runs of every mode on every order, each in a process of its own (default 5)\n");
+    fprintf(stderr, "  --threads=N      number of threads of the writers, 0 for one per core (default)\n");
+    fprintf(stderr, "  --save=FILE      write the results as a baseline JSON file\n");
+    fprintf(stderr, "  --baseline=FILE  compare the results with a baseline and exit with 1 on a regression\n");
+    fprintf(stderr, "  --tolerance=PERCENT\n"
+                    "                   how much slower than the baseline a mode may be (default 10)\n");
+    fprintf(stderr, "  --rss-tolerance=PERCENT\n"
+                    "                   how much more memory than the baseline a mode may use (default 20)\n");
+}
+
+// whether a mode was asked for in a comma separated list
+static int bench_selected(const char *modes, const char *name) {
+    size_t len = strlen(name);
+    for (const char *p = modes; p != NULL; p = strchr(p, ',') ? strchr(p, ',') + 1 : NULL) {
+        if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0')) return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int first_order = 10, last_order = 12, runs = 5;
+    const char *modes = NULL, *save = NULL, *baseline = NULL;
+    double tolerance = 10, rss_tolerance = 20;
+    struct bench_settings settings = {0, getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp"};
+
+    for (int arg = 1; arg < argc; arg++) {
+        if (strncmp(argv[arg], "--orders=", 9) == 0) {
+            if (sscanf(argv[arg] + 9, "%d:%d", &first_order, &last_order) != 2) goto usage;
+            if (first_order < 1 || last_order > HILBERT_MAX_ORDER || first_order > last_order) goto usage;
+        } else if (strncmp(argv[arg], "--modes=", 8) == 0) {
+            modes = argv[arg] + 8;
+        } else if (strncmp(argv[arg], "--runs=", 7) == 0) {
+            runs = atoi(argv[arg] + 7);
+            if (runs < 1 || runs > BENCH_MAX_RUNS) goto usage;
+        } else if (strncmp(argv[arg], "--threads=", 10) == 0) {
+            settings.threads = atoi(argv[arg] + 10);
+        } else if (strncmp(argv[arg], "--save=", 7) == 0) {
+            save = argv[arg] + 7;
+        } else if (strncmp(argv[arg], "--baseline=", 11) == 0) {
+            baseline = argv[arg] + 11;
+        } else if (strncmp(argv[arg], "--tolerance=", 12) == 0) {
+            tolerance = atof(argv[arg] + 12);
+        } else if (strncmp(argv[arg], "--rss-tolerance=", 16) == 0) {
+            rss_tolerance = atof(argv[arg] + 16);
+        } else {
+            goto usage;
+        }
+    }
+    if (modes != NULL) {
+        for (const char *p = modes; p != NULL; p = strchr(p, ',') ? strchr(p, ',') + 1 : NULL) {
+            size_t m;
+            for (m = 0; m < BENCH_NUM_MODES; m++) {
+                size_t len = strlen(bench_modes[m].name);
+                if (strncmp(p, bench_modes[m].name, len) == 0 && (p[len] == ',' || p[len] == '\0')) break;
+            }
+            if (m == BENCH_NUM_MODES) goto usage;
+        }
+    }
+
+    // the baseline is read first, so a missing one doesn't waste a whole run
+    struct bench_result *base = NULL;
+    long num_base = 0;
+    if (baseline != NULL && (num_base = bench_load(baseline, &base)) < 0) {
+        fprintf(stderr, "%s: not a baseline file\n", baseline);
+        return EXIT_FAILURE;
+    }
+
+    size_t num_results = 0;
+    struct bench_result *results = (struct bench_result *) calloc(BENCH_NUM_MODES * (last_order - first_order + 1),
+                                                                  sizeof(struct bench_result));
+    assert(results != NULL);
+    int regressions = 0;
+
+    printf("%-12s %5s %16s %10s %10s%s\n", "mode", "order", "M points/s", "MB/s", "RSS MiB",
+           base != NULL ? "  vs baseline" : "");
+    for (size_t m = 0; m < BENCH_NUM_MODES; m++) {
+        if (modes != NULL && !bench_selected(modes, bench_modes[m].name)) continue;
+        for (int order = first_order; order <= last_order && order <= bench_modes[m].max_order; order++) {
+            struct bench_result *result = &results[num_results++];
+            snprintf(result->mode, sizeof(result->mode), "%s", bench_modes[m].name);
+            result->order = order;
+            result->runs = runs;
+            result->points_per_sec = (double *) malloc(runs * sizeof(double));
+            assert(result->points_per_sec != NULL);
+
+            double mb = 0;
+            for (int run = 0; run < runs; run++) {
+                double seconds;
+                size_t bytes, rss;
+                if (bench_run(m, order, &settings, &seconds, &bytes, &rss) != 0) {
+                    fprintf(stderr, "%s order %d: the run failed\n", result->mode, order);
+                    return EXIT_FAILURE;
+                }
+                result->points_per_sec[run] = (double) HILBERT_NUM_POINTS(order) / seconds;
+                mb += (double) bytes / seconds / 1e6;
+                if (rss > result->peak_rss) result->peak_rss = rss;
+            }
+            result->mb_per_sec = mb / runs;
+
+            double mean, variance;
+            bench_stats(result->points_per_sec, runs, &mean, &variance);
+            printf("%-12s %5d %8.2f +- %5.2f %10.1f %10.1f", result->mode, order, mean / 1e6, sqrt(variance) / 1e6,
+                   result->mb_per_sec, result->peak_rss / 1048576.0);
+
+            // find the same mode and order in the baseline, if it has them
+            const struct bench_result *prev = NULL;
+            for (long b = 0; b < num_base; b++) {
+                if (strcmp(base[b].mode, result->mode) == 0 && base[b].order == order) prev = &base[b];
+            }
+            if (prev != NULL) {
+                double prev_mean, prev_variance;
+                bench_stats(prev->points_per_sec, prev->runs, &prev_mean, &prev_variance);
+                int slower = bench_slower(result, prev, 1 - tolerance / 100);
+                int bigger = (double) result->peak_rss > (double) prev->peak_rss * (1 + rss_tolerance / 100);
+                printf("  %+6.1f%% %s", (mean / prev_mean - 1) * 100,
+                       slower && bigger ? "REGRESSION (speed, memory)" : slower ? "REGRESSION (speed)"
+                                                                        : bigger ? "REGRESSION (memory)" : "ok");
+                regressions += slower || bigger;
+            } else if (base != NULL) {
+                printf("  not in baseline");
+            }
+            printf("\n");
+        }
+    }
+
+    if (save != NULL && bench_save(save, results, num_results) != 0) {
+        perror(save);
+        return EXIT_FAILURE;
+    }
+    if (base != NULL) printf("%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+
+    for (size_t r = 0; r < num_results; r++) free(results[r].points_per_sec);
+    free(results);
+    for (long b = 0; b < num_base; b++) free(base[b].points_per_sec);
+    free(base);
+    return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    usage:
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+}
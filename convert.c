@@ -0,0 +1,306 @@
+/*
+ * convert.c - Program for converting pseudo-hilbert curve files between formats
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * Reads any curve file that hilbert_file_open understands (including the raw oNN_hilbert files written by
+ * hilbert_curve) and writes it out again in another format. The input is memory mapped and converted in
+ * batches, so memory use is bounded by the batch size no matter how large the curve is.
+ *
+ * SEGMENTS:
+ *  Convert - Decodes batches of points on several threads and hands them to the streaming writers
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hilbert.h"
+
+/* CONVERT */
+
+// default number of points decoded and written at once
+#define CONVERT_BATCH_POINTS ((size_t) 1 << 20)
+
+// formats that can be written, selected with --format or guessed from the suffix of the output
+enum convert_format {
+    CONVERT_RAW, // array of space_vec2, like write_hilbert_curve
+    CONVERT_TXT, // write_hilbert_text_points
+    CONVERT_CSV,
+    CONVERT_JSON,
+    CONVERT_PLY,
+    CONVERT_SVG,
+    CONVERT_NPY, // hilbert_npy_write
+    CONVERT_ARROW, // hilbert_arrow_write
+    CONVERT_DELTA, // hilbert_delta_write
+};
+
+static const struct {
+    const char *name; // name given to --format
+    const char *suffix; // suffix of output files in this format
+} convert_formats[] = {
+        [CONVERT_RAW] = {"raw", ""},
+        [CONVERT_TXT] = {"txt", ".txt"},
+        [CONVERT_CSV] = {"csv", ".csv"},
+        [CONVERT_JSON] = {"json", ".json"},
+        [CONVERT_PLY] = {"ply", ".ply"},
+        [CONVERT_SVG] = {"svg", ".svg"},
+        [CONVERT_NPY] = {"npy", ".npy"},
+        [CONVERT_ARROW] = {"arrow", ".arrow"},
+        [CONVERT_DELTA] = {"delta", ".delta"},
+};
+
+static const char *input_names[] = {
+        [HILBERT_FILE_RAW] = "raw",
+        [HILBERT_FILE_NPY] = "npy",
+        [HILBERT_FILE_ARROW] = "arrow",
+        [HILBERT_FILE_DELTA] = "delta",
+};
+
+// coordinate types for npy and arrow files, selected with --dtype
+static const char *dtype_names[] = {
+        [HILBERT_DTYPE_F8] = "f8",
+        [HILBERT_DTYPE_F4] = "f4",
+        [HILBERT_DTYPE_U2] = "u2",
+        [HILBERT_DTYPE_U4] = "u4",
+};
+
+// part of a batch decoded by one thread
+struct decode_part {
+    const struct hilbert_file *file;
+    size_t first, count;
+    struct space_vec2 *out;
+    size_t decoded;
+};
+
+static void *decode_thread(void *arg) {
+    struct decode_part *part = (struct decode_part *) arg;
+    part->decoded = hilbert_file_decode(part->file, part->first, part->count, part->out);
+    return NULL;
+}
+
+// decodes a batch of points with every thread taking an equal part, returns 0 if every point was decoded
+static int decode_batch(const struct hilbert_file *file, size_t first, size_t count, struct space_vec2 *out,
+                        struct decode_part *parts, pthread_t *workers, int threads) {
+    for (int t = 0; t < threads; t++) {
+        size_t begin = count * t / threads, end = count * (t + 1) / threads;
+        parts[t].file = file;
+        parts[t].first = first + begin;
+        parts[t].count = end - begin;
+        parts[t].out = &out[begin];
+    }
+
+    // the calling thread decodes the first part itself, and every part that didn't get a thread
+    int started = 1;
+    while (started < threads && pthread_create(&workers[started], NULL, decode_thread, &parts[started]) == 0) started++;
+    decode_thread(&parts[0]);
+    for (int t = started; t < threads; t++) decode_thread(&parts[t]);
+    for (int t = 1; t < started; t++) pthread_join(workers[t], NULL);
+
+    for (int t = 0; t < threads; t++) {
+        if (parts[t].decoded != parts[t].count) return -1;
+    }
+    return 0;
+}
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void print_usage(const char *program) {
+    fprintf(stderr, "usage: %s [--format=FORMAT] [--dtype=TYPE] [--precision=N] [--threads=N] [--batch=POINTS] "
+                    "[--quiet] INPUT OUTPUT\n", program);
+    fprintf(stderr, "  INPUT            a raw (oNN_hilbert), npy, arrow or delta curve file\n");
+    fprintf(stderr, "  OUTPUT           the file to write, or - for stdout\n");
+    fprintf(stderr, "  --format=FORMAT  one of raw, txt, csv, json, ply, svg, npy, arrow, delta\n"
+                    "                   (default: guessed from the suffix of OUTPUT, otherwise raw)\n");
+    fprintf(stderr, "  --dtype=TYPE     coordinates of npy and arrow files, one of f8 (default), f4, u2, u4\n");
+    fprintf(stderr, "  --precision=N    digits after the decimal point in text files (default 15), or exact for\n"
+                    "                   every digit of every coordinate\n");
+    fprintf(stderr, "  --threads=N      number of threads to use, 0 for one per core (default)\n");
+    fprintf(stderr, "  --batch=POINTS   number of points converted at once (default %zu)\n", CONVERT_BATCH_POINTS);
+    fprintf(stderr, "  --quiet          don't report progress on stderr (only reported when it is a terminal)\n");
+}
+
+int main(int argc, char **argv) {
+    int format = -1;
+    enum hilbert_dtype dtype = HILBERT_DTYPE_F8;
+    struct hilbert_text_options text = {0};
+    int threads = 0, quiet = !isatty(STDERR_FILENO);
+    size_t batch = CONVERT_BATCH_POINTS;
+    const char *input = NULL, *output = NULL;
+
+    for (int arg = 1; arg < argc; arg++) {
+        if (strncmp(argv[arg], "--format=", 9) == 0) {
+            size_t f;
+            for (f = 0; f < sizeof(convert_formats) / sizeof(convert_formats[0]); f++) {
+                if (strcmp(argv[arg] + 9, convert_formats[f].name) == 0) break;
+            }
+            if (f == sizeof(convert_formats) / sizeof(convert_formats[0])) goto usage;
+            format = (int) f;
+        } else if (strncmp(argv[arg], "--dtype=", 8) == 0) {
+            size_t d;
+            for (d = 0; d < sizeof(dtype_names) / sizeof(dtype_names[0]); d++) {
+                if (strcmp(argv[arg] + 8, dtype_names[d]) == 0) break;
+            }
+            if (d == sizeof(dtype_names) / sizeof(dtype_names[0])) goto usage;
+            dtype = (enum hilbert_dtype) d;
+        } else if (strcmp(argv[arg], "--precision=exact") == 0) {
+            text.precision = HILBERT_TEXT_EXACT;
+        } else if (strncmp(argv[arg], "--precision=", 12) == 0) {
+            text.precision = atoi(argv[arg] + 12);
+            if (text.precision < 1 || text.precision > HILBERT_FORMAT_MAX_PRECISION) goto usage;
+        } else if (strncmp(argv[arg], "--threads=", 10) == 0) {
+            threads = text.threads = atoi(argv[arg] + 10);
+        } else if (strncmp(argv[arg], "--batch=", 8) == 0) {
+            batch = (size_t) strtoull(argv[arg] + 8, NULL, 10);
+            if (batch == 0) goto usage;
+        } else if (strcmp(argv[arg], "--quiet") == 0) {
+            quiet = 1;
+        } else if (input == NULL && (argv[arg][0] != '-' || argv[arg][1] == '\0')) {
+            input = argv[arg];
+        } else if (output == NULL && (argv[arg][0] != '-' || argv[arg][1] == '\0')) {
+            output = argv[arg];
+        } else {
+            goto usage;
+        }
+    }
+    if (input == NULL || output == NULL) goto usage;
+    if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+
+    // without --format, the suffix of the output decides
+    if (format < 0) {
+        format = CONVERT_RAW;
+        const char *dot = strrchr(output, '.');
+        for (size_t f = 1; dot != NULL && f < sizeof(convert_formats) / sizeof(convert_formats[0]); f++) {
+            if (strcmp(dot, convert_formats[f].suffix) == 0) format = (int) f;
+        }
+    }
+
+    struct hilbert_file file;
+    if (hilbert_file_open(&file, input) != 0) {
+        fprintf(stderr, "%s: %s\n", input, errno == EINVAL ? "not a curve file" : strerror(errno));
+        return EXIT_FAILURE;
+    }
+    hilbert_file_advise(&file, HILBERT_ACCESS_SEQUENTIAL);
+
+    // cells can only be found for complete curves, so integer outputs (and exact text) need to know the order
+    int integer = format == CONVERT_DELTA ||
+                  ((format == CONVERT_NPY || format == CONVERT_ARROW) && dtype >= HILBERT_DTYPE_U2) ||
+                  (format >= CONVERT_TXT && format <= CONVERT_SVG && text.precision == HILBERT_TEXT_EXACT);
+    if (integer && file.order == 0) {
+        fprintf(stderr, "%s: %zu points aren't a complete curve, so their cells aren't known\n",
+                input, file.num_points);
+        hilbert_file_close(&file);
+        return EXIT_FAILURE;
+    }
+
+    FILE *fp = strcmp(output, "-") == 0 ? stdout : fopen(output, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: %s\n", output, strerror(errno));
+        hilbert_file_close(&file);
+        return EXIT_FAILURE;
+    }
+
+    // start the output, every writer checks that the order fits its format
+    struct hilbert_npy_writer npy;
+    struct hilbert_arrow_writer arrow;
+    struct hilbert_delta_writer delta;
+    int result = 0;
+    if (format == CONVERT_NPY) {
+        result = hilbert_npy_begin(&npy, fp, file.order ? file.order : 1, dtype, file.num_points);
+    } else if (format == CONVERT_ARROW) {
+        result = hilbert_arrow_begin(&arrow, fp, file.order ? file.order : 1, dtype);
+    } else if (format == CONVERT_DELTA) {
+        result = hilbert_delta_begin(&delta, fp, file.order, threads);
+    } else if (format != CONVERT_RAW) {
+        text.format = (enum hilbert_text_format) (format - CONVERT_TXT);
+        text.order = file.order;
+        result = write_hilbert_text_header(&text, file.num_points, fp);
+    }
+    if (result != 0) {
+        fprintf(stderr, "%s: order %d curves can't be stored as %s\n", input, file.order,
+                format == CONVERT_DELTA ? "delta" : dtype_names[dtype]);
+        if (fp != stdout) fclose(fp);
+        hilbert_file_close(&file);
+        return EXIT_FAILURE;
+    }
+
+    // files of doubles are used in place, everything else is decoded into a buffer one batch at a time
+    struct space_vec2 *buf = NULL;
+    struct decode_part *parts = (struct decode_part *) malloc(threads * sizeof(struct decode_part));
+    pthread_t *workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    assert(parts != NULL && workers != NULL);
+    if (file.points == NULL) {
+        buf = (struct space_vec2 *) malloc(batch * sizeof(struct space_vec2));
+        assert(buf != NULL);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int last_percent = -1;
+    for (size_t first = 0; first < file.num_points; first += batch) {
+        size_t len = file.num_points - first < batch ? file.num_points - first : batch;
+        const struct space_vec2 *points = buf;
+        if (file.points != NULL) {
+            points = &file.points[first];
+        } else if (decode_batch(&file, first, len, buf, parts, workers, threads) != 0) {
+            fprintf(stderr, "%s: corrupt %s file\n", input, input_names[file.format]);
+            result = -1;
+            break;
+        }
+
+        if (format == CONVERT_RAW) fwrite(points, sizeof(struct space_vec2), len, fp);
+        else if (format == CONVERT_NPY) hilbert_npy_write(&npy, points, len);
+        else if (format == CONVERT_ARROW) hilbert_arrow_write(&arrow, points, len);
+        else if (format == CONVERT_DELTA) hilbert_delta_write(&delta, points, len);
+        else write_hilbert_text_points(&text, points, first, len, file.num_points, fp);
+
+        // only redraw the progress line when the percentage changes
+        int percent = (int) ((first + len) * 100 / file.num_points);
+        if (!quiet && percent != last_percent) {
+            last_percent = percent;
+            fprintf(stderr, "\r%s -> %s: %zu / %zu points (%d%%)", input, output, first + len, file.num_points,
+                    percent);
+        }
+    }
+
+    // finish the output, even after a failure so that nothing is left allocated
+    if (format == CONVERT_RAW) fflush(fp);
+    else if (format == CONVERT_NPY) hilbert_npy_end(&npy);
+    else if (format == CONVERT_ARROW) hilbert_arrow_end(&arrow);
+    else if (format == CONVERT_DELTA) hilbert_delta_end(&delta);
+    else write_hilbert_text_footer(&text, file.num_points, fp);
+
+    if (ferror(fp)) {
+        fprintf(stderr, "%s: %s\n", output, strerror(errno));
+        result = -1;
+    }
+    if (!quiet && result == 0) {
+        double seconds = seconds_since(&start);
+        fprintf(stderr, "%s%zu %s points written as %s in %.2fs (%.1f M points/s)\n",
+                last_percent >= 0 ? "\n" : "", file.num_points, input_names[file.format],
+                convert_formats[format].name, seconds, seconds > 0 ? (double) file.num_points / seconds / 1e6 : 0.0);
+    }
+
+    free(buf);
+    free(parts);
+    free(workers);
+    if (fp != stdout) fclose(fp);
+    hilbert_file_close(&file);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    usage:
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+}
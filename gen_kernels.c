@@ -0,0 +1,340 @@
+/*
+ * gen_kernels.c - Build time generator of the order specialized curve kernels
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * Run by the build as 'gen_kernels OUTPUT' to write hilbert_kernels.c, which is compiled into the library.
+ * For every order up to HILBERT_KERNEL_MAX_ORDER and every dtype it emits a kernel with the levels of
+ * hilbert_cell fully unrolled, the shifts and the size of a cell as constants, and the hilbert_kernels
+ * table that hilbert_range and hilbert_range_dtype dispatch through at run time.
+ *
+ * DIGIT TABLE:
+ *  hilbert_cell applies one placement per base 4 digit of an index. Four placements in a row (one byte of the
+ *  index, starting at level L) always compose into one of two maps, either (x, y) -> (x + A * 2^L, y + B * 2^L)
+ *  or the reflection (x, y) -> (A * 2^L - 1 - y, B * 2^L - 1 - x). The generated digit table holds the
+ *  reflection flag, A and B for every byte, so a kernel walks an index a byte at a time. The lowest
+ *  (order - 1) % 4 + 1 levels start from cell (0, 0) and are looked up whole in a table of the cells of a
+ *  small curve.
+ *
+ * TILES:
+ *  Every aligned block of 256 points is an order 4 curve that has been moved, and reflected when the map of the
+ *  levels above it reflects. The tables hold the order 4 curve in both orientations, as cells and as centers in
+ *  half cells, so a kernel finds the map of a tile once with the digit tables and writes its 256 points as the
+ *  table plus an offset (times the size of half a cell), a loop the compiler vectorizes. Only the points before
+ *  the first and after the last whole tile of a range are found one at a time.
+ *
+ * SEGMENTS:
+ *  Tables - Simulates hilbert_cell to find the digit, small curve and tile tables
+ *  Kernels - Writes the unrolled kernels and the dispatch table
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "hilbert.h"
+
+/* TABLES */
+
+// points in a tile, an order 4 curve
+#define TILE_POINTS 256
+
+// a map of cells, (x, y) -> (a + x, b + y), or (a - y, b - x) when 'reflect' is set
+struct cell_map {
+    int reflect;
+    int64_t a, b;
+};
+
+// follows one placement of hilbert_cell, of the quadrant 'digit' with sides of 'side' cells, after 'map'
+static struct cell_map place(struct cell_map map, int digit, int64_t side) {
+    int64_t a = map.a;
+    switch (digit) {
+        case 0: // bottom left, (x, y) -> (side - 1 - y, 2 * side - 1 - x)
+            map.reflect = !map.reflect;
+            map.a = side - 1 - map.b;
+            map.b = 2 * side - 1 - a;
+            break;
+        case 2: // top right
+            map.a += side;
+            break;
+        case 3: // bottom right
+            map.a += side;
+            map.b += side;
+            break;
+        default: // top left
+            break;
+    }
+    return map;
+}
+
+// finds the map of the placements of 'levels' digits of an index, at level 0
+// a reflecting map is off by -1 from A * 2^L, which is what the digit tables store
+static uint16_t digit_entry(int digits, int levels) {
+    struct cell_map map = {0, 0, 0};
+    for (int level = 0; level < levels; level++) {
+        map = place(map, (digits >> (level * 2)) & 3, (int64_t) 1 << level);
+    }
+    int64_t a = map.a + map.reflect, b = map.b + map.reflect;
+    if (a < 0 || a > 31 || b < 0 || b > 31) {
+        fprintf(stderr, "digit table entry %d of %d levels is out of range\n", digits, levels);
+        exit(EXIT_FAILURE);
+    }
+    return (uint16_t) (map.reflect | a << 1 | b << 6);
+}
+
+// finds the cell of a point in a curve of a small order, packed as x | y << 8
+static uint16_t small_cell(int order, int index) {
+    struct cell_map map = {0, 0, 0};
+    for (int level = 0; level < order; level++) map = place(map, (index >> (level * 2)) & 3, (int64_t) 1 << level);
+    return (uint16_t) (map.a | map.b << 8);
+}
+
+static void write_tables(FILE *fp) {
+    fprintf(fp, "// reflection flag, A and B of the four placements of every byte of an index (see gen_kernels.c)\n");
+    fprintf(fp, "static const uint16_t digit_table[256] = {");
+    for (int byte = 0; byte < 256; byte++) {
+        fprintf(fp, "%s0x%04x,", byte % 8 == 0 ? "\n        " : " ", digit_entry(byte, 4));
+    }
+    fprintf(fp, "\n};\n\n");
+
+    fprintf(fp, "// the same for one to three placements, for the levels above a tile that don't make up a byte\n");
+    for (int levels = 1; levels <= 3; levels++) {
+        int num_entries = 1 << (levels * 2);
+        fprintf(fp, "static const uint16_t partial_table_%d[%d] = {", levels, num_entries);
+        for (int digits = 0; digits < num_entries; digits++) {
+            fprintf(fp, "%s0x%04x,", digits % 8 == 0 ? "\n        " : " ", digit_entry(digits, levels));
+        }
+        fprintf(fp, "\n};\n\n");
+    }
+
+    fprintf(fp, "// cells of the curves of orders 1 to 4, packed as x | y << 8\n");
+    for (int order = 1; order <= 4; order++) {
+        int num_points = 1 << (order * 2);
+        fprintf(fp, "static const uint16_t small_cells_%d[%d] = {", order, num_points);
+        for (int i = 0; i < num_points; i++) {
+            fprintf(fp, "%s0x%04x,", i % 8 == 0 ? "\n        " : " ", small_cell(order, i));
+        }
+        fprintf(fp, "\n};\n\n");
+    }
+
+    // tiles are the order 4 curve, as it is and reflected the way quadrant 0 is: (x, y) -> (15 - y, 15 - x)
+    static const struct {
+        const char *name, *type, *comment;
+        int centers; // 2 * cell + 1 instead of the cell
+    } tiles[] = {
+            {"tile_cells", "uint16_t", "cells", 0},
+            {"tile_centers_f8", "double", "cell centers in half cells (2 * cell + 1)", 1},
+            {"tile_centers_f4", "float", "cell centers in half cells (2 * cell + 1)", 1},
+    };
+    for (size_t t = 0; t < sizeof(tiles) / sizeof(tiles[0]); t++) {
+        fprintf(fp, "// %s of an order 4 tile, interleaved x, y, as it is and reflected\n", tiles[t].comment);
+        fprintf(fp, "static const %s %s[2][%d] = {\n", tiles[t].type, tiles[t].name, 2 * TILE_POINTS);
+        for (int reflect = 0; reflect < 2; reflect++) {
+            fprintf(fp, "        {");
+            for (int i = 0; i < TILE_POINTS; i++) {
+                uint16_t cell = small_cell(4, i);
+                int x = cell & 0xff, y = cell >> 8;
+                if (reflect) {
+                    int tmp = 15 - y;
+                    y = 15 - x;
+                    x = tmp;
+                }
+                if (tiles[t].centers) {
+                    x = 2 * x + 1;
+                    y = 2 * y + 1;
+                }
+                fprintf(fp, "%s%d, %d,", i % 8 == 0 ? "\n                " : " ", x, y);
+            }
+            fprintf(fp, "\n        },\n");
+        }
+        fprintf(fp, "};\n\n");
+    }
+}
+
+/* KERNELS */
+
+static const struct {
+    const char *name; // suffix of the kernel
+    const char *type; // C type of a coordinate
+} dtypes[] = {
+        [HILBERT_DTYPE_F8] = {"f8", "double"},
+        [HILBERT_DTYPE_F4] = {"f4", "float"},
+        [HILBERT_DTYPE_U2] = {"u2", "uint16_t"},
+        [HILBERT_DTYPE_U4] = {"u4", "uint32_t"},
+};
+
+#define NUM_DTYPES (sizeof(dtypes) / sizeof(dtypes[0]))
+
+// the code that moves a tile into place for every dtype, given the reflection of the tile and the offset of its
+// cells, which the compiler turns into vector adds (and multiplies) over the whole tile. 'coords' never overlaps
+// the tables, and saying so saves the compiler from checking at run time. floats fit twice as many coordinates
+// in a vector as doubles
+static const char *tile_functions =
+        "static inline void tile_f8(uint32_t reflect, uint32_t a, uint32_t b, double half,\n"
+        "                           double *restrict coords) {\n"
+        "    const double *tile = tile_centers_f8[reflect];\n"
+        "    double ox = 2 * (double) a, oy = 2 * (double) b;\n"
+        "    for (size_t i = 0; i < 2 * TILE_POINTS; i += 2) {\n"
+        "        coords[i] = (tile[i] + ox) * half;\n"
+        "        coords[i + 1] = (tile[i + 1] + oy) * half;\n"
+        "    }\n"
+        "}\n\n"
+        "static inline void tile_f4(uint32_t reflect, uint32_t a, uint32_t b, float half,\n"
+        "                           float *restrict coords) {\n"
+        "    const float *tile = tile_centers_f4[reflect];\n"
+        "    float ox = 2 * (float) a, oy = 2 * (float) b;\n"
+        "    for (size_t i = 0; i < 2 * TILE_POINTS; i += 2) {\n"
+        "        coords[i] = (tile[i] + ox) * half;\n"
+        "        coords[i + 1] = (tile[i + 1] + oy) * half;\n"
+        "    }\n"
+        "}\n\n"
+        "static inline void tile_u2(uint32_t reflect, uint32_t a, uint32_t b, uint16_t *restrict coords) {\n"
+        "    const uint16_t *tile = tile_cells[reflect];\n"
+        "    for (size_t i = 0; i < 2 * TILE_POINTS; i += 2) {\n"
+        "        coords[i] = (uint16_t) (tile[i] + a);\n"
+        "        coords[i + 1] = (uint16_t) (tile[i + 1] + b);\n"
+        "    }\n"
+        "}\n\n"
+        "static inline void tile_u4(uint32_t reflect, uint32_t a, uint32_t b, uint32_t *restrict coords) {\n"
+        "    const uint16_t *tile = tile_cells[reflect];\n"
+        "    for (size_t i = 0; i < 2 * TILE_POINTS; i += 2) {\n"
+        "        coords[i] = tile[i] + a;\n"
+        "        coords[i + 1] = tile[i + 1] + b;\n"
+        "    }\n"
+        "}\n\n";
+
+// writes the coordinates of (x, y) in a dtype into coords[2 * i]
+static void write_coords(FILE *fp, int order, int dtype) {
+    // the center of a cell is (2 * cell + 1) / 2^(order + 1), a power of two that folds into a constant
+    switch (dtype) {
+        case HILBERT_DTYPE_F8:
+        case HILBERT_DTYPE_F4:
+            fprintf(fp, "        coords[2 * i] = (2 * (%s) x + 1) * 0x1p-%d%s;\n", dtypes[dtype].type, order + 1,
+                    dtype == HILBERT_DTYPE_F4 ? "f" : "");
+            fprintf(fp, "        coords[2 * i + 1] = (2 * (%s) y + 1) * 0x1p-%d%s;\n", dtypes[dtype].type, order + 1,
+                    dtype == HILBERT_DTYPE_F4 ? "f" : "");
+            break;
+        default:
+            fprintf(fp, "        coords[2 * i] = (%s) x;\n", dtypes[dtype].type);
+            fprintf(fp, "        coords[2 * i + 1] = (%s) y;\n", dtypes[dtype].type);
+            break;
+    }
+}
+
+static void write_kernel(FILE *fp, int order, int dtype) {
+    const char *name = dtypes[dtype].name, *type = dtypes[dtype].type;
+
+    // single points: the lowest levels come from a small curve, the rest a byte at a time
+    int low = (order - 1) % 4 + 1;
+    fprintf(fp, "static inline void points_o%d_%s(size_t first, size_t count, %s *coords) {\n", order, name, type);
+    fprintf(fp, "    for (size_t i = 0; i < count; i++) {\n");
+    fprintf(fp, "        size_t index = first + i;\n");
+    fprintf(fp, "        uint32_t cell = small_cells_%d[index & 0x%x];\n", low, (1 << (low * 2)) - 1);
+    fprintf(fp, "        uint32_t x = cell & 0xff, y = cell >> 8;\n");
+    for (int level = low; level < order; level += 4) fprintf(fp, "        KERNEL_BYTE(%d);\n", level);
+    write_coords(fp, order, dtype);
+    fprintf(fp, "    }\n}\n\n");
+
+    fprintf(fp, "static void kernel_o%d_%s(size_t first, size_t count, void *out) {\n", order, name);
+    fprintf(fp, "    %s *coords = (%s *) out;\n", type, type);
+    if (order < 4) {
+        fprintf(fp, "    points_o%d_%s(first, count, coords);\n}\n\n", order, name);
+        return;
+    }
+
+    // whole tiles: the levels above the tile only decide where it goes and whether it is reflected
+    fprintf(fp, "    size_t head = (TILE_POINTS - (first & (TILE_POINTS - 1))) & (TILE_POINTS - 1);\n");
+    fprintf(fp, "    if (head > count) head = count;\n");
+    fprintf(fp, "    points_o%d_%s(first, head, coords);\n", order, name);
+    fprintf(fp, "    size_t i = head;\n");
+    fprintf(fp, "    for (; count - i >= TILE_POINTS; i += TILE_POINTS) {\n");
+    // an order 4 kernel is a single tile, so only larger orders read the index
+    if (order > 4) fprintf(fp, "        size_t index = first + i;\n");
+    fprintf(fp, "        uint32_t reflect = 0, a = 0, b = 0;\n");
+    int partial = (order - 4) % 4;
+    if (partial) fprintf(fp, "        TILE_MAP(partial_table_%d, 0x%x, 4);\n", partial, (1 << (partial * 2)) - 1);
+    for (int level = 4 + partial; level < order; level += 4) {
+        fprintf(fp, "        TILE_MAP(digit_table, 0xff, %d);\n", level);
+    }
+    switch (dtype) {
+        case HILBERT_DTYPE_F8:
+        case HILBERT_DTYPE_F4:
+            fprintf(fp, "        tile_%s(reflect, a - 15 * reflect, b - 15 * reflect, 0x1p-%d%s, &coords[2 * i]);\n",
+                    name, order + 1,
+                    dtype == HILBERT_DTYPE_F4 ? "f" : "");
+            break;
+        default:
+            fprintf(fp, "        tile_%s(reflect, a - 15 * reflect, b - 15 * reflect, &coords[2 * i]);\n", name);
+            break;
+    }
+    fprintf(fp, "    }\n");
+    fprintf(fp, "    points_o%d_%s(first + i, count - i, &coords[2 * i]);\n}\n\n", order, name);
+}
+
+static void write_kernels(FILE *fp) {
+    fprintf(fp, "#define TILE_POINTS %d\n\n", TILE_POINTS);
+    fprintf(fp, "// applies the placements of the byte of 'index' at 'level' to (x, y)\n");
+    fprintf(fp, "#define KERNEL_BYTE(level) { \\\n");
+    fprintf(fp, "    uint32_t entry = digit_table[(index >> (2 * (level))) & 0xff]; \\\n");
+    fprintf(fp, "    uint32_t flip = (uint32_t) 0 - (entry & 1); \\\n");
+    fprintf(fp, "    uint32_t px = (entry & 1) ? y : x, py = (entry & 1) ? x : y; \\\n");
+    fprintf(fp, "    x = ((entry >> 1 & 0x1f) << (level)) + (px ^ flip); \\\n");
+    fprintf(fp, "    y = ((entry >> 6) << (level)) + (py ^ flip); \\\n");
+    fprintf(fp, "}\n\n");
+    fprintf(fp, "// follows the map of a tile, (a + x, b + y) or reflected (a - y, b - x), with the placements of\n");
+    fprintf(fp, "// the digits of 'index' at 'level'\n");
+    fprintf(fp, "#define TILE_MAP(table, mask, level) { \\\n");
+    fprintf(fp, "    uint32_t entry = table[(index >> (2 * (level))) & (mask)]; \\\n");
+    fprintf(fp, "    uint32_t ea = (entry >> 1 & 0x1f) << (level), eb = (entry >> 6) << (level); \\\n");
+    fprintf(fp, "    if (entry & 1) { \\\n");
+    fprintf(fp, "        uint32_t tmp = ea - 1 - b; \\\n");
+    fprintf(fp, "        b = eb - 1 - a; \\\n");
+    fprintf(fp, "        a = tmp; \\\n");
+    fprintf(fp, "        reflect ^= 1; \\\n");
+    fprintf(fp, "    } else { \\\n");
+    fprintf(fp, "        a += ea; \\\n");
+    fprintf(fp, "        b += eb; \\\n");
+    fprintf(fp, "    } \\\n");
+    fprintf(fp, "}\n\n");
+    fprintf(fp, "%s", tile_functions);
+
+    for (int order = 1; order <= HILBERT_KERNEL_MAX_ORDER; order++) {
+        fprintf(fp, "// order %d\n", order);
+        for (size_t dtype = 0; dtype < NUM_DTYPES; dtype++) write_kernel(fp, order, (int) dtype);
+    }
+
+    fprintf(fp, "const hilbert_kernel_fn hilbert_kernels[HILBERT_KERNEL_MAX_ORDER + 1][HILBERT_DTYPE_U4 + 1] = {\n");
+    for (int order = 1; order <= HILBERT_KERNEL_MAX_ORDER; order++) {
+        fprintf(fp, "        [%d] = {", order);
+        for (size_t dtype = 0; dtype < NUM_DTYPES; dtype++) {
+            fprintf(fp, "%s[HILBERT_DTYPE_%c%c] = kernel_o%d_%s", dtype ? ", " : "", dtypes[dtype].name[0] - 32,
+                    dtypes[dtype].name[1], order, dtypes[dtype].name);
+        }
+        fprintf(fp, "},\n");
+    }
+    fprintf(fp, "};\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s OUTPUT\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    FILE *fp = fopen(argv[1], "w");
+    if (fp == NULL) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(fp, "// generated by gen_kernels.c, do not edit\n\n");
+    fprintf(fp, "#include \"hilbert.h\"\n\n");
+    write_tables(fp);
+    write_kernels(fp);
+
+    if (fclose(fp) != 0) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
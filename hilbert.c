@@ -0,0 +1,334 @@
+/*
+ * hilbert.c - Geometry and pseudo-hilbert curve generation
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * See hilbert.h for the list of segments, and main.c for a description of the coordinate space
+*/
+
+#include "hilbert.h"
+
+#include <stdlib.h>
+#include <memory.h>
+#include <assert.h>
+
+/* GEOMETRY */
+
+// reflects all points in a space_vec2 array across a given vertical line at 'origin'
+void space_reflect_y(struct space_vec2 *arr, size_t len, space_pos_t origin) {
+    for (size_t i = 0; i < len; i++) SPACE_REFLECT_POINT(arr[i].x, origin);
+}
+
+// reflects all points in a space_vec2 array across a given horizontal line at 'origin'
+void space_reflect_x(struct space_vec2 *arr, size_t len, space_pos_t origin) {
+    for (size_t i = 0; i < len; i++) SPACE_REFLECT_POINT(arr[i].y, origin);
+}
+
+/*
+ * Little explanation on how rotations work:
+ * 90 degree counter-clockwise rotation is (A, B) -> (-y, x)
+ * 270 degree counter-clockwise rotation (essentially 90 degree clockwise) is (x, y) -> (y, -x)
+ *
+ * This is what the macro and functions below are doing in essence.
+ * It also takes into account a point of origin so it doesn't just rotate around (0, 0)
+ *
+ * P.S. x/y negates below are swapped because positive y's are down instead of up
+ * which flips the rotation order (cc becomes c, vice versa)
+*/
+
+// rotates all points in a space_vec2 array 90 degress around an origin point clockwise
+void space_rotate_c(struct space_vec2 *arr, size_t len, struct space_vec2 origin) {
+    for (size_t i = 0; i < len; i++) SPACE_ROTATE_POINT_ABOUT_ORIGIN(arr[i], x, origin);
+}
+
+// rotates all points in a space_vec2 array 90 degress around an origin point counter-clockwise
+void space_rotate_cc(struct space_vec2 *arr, size_t len, struct space_vec2 origin) {
+    for (size_t i = 0; i < len; i++) SPACE_ROTATE_POINT_ABOUT_ORIGIN(arr[i], y, origin);
+}
+
+// scales all point sin a space_vec2 array a multiplier around an origin point
+void space_scale(struct space_vec2 *arr, size_t len, space_pos_t scale, struct space_vec2 origin) {
+    // define a space_vec2 for the scale so that we can easily multiply the values
+    struct space_vec2 scale_p = POINT_AT(scale, scale);
+    for (size_t i = 0; i < len; i++) {
+        SPACE_OP_POINTS(arr[i], -=, origin);
+        SPACE_OP_POINTS(arr[i], *=, scale_p);
+        SPACE_OP_POINTS(arr[i], +=, origin);
+    }
+}
+
+/* HILBERT CURVE */
+
+// recursively creates an pseudo-hilbert curve of a certain order
+size_t hilbert_create(int order, struct space_vec2 **out) {
+    // statically defined order 1 pseudo-hilbert curve
+    // this is upside-down to how you usually see it
+    const static struct space_vec2 o1_hilbert[] = {
+            POINT_AT(0.25, 0.75), // bottom left
+            POINT_AT(0.25, 0.25), // top left
+            POINT_AT(0.75, 0.25), // top right
+            POINT_AT(0.75, 0.75), // bottom right
+    };
+    // space_vec2 origins for where to scale lower order pseudo-hilbert curves
+    // must be same order as order 1 pseudo-hilbert curve
+    const static struct space_vec2 scale_origins[] = {
+            POINT_AT(0.0, 1.0), // bottom left
+            POINT_AT(0.0, 0.0), // top left
+            POINT_AT(1.0, 0.0), // top right
+            POINT_AT(1.0, 1.0), // bottom right
+    };
+
+    // make sure we got valid input
+    if (out == NULL && order >= 1) goto fail;
+
+    // every level of the recursion shows up in a trace, nested in the level above
+    HILBERT_TRACE_BEGIN("hilbert_create", "order", order);
+
+    // find the number of points this hilber curve requires, then allocate the space
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    struct space_vec2 *arr = (struct space_vec2 *) malloc(num_points * sizeof(struct space_vec2));
+    assert(arr != NULL);
+
+    // if it's an order 1 hilbert curve, just use the statically allocated o1_hilbert
+    // this will break the process of recursion
+    if (order == 1) {
+        // with order 1 hilbert curves, num_points will always be 4 so this is safe
+        memcpy(arr, o1_hilbert, num_points * sizeof(struct space_vec2));
+        *out = arr;
+        HILBERT_TRACE_END("hilbert_create");
+        return num_points;
+    }
+
+    // find the pseudo-hilbert curve of the order below this and store it as memoization
+    // lo = lower order
+    struct space_vec2 *lo = NULL;
+    size_t lo_points = hilbert_create(order - 1, &lo);
+    size_t lo_size = lo_points * sizeof(struct space_vec2);
+
+    // variables used in the loop below
+    struct space_vec2 center_point = POINT_AT(0.5, 0.5); // point defining the center of space
+    struct space_vec2 *work; // working copy of lo
+
+    // create this version of the pseudo-hilbert curve from the others
+    for (size_t i = 0; i < sizeof(scale_origins) / sizeof(struct space_vec2); i++) {
+        HILBERT_TRACE_BEGIN("quadrant", "quadrant", i);
+
+        // create another allocation for the pseudo-hilbert curve we're going to work with in this loop
+        work = (struct space_vec2 *) malloc(lo_size);
+        assert(work != NULL);
+        memcpy(work, lo, lo_size);
+
+        // perform transformations based on current i value
+        if (i == 0) { // bottom left
+            space_reflect_y(work, lo_points, 0.5);
+            space_rotate_c(work, lo_points, center_point);
+        } else if (i == 4) { // bottom right
+            space_reflect_y(work, lo_points, 0.5);
+            space_rotate_cc(work, lo_points, center_point);
+        }
+        // scale it to 1/4 total area, also moves it in the quadrant we want (because of origin)
+        space_scale(work, lo_points, 0.5, scale_origins[i]);
+
+        // copy our one quadrant into the total list of hilbert curve coordinates
+        memcpy(&arr[lo_points * i], work, lo_points * sizeof(struct space_vec2));
+
+        // cleanup working hilbert-curve
+        free(work);
+        HILBERT_TRACE_END("quadrant");
+    }
+    // cleanup lower order hilbert-curve memoization
+    free(lo);
+
+    // finally return this value
+    *out = arr;
+    HILBERT_TRACE_END("hilbert_create");
+    return num_points;
+
+    fail:
+    *out = NULL;
+    return -1;
+}
+
+/*
+ * hilbert_create builds order n out of four copies of order n - 1. In integer cell coordinates
+ * (S = 2^(n - 1) cells per side of a quadrant) the copies are placed as follows:
+ *  quadrant 0 (bottom left) - reflected then rotated, which is (x, y) -> (S - 1 - y, S - 1 - x), moved down by S
+ *  quadrant 1 (top left) - unchanged
+ *  quadrant 2 (top right) - moved right by S
+ *  quadrant 3 (bottom right) - moved right and down by S
+ *
+ * Walking the base 4 digits of an index from least to most significant applies these placements from the
+ * smallest quadrant to the largest, which finds the cell of a single point without the rest of the curve.
+ * The cell centers (2 * cell + 1) / 2^(order + 1) are exact in a double, so the result is bit-identical
+*/
+
+// finds the integer cell (0 to 2^order - 1 on both axes) of the point at 'index' in a curve of a certain order
+void hilbert_cell(int order, size_t index, uint32_t *cx, uint32_t *cy) {
+    uint32_t x = 0, y = 0, tmp;
+    for (int level = 0; level < order; level++) {
+        uint32_t side = (uint32_t) 1 << level; // size of the quadrant we are placing
+        switch ((index >> (level * 2)) & 3) {
+            case 0: // bottom left
+                tmp = side - 1 - y;
+                y = side - 1 - x + side;
+                x = tmp;
+                break;
+            case 2: // top right
+                x += side;
+                break;
+            case 3: // bottom right
+                x += side;
+                y += side;
+                break;
+            default: // top left
+                break;
+        }
+    }
+    *cx = x;
+    *cy = y;
+}
+
+// finds the index of the point in an integer cell of a curve of a certain order, the inverse of hilbert_cell
+// undoes the placements from the largest quadrant to the smallest, reading one base 4 digit off every level
+size_t hilbert_index(int order, uint32_t cx, uint32_t cy) {
+    uint32_t x = cx, y = cy, tmp;
+    size_t index = 0;
+    for (int level = order - 1; level >= 0; level--) {
+        uint32_t side = (uint32_t) 1 << level;
+        size_t digit;
+        if (x < side && y >= side) { // bottom left
+            digit = 0;
+            tmp = 2 * side - 1 - y;
+            y = side - 1 - x;
+            x = tmp;
+        } else if (x < side) { // top left
+            digit = 1;
+        } else if (y < side) { // top right
+            digit = 2;
+            x -= side;
+        } else { // bottom right
+            digit = 3;
+            x -= side;
+            y -= side;
+        }
+        index |= digit << (level * 2);
+    }
+    return index;
+}
+
+// spans found so far by hilbert_decompose
+struct decompose_state {
+    int order;
+    uint32_t rect[4]; // x0, y0, x1, y1
+    struct hilbert_span *out;
+    size_t max, num;
+    uint64_t end; // one past the last index of the last span
+};
+
+// adds the indices of a block to the spans, merged with the last span when they follow on from it
+static void decompose_emit(struct decompose_state *state, uint64_t first, uint64_t count) {
+    if (state->num > 0 && state->end == first) {
+        if (state->num <= state->max) state->out[state->num - 1].count += count;
+    } else {
+        if (state->num < state->max) state->out[state->num] = (struct hilbert_span) {first, count};
+        state->num++;
+    }
+    state->end = first + count;
+}
+
+// every aligned block of 4^level indices fills an aligned square of 2^level cells, which is searched for the parts
+// of the rectangle it holds
+static void decompose_block(struct decompose_state *state, int level, uint64_t first) {
+    uint32_t x, y;
+    hilbert_cell(state->order, (size_t) first, &x, &y);
+    uint32_t mask = ~(uint32_t) 0 << level, side_last = (uint32_t) (((uint64_t) 1 << level) - 1);
+    x &= mask;
+    y &= mask;
+    const uint32_t *rect = state->rect;
+    if (x > rect[2] || y > rect[3] || x + side_last < rect[0] || y + side_last < rect[1]) return;
+    if (x >= rect[0] && y >= rect[1] && x + side_last <= rect[2] && y + side_last <= rect[3]) {
+        decompose_emit(state, first, (uint64_t) 1 << (2 * level));
+        return;
+    }
+    uint64_t quarter = (uint64_t) 1 << (2 * (level - 1));
+    for (uint64_t digit = 0; digit < 4; digit++) decompose_block(state, level - 1, first + digit * quarter);
+}
+
+// finds the ranges of indices whose cells are in the rectangle from (x0, y0) to (x1, y1) inclusive, in order and
+// with neighbouring ranges merged. writes at most 'max' of them to 'out' and returns how many there are, so a
+// return above 'max' means 'out' was too small
+size_t hilbert_decompose(int order, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, struct hilbert_span *out,
+                         size_t max) {
+    uint32_t last = (uint32_t) (((uint64_t) 1 << order) - 1);
+    if (x1 > last) x1 = last;
+    if (y1 > last) y1 = last;
+    if (x0 > x1 || y0 > y1) return 0;
+
+    struct decompose_state state = {order, {x0, y0, x1, y1}, out, max, 0, 0};
+    decompose_block(&state, order, 0);
+    return state.num;
+}
+
+// finds the center of an integer cell in a curve of a certain order
+struct space_vec2 hilbert_cell_point(int order, uint32_t cx, uint32_t cy) {
+    // size of half a cell, which is a power of two so the multiplication is exact
+    space_pos_t half_cell = (space_pos_t) 1 / (space_pos_t) ((uint64_t) 2 << order);
+    struct space_vec2 point = POINT_AT((2 * (space_pos_t) cx + 1) * half_cell, (2 * (space_pos_t) cy + 1) * half_cell);
+    return point;
+}
+
+// finds the point at 'index' in a curve of a certain order, exactly as hilbert_create would place it
+struct space_vec2 hilbert_point(int order, size_t index) {
+    uint32_t cx, cy;
+    hilbert_cell(order, index, &cx, &cy);
+    return hilbert_cell_point(order, cx, cy);
+}
+
+// writes 'count' points starting at 'first' of a curve of a certain order into 'out'
+void hilbert_range(int order, size_t first, size_t count, struct space_vec2 *out) {
+    // orders up to HILBERT_KERNEL_MAX_ORDER have a generated kernel that writes doubles straight into 'out'
+    if (order >= 1 && order <= HILBERT_KERNEL_MAX_ORDER) {
+        hilbert_kernels[order][HILBERT_DTYPE_F8](first, count, out);
+        return;
+    }
+    for (size_t i = 0; i < count; i++) out[i] = hilbert_point(order, first + i);
+}
+
+// writes 'count' points starting at 'first' of a curve as fixed point into 'out', with integer math only
+void hilbert_range_fixed(int order, size_t first, size_t count, struct hilbert_fixed_vec2 *out) {
+    if (order >= 1 && order <= HILBERT_KERNEL_MAX_ORDER) {
+        // cells come from the generated kernel a block at a time, then widen into numerators
+        uint32_t cells[2 * 256];
+        for (size_t i = 0; i < count; i += 256) {
+            size_t len = count - i < 256 ? count - i : 256;
+            hilbert_kernels[order][HILBERT_DTYPE_U4](first + i, len, cells);
+            for (size_t p = 0; p < len; p++) {
+                out[i + p].x = 2 * (uint64_t) cells[2 * p] + 1;
+                out[i + p].y = 2 * (uint64_t) cells[2 * p + 1] + 1;
+            }
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t cx, cy;
+        hilbert_cell(order, first + i, &cx, &cy);
+        out[i].x = 2 * (uint64_t) cx + 1;
+        out[i].y = 2 * (uint64_t) cy + 1;
+    }
+}
+
+// converts a fixed point of a curve of a certain order into a space_vec2
+// numerators below 2^53 (every order up to 52) convert without rounding
+struct space_vec2 hilbert_fixed_point(int order, struct hilbert_fixed_vec2 fixed) {
+    space_pos_t scale = (space_pos_t) 1 / (space_pos_t) ((uint64_t) 2 << order);
+    struct space_vec2 point = POINT_AT((space_pos_t) fixed.x * scale, (space_pos_t) fixed.y * scale);
+    return point;
+}
+
+// writes 'count' points starting at 'first' of a curve of a certain order into 'out' in single precision
+// returns -1 if the order is above HILBERT_FLOAT_MAX_ORDER, otherwise 0
+int hilbert_range_float(int order, size_t first, size_t count, struct space_vec2f *out) {
+    return hilbert_range_dtype(order, HILBERT_DTYPE_F4, first, count, out);
+}
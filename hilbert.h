@@ -0,0 +1,662 @@
+/*
+ * hilbert.h - Geometry and pseudo-hilbert curve generation
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * Shared declarations for everything that generates or consumes pseudo-hilbert curves.
+ * See main.c for a description of the coordinate space.
+ *
+ * SEGMENTS:
+ *  Geometry - Contains basic geometric functions revolving around points in space and translating their position
+ *  Hilbert Curves - Code for generation of pseudo-hilbert curves, built on-top of the geometric functions
+ *  Hilbert Curve View - Lazy random access into a curve without materializing all of its points
+ *  Hilbert Curve Segments - Straight runs of a curve, for output that only needs the turning points
+ *  Hilbert Curve Render - Streaming PPM/PNG images of a curve, rendered in parallel bands
+ *  Hilbert Curve Output - Writers for binary, text, npy and arrow files
+ *  Text Formatting - Fast number formatting and txt/CSV/JSON/PLY/SVG writers, formatted in parallel chunks
+ *  Delta Encoding - Compact files of the steps between cells, in blocks that are encoded and decoded independently
+ *  Hilbert Curve Input - Memory mapped reading of raw, npy, arrow and delta curve files
+ *  Hilbert Curve Validation - Parallel checks that a curve file holds a complete, correct curve
+ *  Checkpoints - Binary output in checksummed blocks that picks up where an interrupted run stopped
+ *  Tracing - Optional Chrome trace timelines of what every thread generates and writes
+ *  Key Service - A daemon serving batches of keys to other processes through shared memory rings
+ *  Shared Tables - Curves generated once into sealed memory that other processes map read only
+ *  Geographic Keys - Latitude and longitude to keys of the curve on the six faces of a cube
+ *  String Keys - Indices as fixed width strings that sort like the curve and whose prefixes are quadrants
+*/
+
+#ifndef HILBERT_H
+#define HILBERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* GEOMETRY */
+
+typedef double space_pos_t;
+// Simple structure for a point in 2d space
+struct space_vec2 {
+    space_pos_t x, y;
+};
+// macro for easily assigning space_vec2 variables
+#define POINT_AT(px, py) { .x = px, .y = py }
+// a point in single precision, half the size of a space_vec2
+struct space_vec2f {
+    float x, y;
+};
+
+// swap the x and y values in a point
+#define SPACE_SWAP_POINT(point) { \
+    space_pos_t tmp = point.x; \
+    point.x = point.y; \
+    point.y = tmp; \
+}
+
+// macro for defining an operation between two points that is the same for the x and y values
+#define SPACE_OP_POINTS(pointA, op, pointB) \
+    pointA.x op pointB.x; \
+    pointA.y op pointB.y
+
+// macro for reflecting a single value across an origin value
+#define SPACE_REFLECT_POINT(val, origin) {\
+    val -= origin; \
+    val *= -1; \
+    val += origin; \
+}
+
+// reflects all points in a space_vec2 array across a given vertical line at 'origin'
+void space_reflect_y(struct space_vec2 *arr, size_t len, space_pos_t origin);
+// reflects all points in a space_vec2 array across a given horizontal line at 'origin'
+void space_reflect_x(struct space_vec2 *arr, size_t len, space_pos_t origin);
+
+// helper macro for the rotate functions (see hilbert.c for how rotations work)
+#define SPACE_ROTATE_POINT_ABOUT_ORIGIN(point, neg_mult, origin) { \
+    SPACE_OP_POINTS(point, -=, origin); \
+    SPACE_SWAP_POINT(point); \
+    point.neg_mult *= -1; \
+    SPACE_OP_POINTS(point, +=, origin); \
+}
+
+// rotates all points in a space_vec2 array 90 degress around an origin point clockwise
+void space_rotate_c(struct space_vec2 *arr, size_t len, struct space_vec2 origin);
+// rotates all points in a space_vec2 array 90 degress around an origin point counter-clockwise
+void space_rotate_cc(struct space_vec2 *arr, size_t len, struct space_vec2 origin);
+// scales all point sin a space_vec2 array a multiplier around an origin point
+void space_scale(struct space_vec2 *arr, size_t len, space_pos_t scale, struct space_vec2 origin);
+
+/* HILBERT CURVE */
+
+// every pseudo-hilbert curve has 4^order points
+// this essentially returns that, but uses bitshifting instead
+#define HILBERT_NUM_POINTS(order) ((size_t) 1 << ((size_t) (order) * 2))
+
+// highest order that the index based functions support (cell coordinates must fit in 32 bits)
+#define HILBERT_MAX_ORDER 31
+
+// recursively creates an pseudo-hilbert curve of a certain order
+size_t hilbert_create(int order, struct space_vec2 **out);
+
+// finds the integer cell (0 to 2^order - 1 on both axes) of the point at 'index' in a curve of a certain order
+void hilbert_cell(int order, size_t index, uint32_t *cx, uint32_t *cy);
+// finds the index of the point in an integer cell, the inverse of hilbert_cell
+size_t hilbert_index(int order, uint32_t cx, uint32_t cy);
+
+// a range of indices of a curve
+struct hilbert_span {
+    uint64_t first, count;
+};
+
+// finds the ranges of indices whose cells are in a rectangle of cells (inclusive), in order and merged
+// writes at most 'max' ranges and returns how many there are, more than 'max' if 'out' was too small
+size_t hilbert_decompose(int order, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, struct hilbert_span *out,
+                         size_t max);
+// finds the center of an integer cell in a curve of a certain order
+struct space_vec2 hilbert_cell_point(int order, uint32_t cx, uint32_t cy);
+// finds the point at 'index' in a curve of a certain order, exactly as hilbert_create would place it
+struct space_vec2 hilbert_point(int order, size_t index);
+// writes 'count' points starting at 'first' of a curve of a certain order into 'out'
+void hilbert_range(int order, size_t first, size_t count, struct space_vec2 *out);
+
+// a point in fixed point, as numerators over 2^(order + 1): the center of cell (cx, cy) is (2 * cx + 1, 2 * cy + 1)
+// this is exact for every order, space_vec2 only when converted with hilbert_fixed_point
+struct hilbert_fixed_vec2 {
+    uint64_t x, y;
+};
+
+// writes 'count' points starting at 'first' of a curve as fixed point into 'out', with integer math only
+void hilbert_range_fixed(int order, size_t first, size_t count, struct hilbert_fixed_vec2 *out);
+// converts a fixed point of a curve of a certain order into a space_vec2
+struct space_vec2 hilbert_fixed_point(int order, struct hilbert_fixed_vec2 fixed);
+
+// highest order whose cell centers a float holds exactly
+#define HILBERT_FLOAT_MAX_ORDER 23
+
+// writes 'count' points starting at 'first' of a curve of a certain order into 'out' in single precision
+// returns -1 if the order is above HILBERT_FLOAT_MAX_ORDER, otherwise 0
+int hilbert_range_float(int order, size_t first, size_t count, struct space_vec2f *out);
+
+/* HILBERT CURVE VIEW */
+
+// number of points in one cached tile of a hilbert_view (one order 6 block)
+#define HILBERT_VIEW_TILE_POINTS ((size_t) 4096)
+
+// lazy view of a pseudo-hilbert curve, points are decoded on demand into a small LRU tile cache
+// a view is not thread safe, give each thread its own view
+struct hilbert_view;
+
+// creates a view of a curve of a certain order using at most (roughly) 'cache_bytes' for decoded tiles
+struct hilbert_view *hilbert_view_create(int order, size_t cache_bytes);
+// destroys a view and all of its cached tiles
+void hilbert_view_destroy(struct hilbert_view *view);
+// number of points in the curve behind a view
+size_t hilbert_view_size(const struct hilbert_view *view);
+// finds the point at 'index', returns 0 on success and -1 if the index is out of range
+int hilbert_view_get(struct hilbert_view *view, size_t index, struct space_vec2 *out);
+// copies up to 'count' points starting at 'first' into 'out', returns the number of points copied
+size_t hilbert_view_get_range(struct hilbert_view *view, size_t first, size_t count, struct space_vec2 *out);
+
+/* HILBERT CURVE SEGMENTS */
+
+// a straight run of a curve, 'length' steps of (dx, dy) cells starting at cell (x, y)
+struct hilbert_segment {
+    uint32_t x, y;
+    int32_t dx, dy;
+    size_t length;
+};
+
+// number of points whose cells a hilbert_segment_iter generates at once
+#define HILBERT_SEGMENT_BLOCK 256
+
+// walks a curve one straight run at a time, without materializing more than a small block of its points
+struct hilbert_segment_iter {
+    int order;
+    size_t index; // index of the point the next segment starts at
+    size_t num_points;
+    uint32_t x, y; // cell of the point at 'index'
+    size_t block_first, block_len; // points held in 'block', starting at index 'block_first'
+    struct hilbert_fixed_vec2 block[HILBERT_SEGMENT_BLOCK];
+};
+
+// starts walking the segments of a curve of a certain order, returns -1 if the order isn't supported
+int hilbert_segments_begin(struct hilbert_segment_iter *iter, int order);
+// finds the next segment of the curve, returns 1 if one was found and 0 at the end of the curve
+int hilbert_segments_next(struct hilbert_segment_iter *iter, struct hilbert_segment *out);
+
+/* HILBERT CURVE RENDER */
+
+// image formats that hilbert_render can write
+enum hilbert_image_format {
+    HILBERT_IMAGE_PPM, // binary (P6) portable pixmap
+    HILBERT_IMAGE_PNG, // png with uncompressed image data
+};
+
+// everything hilbert_render needs to know, zeroed fields fall back to defaults where noted
+struct hilbert_render_options {
+    int order;
+    uint32_t width, height; // size of the image in pixels
+    int gradient; // color the curve by index instead of drawing it black
+    int threads; // number of render threads, 0 for one per core
+    uint32_t band_rows; // rows rendered at once by one thread, 0 for the default
+    enum hilbert_image_format format;
+};
+
+// largest width and height of an image that hilbert_render takes
+#define HILBERT_RENDER_MAX_SIZE ((uint32_t) 1 << 20)
+
+// renders a curve into an image and writes it to a stream
+// returns 0 on success and -1 with errno set on invalid options (EINVAL) or a failed write
+int hilbert_render(const struct hilbert_render_options *options, FILE *fp);
+
+/* HILBERT CURVE OUTPUT */
+
+// writes coordinates of a hilbert curve to a stream in binary format
+void write_hilbert_curve(struct space_vec2 *hc, size_t len, FILE *fp);
+// writes a curve in binary format straight from the generator into a file, with positional writes from every thread
+// starts at the current offset of 'fd', returns the number of points written or -1 on failure
+size_t write_hilbert_curve_fd(int order, int threads, int preallocate, int fd);
+// writes a curve in binary format straight from the generator to a pipe (with vmsplice) or any other descriptor
+// returns the number of points written or -1 on failure
+size_t write_hilbert_curve_stream(int order, int fd);
+// the same as write_hilbert_curve_fd and write_hilbert_curve_stream with space_vec2f points, half the size
+// return -1 as well if the order is above HILBERT_FLOAT_MAX_ORDER
+size_t write_hilbert_curve_float_fd(int order, int threads, int preallocate, int fd);
+size_t write_hilbert_curve_float_stream(int order, int fd);
+// writes the turning points of a hilbert curve to a stream in binary format, straight from the generator
+// returns the number of points written or -1 on an unsupported order or a failed write
+size_t write_hilbert_turns(int order, FILE *fp);
+// writes the straight segments of a hilbert curve to a stream in a txt format, straight from the generator
+// returns the number of segments written or -1 on an unsupported order or a failed write
+size_t write_hilbert_segments_txt(int order, FILE *fp);
+
+// coordinate types of the npy and arrow writers
+// integer types store the cell of a point, floating point types store the point itself
+enum hilbert_dtype {
+    HILBERT_DTYPE_F8, // double, exact up to order 52
+    HILBERT_DTYPE_F4, // float, exact up to order 23
+    HILBERT_DTYPE_U2, // uint16_t, up to order 16
+    HILBERT_DTYPE_U4, // uint32_t
+};
+
+// size of one coordinate of a dtype in bytes
+size_t hilbert_dtype_size(enum hilbert_dtype dtype);
+
+// highest order with kernels generated at build time by gen_kernels.c
+#define HILBERT_KERNEL_MAX_ORDER 16
+
+// a generated kernel, writes 'count' points starting at 'first' as interleaved x, y coordinates of its dtype
+typedef void (*hilbert_kernel_fn)(size_t first, size_t count, void *out);
+// the generated kernels of every order and dtype, with the levels unrolled and the scale folded into constants
+extern const hilbert_kernel_fn hilbert_kernels[HILBERT_KERNEL_MAX_ORDER + 1][HILBERT_DTYPE_U4 + 1];
+
+// writes 'count' points starting at 'first' of a curve into 'out' as interleaved x, y coordinates of a dtype
+// returns -1 if the dtype can't hold the order, otherwise 0
+int hilbert_range_dtype(int order, enum hilbert_dtype dtype, size_t first, size_t count, void *out);
+// hilbert_range_dtype split between 'threads' threads, 0 for one per core
+int hilbert_range_dtype_threads(int order, enum hilbert_dtype dtype, size_t first, size_t count, int threads,
+                                void *out);
+
+// the ways of writing a binary curve, from the least memory for a file to the most
+enum hilbert_strategy {
+    HILBERT_STRATEGY_POSITIONAL, // every thread writes its own chunks with pwrite, needs a chunk per thread
+    HILBERT_STRATEGY_STREAM, // one thread generates into two buffers and writes them in order, for pipes
+    HILBERT_STRATEGY_MEMORY, // every thread generates part of the whole curve, which is written at once
+};
+
+// how a binary curve is written within a memory budget
+struct hilbert_plan {
+    int order;
+    enum hilbert_dtype dtype; // f8 or f4
+    enum hilbert_strategy strategy;
+    int threads;
+    size_t chunk_points; // points in a chunk of a thread, a buffer of the stream or the whole curve
+    size_t memory; // bytes of every buffer of the plan together
+};
+
+// picks the fastest way to write a binary curve to 'fd' with buffers of at most 'max_memory' bytes (0 for no limit)
+// returns -1 if nothing fits or the dtype is wrong
+int hilbert_plan_curve(int order, enum hilbert_dtype dtype, int threads, int fd, size_t max_memory,
+                       struct hilbert_plan *plan);
+// writes a curve the way a plan says, returns the number of points written or -1 on failure
+size_t write_hilbert_curve_plan(const struct hilbert_plan *plan, int preallocate, int fd);
+
+// streaming writer for npy files of shape [N, 2]
+struct hilbert_npy_writer {
+    FILE *fp;
+    int order;
+    enum hilbert_dtype dtype;
+    uint8_t *buf; // conversion buffer
+};
+
+// starts an npy file of 'num_points' rows of (x, y) in a dtype, returns -1 if the dtype can't hold the order
+int hilbert_npy_begin(struct hilbert_npy_writer *writer, FILE *fp, int order, enum hilbert_dtype dtype,
+                      size_t num_points);
+// appends points to an npy file, in the order given
+void hilbert_npy_write(struct hilbert_npy_writer *writer, const struct space_vec2 *points, size_t len);
+// finishes an npy file, every row promised to hilbert_npy_begin must have been written
+void hilbert_npy_end(struct hilbert_npy_writer *writer);
+// writes a curve as an npy file of shape [4^order, 2] straight from the generator
+size_t write_hilbert_npy(int order, enum hilbert_dtype dtype, FILE *fp);
+
+// streaming writer for arrow IPC files with an 'x' and a 'y' column
+struct hilbert_arrow_writer {
+    FILE *fp;
+    int order;
+    enum hilbert_dtype dtype;
+    uint8_t *columns[2]; // rows of the record batch being built
+    size_t rows;
+    uint64_t pos; // bytes written to the file so far
+    struct arrow_block *blocks; // record batches written so far, for the footer
+    size_t num_blocks, cap_blocks;
+};
+
+// starts an arrow IPC file with 'x' and 'y' columns of a dtype, returns -1 if the dtype can't hold the order
+int hilbert_arrow_begin(struct hilbert_arrow_writer *writer, FILE *fp, int order, enum hilbert_dtype dtype);
+// appends points to an arrow file
+void hilbert_arrow_write(struct hilbert_arrow_writer *writer, const struct space_vec2 *points, size_t len);
+// finishes an arrow file by writing the last batch, the end of stream marker and the footer
+void hilbert_arrow_end(struct hilbert_arrow_writer *writer);
+// writes a curve as an arrow IPC file straight from the generator
+size_t write_hilbert_arrow(int order, enum hilbert_dtype dtype, FILE *fp);
+
+/* TEXT FORMATTING */
+
+// most digits after the decimal point that hilbert_format_fixed supports
+#define HILBERT_FORMAT_MAX_PRECISION 17
+// room that hilbert_format_fixed needs for any double
+#define HILBERT_FORMAT_FIXED_MAX 352
+
+// formats a double like printf("%.*f", precision, val), returns the number of characters written
+size_t hilbert_format_fixed(char *out, double val, int precision);
+
+// most bits after the binary point that hilbert_format_exact supports
+#define HILBERT_FORMAT_EXACT_MAX_BITS 60
+
+// formats numerator / 2^bits exactly, which takes 'bits' digits after the decimal point
+// returns the number of characters written, 'out' needs room for HILBERT_FORMAT_FIXED_MAX characters
+size_t hilbert_format_exact(char *out, uint64_t numerator, int bits);
+
+// precision of hilbert_text_options that writes every digit of every coordinate, order + 1 after the decimal point
+#define HILBERT_TEXT_EXACT (-1)
+
+// text formats that write_hilbert_text can write
+enum hilbert_text_format {
+    HILBERT_TEXT_TXT, // one "(x,y)" line per point, like write_hilbert_curve_txt
+    HILBERT_TEXT_CSV, // "x,y" header, then one "x,y" line per point
+    HILBERT_TEXT_JSON, // array of [x,y] arrays
+    HILBERT_TEXT_PLY, // ascii PLY with a vertex per point and an edge between consecutive points
+    HILBERT_TEXT_SVG, // a single SVG path through every point
+};
+
+struct hilbert_text_options {
+    int order;
+    enum hilbert_text_format format;
+    int precision; // digits after the decimal point, 0 for the default of 15, or HILBERT_TEXT_EXACT
+    int threads; // number of formatting threads, 0 for one per core
+};
+
+// writes a curve in a text format straight from the generator
+// returns the number of points written or -1 on invalid options or a failed write
+size_t write_hilbert_text(const struct hilbert_text_options *options, FILE *fp);
+// writes a curve in a fixed width text format (txt or csv) into a file with positional writes from every thread
+// starts at the current offset of 'fd', returns the number of points written or -1 on failure
+size_t write_hilbert_text_fd(const struct hilbert_text_options *options, int fd);
+
+// the pieces of write_hilbert_text, for points that come from somewhere other than the generator
+// options->order is ignored by all three (except for the points of HILBERT_TEXT_EXACT, which are written with
+// order + 1 digits), and they return -1 on invalid options or a failed write
+// writes what comes before the points of a curve with 'num_points' points in a text format
+int write_hilbert_text_header(const struct hilbert_text_options *options, size_t num_points, FILE *fp);
+// writes points 'first' to 'first + len' of a curve with 'num_points' points, formatting chunks in parallel
+int write_hilbert_text_points(const struct hilbert_text_options *options, const struct space_vec2 *points,
+                              size_t first, size_t len, size_t num_points, FILE *fp);
+// writes what comes after the points, which are the edges of PLY files and the footer
+int write_hilbert_text_footer(const struct hilbert_text_options *options, size_t num_points, FILE *fp);
+
+// writes coordinates of a hilbert curve to a stream in a txt format
+void write_hilbert_curve_txt(struct space_vec2 *hc, size_t len, FILE *fp);
+// writes coordinates of a hilbert curve to a stream in a txt format, formatting chunks on several threads
+void write_hilbert_curve_txt_parallel(const struct space_vec2 *hc, size_t len, int threads, FILE *fp);
+
+/* DELTA ENCODING */
+
+// points in one block of a delta file, every block can be decoded on its own
+#define HILBERT_DELTA_BLOCK_POINTS ((size_t) 16384)
+// most bytes that a block of 'len' points can be encoded into
+#define HILBERT_DELTA_BLOCK_MAX(len) (8 + 11 * (size_t) (len))
+
+// encodes a block of points of a curve of a certain order, 'out' needs HILBERT_DELTA_BLOCK_MAX(len) bytes
+// returns the number of bytes written
+size_t hilbert_delta_encode(int order, const struct space_vec2 *points, size_t len, uint8_t *out);
+// decodes a block of 'size' bytes, skipping its first 'skip' points and writing the next 'len' into 'out'
+// returns the number of points written, or -1 if the block ends early
+size_t hilbert_delta_decode(int order, const uint8_t *in, size_t size, size_t skip, size_t len,
+                            struct space_vec2 *out);
+
+// streaming writer for delta files
+struct hilbert_delta_writer {
+    FILE *fp;
+    int order;
+    int threads;
+    size_t num_points; // points written so far
+    struct space_vec2 *pending; // points of the block that isn't full yet
+    size_t num_pending;
+    uint8_t *buf; // blocks being encoded by the threads
+    size_t *sizes;
+    size_t buf_blocks;
+    uint64_t pos; // bytes written to the file so far
+    uint64_t *index; // offsets of the blocks written so far, for the index
+    size_t num_blocks, cap_blocks;
+};
+
+// starts a delta file of a curve of a certain order, 'threads' encode blocks and can be 0 for one per core
+// returns -1 if the order isn't valid
+int hilbert_delta_begin(struct hilbert_delta_writer *writer, FILE *fp, int order, int threads);
+// appends points to a delta file, full blocks are encoded on the writer's threads and written in order
+void hilbert_delta_write(struct hilbert_delta_writer *writer, const struct space_vec2 *points, size_t len);
+// finishes a delta file by writing the last block, the index and the footer
+void hilbert_delta_end(struct hilbert_delta_writer *writer);
+// writes a curve as a delta file straight from the generator
+size_t write_hilbert_delta(int order, int threads, FILE *fp);
+
+/* HILBERT CURVE INPUT */
+
+// layouts of curve files that hilbert_file_open understands
+enum hilbert_file_format {
+    HILBERT_FILE_RAW, // array of space_vec2, as written by write_hilbert_curve
+    HILBERT_FILE_NPY, // [N, 2] npy array
+    HILBERT_FILE_ARROW, // arrow IPC file with 'x' and 'y' columns
+    HILBERT_FILE_DELTA, // delta encoded blocks of cells, as written by hilbert_delta_write
+};
+
+// how a curve file is going to be accessed, passed on to madvise
+enum hilbert_access {
+    HILBERT_ACCESS_NORMAL,
+    HILBERT_ACCESS_SEQUENTIAL,
+    HILBERT_ACCESS_RANDOM,
+    HILBERT_ACCESS_WILLNEED, // start reading the whole file in now
+};
+
+// rows of a curve file that are stored one after the other, pointing straight into the mapping
+struct hilbert_columns {
+    const void *x, *y; // first coordinate of each column, stored as the dtype of the file
+    size_t stride; // bytes between consecutive coordinates of a column
+    size_t len; // number of rows
+};
+
+// a memory mapped curve file
+struct hilbert_file {
+    enum hilbert_file_format format;
+    enum hilbert_dtype dtype;
+    size_t num_points;
+    int order; // order of the curve when num_points is a power of 4 (or of the cells of a delta file), otherwise 0
+    const struct space_vec2 *points; // every point in place when the file stores space_vec2, otherwise NULL
+
+    // private
+    const uint8_t *map;
+    size_t map_size;
+    const uint8_t *data; // first row of raw and npy files
+    struct hilbert_file_batch *batches; // record batches of arrow files, blocks of delta files
+    size_t num_batches;
+};
+
+// maps a curve file, telling raw, npy, arrow and delta files apart by their magic
+// returns 0 on success, or -1 with errno set (EINVAL when the file isn't a valid curve file)
+int hilbert_file_open(struct hilbert_file *file, const char *path);
+// unmaps a curve file
+void hilbert_file_close(struct hilbert_file *file);
+// tells the kernel how the file is going to be read
+void hilbert_file_advise(const struct hilbert_file *file, enum hilbert_access access);
+// finds the rows starting at 'first' that are stored one after the other, without copying anything
+// returns the number of rows in the view, 0 when 'first' is past the end of the file or the file is delta encoded
+size_t hilbert_file_columns(const struct hilbert_file *file, size_t first, struct hilbert_columns *out);
+// decodes up to 'count' points starting at 'first' into 'out', whatever the file stores them as
+// returns the number of points decoded, or -1 if the file has integer cells but isn't a complete curve,
+// or a delta block is corrupt
+size_t hilbert_file_decode(const struct hilbert_file *file, size_t first, size_t count, struct space_vec2 *out);
+
+/* HILBERT CURVE VALIDATION */
+
+struct hilbert_validate_options {
+    int order; // order the file has to be, 0 for whatever its number of points says
+    int threads; // number of checking threads, 0 for one per core
+    size_t ref_first, ref_count; // points compared with the generator, (size_t) -1 for all of them from ref_first
+};
+
+// problems found by hilbert_validate, every count is 0 for a valid file
+struct hilbert_validate_report {
+    int order;
+    size_t num_points;
+    int wrong_count; // the number of points isn't 4^order, nothing else is checked
+    size_t bad_points; // points that aren't the center of a cell
+    size_t bad_steps; // steps that aren't the generator's, to a neighbouring cell or across a seam
+    size_t repeated; // points in a cell that was already visited
+    size_t missing; // cells that were never visited
+    size_t mismatched; // points of the reference range that differ from the generator
+    size_t first_error; // index of the first point with a problem, (size_t) -1 if there is none
+};
+
+// checks that a file holds a complete curve: the right number of points, every point the center of a cell,
+// every step the one the generator takes and every cell visited exactly once, and compares the reference range
+// of the options with the generator. returns 0 if the file is valid, otherwise -1 with the problems in 'report'
+int hilbert_validate(const struct hilbert_file *file, const struct hilbert_validate_options *options,
+                     struct hilbert_validate_report *report);
+
+/* CHECKPOINTS */
+
+// number of points in a block of a resumable file, the unit that is written, recorded and verified
+#define HILBERT_CHECKPOINT_BLOCK_POINTS ((size_t) 1 << 20)
+
+// what write_hilbert_curve_resumable did with the blocks of a file
+struct hilbert_resume_report {
+    size_t num_blocks;
+    size_t verified; // blocks from an earlier run that still matched their checksum and were kept
+    size_t damaged; // blocks from an earlier run that didn't match their checksum and were written again
+    size_t generated; // blocks that were written, including the damaged ones
+};
+
+// writes a curve in binary (points of f8 or f4) into the file at 'path' a block at a time, recording every
+// finished block in the checkpoint file at 'checkpoint'. when both are left over from an earlier run of the same
+// curve, only the blocks that don't match their recorded checksum are written. returns 0 or -1 with errno set
+int write_hilbert_curve_resumable(int order, enum hilbert_dtype dtype, int threads, const char *path,
+                                  const char *checkpoint, struct hilbert_resume_report *report);
+
+/* TRACING */
+
+// begin and end events of a thread, only recorded when built with HILBERT_TRACE and compiled out otherwise
+// 'name' and 'key' have to be string literals, 'key' names 'value' in the trace and can be NULL
+#ifdef HILBERT_TRACE
+#define HILBERT_TRACE_BEGIN(name, key, value) hilbert_trace_event(name, 'B', key, (int64_t) (value))
+#define HILBERT_TRACE_END(name) hilbert_trace_event(name, 'E', NULL, 0)
+#else
+#define HILBERT_TRACE_BEGIN(name, key, value) ((void) 0)
+#define HILBERT_TRACE_END(name) ((void) 0)
+#endif
+
+// records an event of the calling thread into its own buffer, without any locks
+void hilbert_trace_event(const char *name, char phase, const char *key, int64_t value);
+// starts recording, the events are written to 'path' as Chrome trace JSON when the program exits
+// returns -1 with errno set to ENOSYS when built without HILBERT_TRACE
+int hilbert_trace_start(const char *path);
+// writes every recorded event as Chrome trace JSON, once every thread is done. returns -1 if the stream failed
+int hilbert_trace_write(FILE *fp);
+
+/* KEY SERVICE */
+
+// slots in the shared memory ring of a client, which can all be in flight at once
+#define HILBERT_SERVICE_SLOTS 16
+// size of a slot, its header and its data
+#define HILBERT_SERVICE_SLOT_BYTES ((size_t) 1 << 18)
+// size of the data of a slot, which holds a batch and then its results
+#define HILBERT_SERVICE_DATA_BYTES (HILBERT_SERVICE_SLOT_BYTES - sizeof(struct hilbert_service_slot))
+
+// what the server does with a batch, every result replaces its batch in the data of the slot
+enum hilbert_service_op {
+    HILBERT_OP_CELLS, // uint64_t indices in, uint32_t x, y cells out
+    HILBERT_OP_POINTS, // uint64_t indices in, space_vec2 points out
+    HILBERT_OP_INDICES, // uint32_t x, y cells in, uint64_t indices out
+    HILBERT_OP_DECOMPOSE, // one uint32_t x0, y0, x1, y1 rectangle of cells in, hilbert_span ranges out
+};
+
+// header of a slot, in front of its data
+struct hilbert_service_slot {
+    uint32_t op;
+    int32_t order;
+    uint64_t count; // number of items in the batch
+    int64_t result; // number of results, the ranges there are for decomposing, or -1 for a bad batch
+    uint8_t pad[40]; // keeps the data of the slot on a cache line of its own
+};
+
+struct hilbert_server;
+struct hilbert_client;
+
+// starts serving on a Unix socket with a worker per core (or 'workers'), returns NULL with errno on failure
+struct hilbert_server *hilbert_server_start(const char *path, int workers);
+// stops a server, closing every connection and removing its socket
+void hilbert_server_stop(struct hilbert_server *server);
+// connects to a server and maps the ring of slots it hands out, returns NULL with errno on failure
+struct hilbert_client *hilbert_client_connect(const char *path);
+void hilbert_client_close(struct hilbert_client *client);
+// the data of a slot, which a batch is written into and its results are read from
+void *hilbert_client_data(struct hilbert_client *client, int slot);
+// hands a batch to the server, any number of slots can be in flight. returns -1 if the server is gone
+int hilbert_client_submit(struct hilbert_client *client, int slot, enum hilbert_service_op op, int order,
+                          size_t count);
+// waits for the next finished batch and returns its result, with its slot in 'slot'
+int64_t hilbert_client_wait(struct hilbert_client *client, int *slot);
+// submits a batch and waits for it, when nothing else is in flight
+int64_t hilbert_client_call(struct hilbert_client *client, int slot, enum hilbert_service_op op, int order,
+                            size_t count);
+
+/* SHARED TABLES */
+
+// a curve that a publisher generated once, mapped read only
+struct hilbert_shared_table {
+    int order;
+    enum hilbert_dtype dtype;
+    size_t num_points;
+    const void *points; // interleaved x, y coordinates of the dtype, 64 byte aligned
+    void *map; // the whole mapping, header included
+    size_t map_bytes;
+};
+
+struct hilbert_publisher;
+
+// generates a curve into a sealed memfd and hands it out on a Unix socket, returns NULL with errno on failure
+struct hilbert_publisher *hilbert_publish_start(const char *path, int order, enum hilbert_dtype dtype, int threads);
+// stops handing out a table and removes its socket, attached tables stay valid
+void hilbert_publish_stop(struct hilbert_publisher *publisher);
+// maps the table published on a socket, returns -1 with errno on failure (EPERM if it isn't sealed)
+int hilbert_shared_attach(const char *path, struct hilbert_shared_table *table);
+void hilbert_shared_detach(struct hilbert_shared_table *table);
+
+/* GEOGRAPHIC KEYS */
+
+// level of the smallest cells of geographic keys, about a centimeter across
+#define HILBERT_GEO_MAX_LEVEL 30
+
+// the key of the cell at a level that holds a latitude and longitude in degrees, 0 for a level out of range
+uint64_t hilbert_geo_encode(double lat, double lon, int level);
+// the latitude and longitude in degrees of the center of the cell of a key
+void hilbert_geo_decode(uint64_t key, double *lat, double *lon);
+// hilbert_geo_encode of interleaved latitude, longitude pairs, returns -1 for a level out of range
+int hilbert_geo_encode_batch(const double *latlon, size_t count, int level, uint64_t *keys);
+void hilbert_geo_decode_batch(const uint64_t *keys, size_t count, double *latlon);
+int hilbert_geo_level(uint64_t key);
+// 0 to 5, for the faces of the cube around +x, +y, +z, -x, -y and -z
+int hilbert_geo_face(uint64_t key);
+// the key of the cell at a lower level that holds a key
+uint64_t hilbert_geo_parent(uint64_t key, int level);
+// the first and last leaf keys inside the cell of a key, the keys of everything inside it are between them
+uint64_t hilbert_geo_range_min(uint64_t key);
+uint64_t hilbert_geo_range_max(uint64_t key);
+
+/* STRING KEYS */
+
+// bytes of the widest key, base 4 at HILBERT_MAX_ORDER, with its terminator
+#define HILBERT_KEY_MAX (HILBERT_MAX_ORDER + 1)
+
+// digits of string keys, which are in ASCII order
+enum hilbert_key_base {
+    HILBERT_KEY_BASE4, // '0' to '3', a character per level of the curve
+    HILBERT_KEY_BASE32, // '0' to '9' and 'a' to 'v', two and a half levels per character
+};
+
+// characters of the keys of an order
+size_t hilbert_key_width(int order, enum hilbert_key_base base);
+// writes the terminated key of an index, returns its width or 0 for an index past the curve
+size_t hilbert_key_encode(int order, enum hilbert_key_base base, uint64_t index, char *out);
+// returns -1 if 'key' isn't a key of the order
+int hilbert_key_decode(int order, enum hilbert_key_base base, const char *key, size_t len, uint64_t *index);
+// keys back to back, hilbert_key_width bytes each without terminators. return -1 for an index or key that isn't one
+int hilbert_key_encode_batch(int order, enum hilbert_key_base base, const uint64_t *indices, size_t count,
+                             char *out);
+int hilbert_key_decode_batch(int order, enum hilbert_key_base base, const char *keys, size_t count,
+                             uint64_t *indices);
+// the fewest prefixes that the keys of a rectangle of cells start with, as terminated records of
+// hilbert_key_width + 1 bytes. writes at most 'max' and returns how many there are
+size_t hilbert_key_prefixes(int order, enum hilbert_key_base base, uint32_t x0, uint32_t y0, uint32_t x1,
+                            uint32_t y1, char *out, size_t max);
+
+#endif //HILBERT_H
@@ -0,0 +1,286 @@
+/*
+ * hilbert_checkpoint.c - Resumable binary output of pseudo-hilbert curves
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * A curve is written in blocks of HILBERT_CHECKPOINT_BLOCK_POINTS points by every thread at once, and every
+ * finished block is appended to a checkpoint file as its index and the checksum of its bytes. When the writer
+ * is started again on the same files, every block that the checkpoint lists is read back and kept if its
+ * checksum still matches, and everything else is generated again. A block is recorded before its data is
+ * known to be on disk, which is fine: data that didn't make it fails the checksum and is written again.
+ *
+ * CHECKPOINT FILES:
+ *  "HILBCKP1", u32 order, u32 dtype, u64 points per block, u64 number of points, then one record of
+ *  u64 block and u64 checksum per finished block, in the order they finished. A record that was cut off by
+ *  an interruption is ignored, and a header that doesn't match the curve being written starts everything over
+*/
+
+#include "hilbert.h"
+
+#include <stdlib.h>
+#include <memory.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// largest offset of a file, whatever the size of off_t
+#define CHECKPOINT_OFF_MAX ((((off_t) 1 << (sizeof(off_t) * 8 - 2)) - 1) * 2 + 1)
+
+/* CHECKPOINTS */
+
+#define CHECKPOINT_MAGIC "HILBCKP1"
+#define CHECKPOINT_HEADER_SIZE 32
+#define CHECKPOINT_RECORD_SIZE 16
+#define CHECKPOINT_NONE 0 // checksum of a block without a record, no block of a curve hashes to it
+
+// state shared between the threads of write_hilbert_curve_resumable
+struct checkpoint_job {
+    int order;
+    enum hilbert_dtype dtype;
+    size_t point_size;
+    size_t num_points;
+    int fd, checkpoint_fd;
+    uint64_t *checksums; // recorded checksum of every block, CHECKPOINT_NONE if there is none
+    size_t num_blocks;
+    size_t next_block;
+    int error; // errno of a failed write, stored atomically by whichever thread failed, 0 if none did
+    struct hilbert_resume_report report;
+    pthread_mutex_t lock;
+};
+
+// 64 bit checksum of a block, a word at a time with a multiply and rotate mix in between
+static uint64_t checkpoint_checksum(const uint8_t *data, size_t size) {
+    uint64_t hash = 0x9e3779b97f4a7c15u ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, &data[i], 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdu;
+        hash = (hash << 29) | (hash >> 35);
+    }
+    for (; i < size; i++) hash = (hash ^ data[i]) * 0x100000001b3u;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53u;
+    hash ^= hash >> 33;
+    return hash == CHECKPOINT_NONE ? 1 : hash;
+}
+
+static int pread_all(int fd, uint8_t *data, size_t len, off_t offset) {
+    for (size_t done = 0; done < len;) {
+        ssize_t n = pread(fd, &data[done], len - done, offset + (off_t) done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += (size_t) n;
+    }
+    return 0;
+}
+
+static int pwrite_all(int fd, const uint8_t *data, size_t len, off_t offset) {
+    for (size_t done = 0; done < len;) {
+        ssize_t n = pwrite(fd, &data[done], len - done, offset + (off_t) done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0) errno = EIO;
+        if (n <= 0) return -1;
+        done += (size_t) n;
+    }
+    return 0;
+}
+
+static void checkpoint_u32(uint8_t *out, uint32_t val) {
+    for (int i = 0; i < 4; i++) out[i] = (uint8_t) (val >> (8 * i));
+}
+
+static void checkpoint_u64(uint8_t *out, uint64_t val) {
+    for (int i = 0; i < 8; i++) out[i] = (uint8_t) (val >> (8 * i));
+}
+
+static uint64_t checkpoint_get_u64(const uint8_t *in) {
+    uint64_t val = 0;
+    for (int i = 7; i >= 0; i--) val = (val << 8) | in[i];
+    return val;
+}
+
+// reads the records of a checkpoint into job->checksums, or starts a new checkpoint when there is no usable one
+// returns -1 when the checkpoint can't be read or written
+static int checkpoint_load(struct checkpoint_job *job) {
+    uint8_t header[CHECKPOINT_HEADER_SIZE];
+    memcpy(header, CHECKPOINT_MAGIC, 8);
+    checkpoint_u32(&header[8], (uint32_t) job->order);
+    checkpoint_u32(&header[12], (uint32_t) job->dtype);
+    checkpoint_u64(&header[16], HILBERT_CHECKPOINT_BLOCK_POINTS);
+    checkpoint_u64(&header[24], job->num_points);
+
+    struct stat st;
+    if (fstat(job->checkpoint_fd, &st) != 0) return -1;
+    size_t size = (size_t) st.st_size;
+
+    uint8_t existing[CHECKPOINT_HEADER_SIZE];
+    if (size < CHECKPOINT_HEADER_SIZE || pread_all(job->checkpoint_fd, existing, CHECKPOINT_HEADER_SIZE, 0) != 0 ||
+        memcmp(existing, header, CHECKPOINT_HEADER_SIZE) != 0) {
+        // nothing to resume, whatever was in the checkpoint belongs to something else
+        if (ftruncate(job->checkpoint_fd, 0) != 0) return -1;
+        return pwrite_all(job->checkpoint_fd, header, CHECKPOINT_HEADER_SIZE, 0);
+    }
+
+    // the records, the last one of a block wins and a record cut off at the end is dropped
+    size_t num_records = (size - CHECKPOINT_HEADER_SIZE) / CHECKPOINT_RECORD_SIZE;
+    if (num_records > 0) {
+        uint8_t *records = (uint8_t *) malloc(num_records * CHECKPOINT_RECORD_SIZE);
+        assert(records != NULL);
+        if (pread_all(job->checkpoint_fd, records, num_records * CHECKPOINT_RECORD_SIZE,
+                      CHECKPOINT_HEADER_SIZE) != 0) {
+            free(records);
+            return -1;
+        }
+        for (size_t r = 0; r < num_records; r++) {
+            uint64_t block = checkpoint_get_u64(&records[r * CHECKPOINT_RECORD_SIZE]);
+            uint64_t checksum = checkpoint_get_u64(&records[r * CHECKPOINT_RECORD_SIZE + 8]);
+            if (block < job->num_blocks) job->checksums[block] = checksum;
+        }
+        free(records);
+    }
+    size_t end = CHECKPOINT_HEADER_SIZE + num_records * CHECKPOINT_RECORD_SIZE;
+    if (end != size && ftruncate(job->checkpoint_fd, (off_t) end) != 0) return -1;
+    return 0;
+}
+
+static void *checkpoint_thread(void *arg) {
+    struct checkpoint_job *job = (struct checkpoint_job *) arg;
+    size_t block_size = HILBERT_CHECKPOINT_BLOCK_POINTS * job->point_size;
+    uint8_t *buf = (uint8_t *) malloc(block_size);
+    assert(buf != NULL);
+    struct hilbert_resume_report report = {0};
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t b = job->next_block++;
+        pthread_mutex_unlock(&job->lock);
+        if (b >= job->num_blocks || __atomic_load_n(&job->error, __ATOMIC_RELAXED) != 0) break;
+
+        size_t first = b * HILBERT_CHECKPOINT_BLOCK_POINTS;
+        size_t count = job->num_points - first < HILBERT_CHECKPOINT_BLOCK_POINTS ? job->num_points - first
+                                                                                  : HILBERT_CHECKPOINT_BLOCK_POINTS;
+        size_t len = count * job->point_size;
+        off_t offset = (off_t) (first * job->point_size);
+
+        // a recorded block is kept if it still reads back to the same checksum
+        if (job->checksums[b] != CHECKPOINT_NONE) {
+            HILBERT_TRACE_BEGIN("verify", "block", b);
+            int kept = pread_all(job->fd, buf, len, offset) == 0 && checkpoint_checksum(buf, len) == job->checksums[b];
+            HILBERT_TRACE_END("verify");
+            if (kept) {
+                report.verified++;
+                continue;
+            }
+            report.damaged++;
+        }
+
+        HILBERT_TRACE_BEGIN("generate", "block", b);
+        hilbert_range_dtype(job->order, job->dtype, first, count, buf);
+        uint8_t record[CHECKPOINT_RECORD_SIZE];
+        checkpoint_u64(record, b);
+        checkpoint_u64(&record[8], checkpoint_checksum(buf, len));
+        HILBERT_TRACE_END("generate");
+        HILBERT_TRACE_BEGIN("pwrite", "bytes", len);
+        int written = pwrite_all(job->fd, buf, len, offset) == 0;
+        HILBERT_TRACE_END("pwrite");
+        if (!written) {
+            __atomic_store_n(&job->error, errno, __ATOMIC_RELAXED);
+            break;
+        }
+
+        // records are appended one at a time, so they never interleave
+        pthread_mutex_lock(&job->lock);
+        ssize_t n = write(job->checkpoint_fd, record, CHECKPOINT_RECORD_SIZE);
+        pthread_mutex_unlock(&job->lock);
+        if (n != CHECKPOINT_RECORD_SIZE) {
+            __atomic_store_n(&job->error, n < 0 ? errno : EIO, __ATOMIC_RELAXED);
+            break;
+        }
+        report.generated++;
+    }
+
+    pthread_mutex_lock(&job->lock);
+    job->report.verified += report.verified;
+    job->report.damaged += report.damaged;
+    job->report.generated += report.generated;
+    pthread_mutex_unlock(&job->lock);
+    free(buf);
+    return NULL;
+}
+
+// writes a curve in binary (points of f8 or f4) into the file at 'path' a block at a time, recording every
+// finished block in the checkpoint file at 'checkpoint'. when both files are left over from an interrupted run
+// of the same curve, blocks that still match their checksum are kept and only the rest are written
+// returns 0 when the whole file is written, or -1 with errno set (EINVAL for an order the dtype can't hold,
+// EFBIG for a curve whose bytes don't fit in a file offset)
+int write_hilbert_curve_resumable(int order, enum hilbert_dtype dtype, int threads, const char *path,
+                                  const char *checkpoint, struct hilbert_resume_report *report) {
+    memset(report, 0, sizeof(struct hilbert_resume_report));
+    if (order < 1 || order > HILBERT_MAX_ORDER || (dtype != HILBERT_DTYPE_F8 && dtype != HILBERT_DTYPE_F4) ||
+        (dtype == HILBERT_DTYPE_F4 && order > HILBERT_FLOAT_MAX_ORDER)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct checkpoint_job job;
+    memset(&job, 0, sizeof(job));
+    job.order = order;
+    job.dtype = dtype;
+    job.point_size = 2 * hilbert_dtype_size(dtype);
+    job.num_points = HILBERT_NUM_POINTS(order);
+    job.num_blocks = (job.num_points + HILBERT_CHECKPOINT_BLOCK_POINTS - 1) / HILBERT_CHECKPOINT_BLOCK_POINTS;
+    // the size of the file and the offset of every block have to fit in an off_t
+    if (job.num_points > (uint64_t) CHECKPOINT_OFF_MAX / job.point_size) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    job.fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (job.fd < 0) return -1;
+    job.checkpoint_fd = open(checkpoint, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (job.checkpoint_fd < 0) {
+        close(job.fd);
+        return -1;
+    }
+
+    // without records, nothing that is in the file already can be trusted
+    job.checksums = (uint64_t *) calloc(job.num_blocks, sizeof(uint64_t));
+    assert(job.checksums != NULL);
+    int result = checkpoint_load(&job);
+    if (result == 0) result = ftruncate(job.fd, (off_t) (job.num_points * job.point_size));
+
+    if (result == 0) {
+        if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads <= 0) threads = 1;
+        pthread_mutex_init(&job.lock, NULL);
+        pthread_t *workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+        assert(workers != NULL);
+        int started = 0;
+        while (started < threads && pthread_create(&workers[started], NULL, checkpoint_thread, &job) == 0) started++;
+        // blocks are taken one at a time, so without any thread the calling thread writes them all
+        if (started == 0) checkpoint_thread(&job);
+        for (int t = 0; t < started; t++) pthread_join(workers[t], NULL);
+        free(workers);
+        pthread_mutex_destroy(&job.lock);
+
+        // the file is only complete once it is on disk, the checkpoint keeps its checksums for the next run
+        // and a write that failed on a worker reports the errno of that worker
+        if (job.error != 0) errno = job.error;
+        if (job.error != 0 || fdatasync(job.fd) != 0 || fdatasync(job.checkpoint_fd) != 0) result = -1;
+    }
+
+    int saved = errno;
+    *report = job.report;
+    report->num_blocks = job.num_blocks;
+    free(job.checksums);
+    close(job.fd);
+    close(job.checkpoint_fd);
+    errno = saved;
+    return result;
+}
@@ -0,0 +1,320 @@
+/*
+ * hilbert_delta.c - Delta encoded pseudo-hilbert curve files
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * Consecutive points of a curve are almost always neighbouring cells, so a curve compresses well as the
+ * steps between integer cells. Points are stored in blocks of HILBERT_DELTA_BLOCK_POINTS, and every block
+ * starts with an absolute cell so blocks can be encoded and decoded on their own, on any thread.
+ *
+ * LAYOUT (all integers little endian):
+ *  header - "HILBDLT1", u32 order, u32 points per block
+ *  blocks - u32 x, u32 y of the first cell, then one step per point after it
+ *  index - u64 file offset of every block
+ *  footer - u64 number of points, u64 file offset of the index, "HILBDLT1"
+ *
+ * A step is a zigzag encoded (dx, dy). When both fit in 4 bits they share a single byte (dx << 4 | dy),
+ * otherwise the byte is 0xff and both follow as LEB128 varints
+*/
+
+#include "hilbert.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* DELTA ENCODING */
+
+// number of blocks encoded at once by every thread of a delta writer
+#define DELTA_BLOCKS_PER_THREAD 4
+// number of points generated at once by write_hilbert_delta
+#define DELTA_CHUNK_POINTS ((size_t) 1 << 20)
+
+static void put_u32(uint8_t *out, uint32_t v) {
+    for (int i = 0; i < 4; i++) out[i] = (uint8_t) (v >> (8 * i));
+}
+
+static void put_u64(uint8_t *out, uint64_t v) {
+    for (int i = 0; i < 8; i++) out[i] = (uint8_t) (v >> (8 * i));
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+    return in[0] | (uint32_t) in[1] << 8 | (uint32_t) in[2] << 16 | (uint32_t) in[3] << 24;
+}
+
+// finds the cell of a point, points outside of [0, 1) are clamped to the border cells
+static uint32_t delta_cell(space_pos_t val, int order) {
+    space_pos_t cells = (space_pos_t) ((uint64_t) 1 << order);
+    if (!(val > 0)) return 0;
+    if (val * cells >= cells) return (uint32_t) (((uint64_t) 1 << order) - 1);
+    return (uint32_t) (val * cells);
+}
+
+static size_t put_varint(uint8_t *out, uint64_t v) {
+    size_t len = 0;
+    while (v >= 0x80) {
+        out[len++] = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    out[len++] = (uint8_t) v;
+    return len;
+}
+
+// reads a varint of at most 5 bytes (every step fits in 33 bits), returns its length or 0 if it is cut off
+static size_t get_varint(const uint8_t *in, size_t size, uint64_t *out) {
+    *out = 0;
+    for (size_t i = 0; i < size && i < 5; i++) {
+        *out |= (uint64_t) (in[i] & 0x7f) << (7 * i);
+        if (!(in[i] & 0x80)) return i + 1;
+    }
+    return 0;
+}
+
+// encodes a block of points of a curve of a certain order, 'out' needs HILBERT_DELTA_BLOCK_MAX(len) bytes
+// returns the number of bytes written
+size_t hilbert_delta_encode(int order, const struct space_vec2 *points, size_t len, uint8_t *out) {
+    if (len == 0) return 0;
+
+    uint32_t x = delta_cell(points[0].x, order), y = delta_cell(points[0].y, order);
+    put_u32(&out[0], x);
+    put_u32(&out[4], y);
+    size_t pos = 8;
+
+    for (size_t i = 1; i < len; i++) {
+        uint32_t nx = delta_cell(points[i].x, order), ny = delta_cell(points[i].y, order);
+        int64_t dx = (int64_t) nx - x, dy = (int64_t) ny - y;
+        uint64_t zx = (uint64_t) dx << 1 ^ (uint64_t) (dx >> 63);
+        uint64_t zy = (uint64_t) dy << 1 ^ (uint64_t) (dy >> 63);
+
+        if (zx < 15 && zy < 15) {
+            // the steps of a curve are a single cell, so this is nearly every point
+            out[pos++] = (uint8_t) (zx << 4 | zy);
+        } else {
+            out[pos++] = 0xff;
+            pos += put_varint(&out[pos], zx);
+            pos += put_varint(&out[pos], zy);
+        }
+        x = nx;
+        y = ny;
+    }
+    return pos;
+}
+
+// decodes a block of 'size' bytes, skipping its first 'skip' points and writing the next 'len' into 'out'
+// returns the number of points written, or -1 if the block ends early
+size_t hilbert_delta_decode(int order, const uint8_t *in, size_t size, size_t skip, size_t len,
+                            struct space_vec2 *out) {
+    if (len == 0) return 0;
+    if (size < 8) return -1;
+
+    uint32_t x = get_u32(&in[0]), y = get_u32(&in[4]);
+    size_t pos = 8, done = 0;
+    for (size_t i = 0;; i++) {
+        if (i >= skip) {
+            out[done] = hilbert_cell_point(order, x, y);
+            if (++done == len) return done;
+        }
+
+        if (pos >= size) return -1;
+        uint64_t zx, zy;
+        uint8_t token = in[pos++];
+        if (token != 0xff) {
+            zx = token >> 4;
+            zy = token & 0xf;
+        } else {
+            size_t n = get_varint(&in[pos], size - pos, &zx);
+            if (n == 0) return -1;
+            pos += n;
+            n = get_varint(&in[pos], size - pos, &zy);
+            if (n == 0) return -1;
+            pos += n;
+        }
+        x += (uint32_t) (zx >> 1 ^ (0 - (zx & 1)));
+        y += (uint32_t) (zy >> 1 ^ (0 - (zy & 1)));
+    }
+}
+
+/* DELTA WRITER */
+
+// full blocks of one hilbert_delta_write call, encoded by several threads
+struct delta_job {
+    int order;
+    const struct space_vec2 *points;
+    uint8_t *buf; // HILBERT_DELTA_BLOCK_MAX(HILBERT_DELTA_BLOCK_POINTS) bytes per block
+    size_t *sizes;
+    size_t num_blocks;
+    size_t next_block;
+    pthread_mutex_t lock;
+};
+
+static void *delta_thread(void *arg) {
+    struct delta_job *job = (struct delta_job *) arg;
+    size_t block_max = HILBERT_DELTA_BLOCK_MAX(HILBERT_DELTA_BLOCK_POINTS);
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t b = job->next_block++;
+        pthread_mutex_unlock(&job->lock);
+        if (b >= job->num_blocks) break;
+
+        job->sizes[b] = hilbert_delta_encode(job->order, &job->points[b * HILBERT_DELTA_BLOCK_POINTS],
+                                             HILBERT_DELTA_BLOCK_POINTS, &job->buf[b * block_max]);
+    }
+    return NULL;
+}
+
+// writes one encoded block and remembers where it went for the index
+static void delta_put_block(struct hilbert_delta_writer *writer, const uint8_t *data, size_t size) {
+    if (writer->num_blocks == writer->cap_blocks) {
+        writer->cap_blocks = writer->cap_blocks ? writer->cap_blocks * 2 : 64;
+        writer->index = (uint64_t *) realloc(writer->index, writer->cap_blocks * sizeof(uint64_t));
+        assert(writer->index != NULL);
+    }
+    writer->index[writer->num_blocks++] = writer->pos;
+    fwrite(data, 1, size, writer->fp);
+    writer->pos += size;
+}
+
+// starts a delta file of a curve of a certain order, 'threads' encode blocks and can be 0 for one per core
+// returns -1 if the order isn't valid
+// the stream must be at the start of the file, since the index records absolute offsets
+int hilbert_delta_begin(struct hilbert_delta_writer *writer, FILE *fp, int order, int threads) {
+    if (order < 1 || order > HILBERT_MAX_ORDER) return -1;
+    if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+
+    writer->fp = fp;
+    writer->order = order;
+    writer->threads = threads;
+    writer->num_points = 0;
+    writer->num_pending = 0;
+    writer->index = NULL;
+    writer->num_blocks = writer->cap_blocks = 0;
+    writer->pending = (struct space_vec2 *) malloc(HILBERT_DELTA_BLOCK_POINTS * sizeof(struct space_vec2));
+    writer->buf_blocks = (size_t) threads * DELTA_BLOCKS_PER_THREAD;
+    writer->buf = (uint8_t *) malloc(writer->buf_blocks * HILBERT_DELTA_BLOCK_MAX(HILBERT_DELTA_BLOCK_POINTS));
+    writer->sizes = (size_t *) malloc(writer->buf_blocks * sizeof(size_t));
+    assert(writer->pending != NULL && writer->buf != NULL && writer->sizes != NULL);
+
+    uint8_t header[16];
+    memcpy(header, "HILBDLT1", 8);
+    put_u32(&header[8], (uint32_t) order);
+    put_u32(&header[12], (uint32_t) HILBERT_DELTA_BLOCK_POINTS);
+    fwrite(header, 1, sizeof(header), fp);
+    writer->pos = sizeof(header);
+    return 0;
+}
+
+// appends points to a delta file, full blocks are encoded on the writer's threads and written in order
+void hilbert_delta_write(struct hilbert_delta_writer *writer, const struct space_vec2 *points, size_t len) {
+    size_t block_max = HILBERT_DELTA_BLOCK_MAX(HILBERT_DELTA_BLOCK_POINTS);
+    writer->num_points += len;
+
+    // finish the block that the last call started
+    if (writer->num_pending > 0) {
+        size_t fill = HILBERT_DELTA_BLOCK_POINTS - writer->num_pending;
+        if (fill > len) fill = len;
+        memcpy(&writer->pending[writer->num_pending], points, fill * sizeof(struct space_vec2));
+        writer->num_pending += fill;
+        points += fill;
+        len -= fill;
+        if (writer->num_pending < HILBERT_DELTA_BLOCK_POINTS) return;
+
+        size_t size = hilbert_delta_encode(writer->order, writer->pending, HILBERT_DELTA_BLOCK_POINTS, writer->buf);
+        delta_put_block(writer, writer->buf, size);
+        writer->num_pending = 0;
+    }
+
+    // encode the full blocks a group at a time, straight from the caller's points
+    while (len >= HILBERT_DELTA_BLOCK_POINTS) {
+        struct delta_job job;
+        job.order = writer->order;
+        job.points = points;
+        job.buf = writer->buf;
+        job.sizes = writer->sizes;
+        job.num_blocks = len / HILBERT_DELTA_BLOCK_POINTS;
+        if (job.num_blocks > writer->buf_blocks) job.num_blocks = writer->buf_blocks;
+        job.next_block = 0;
+
+        int threads = writer->threads < (int) job.num_blocks ? writer->threads : (int) job.num_blocks;
+        pthread_mutex_init(&job.lock, NULL);
+        if (threads == 1) {
+            delta_thread(&job);
+        } else {
+            pthread_t *workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+            assert(workers != NULL);
+            int started = 0;
+            while (started < threads && pthread_create(&workers[started], NULL, delta_thread, &job) == 0) started++;
+            // blocks are taken one at a time, so without any thread the calling thread encodes them all
+            if (started == 0) delta_thread(&job);
+            for (int t = 0; t < started; t++) pthread_join(workers[t], NULL);
+            free(workers);
+        }
+        pthread_mutex_destroy(&job.lock);
+
+        for (size_t b = 0; b < job.num_blocks; b++) delta_put_block(writer, &writer->buf[b * block_max], writer->sizes[b]);
+        points += job.num_blocks * HILBERT_DELTA_BLOCK_POINTS;
+        len -= job.num_blocks * HILBERT_DELTA_BLOCK_POINTS;
+    }
+
+    // and keep the rest for the next call
+    memcpy(writer->pending, points, len * sizeof(struct space_vec2));
+    writer->num_pending = len;
+}
+
+// finishes a delta file by writing the last block, the index and the footer
+void hilbert_delta_end(struct hilbert_delta_writer *writer) {
+    if (writer->num_pending > 0) {
+        size_t size = hilbert_delta_encode(writer->order, writer->pending, writer->num_pending, writer->buf);
+        delta_put_block(writer, writer->buf, size);
+    }
+
+    uint8_t entry[8];
+    uint64_t index_pos = writer->pos;
+    for (size_t b = 0; b < writer->num_blocks; b++) {
+        put_u64(entry, writer->index[b]);
+        fwrite(entry, 1, sizeof(entry), writer->fp);
+    }
+
+    uint8_t footer[24];
+    put_u64(&footer[0], (uint64_t) writer->num_points);
+    put_u64(&footer[8], index_pos);
+    memcpy(&footer[16], "HILBDLT1", 8);
+    fwrite(footer, 1, sizeof(footer), writer->fp);
+    fflush(writer->fp);
+
+    free(writer->pending);
+    free(writer->buf);
+    free(writer->sizes);
+    free(writer->index);
+    writer->pending = NULL;
+    writer->sizes = NULL;
+    writer->buf = NULL;
+    writer->index = NULL;
+}
+
+// writes a curve as a delta file straight from the generator
+// returns the number of points written or -1 if the order isn't valid or a write failed
+size_t write_hilbert_delta(int order, int threads, FILE *fp) {
+    struct hilbert_delta_writer writer;
+    if (hilbert_delta_begin(&writer, fp, order, threads) != 0) return -1;
+
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    struct space_vec2 *chunk = (struct space_vec2 *) malloc(DELTA_CHUNK_POINTS * sizeof(struct space_vec2));
+    assert(chunk != NULL);
+    for (size_t i = 0; i < num_points; i += DELTA_CHUNK_POINTS) {
+        size_t len = num_points - i < DELTA_CHUNK_POINTS ? num_points - i : DELTA_CHUNK_POINTS;
+        hilbert_range(order, i, len, chunk);
+        hilbert_delta_write(&writer, chunk, len);
+    }
+    free(chunk);
+
+    hilbert_delta_end(&writer);
+    // writes are buffered, so a failed one only shows up in the error flag of the stream
+    return ferror(fp) ? (size_t) -1 : num_points;
+}
@@ -0,0 +1,695 @@
+/*
+ * hilbert_format.c - Fast text output of pseudo-hilbert curves
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * Every text format is built from the same pieces: a header, one piece of text per point (and for PLY,
+ * one per edge), and a footer. Points are formatted in chunks into plain memory buffers with a custom
+ * fixed point number formatter instead of going through printf for every point.
+ *
+ * Chunks can be formatted by several threads at once. Every chunk goes into its own buffer in a small ring,
+ * and the calling thread writes the finished buffers to the stream in order, so the output is identical
+ * no matter how many threads are used. The straight segments of a curve are formatted with the same pieces,
+ * one chunk of segments at a time
+*/
+
+#include "hilbert.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* TEXT FORMATTING */
+
+// number of points (or edges) formatted together as one chunk
+#define TEXT_CHUNK_ITEMS ((size_t) 65536)
+
+// growable buffer of text
+struct text_buf {
+    char *data;
+    size_t len, cap;
+};
+
+// makes room for 'size' more bytes and returns where they go
+static char *text_reserve(struct text_buf *buf, size_t size) {
+    if (buf->len + size > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 4096;
+        while (buf->len + size > cap) cap *= 2;
+        buf->data = (char *) realloc(buf->data, cap);
+        assert(buf->data != NULL);
+        buf->cap = cap;
+    }
+    return &buf->data[buf->len];
+}
+
+static void text_puts(struct text_buf *buf, const char *str) {
+    size_t len = strlen(str);
+    memcpy(text_reserve(buf, len), str, len);
+    buf->len += len;
+}
+
+// writes the digits of an unsigned integer, returns the number of characters written
+static size_t format_uint(char *out, uint64_t val) {
+    char digits[20];
+    size_t len = 0;
+    do {
+        digits[len++] = (char) ('0' + val % 10);
+        val /= 10;
+    } while (val != 0);
+    for (size_t i = 0; i < len; i++) out[i] = digits[len - 1 - i];
+    return len;
+}
+
+static void text_uint(struct text_buf *buf, uint64_t val) {
+    buf->len += format_uint(text_reserve(buf, 20), val);
+}
+
+static const uint64_t powers_of_ten[] = {
+        1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull,
+        1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull,
+        100000000000000ull, 1000000000000000ull, 10000000000000000ull, 100000000000000000ull,
+};
+
+// formats a double like printf("%.*f", precision, val), returns the number of characters written
+// 'out' needs room for HILBERT_FORMAT_FIXED_MAX characters
+size_t hilbert_format_fixed(char *out, double val, int precision) {
+#ifdef __SIZEOF_INT128__
+    /*
+     * A double is an integer m divided by 2^e, so val * 10^precision is m * 10^precision / 2^e.
+     * That is computed exactly in 128 bits and rounded half to even, which is what printf does
+     * for exact ties, so the digits are the same as printf's without any of its overhead.
+     * val must stay below 2^50 so that e is positive, and the scaled value must fit in 64 bits
+    */
+    if (isfinite(val) && precision >= 0 && precision <= HILBERT_FORMAT_MAX_PRECISION && fabs(val) < 1e15 &&
+        fabs(val) * (double) powers_of_ten[precision] < 1e18) {
+        size_t len = 0;
+        if (signbit(val)) {
+            out[len++] = '-';
+            val = -val;
+        }
+
+        int exp;
+        double frac = frexp(val, &exp);
+        uint64_t m = (uint64_t) ldexp(frac, 53);
+        int e = 53 - exp;
+
+        unsigned __int128 scaled = (unsigned __int128) m * powers_of_ten[precision];
+        uint64_t q;
+        if (e >= 120) {
+            q = 0; // far below the last digit
+        } else {
+            unsigned __int128 whole = scaled >> e;
+            unsigned __int128 rest = scaled - (whole << e);
+            unsigned __int128 half = (unsigned __int128) 1 << (e - 1);
+            if (rest > half || (rest == half && (whole & 1))) whole++;
+            q = (uint64_t) whole;
+        }
+
+        // integer part, then the fraction zero padded to 'precision' digits
+        len += format_uint(&out[len], q / powers_of_ten[precision]);
+        if (precision > 0) {
+            uint64_t fraction = q % powers_of_ten[precision];
+            out[len++] = '.';
+            for (int i = precision - 1; i >= 0; i--) {
+                out[len + i] = (char) ('0' + fraction % 10);
+                fraction /= 10;
+            }
+            len += precision;
+        }
+        return len;
+    }
+#endif
+    int len = snprintf(out, HILBERT_FORMAT_FIXED_MAX, "%.*f", precision, val);
+    return len < HILBERT_FORMAT_FIXED_MAX ? (size_t) len : HILBERT_FORMAT_FIXED_MAX - 1;
+}
+
+// formats numerator / 2^bits exactly, which takes 'bits' digits after the decimal point
+// returns the number of characters written, 'out' needs room for HILBERT_FORMAT_FIXED_MAX characters
+size_t hilbert_format_exact(char *out, uint64_t numerator, int bits) {
+    if (bits < 0 || bits > HILBERT_FORMAT_EXACT_MAX_BITS) return 0;
+
+    // long division by 2^bits: every digit is the whole part of ten times what is left, which fits in 64 bits
+    uint64_t mask = ((uint64_t) 1 << bits) - 1, rest = numerator & mask;
+    size_t len = format_uint(out, numerator >> bits);
+    if (bits > 0) out[len++] = '.';
+    for (int i = 0; i < bits; i++) {
+        rest *= 10;
+        out[len++] = (char) ('0' + (rest >> bits));
+        rest &= mask;
+    }
+    return len;
+}
+
+// a negative precision is HILBERT_TEXT_EXACT for a curve with -precision bits after the binary point
+static void text_fixed(struct text_buf *buf, double val, int precision) {
+    char *out = text_reserve(buf, HILBERT_FORMAT_FIXED_MAX);
+    if (precision >= 0) {
+        buf->len += hilbert_format_fixed(out, val, precision);
+    } else if (val >= 0 && val < 1) {
+        // coordinates of the curve are numerators over 2^(order + 1), so scaling them is exact
+        buf->len += hilbert_format_exact(out, (uint64_t) ldexp(val, -precision), -precision);
+    } else {
+        buf->len += hilbert_format_fixed(out, val, HILBERT_FORMAT_MAX_PRECISION);
+    }
+}
+
+/* TEXT FORMATS */
+
+// the pieces that make up one text format
+struct text_format {
+    // when every point of the curve is formatted to the same number of bytes, that number minus two times
+    // the digits after the decimal point (coordinates of points in the curve are always below 10), otherwise 0
+    size_t fixed_width;
+    void (*header)(struct text_buf *buf, size_t num_points);
+    void (*point)(struct text_buf *buf, size_t index, struct space_vec2 point, size_t num_points, int precision);
+    void (*edge)(struct text_buf *buf, size_t index); // edge from point 'index' to 'index + 1', can be NULL
+    void (*footer)(struct text_buf *buf, size_t num_points);
+};
+
+// the "(x,y)" lines of write_hilbert_curve_txt
+static void txt_point(struct text_buf *buf, size_t index, struct space_vec2 point, size_t num_points, int precision) {
+    text_puts(buf, "(");
+    text_fixed(buf, point.x, precision);
+    text_puts(buf, ",");
+    text_fixed(buf, point.y, precision);
+    text_puts(buf, ")\n");
+}
+
+static void csv_header(struct text_buf *buf, size_t num_points) {
+    text_puts(buf, "x,y\n");
+}
+
+static void csv_point(struct text_buf *buf, size_t index, struct space_vec2 point, size_t num_points, int precision) {
+    text_fixed(buf, point.x, precision);
+    text_puts(buf, ",");
+    text_fixed(buf, point.y, precision);
+    text_puts(buf, "\n");
+}
+
+static void json_header(struct text_buf *buf, size_t num_points) {
+    text_puts(buf, "[\n");
+}
+
+static void json_point(struct text_buf *buf, size_t index, struct space_vec2 point, size_t num_points, int precision) {
+    text_puts(buf, "[");
+    text_fixed(buf, point.x, precision);
+    text_puts(buf, ",");
+    text_fixed(buf, point.y, precision);
+    text_puts(buf, index + 1 < num_points ? "],\n" : "]\n");
+}
+
+static void json_footer(struct text_buf *buf, size_t num_points) {
+    text_puts(buf, "]\n");
+}
+
+// ascii PLY with every point as a vertex and a chain of edges between consecutive vertices
+static void ply_header(struct text_buf *buf, size_t num_points) {
+    text_puts(buf, "ply\nformat ascii 1.0\ncomment pseudo-hilbert curve\nelement vertex ");
+    text_uint(buf, num_points);
+    text_puts(buf, "\nproperty double x\nproperty double y\nproperty double z\nelement edge ");
+    text_uint(buf, num_points - 1);
+    text_puts(buf, "\nproperty uint vertex1\nproperty uint vertex2\nend_header\n");
+}
+
+static void ply_point(struct text_buf *buf, size_t index, struct space_vec2 point, size_t num_points, int precision) {
+    text_fixed(buf, point.x, precision);
+    text_puts(buf, " ");
+    text_fixed(buf, point.y, precision);
+    text_puts(buf, " 0\n");
+}
+
+static void ply_edge(struct text_buf *buf, size_t index) {
+    text_uint(buf, index);
+    text_puts(buf, " ");
+    text_uint(buf, index + 1);
+    text_puts(buf, "\n");
+}
+
+// a single SVG path in the unit square, scaled up to 1024 pixels by the viewBox
+static void svg_header(struct text_buf *buf, size_t num_points) {
+    text_puts(buf, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                   "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"1024\" height=\"1024\" viewBox=\"0 0 1 1\">\n"
+                   "<path fill=\"none\" stroke=\"black\" stroke-width=\"1\" vector-effect=\"non-scaling-stroke\" d=\"");
+}
+
+static void svg_point(struct text_buf *buf, size_t index, struct space_vec2 point, size_t num_points, int precision) {
+    text_puts(buf, index == 0 ? "M" : "\nL");
+    text_fixed(buf, point.x, precision);
+    text_puts(buf, " ");
+    text_fixed(buf, point.y, precision);
+}
+
+static void svg_footer(struct text_buf *buf, size_t num_points) {
+    text_puts(buf, "\"/>\n</svg>\n");
+}
+
+static const struct text_format text_formats[] = {
+        [HILBERT_TEXT_TXT] = {8, NULL, txt_point, NULL, NULL}, // "(" "0." "," "0." ")\n"
+        [HILBERT_TEXT_CSV] = {6, csv_header, csv_point, NULL, NULL}, // "0." "," "0." "\n"
+        [HILBERT_TEXT_JSON] = {0, json_header, json_point, NULL, json_footer},
+        [HILBERT_TEXT_PLY] = {0, ply_header, ply_point, ply_edge, NULL},
+        [HILBERT_TEXT_SVG] = {0, svg_header, svg_point, NULL, svg_footer},
+};
+
+/* TEXT THREADS */
+
+// a chunk of items formatted by one thread
+struct text_chunk {
+    struct text_buf buf;
+    struct space_vec2 *points; // scratch space for generated points
+};
+
+// state shared between the formatting threads and the writer
+struct text_job {
+    const struct text_format *format;
+    int order;
+    int precision;
+    const struct space_vec2 *points; // points from item 'first' on, NULL to generate them from 'order'
+    size_t num_points;
+    size_t first, last; // range of items to format, the items of a curve are its points followed by its edges
+    size_t num_chunks;
+
+    struct text_chunk *slots; // ring of chunks, chunk c is formatted into slot c % num_slots
+    int *ready;
+    size_t num_slots;
+    size_t next_chunk;
+    size_t written;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+// formats every item of a chunk into a slot
+static void text_format_chunk(struct text_job *job, size_t chunk, struct text_chunk *slot) {
+    size_t first = job->first + chunk * TEXT_CHUNK_ITEMS;
+    size_t last = job->last - first > TEXT_CHUNK_ITEMS ? first + TEXT_CHUNK_ITEMS : job->last;
+    slot->buf.len = 0;
+    HILBERT_TRACE_BEGIN("format", "first", first);
+
+    // points come first
+    if (first < job->num_points) {
+        size_t end = last < job->num_points ? last : job->num_points;
+        const struct space_vec2 *points = &job->points[first - job->first];
+        if (job->points == NULL) {
+            hilbert_range(job->order, first, end - first, slot->points);
+            points = slot->points;
+        }
+        for (size_t i = first; i < end; i++) {
+            job->format->point(&slot->buf, i, points[i - first], job->num_points, job->precision);
+        }
+    }
+
+    // then the edges, if the format has them
+    for (size_t i = first > job->num_points ? first : job->num_points; i < last; i++) {
+        job->format->edge(&slot->buf, i - job->num_points);
+    }
+    HILBERT_TRACE_END("format");
+}
+
+static void *text_thread(void *arg) {
+    struct text_job *job = (struct text_job *) arg;
+
+    pthread_mutex_lock(&job->lock);
+    for (;;) {
+        size_t c = job->next_chunk;
+        if (c >= job->num_chunks) break;
+        job->next_chunk++;
+
+        // wait for the writer to free the slot we are about to format into
+        while (c >= job->written + job->num_slots) pthread_cond_wait(&job->changed, &job->lock);
+        pthread_mutex_unlock(&job->lock);
+
+        text_format_chunk(job, c, &job->slots[c % job->num_slots]);
+
+        pthread_mutex_lock(&job->lock);
+        job->ready[c % job->num_slots] = 1;
+        pthread_cond_broadcast(&job->changed);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+// number of items (points, then edges) of a curve with 'num_points' points in a format
+static size_t text_num_items(const struct text_format *format, size_t num_points) {
+    return num_points + (format->edge != NULL && num_points > 0 ? num_points - 1 : 0);
+}
+
+// formats items 'first' to 'last' of a curve and writes them to a stream in order
+// the points are taken from 'points', which starts at item 'first', or generated when it is NULL
+static void text_run(const struct text_format *format, int order, const struct space_vec2 *points,
+                     size_t first, size_t last, size_t num_points, int precision, int threads, FILE *fp) {
+    if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+
+    struct text_job job;
+    job.format = format;
+    job.order = order;
+    job.precision = precision;
+    job.points = points;
+    job.num_points = num_points;
+    job.first = first;
+    job.last = last;
+    job.num_chunks = (last - first + TEXT_CHUNK_ITEMS - 1) / TEXT_CHUNK_ITEMS;
+    job.num_slots = threads > 1 ? (size_t) threads * 2 : 1;
+    job.next_chunk = 0;
+    job.written = 0;
+
+    job.slots = (struct text_chunk *) calloc(job.num_slots, sizeof(struct text_chunk));
+    job.ready = (int *) calloc(job.num_slots, sizeof(int));
+    assert(job.slots != NULL && job.ready != NULL);
+    for (size_t i = 0; i < job.num_slots; i++) {
+        if (points != NULL) continue;
+        job.slots[i].points = (struct space_vec2 *) malloc(TEXT_CHUNK_ITEMS * sizeof(struct space_vec2));
+        assert(job.slots[i].points != NULL);
+    }
+
+    pthread_t *workers = NULL;
+    int started = 0;
+    if (threads > 1) {
+        pthread_mutex_init(&job.lock, NULL);
+        pthread_cond_init(&job.changed, NULL);
+        workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+        assert(workers != NULL);
+        while (started < threads && pthread_create(&workers[started], NULL, text_thread, &job) == 0) started++;
+    }
+
+    if (started == 0) {
+        // no need for any threads (or none could be started), format and write one chunk after the other
+        for (size_t c = 0; c < job.num_chunks; c++) {
+            text_format_chunk(&job, c, &job.slots[0]);
+            HILBERT_TRACE_BEGIN("fwrite", "bytes", job.slots[0].buf.len);
+            fwrite(job.slots[0].buf.data, 1, job.slots[0].buf.len, fp);
+            HILBERT_TRACE_END("fwrite");
+        }
+    } else {
+        // write every chunk as soon as it is done, in order
+        for (size_t c = 0; c < job.num_chunks; c++) {
+            size_t slot = c % job.num_slots;
+            pthread_mutex_lock(&job.lock);
+            while (!job.ready[slot]) pthread_cond_wait(&job.changed, &job.lock);
+            pthread_mutex_unlock(&job.lock);
+
+            HILBERT_TRACE_BEGIN("fwrite", "bytes", job.slots[slot].buf.len);
+            fwrite(job.slots[slot].buf.data, 1, job.slots[slot].buf.len, fp);
+            HILBERT_TRACE_END("fwrite");
+
+            pthread_mutex_lock(&job.lock);
+            job.ready[slot] = 0;
+            job.written++;
+            pthread_cond_broadcast(&job.changed);
+            pthread_mutex_unlock(&job.lock);
+        }
+
+        for (int t = 0; t < started; t++) pthread_join(workers[t], NULL);
+    }
+    if (threads > 1) {
+        free(workers);
+        pthread_cond_destroy(&job.changed);
+        pthread_mutex_destroy(&job.lock);
+    }
+
+    // cleanup
+    for (size_t i = 0; i < job.num_slots; i++) {
+        free(job.slots[i].buf.data);
+        free(job.slots[i].points);
+    }
+    free(job.slots);
+    free(job.ready);
+}
+
+// checks the format and precision of the text writers
+static int text_format_valid(const struct hilbert_text_options *options) {
+    if ((unsigned) options->format >= sizeof(text_formats) / sizeof(text_formats[0])) return 0;
+    if (options->precision == HILBERT_TEXT_EXACT) return 1;
+    return options->precision >= 0 && options->precision <= HILBERT_FORMAT_MAX_PRECISION;
+}
+
+// finds the precision passed on to the formats, which is negative for HILBERT_TEXT_EXACT (see text_fixed)
+static int text_precision(const struct hilbert_text_options *options, int order) {
+    if (options->precision == HILBERT_TEXT_EXACT) return -(order + 1);
+    return options->precision ? options->precision : 15;
+}
+
+// checks the options of the text writers
+static int text_options_valid(const struct hilbert_text_options *options) {
+    if (options->order < 1 || options->order > HILBERT_MAX_ORDER) return 0;
+    return text_format_valid(options);
+}
+
+// writes a curve in a text format straight from the generator
+// returns the number of points written or -1 on invalid options or a failed write
+size_t write_hilbert_text(const struct hilbert_text_options *options, FILE *fp) {
+    if (!text_options_valid(options)) return -1;
+
+    const struct text_format *format = &text_formats[options->format];
+    size_t num_points = HILBERT_NUM_POINTS(options->order);
+    int precision = text_precision(options, options->order);
+
+    // header and footer are small, so they are formatted right here
+    struct text_buf buf = {NULL, 0, 0};
+    if (format->header != NULL) {
+        format->header(&buf, num_points);
+        fwrite(buf.data, 1, buf.len, fp);
+    }
+    text_run(format, options->order, NULL, 0, text_num_items(format, num_points), num_points, precision,
+             options->threads, fp);
+    if (format->footer != NULL) {
+        buf.len = 0;
+        format->footer(&buf, num_points);
+        fwrite(buf.data, 1, buf.len, fp);
+    }
+    fflush(fp);
+
+    free(buf.data);
+    // writes are buffered, so a failed one only shows up in the error flag of the stream
+    return ferror(fp) ? (size_t) -1 : num_points;
+}
+
+// writes what comes before the points of a curve with 'num_points' points in a text format
+// options->order is ignored, returns -1 on invalid options or a failed write
+int write_hilbert_text_header(const struct hilbert_text_options *options, size_t num_points, FILE *fp) {
+    if (!text_format_valid(options)) return -1;
+
+    const struct text_format *format = &text_formats[options->format];
+    if (format->header != NULL) {
+        struct text_buf buf = {NULL, 0, 0};
+        format->header(&buf, num_points);
+        fwrite(buf.data, 1, buf.len, fp);
+        free(buf.data);
+    }
+    return ferror(fp) ? -1 : 0;
+}
+
+// writes points 'first' to 'first + len' of a curve with 'num_points' points in a text format,
+// formatting chunks on options->threads threads. options->order is only used by HILBERT_TEXT_EXACT,
+// returns -1 on invalid options or a failed write
+int write_hilbert_text_points(const struct hilbert_text_options *options, const struct space_vec2 *points,
+                              size_t first, size_t len, size_t num_points, FILE *fp) {
+    if (!text_format_valid(options) || first + len > num_points) return -1;
+    if (options->precision == HILBERT_TEXT_EXACT && (options->order < 1 || options->order > HILBERT_MAX_ORDER)) {
+        return -1;
+    }
+
+    int precision = text_precision(options, options->order);
+    text_run(&text_formats[options->format], 0, points, first, first + len, num_points, precision,
+             options->threads, fp);
+    return ferror(fp) ? -1 : 0;
+}
+
+// writes what comes after the points of a curve with 'num_points' points in a text format, which are
+// the edges of PLY files and the footer. options->order is ignored, returns -1 on invalid options or a failed write
+int write_hilbert_text_footer(const struct hilbert_text_options *options, size_t num_points, FILE *fp) {
+    if (!text_format_valid(options)) return -1;
+
+    // edges only need the number of points, so there is nothing to generate
+    const struct text_format *format = &text_formats[options->format];
+    size_t num_items = text_num_items(format, num_points);
+    if (num_items > num_points) {
+        text_run(format, 0, NULL, num_points, num_items, num_points, 15, options->threads, fp);
+    }
+    if (format->footer != NULL) {
+        struct text_buf buf = {NULL, 0, 0};
+        format->footer(&buf, num_points);
+        fwrite(buf.data, 1, buf.len, fp);
+        free(buf.data);
+    }
+    fflush(fp);
+    return ferror(fp) ? -1 : 0;
+}
+
+// writes coordinates of a hilbert curve to a stream in a txt format
+void write_hilbert_curve_txt(struct space_vec2 *hc, size_t len, FILE *fp) {
+    text_run(&text_formats[HILBERT_TEXT_TXT], 0, hc, 0, len, len, 15, 1, fp);
+    fflush(fp);
+}
+
+// writes coordinates of a hilbert curve to a stream in a txt format, formatting chunks on several threads
+// the output is the same as write_hilbert_curve_txt, 'threads' can be 0 for one per core
+void write_hilbert_curve_txt_parallel(const struct space_vec2 *hc, size_t len, int threads, FILE *fp) {
+    text_run(&text_formats[HILBERT_TEXT_TXT], 0, hc, 0, len, len, 15, threads, fp);
+    fflush(fp);
+}
+
+/* SEGMENT TEXT OUTPUT */
+
+static void text_int(struct text_buf *buf, int64_t val) {
+    if (val < 0) text_puts(buf, "-");
+    text_uint(buf, val < 0 ? (uint64_t) -val : (uint64_t) val);
+}
+
+// writes the straight segments of a hilbert curve to a stream in a txt format, straight from the generator
+// every line is the starting point, then the step between cells and the number of steps
+// returns the number of segments written or -1 on an unsupported order or a failed write
+size_t write_hilbert_segments_txt(int order, FILE *fp) {
+    struct hilbert_segment_iter iter;
+    struct hilbert_segment seg;
+    if (hilbert_segments_begin(&iter, order) != 0) return -1;
+
+    // segments are formatted into one buffer, which is written every chunk of segments
+    struct text_buf buf = {NULL, 0, 0};
+    size_t written = 0;
+    while (hilbert_segments_next(&iter, &seg)) {
+        struct space_vec2 start = hilbert_cell_point(order, seg.x, seg.y);
+        text_puts(&buf, "(");
+        text_fixed(&buf, start.x, 15);
+        text_puts(&buf, ",");
+        text_fixed(&buf, start.y, 15);
+        text_puts(&buf, ") ");
+        text_int(&buf, seg.dx);
+        text_puts(&buf, " ");
+        text_int(&buf, seg.dy);
+        text_puts(&buf, " ");
+        text_uint(&buf, seg.length);
+        text_puts(&buf, "\n");
+        if (++written % TEXT_CHUNK_ITEMS == 0) {
+            fwrite(buf.data, 1, buf.len, fp);
+            buf.len = 0;
+        }
+    }
+    fwrite(buf.data, 1, buf.len, fp);
+    fflush(fp);
+
+    free(buf.data);
+    return ferror(fp) ? (size_t) -1 : written;
+}
+
+/* POSITIONAL TEXT OUTPUT */
+
+// state shared between the threads of write_hilbert_text_fd
+struct text_fd_job {
+    const struct text_format *format;
+    int order;
+    int precision;
+    size_t num_points;
+    size_t width; // bytes of every point
+    int fd;
+    off_t base; // file offset of the first point
+    size_t next_chunk, num_chunks;
+    int error; // errno of a failed write, stored atomically by whichever thread failed, 0 if none did
+    pthread_mutex_t lock;
+};
+
+static void *text_fd_thread(void *arg) {
+    struct text_fd_job *job = (struct text_fd_job *) arg;
+    struct text_buf buf = {NULL, 0, 0};
+    struct space_vec2 *points = (struct space_vec2 *) malloc(TEXT_CHUNK_ITEMS * sizeof(struct space_vec2));
+    assert(points != NULL);
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t c = job->next_chunk++;
+        pthread_mutex_unlock(&job->lock);
+        if (c >= job->num_chunks || __atomic_load_n(&job->error, __ATOMIC_RELAXED) != 0) break;
+
+        // every chunk knows where it goes in the file, so it can be written without waiting for the others
+        size_t first = c * TEXT_CHUNK_ITEMS;
+        size_t count = job->num_points - first < TEXT_CHUNK_ITEMS ? job->num_points - first : TEXT_CHUNK_ITEMS;
+        HILBERT_TRACE_BEGIN("format", "first", first);
+        hilbert_range(job->order, first, count, points);
+        buf.len = 0;
+        for (size_t i = 0; i < count; i++) {
+            job->format->point(&buf, first + i, points[i], job->num_points, job->precision);
+        }
+        assert(buf.len == count * job->width);
+        HILBERT_TRACE_END("format");
+
+        off_t offset = job->base + (off_t) (first * job->width);
+        HILBERT_TRACE_BEGIN("pwrite", "bytes", buf.len);
+        for (size_t done = 0; done < buf.len;) {
+            ssize_t n = pwrite(job->fd, &buf.data[done], buf.len - done, offset + (off_t) done);
+            if (n <= 0) {
+                __atomic_store_n(&job->error, n < 0 ? errno : EIO, __ATOMIC_RELAXED);
+                break;
+            }
+            done += (size_t) n;
+        }
+        HILBERT_TRACE_END("pwrite");
+    }
+
+    free(points);
+    free(buf.data);
+    return NULL;
+}
+
+// writes a curve in a fixed width text format (txt or csv) straight from the generator into a file
+// every thread formats its own chunks and writes them with pwrite at the offset they belong at,
+// starting at the current offset of 'fd'. the offset is moved to the end of what was written
+// returns the number of points written or -1 on invalid options, a format without fixed width or a failed write,
+// which sets errno
+size_t write_hilbert_text_fd(const struct hilbert_text_options *options, int fd) {
+    if (!text_options_valid(options)) return -1;
+    const struct text_format *format = &text_formats[options->format];
+    if (format->fixed_width == 0) return -1;
+
+    struct text_fd_job job;
+    job.format = format;
+    job.order = options->order;
+    job.precision = text_precision(options, options->order);
+    job.num_points = HILBERT_NUM_POINTS(options->order);
+    job.width = format->fixed_width + 2 * (size_t) abs(job.precision);
+    job.fd = fd;
+    job.next_chunk = 0;
+    job.num_chunks = (job.num_points + TEXT_CHUNK_ITEMS - 1) / TEXT_CHUNK_ITEMS;
+    job.error = 0;
+
+    job.base = lseek(fd, 0, SEEK_CUR);
+    if (job.base < 0) return -1;
+
+    // the header goes first, where the stream is right now
+    if (format->header != NULL) {
+        struct text_buf buf = {NULL, 0, 0};
+        format->header(&buf, job.num_points);
+        ssize_t n = pwrite(fd, buf.data, buf.len, job.base);
+        if (n != (ssize_t) buf.len) job.error = n < 0 ? errno : EIO;
+        job.base += (off_t) buf.len;
+        free(buf.data);
+    }
+
+    int threads = options->threads;
+    if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_t *workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    assert(workers != NULL);
+    // threads take chunks until there are none left, so fewer threads than asked for only make it slower
+    int started = 0;
+    while (started < threads && pthread_create(&workers[started], NULL, text_fd_thread, &job) == 0) started++;
+    if (started == 0) text_fd_thread(&job);
+    for (int t = 0; t < started; t++) pthread_join(workers[t], NULL);
+    free(workers);
+    pthread_mutex_destroy(&job.lock);
+
+    lseek(fd, job.base + (off_t) (job.num_points * job.width), SEEK_SET);
+    if (job.error != 0) {
+        errno = job.error;
+        return -1;
+    }
+    return job.num_points;
+}
@@ -0,0 +1,268 @@
+/*
+ * hilbert_geo.c - Geographic keys: latitude and longitude to curve indices on the six faces of a cube
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * A point on the sphere is projected onto the face of the cube around it that it is closest to (the largest
+ * coordinate of its unit vector), the same way S2 does it, so no face is stretched much more than any other and
+ * the poles are just the middle of a face. On a face, the quadratic transform of S2 evens out the sizes of the
+ * cells, and the order 30 curve runs over a grid of 2^30 by 2^30 cells.
+ *
+ * A key is the face in the top 3 bits, then the index on the face, then a 1 marking the level of the key, with
+ * zeroes below it. Every aligned block of 4^k indices fills an aligned square on a face, so the key of a cell at
+ * a lower level is a prefix of the keys of every cell inside it, and the keys of a cell and everything inside it
+ * are a contiguous range of integers.
+ *
+ * Indices are found 4 levels at a time through tables: the curve only ever turns one of the quadrants of a square
+ * around (reflecting it across the anti-diagonal), so the state of the descent is a single bit
+ *
+ * SEGMENTS:
+ *  Geographic Keys - Projection, the tables of the curve on a face, and the keys themselves
+*/
+
+#include "hilbert.h"
+
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+
+/* GEOGRAPHIC KEYS */
+
+// cells along a side of a face
+#define GEO_FACE_CELLS ((uint32_t) 1 << HILBERT_GEO_MAX_LEVEL)
+// points converted per pass of a batch, so every pass stays in the L1 cache
+#define GEO_BATCH 256
+
+static const double geo_degrees = 180.0 / 3.14159265358979323846;
+
+// the 4 levels of digits of a nibble of x and y: geo_encode_table[state][x nibble][y nibble] is the 8 bits of
+// digits, with the state after them in bit 8. geo_decode_table[state][digits] is the x nibble, the y nibble << 4,
+// and the state after them in bit 8
+static uint16_t geo_encode_table[2][16][16];
+static uint16_t geo_decode_table[2][256];
+static pthread_once_t geo_tables_once = PTHREAD_ONCE_INIT;
+
+// the quadrant each digit of hilbert_index is, as the bits of x and y once the state is undone
+static const int geo_digit_x[4] = {0, 0, 1, 1};
+static const int geo_digit_y[4] = {1, 0, 0, 1};
+
+static void geo_build_tables(void) {
+    for (int state = 0; state < 2; state++) {
+        for (int x = 0; x < 16; x++) {
+            for (int y = 0; y < 16; y++) {
+                int s = state, digits = 0;
+                for (int bit = 3; bit >= 0; bit--) {
+                    int bx = (x >> bit) & 1, by = (y >> bit) & 1;
+                    // a reflected square swaps and flips x and y
+                    int ex = s ? 1 - by : bx, ey = s ? 1 - bx : by;
+                    int digit = ex ? (ey ? 3 : 2) : (ey ? 0 : 1);
+                    digits = digits << 2 | digit;
+                    s ^= digit == 0;
+                }
+                geo_encode_table[state][x][y] = (uint16_t) (digits | s << 8);
+            }
+        }
+        for (int digits = 0; digits < 256; digits++) {
+            int s = state, x = 0, y = 0;
+            for (int level = 3; level >= 0; level--) {
+                int digit = (digits >> (2 * level)) & 3;
+                int ex = geo_digit_x[digit], ey = geo_digit_y[digit];
+                x = x << 1 | (s ? 1 - ey : ex);
+                y = y << 1 | (s ? 1 - ex : ey);
+                s ^= digit == 0;
+            }
+            geo_decode_table[state][digits] = (uint16_t) (x | y << 4 | s << 8);
+        }
+    }
+}
+
+// hilbert_index of a cell of the order 30 curve. the cell is taken as one of the order 32 curve, whose first two
+// digits are then always 1
+static uint64_t geo_index(uint32_t x, uint32_t y) {
+    uint64_t index = 0;
+    int state = 0;
+    for (int shift = 28; shift >= 0; shift -= 4) {
+        uint16_t entry = geo_encode_table[state][(x >> shift) & 15][(y >> shift) & 15];
+        index = index << 8 | (entry & 255);
+        state = entry >> 8;
+    }
+    return index & (((uint64_t) 1 << (2 * HILBERT_GEO_MAX_LEVEL)) - 1);
+}
+
+// hilbert_cell of the order 30 curve, the inverse of geo_index
+static void geo_cell(uint64_t index, uint32_t *cx, uint32_t *cy) {
+    index |= (uint64_t) 5 << (2 * HILBERT_GEO_MAX_LEVEL);
+    uint32_t x = 0, y = 0;
+    int state = 0;
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        uint16_t entry = geo_decode_table[state][(index >> shift) & 255];
+        x = x << 4 | (entry & 15);
+        y = y << 4 | ((entry >> 4) & 15);
+        state = entry >> 8;
+    }
+    *cx = x;
+    *cy = y;
+}
+
+// sine and cosine of an angle in [-pi, pi], as precise as libm's to within an ulp but without a call or a branch,
+// so that batches vectorize. the angle is reduced to [-pi/4, pi/4] around a multiple of pi/2, in two parts so
+// nothing is lost, and the kernels are the polynomials of fdlibm. the multiple is rounded by adding and taking
+// away 1.5 * 2^52, since floor() is a call on x86-64 without SSE 4.1
+static inline void geo_sincos(double a, double *sin_a, double *cos_a) {
+    double k = (a * 0.63661977236758134308 + 6755399441055744.0) - 6755399441055744.0;
+    double r = (a - k * 1.57079632673412561417e+00) - k * 6.07710050650619224932e-11;
+    double r2 = r * r;
+    double s = r + r * r2 * (-1.66666666666666324348e-01 + r2 * (8.33333333332248946124e-03 + r2 * (
+            -1.98412698298579493134e-04 + r2 * (2.75573137070700676789e-06 + r2 * (-2.50507602534068634195e-08 +
+            r2 * 1.58969099521155010221e-10)))));
+    double c = 1 - 0.5 * r2 + r2 * r2 * (4.16666666666666019037e-02 + r2 * (-1.38888888888741095749e-03 + r2 * (
+            2.48015872894767294178e-05 + r2 * (-2.75573143513906633035e-07 + r2 * (2.08757232129817482790e-09 +
+            r2 * -1.13596475577881948265e-11)))));
+    // the quadrant of the multiple of pi/2 rotates the sine and cosine of what is left
+    int q = (int) k & 3;
+    *sin_a = q == 0 ? s : q == 1 ? c : q == 2 ? -s : -c;
+    *cos_a = q == 0 ? c : q == 1 ? -s : q == 2 ? -c : s;
+}
+
+// the unit vector of a latitude and longitude in degrees
+static inline void geo_vector(double lat, double lon, double *x, double *y, double *z) {
+    double sin_phi, cos_phi, sin_theta, cos_theta;
+    geo_sincos(lat / geo_degrees, &sin_phi, &cos_phi);
+    geo_sincos(lon / geo_degrees, &sin_theta, &cos_theta);
+    *x = cos_phi * cos_theta;
+    *y = cos_phi * sin_theta;
+    *z = sin_phi;
+}
+
+// the quadratic transform of S2, from a coordinate of the plane of a face in [-1, 1] to one in [0, 1]
+static inline double geo_uv_to_st(double u) {
+    double half = 0.5 * sqrt(1 + 3 * fabs(u));
+    return u >= 0 ? half : 1 - half;
+}
+
+static double geo_st_to_uv(double s) {
+    return s >= 0.5 ? (4 * s * s - 1) / 3 : (1 - 4 * (1 - s) * (1 - s)) / 3;
+}
+
+// clamped first, so that the conversion, which truncates, floors. it goes through int32_t, which vector units can
+// convert to and uint32_t they can't
+static inline uint32_t geo_st_to_cell(double s) {
+    double cell = s * GEO_FACE_CELLS;
+    cell = cell < 0 ? 0 : cell;
+    cell = cell > GEO_FACE_CELLS - 1 ? GEO_FACE_CELLS - 1 : cell;
+    return (uint32_t) (int32_t) cell;
+}
+
+// the face of a unit vector, which doesn't need to be normalized, and its cell on the face
+// the face is picked with selects rather than branches, which would be mispredicted for points all over the globe
+static inline int geo_face_cell(double x, double y, double z, uint32_t *cx, uint32_t *cy) {
+    double ax = fabs(x), ay = fabs(y), az = fabs(z);
+    // the face of the largest coordinate, +x, +y, +z, -x, -y, -z, with the axes of the faces of S2
+    int axis = ax >= ay && ax >= az ? 0 : ay >= az ? 1 : 2;
+    double major = axis == 0 ? x : axis == 1 ? y : z;
+    int face = axis + (major < 0 ? 3 : 0);
+    double u = face == 0 ? y : face == 3 || face == 4 ? z : face == 5 ? -y : -x;
+    double v = face == 0 || face == 1 ? z : face == 2 ? -y : face == 3 ? y : -x;
+    *cx = geo_st_to_cell(geo_uv_to_st(u / major));
+    *cy = geo_st_to_cell(geo_uv_to_st(v / major));
+    return face;
+}
+
+static inline uint64_t geo_leaf(int face, uint32_t cx, uint32_t cy) {
+    return (uint64_t) face << 61 | geo_index(cx, cy) << 1 | 1;
+}
+
+// the key of the cell at 'level' that holds a leaf key
+static uint64_t geo_at_level(uint64_t leaf, int level) {
+    uint64_t lsb = (uint64_t) 1 << (2 * (HILBERT_GEO_MAX_LEVEL - level));
+    return (leaf & -lsb) | lsb;
+}
+
+// the level of a key, from where its lowest 1 is
+int hilbert_geo_level(uint64_t key) {
+    return HILBERT_GEO_MAX_LEVEL - __builtin_ctzll(key) / 2;
+}
+
+// the face of a key, 0 to 5 for +x, +y, +z, -x, -y and -z
+int hilbert_geo_face(uint64_t key) {
+    return (int) (key >> 61);
+}
+
+// the key of the cell at 'level' that holds a key, which must be at 'level' or below it
+uint64_t hilbert_geo_parent(uint64_t key, int level) {
+    return geo_at_level(key, level);
+}
+
+// the first and last leaf keys inside a key, every key inside it lies between them
+uint64_t hilbert_geo_range_min(uint64_t key) {
+    return key - ((key & -key) - 1);
+}
+
+uint64_t hilbert_geo_range_max(uint64_t key) {
+    return key + ((key & -key) - 1);
+}
+
+// the key at 'level' (0 for a whole face to HILBERT_GEO_MAX_LEVEL for cells of about a centimeter) of a latitude
+// and longitude in degrees
+// returns 0, which is never a key, for a level out of range
+uint64_t hilbert_geo_encode(double lat, double lon, int level) {
+    if (level < 0 || level > HILBERT_GEO_MAX_LEVEL) return 0;
+    pthread_once(&geo_tables_once, geo_build_tables);
+    double x, y, z;
+    uint32_t cx, cy;
+    geo_vector(lat, lon, &x, &y, &z);
+    int face = geo_face_cell(x, y, z, &cx, &cy);
+    return geo_at_level(geo_leaf(face, cx, cy), level);
+}
+
+// the latitude and longitude in degrees of the center of the cell of a key
+void hilbert_geo_decode(uint64_t key, double *lat, double *lon) {
+    pthread_once(&geo_tables_once, geo_build_tables);
+    int face = hilbert_geo_face(key);
+    uint64_t size = (uint64_t) 1 << (HILBERT_GEO_MAX_LEVEL - hilbert_geo_level(key));
+    // the first leaf of a cell is in one of its corners, not always the lowest
+    uint32_t cx, cy;
+    geo_cell((hilbert_geo_range_min(key) >> 1) & (((uint64_t) 1 << (2 * HILBERT_GEO_MAX_LEVEL)) - 1), &cx, &cy);
+    cx &= (uint32_t) -size;
+    cy &= (uint32_t) -size;
+    double u = geo_st_to_uv((cx + 0.5 * (double) size) / GEO_FACE_CELLS);
+    double v = geo_st_to_uv((cy + 0.5 * (double) size) / GEO_FACE_CELLS);
+
+    double x, y, z;
+    switch (face) {
+        case 0: x = 1, y = u, z = v; break;
+        case 1: x = -u, y = 1, z = v; break;
+        case 2: x = -u, y = -v, z = 1; break;
+        case 3: x = -1, y = -v, z = -u; break;
+        case 4: x = v, y = -1, z = -u; break;
+        default: x = v, y = u, z = -1; break;
+    }
+    *lat = atan2(z, sqrt(x * x + y * y)) * geo_degrees;
+    *lon = atan2(y, x) * geo_degrees;
+}
+
+// the keys at 'level' of 'count' interleaved latitude, longitude pairs in degrees
+// a block of points goes through the unit vectors and then the faces and cells in passes of their own, which both
+// vectorize, before the indices, whose table lookups don't. the results are the same as hilbert_geo_encode's
+// returns -1 for a level out of range, otherwise 0
+int hilbert_geo_encode_batch(const double *latlon, size_t count, int level, uint64_t *keys) {
+    if (level < 0 || level > HILBERT_GEO_MAX_LEVEL) return -1;
+    pthread_once(&geo_tables_once, geo_build_tables);
+    double x[GEO_BATCH], y[GEO_BATCH], z[GEO_BATCH];
+    uint32_t cx[GEO_BATCH], cy[GEO_BATCH];
+    int face[GEO_BATCH];
+    for (size_t first = 0; first < count; first += GEO_BATCH) {
+        size_t len = count - first < GEO_BATCH ? count - first : GEO_BATCH;
+        const double *in = &latlon[2 * first];
+        for (size_t i = 0; i < len; i++) geo_vector(in[2 * i], in[2 * i + 1], &x[i], &y[i], &z[i]);
+        for (size_t i = 0; i < len; i++) face[i] = geo_face_cell(x[i], y[i], z[i], &cx[i], &cy[i]);
+        for (size_t i = 0; i < len; i++) keys[first + i] = geo_at_level(geo_leaf(face[i], cx[i], cy[i]), level);
+    }
+    return 0;
+}
+
+// the centers of 'count' keys as interleaved latitude, longitude pairs in degrees
+void hilbert_geo_decode_batch(const uint64_t *keys, size_t count, double *latlon) {
+    for (size_t i = 0; i < count; i++) hilbert_geo_decode(keys[i], &latlon[2 * i], &latlon[2 * i + 1]);
+}
@@ -0,0 +1,180 @@
+/*
+ * hilbert_key.c - Curve indices as strings for stores that only sort and scan string keys
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * A key is an index written in base 4, a character per level of the curve, or in base 32, with the bits of the
+ * index first and zero bits after them to fill the last character. Every key of an order has the same width and
+ * the digits are in ASCII order, so keys sort the way the curve runs. A base 4 key of an order is its quadrant at
+ * every level, the same way hilbert_create places the curve in the four quadrants of scale_origins and then again
+ * in theirs: the first n characters of a key are the key of the quadrant at order n that holds it. In base 32 a
+ * prefix of n characters is a block of 32^(width - n) indices, which is a quadrant when n is even.
+ *
+ * A rectangle becomes the fewest prefixes whose keys are exactly the keys of its cells, so a store can answer it
+ * with prefix scans
+ *
+ * SEGMENTS:
+ *  String Keys - Widths, encoding and decoding, and the prefixes of a rectangle
+*/
+
+#include "hilbert.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* STRING KEYS */
+
+static const char key_digits[] = "0123456789abcdefghijklmnopqrstuv";
+// bits of a digit of each base
+static const int key_bits[] = {2, 5};
+
+// characters of the keys of an order in a base
+size_t hilbert_key_width(int order, enum hilbert_key_base base) {
+    return (size_t) (2 * order + key_bits[base] - 1) / (size_t) key_bits[base];
+}
+
+// the bits of zero that fill the last character of a key
+static int key_padding(int order, enum hilbert_key_base base) {
+    return (int) hilbert_key_width(order, base) * key_bits[base] - 2 * order;
+}
+
+// digit 'c' of the key of an index, from its bits at the same place in the key, which in base 32 are shifted up by
+// the padding. the padded key is never built, it is 65 bits at order 31
+static int key_digit(uint64_t index, int c, int width, int bits, int padding) {
+    int shift = bits * (width - 1 - c) - padding;
+    uint64_t digits = shift >= 0 ? index >> shift : index << -shift;
+    return (int) (digits & (((uint64_t) 1 << bits) - 1));
+}
+
+// writes the first 'length' characters of the key of an index into 'out' without a terminator
+static void key_write(uint64_t index, int length, int width, int bits, int padding, char *out) {
+    for (int c = 0; c < length; c++) out[c] = key_digits[key_digit(index, c, width, bits, padding)];
+}
+
+// reads a key, returns -1 for a character that isn't a digit of the base or padding that isn't zero
+static int key_read(const char *key, int width, int bits, int padding, uint64_t *index) {
+    uint64_t result = 0;
+    for (int c = 0; c < width; c++) {
+        char ch = key[c];
+        int digit = ch >= '0' && ch <= '9' ? ch - '0' : ch >= 'a' && ch <= 'v' ? ch - 'a' + 10 : 32;
+        if (digit >> bits) return -1;
+        if (c == width - 1) {
+            // the padding is the bottom of the last digit
+            if (digit & ((1 << padding) - 1)) return -1;
+            result = result << (bits - padding) | (uint64_t) (digit >> padding);
+        } else {
+            result = result << bits | (uint64_t) digit;
+        }
+    }
+    *index = result;
+    return 0;
+}
+
+// writes the key of an index and a terminator into 'out', which has room for HILBERT_KEY_MAX bytes
+// returns the width of the key, or 0 for an order out of range or an index past the curve
+size_t hilbert_key_encode(int order, enum hilbert_key_base base, uint64_t index, char *out) {
+    if (order < 1 || order > HILBERT_MAX_ORDER || index >= HILBERT_NUM_POINTS(order)) return 0;
+    int width = (int) hilbert_key_width(order, base);
+    key_write(index, width, width, key_bits[base], key_padding(order, base), out);
+    out[width] = '\0';
+    return (size_t) width;
+}
+
+// the index of a key of an order, which has to be exactly as wide as the keys of the order
+// returns -1 for a key of another width, a character that isn't a digit of the base, or padding that isn't zero
+int hilbert_key_decode(int order, enum hilbert_key_base base, const char *key, size_t len, uint64_t *index) {
+    if (order < 1 || order > HILBERT_MAX_ORDER || len != hilbert_key_width(order, base)) return -1;
+    return key_read(key, (int) len, key_bits[base], key_padding(order, base), index);
+}
+
+// writes the keys of 'count' indices back to back into 'out', hilbert_key_width bytes each without terminators
+// returns -1 for an order out of range or an index past the curve, after writing the keys before it
+int hilbert_key_encode_batch(int order, enum hilbert_key_base base, const uint64_t *indices, size_t count,
+                             char *out) {
+    if (order < 1 || order > HILBERT_MAX_ORDER) return -1;
+    int width = (int) hilbert_key_width(order, base), bits = key_bits[base], padding = key_padding(order, base);
+    uint64_t num_points = HILBERT_NUM_POINTS(order);
+    for (size_t i = 0; i < count; i++) {
+        if (indices[i] >= num_points) return -1;
+        key_write(indices[i], width, width, bits, padding, &out[i * (size_t) width]);
+    }
+    return 0;
+}
+
+// reads 'count' keys written back to back by hilbert_key_encode_batch
+// returns -1 for an order out of range or a key that isn't one, after reading the keys before it
+int hilbert_key_decode_batch(int order, enum hilbert_key_base base, const char *keys, size_t count,
+                             uint64_t *indices) {
+    if (order < 1 || order > HILBERT_MAX_ORDER) return -1;
+    size_t width = hilbert_key_width(order, base);
+    for (size_t i = 0; i < count; i++) {
+        if (hilbert_key_decode(order, base, &keys[i * width], width, &indices[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+// state of the prefixes of a rectangle
+struct key_prefix_state {
+    int order;
+    enum hilbert_key_base base;
+    int width;
+    char *out;
+    size_t max;
+    size_t num;
+};
+
+// the prefix of 'length' characters of the key of an index
+static void key_prefix_emit(struct key_prefix_state *state, uint64_t index, int length) {
+    if (state->num < state->max) {
+        char *out = &state->out[state->num * (size_t) (state->width + 1)];
+        key_write(index, length, state->width, key_bits[state->base], key_padding(state->order, state->base), out);
+        out[length] = '\0';
+    }
+    state->num++;
+}
+
+// splits a range of indices into the fewest blocks that are whole prefixes, each of them as large as the
+// alignment of where it starts and what is left of the range allow. dropping 'dropped' characters of a key leaves
+// a block of 2^(bits * dropped - padding) indices
+static void key_prefix_span(struct key_prefix_state *state, struct hilbert_span span) {
+    int bits = key_bits[state->base], padding = key_padding(state->order, state->base);
+    uint64_t first = span.first, end = span.first + span.count;
+    while (first < end) {
+        int dropped = 0;
+        uint64_t size = 1;
+        while (dropped < state->width) {
+            uint64_t next = (uint64_t) 1 << (bits * (dropped + 1) - padding);
+            if (first % next != 0 || end - first < next) break;
+            dropped++;
+            size = next;
+        }
+        key_prefix_emit(state, first, state->width - dropped);
+        first += size;
+    }
+}
+
+// writes the fewest prefixes that the keys of the cells of a rectangle (inclusive, clamped to the grid) and no
+// others start with, in the order of the curve, into 'out' as records of hilbert_key_width + 1 bytes, each a
+// terminated prefix. at most 'max' are written, and the number of prefixes there are is returned either way, or
+// -1 for an order out of range
+size_t hilbert_key_prefixes(int order, enum hilbert_key_base base, uint32_t x0, uint32_t y0, uint32_t x1,
+                            uint32_t y1, char *out, size_t max) {
+    if (order < 1 || order > HILBERT_MAX_ORDER) return (size_t) -1;
+    struct key_prefix_state state = {order, base, (int) hilbert_key_width(order, base), out, max, 0};
+
+    // the rectangle as ranges of indices first, a bounded number at a time
+    struct hilbert_span spans[256];
+    size_t num_spans = hilbert_decompose(order, x0, y0, x1, y1, spans, 256);
+    if (num_spans <= 256) {
+        for (size_t s = 0; s < num_spans; s++) key_prefix_span(&state, spans[s]);
+        return state.num;
+    }
+    struct hilbert_span *all = (struct hilbert_span *) malloc(num_spans * sizeof(struct hilbert_span));
+    assert(all != NULL);
+    hilbert_decompose(order, x0, y0, x1, y1, all, num_spans);
+    for (size_t s = 0; s < num_spans; s++) key_prefix_span(&state, all[s]);
+    free(all);
+    return state.num;
+}
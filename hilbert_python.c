@@ -0,0 +1,339 @@
+/*
+ * hilbert_python.c - Python extension module of the curve generator and keys
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * Built as the 'hilbert' module when cmake is configured with -DHILBERT_PYTHON=ON. Every function writes its
+ * results straight into a buffer through the buffer protocol: either a writable buffer passed as 'out' (a
+ * NumPy array, a bytearray, anything C contiguous of the right type and size) or a new memoryview of shape
+ * (n, 2) or (n,), which numpy.asarray wraps without copying. The GIL is released while the C code runs on every
+ * thread, so other Python threads keep going.
+ *
+ *     import hilbert, numpy
+ *     points = numpy.asarray(hilbert.curve(10))                  # float64, shape (1048576, 2)
+ *     cells = numpy.empty((1000, 2), numpy.uint32)
+ *     hilbert.decode(16, numpy.arange(1000, dtype=numpy.uint64), out=cells)
+ *     indices = numpy.asarray(hilbert.encode(16, cells))         # uint64, shape (1000,)
+ *
+ * SEGMENTS:
+ *  Buffers - Checking buffers of the caller and making new ones
+ *  Batches - Keys converted on every thread
+ *  Module - The functions of the module
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "hilbert.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* BUFFERS */
+
+// smallest batch of keys worth a thread of its own
+#define PYTHON_MIN_BATCH ((size_t) 1 << 16)
+
+static const char *dtype_names[] = {"f8", "f4", "u2", "u4"};
+// struct module formats of the dtypes, which is what new buffers get
+static const char *dtype_formats[] = {"d", "f", "H", "I"};
+
+static int parse_dtype(const char *name, enum hilbert_dtype *dtype) {
+    for (int d = 0; d < (int) (sizeof(dtype_names) / sizeof(dtype_names[0])); d++) {
+        if (strcmp(name, dtype_names[d]) == 0) {
+            *dtype = (enum hilbert_dtype) d;
+            return 0;
+        }
+    }
+    PyErr_Format(PyExc_ValueError, "unknown dtype '%s', expected f8, f4, u2 or u4", name);
+    return -1;
+}
+
+static int check_order(int order) {
+    if (order >= 1 && order <= HILBERT_MAX_ORDER) return 0;
+    PyErr_Format(PyExc_ValueError, "order %d is out of range, expected 1 to %d", order, HILBERT_MAX_ORDER);
+    return -1;
+}
+
+// whether a buffer holds items of a kind ('f' for floating point, 'u' for unsigned) and size
+// the format is checked by size and kind, since NumPy and the struct module name the same types differently
+static int buffer_matches(const Py_buffer *view, char kind, Py_ssize_t itemsize) {
+    const char *format = view->format != NULL ? view->format : "B";
+    if (*format == '@' || *format == '=' || *format == '<') format++;
+    if (strlen(format) != 1 || view->itemsize != itemsize) return 0;
+    return strchr(kind == 'f' ? "efd" : "BHILQN", *format) != NULL;
+}
+
+// gets a buffer of the caller, C contiguous and writable if 'writable', of exactly 'len' items of a kind
+// and size, or of any number of them with 'len' set to -1. returns -1 with a Python exception set otherwise
+static int get_buffer(PyObject *obj, Py_buffer *view, int writable, char kind, Py_ssize_t itemsize, Py_ssize_t len,
+                      const char *name) {
+    if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0)) != 0) {
+        return -1;
+    }
+    if (!buffer_matches(view, kind, itemsize)) {
+        PyErr_Format(PyExc_TypeError, "%s has to hold %s of %zd bytes", name,
+                     kind == 'f' ? "floats" : "unsigned integers", itemsize);
+        PyBuffer_Release(view);
+        return -1;
+    }
+    if (len >= 0 && view->len != len * itemsize) {
+        PyErr_Format(PyExc_ValueError, "%s has %zd items instead of %zd", name, view->len / itemsize, len);
+        PyBuffer_Release(view);
+        return -1;
+    }
+    return 0;
+}
+
+// makes a new memoryview of 'rows' rows of 'columns' items in a struct module format
+static PyObject *new_buffer(const char *format, Py_ssize_t itemsize, Py_ssize_t rows, Py_ssize_t columns) {
+    PyObject *bytes = PyByteArray_FromStringAndSize(NULL, rows * columns * itemsize);
+    if (bytes == NULL) return NULL;
+    PyObject *raw = PyMemoryView_FromObject(bytes);
+    Py_DECREF(bytes);
+    if (raw == NULL) return NULL;
+    PyObject *shape = columns == 1 ? Py_BuildValue("(n)", rows) : Py_BuildValue("(nn)", rows, columns);
+    PyObject *view = shape != NULL ? PyObject_CallMethod(raw, "cast", "sO", format, shape) : NULL;
+    Py_XDECREF(shape);
+    Py_DECREF(raw);
+    return view;
+}
+
+// the writable buffer that results go into, either 'out' or a new memoryview returned through 'result'
+static int get_output(PyObject *out, Py_buffer *view, PyObject **result, char kind, const char *format,
+                      Py_ssize_t itemsize, Py_ssize_t rows, Py_ssize_t columns) {
+    if (out == NULL || out == Py_None) {
+        *result = new_buffer(format, itemsize, rows, columns);
+        out = *result;
+    } else {
+        Py_INCREF(out);
+        *result = out;
+    }
+    if (*result == NULL) return -1;
+    if (get_buffer(out, view, 1, kind, itemsize, rows * columns, "out") != 0) {
+        Py_CLEAR(*result);
+        return -1;
+    }
+    return 0;
+}
+
+/* BATCHES */
+
+// state shared between the threads converting a batch of keys
+struct python_batch {
+    int order;
+    int encode; // cells to indices, otherwise indices to cells
+    const void *in;
+    void *out;
+    size_t count;
+    int threads;
+    int invalid; // set atomically by any thread that finds a key outside of the curve
+};
+
+struct python_part {
+    struct python_batch *batch;
+    int part;
+};
+
+static void *batch_thread(void *arg) {
+    struct python_part *part = (struct python_part *) arg;
+    struct python_batch *batch = part->batch;
+    size_t first = batch->count / batch->threads * part->part;
+    size_t last = part->part == batch->threads - 1 ? batch->count : batch->count / batch->threads * (part->part + 1);
+    uint64_t num_points = HILBERT_NUM_POINTS(batch->order);
+    uint32_t last_cell = (uint32_t) (((uint64_t) 1 << batch->order) - 1);
+
+    if (batch->encode) {
+        const uint32_t *cells = (const uint32_t *) batch->in;
+        uint64_t *indices = (uint64_t *) batch->out;
+        for (size_t i = first; i < last; i++) {
+            if (cells[2 * i] > last_cell || cells[2 * i + 1] > last_cell) {
+                __atomic_store_n(&batch->invalid, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            indices[i] = hilbert_index(batch->order, cells[2 * i], cells[2 * i + 1]);
+        }
+    } else {
+        const uint64_t *indices = (const uint64_t *) batch->in;
+        uint32_t *cells = (uint32_t *) batch->out;
+        for (size_t i = first; i < last; i++) {
+            if (indices[i] >= num_points) {
+                __atomic_store_n(&batch->invalid, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            hilbert_cell(batch->order, (size_t) indices[i], &cells[2 * i], &cells[2 * i + 1]);
+        }
+    }
+    return NULL;
+}
+
+// converts a batch on 'threads' threads (0 for one per core), returns -1 if any key is outside of the curve
+static int run_batch(struct python_batch *batch, int threads) {
+    if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if ((size_t) threads > batch->count / PYTHON_MIN_BATCH) threads = (int) (batch->count / PYTHON_MIN_BATCH);
+    if (threads <= 0) threads = 1;
+    batch->threads = threads;
+
+    pthread_t *workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    struct python_part *parts = (struct python_part *) malloc(threads * sizeof(struct python_part));
+    assert(workers != NULL && parts != NULL);
+    for (int t = 0; t < threads; t++) {
+        parts[t].batch = batch;
+        parts[t].part = t;
+    }
+    int started = 1;
+    while (started < threads && pthread_create(&workers[started], NULL, batch_thread, &parts[started]) == 0) started++;
+    // the calling thread takes the first part itself, and every part that didn't get a thread
+    batch_thread(&parts[0]);
+    for (int t = started; t < threads; t++) batch_thread(&parts[t]);
+    for (int t = 1; t < started; t++) pthread_join(workers[t], NULL);
+    free(workers);
+    free(parts);
+    return __atomic_load_n(&batch->invalid, __ATOMIC_RELAXED) ? -1 : 0;
+}
+
+/* MODULE */
+
+static PyObject *python_range(int order, unsigned long long first, unsigned long long count, const char *dtype_name,
+                              int threads, PyObject *out) {
+    enum hilbert_dtype dtype;
+    if (check_order(order) != 0 || parse_dtype(dtype_name, &dtype) != 0) return NULL;
+    if (hilbert_range_dtype(order, dtype, 0, 0, NULL) != 0) {
+        PyErr_Format(PyExc_ValueError, "dtype %s can't hold the points of order %d", dtype_name, order);
+        return NULL;
+    }
+    uint64_t num_points = HILBERT_NUM_POINTS(order);
+    if (first > num_points || count > num_points - first || count > (uint64_t) PY_SSIZE_T_MAX / 16) {
+        PyErr_Format(PyExc_ValueError, "range %llu + %llu is past the %llu points of order %d", first, count,
+                     (unsigned long long) num_points, order);
+        return NULL;
+    }
+
+    Py_buffer view;
+    PyObject *result;
+    Py_ssize_t itemsize = (Py_ssize_t) hilbert_dtype_size(dtype);
+    char kind = dtype == HILBERT_DTYPE_F8 || dtype == HILBERT_DTYPE_F4 ? 'f' : 'u';
+    if (get_output(out, &view, &result, kind, dtype_formats[dtype], itemsize, (Py_ssize_t) count, 2) != 0) return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    hilbert_range_dtype_threads(order, dtype, (size_t) first, (size_t) count, threads, view.buf);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    return result;
+}
+
+static PyObject *hilbert_py_curve(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"order", "dtype", "threads", "out", NULL};
+    int order, threads = 0;
+    const char *dtype = "f8";
+    PyObject *out = NULL;
+    (void) self;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i|$siO", keywords, &order, &dtype, &threads, &out)) return NULL;
+    if (check_order(order) != 0) return NULL;
+    return python_range(order, 0, HILBERT_NUM_POINTS(order), dtype, threads, out);
+}
+
+static PyObject *hilbert_py_range(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"order", "first", "count", "dtype", "threads", "out", NULL};
+    int order, threads = 0;
+    unsigned long long first, count;
+    const char *dtype = "f8";
+    PyObject *out = NULL;
+    (void) self;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "iKK|$siO", keywords, &order, &first, &count, &dtype, &threads,
+                                     &out)) {
+        return NULL;
+    }
+    return python_range(order, first, count, dtype, threads, out);
+}
+
+static PyObject *python_batch(PyObject *args, PyObject *kwargs, int encode) {
+    static char *keywords[] = {"order", "keys", "threads", "out", NULL};
+    int order, threads = 0;
+    PyObject *keys, *out = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "iO|$iO", keywords, &order, &keys, &threads, &out)) return NULL;
+    if (check_order(order) != 0) return NULL;
+
+    // cells come in pairs of uint32, indices are uint64
+    Py_buffer in, view;
+    if (get_buffer(keys, &in, 0, 'u', encode ? 4 : 8, -1, encode ? "cells" : "indices") != 0) return NULL;
+    if (encode && in.len % 8 != 0) {
+        PyErr_SetString(PyExc_ValueError, "cells have to come in x, y pairs");
+        PyBuffer_Release(&in);
+        return NULL;
+    }
+    Py_ssize_t count = in.len / 8;
+    PyObject *result;
+    if (get_output(out, &view, &result, 'u', encode ? "Q" : "I", encode ? 8 : 4, count, encode ? 1 : 2) != 0) {
+        PyBuffer_Release(&in);
+        return NULL;
+    }
+
+    struct python_batch batch = {order, encode, in.buf, view.buf, (size_t) count, 0, 0};
+    int failed;
+    Py_BEGIN_ALLOW_THREADS
+    failed = run_batch(&batch, threads);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&in);
+    PyBuffer_Release(&view);
+    if (failed) {
+        PyErr_Format(PyExc_ValueError, "%s outside of the curve of order %d", encode ? "cells" : "indices", order);
+        Py_DECREF(result);
+        return NULL;
+    }
+    return result;
+}
+
+static PyObject *hilbert_py_encode(PyObject *self, PyObject *args, PyObject *kwargs) {
+    (void) self;
+    return python_batch(args, kwargs, 1);
+}
+
+static PyObject *hilbert_py_decode(PyObject *self, PyObject *args, PyObject *kwargs) {
+    (void) self;
+    return python_batch(args, kwargs, 0);
+}
+
+static PyObject *hilbert_py_num_points(PyObject *self, PyObject *args) {
+    int order;
+    (void) self;
+    if (!PyArg_ParseTuple(args, "i", &order) || check_order(order) != 0) return NULL;
+    return PyLong_FromUnsignedLongLong(HILBERT_NUM_POINTS(order));
+}
+
+static PyMethodDef hilbert_methods[] = {
+        {"curve", (PyCFunction) (void (*)(void)) hilbert_py_curve, METH_VARARGS | METH_KEYWORDS,
+                "curve(order, *, dtype='f8', threads=0, out=None)\n"
+                "Every point of a curve as (x, y) rows of f8 or f4 points, or u2 or u4 cells"},
+        {"range", (PyCFunction) (void (*)(void)) hilbert_py_range, METH_VARARGS | METH_KEYWORDS,
+                "range(order, first, count, *, dtype='f8', threads=0, out=None)\n"
+                "'count' points of a curve starting at index 'first', like curve()"},
+        {"encode", (PyCFunction) (void (*)(void)) hilbert_py_encode, METH_VARARGS | METH_KEYWORDS,
+                "encode(order, cells, *, threads=0, out=None)\n"
+                "The uint64 index of every uint32 (x, y) cell"},
+        {"decode", (PyCFunction) (void (*)(void)) hilbert_py_decode, METH_VARARGS | METH_KEYWORDS,
+                "decode(order, indices, *, threads=0, out=None)\n"
+                "The uint32 (x, y) cell of every uint64 index"},
+        {"num_points", hilbert_py_num_points, METH_VARARGS,
+                "num_points(order)\nThe number of points of a curve"},
+        {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef hilbert_module = {
+        PyModuleDef_HEAD_INIT, "hilbert",
+        "Pseudo-hilbert curves and keys, written straight into buffers such as NumPy arrays", -1, hilbert_methods,
+        NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit_hilbert(void) {
+    PyObject *module = PyModule_Create(&hilbert_module);
+    if (module == NULL) return NULL;
+    if (PyModule_AddIntConstant(module, "MAX_ORDER", HILBERT_MAX_ORDER) != 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
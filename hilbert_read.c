@@ -0,0 +1,521 @@
+/*
+ * hilbert_read.c - Reading pseudo-hilbert curve files back
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * Curve files are memory mapped and used in place. Raw files from write_hilbert_curve and f8 npy files are
+ * already arrays of space_vec2, and every format can hand out its coordinates as strided columns without
+ * copying them. Anything that isn't stored as doubles is decoded in batches into buffers given by the caller,
+ * including delta files, which have no columns and are decoded block by block.
+ *
+ * Everything read from a file is checked against the size of the mapping before it is used, so a truncated
+ * or corrupt file makes hilbert_file_open fail instead of reading out of bounds
+*/
+
+#include "hilbert.h"
+
+#include <stdlib.h>
+#include <memory.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* HILBERT CURVE INPUT */
+
+// a record batch of an arrow file, or a block of a delta file
+struct hilbert_file_batch {
+    size_t first; // index of the first row in the batch
+    size_t rows;
+    const uint8_t *x, *y; // values of the columns, a delta block only has its encoded bytes in x
+    size_t size; // bytes of a delta block
+};
+
+static const size_t dtype_sizes[] = {
+        [HILBERT_DTYPE_F8] = 8,
+        [HILBERT_DTYPE_F4] = 4,
+        [HILBERT_DTYPE_U2] = 2,
+        [HILBERT_DTYPE_U4] = 4,
+};
+
+static int host_is_little_endian(void) {
+    const uint16_t probe = 1;
+    return *(const uint8_t *) &probe == 1;
+}
+
+// finds the order of a curve with 'num_points' points, or 0 if it isn't a power of 4
+static int order_of(size_t num_points) {
+    for (int order = 1; order <= HILBERT_MAX_ORDER; order++) {
+        if (HILBERT_NUM_POINTS(order) == num_points) return order;
+    }
+    return 0;
+}
+
+/* NPY */
+
+// parses the header of an npy file, returns 0 if it is an [N, 2] array that we can read
+static int open_npy(struct hilbert_file *file) {
+    static const char *descrs[] = {
+            [HILBERT_DTYPE_F8] = "f8",
+            [HILBERT_DTYPE_F4] = "f4",
+            [HILBERT_DTYPE_U2] = "u2",
+            [HILBERT_DTYPE_U4] = "u4",
+    };
+    if (file->map_size < 10) return -1;
+
+    // version 1 has a 2 byte header length, versions 2 and 3 have 4 bytes
+    const uint8_t *map = file->map;
+    size_t header_len, start;
+    if (map[6] == 1) {
+        header_len = map[8] | (size_t) map[9] << 8;
+        start = 10;
+    } else if ((map[6] == 2 || map[6] == 3) && file->map_size >= 12) {
+        header_len = map[8] | (size_t) map[9] << 8 | (size_t) map[10] << 16 | (size_t) map[11] << 24;
+        start = 12;
+    } else {
+        return -1;
+    }
+    if (header_len > file->map_size - start || header_len > 65536) return -1;
+
+    char header[65537];
+    memcpy(header, &map[start], header_len);
+    header[header_len] = '\0';
+
+    // the dictionary is python syntax, but every writer produces something close to what numpy does
+    const char *descr = strstr(header, "'descr':");
+    const char *fortran = strstr(header, "'fortran_order':");
+    const char *shape = strstr(header, "'shape':");
+    if (descr == NULL || fortran == NULL || shape == NULL) return -1;
+
+    descr = strchr(descr + 8, '\'');
+    if (descr == NULL) return -1;
+    char order_char = descr[1];
+    if (order_char != (host_is_little_endian() ? '<' : '>') && order_char != '|') return -1;
+    size_t d;
+    for (d = 0; d < sizeof(descrs) / sizeof(descrs[0]); d++) {
+        if (strncmp(&descr[2], descrs[d], 2) == 0 && descr[4] == '\'') break;
+    }
+    if (d == sizeof(descrs) / sizeof(descrs[0])) return -1;
+    file->dtype = (enum hilbert_dtype) d;
+
+    fortran += 16;
+    while (*fortran == ' ') fortran++;
+    if (strncmp(fortran, "False", 5) != 0) return -1;
+
+    unsigned long long rows, cols;
+    if (sscanf(shape + 8, " (%llu , %llu )", &rows, &cols) != 2 || cols != 2) return -1;
+
+    size_t size = dtype_sizes[file->dtype];
+    file->data = &map[start + header_len];
+    file->num_points = (size_t) rows;
+    if (file->num_points > (file->map_size - start - header_len) / (2 * size)) return -1;
+    if ((uintptr_t) file->data % size != 0) return -1;
+    return 0;
+}
+
+/* ARROW */
+
+// the footer and messages of arrow files are flatbuffers, these read them with bounds checks
+struct fb_reader {
+    const uint8_t *buf;
+    size_t len;
+};
+
+static int fb_u32(const struct fb_reader *fb, size_t pos, uint32_t *out) {
+    if (pos > fb->len || fb->len - pos < 4) return -1;
+    memcpy(out, &fb->buf[pos], 4);
+    return 0;
+}
+
+// finds where field 'id' of the table at 'table' is stored, 0 if it isn't present
+static size_t fb_field(const struct fb_reader *fb, size_t table, int id) {
+    uint32_t soffset;
+    if (fb_u32(fb, table, &soffset) != 0) return 0;
+    size_t vtable = table - (size_t) (int64_t) (int32_t) soffset;
+    if (vtable > fb->len || fb->len - vtable < 4) return 0;
+
+    uint16_t vtable_size, off;
+    memcpy(&vtable_size, &fb->buf[vtable], 2);
+    if ((size_t) 4 + 2 * id + 2 > vtable_size || vtable + 4 + 2 * id + 2 > fb->len) return 0;
+    memcpy(&off, &fb->buf[vtable + 4 + 2 * id], 2);
+    if (off == 0 || table + off > fb->len) return 0;
+    return table + off;
+}
+
+// reads a scalar field, keeping 'out' as the default when it isn't present
+static int fb_scalar(const struct fb_reader *fb, size_t table, int id, void *out, size_t size) {
+    size_t pos = fb_field(fb, table, id);
+    if (pos == 0) return 0;
+    if (fb->len - pos < size) return -1;
+    memcpy(out, &fb->buf[pos], size);
+    return 0;
+}
+
+// follows a reference field to the table, vector or string it points at, 0 if it isn't present
+static size_t fb_ref(const struct fb_reader *fb, size_t pos) {
+    uint32_t off;
+    if (pos == 0 || fb_u32(fb, pos, &off) != 0 || off > fb->len - pos) return 0;
+    return pos + off;
+}
+
+// finds a vector field, its length goes into 'count', returns the position of the first element or 0
+static size_t fb_vector(const struct fb_reader *fb, size_t table, int id, size_t elem_size, uint32_t *count) {
+    size_t vec = fb_ref(fb, fb_field(fb, table, id));
+    if (vec == 0 || fb_u32(fb, vec, count) != 0) return 0;
+    if (*count > (fb->len - vec - 4) / elem_size) return 0;
+    return vec + 4;
+}
+
+// checks that the schema has 'x' and 'y' columns of the same type that we can read
+static int arrow_schema(struct hilbert_file *file, const struct fb_reader *fb, size_t schema) {
+    uint32_t num_fields;
+    size_t fields = fb_vector(fb, schema, 1, 4, &num_fields);
+    if (fields == 0 || num_fields != 2) return -1;
+
+    for (uint32_t i = 0; i < 2; i++) {
+        size_t field = fb_ref(fb, fields + 4 * i);
+        if (field == 0) return -1;
+
+        uint8_t type_type = 0;
+        if (fb_scalar(fb, field, 2, &type_type, 1) != 0) return -1;
+        size_t type = fb_ref(fb, fb_field(fb, field, 3));
+        if (type == 0) return -1;
+
+        enum hilbert_dtype dtype;
+        if (type_type == 3) { // FloatingPoint
+            int16_t precision = 0;
+            if (fb_scalar(fb, type, 0, &precision, 2) != 0) return -1;
+            if (precision == 2) dtype = HILBERT_DTYPE_F8;
+            else if (precision == 1) dtype = HILBERT_DTYPE_F4;
+            else return -1;
+        } else if (type_type == 2) { // Int
+            int32_t bit_width = 0;
+            uint8_t is_signed = 0;
+            if (fb_scalar(fb, type, 0, &bit_width, 4) != 0 || fb_scalar(fb, type, 1, &is_signed, 1) != 0) return -1;
+            if (is_signed) return -1;
+            if (bit_width == 16) dtype = HILBERT_DTYPE_U2;
+            else if (bit_width == 32) dtype = HILBERT_DTYPE_U4;
+            else return -1;
+        } else {
+            return -1;
+        }
+
+        if (i == 0) file->dtype = dtype;
+        else if (dtype != file->dtype) return -1;
+    }
+    return 0;
+}
+
+// finds the columns of the record batch described by an arrow Block
+static int arrow_batch(struct hilbert_file *file, const uint8_t *block, struct hilbert_file_batch *out) {
+    int64_t offset, body_length;
+    int32_t meta_length;
+    memcpy(&offset, &block[0], 8);
+    memcpy(&meta_length, &block[8], 4);
+    memcpy(&body_length, &block[16], 8);
+    if (offset < 8 || meta_length < 8 || body_length < 0) return -1;
+    // each length is checked against what is left of the file, so that nothing from the file can overflow a sum
+    if ((uint64_t) offset > file->map_size || (uint64_t) meta_length > file->map_size - (uint64_t) offset ||
+        (uint64_t) body_length > file->map_size - (uint64_t) offset - (uint64_t) meta_length) {
+        return -1;
+    }
+
+    // messages start with a continuation marker, older files go straight to the length
+    const uint8_t *msg = &file->map[offset];
+    uint32_t marker;
+    memcpy(&marker, msg, 4);
+    size_t prefix = marker == 0xffffffffu ? 8 : 4;
+    struct fb_reader fb = {&msg[prefix], (size_t) meta_length - prefix};
+
+    uint32_t root;
+    uint8_t header_type = 0;
+    if (fb_u32(&fb, 0, &root) != 0 || root >= fb.len) return -1;
+    if (fb_scalar(&fb, root, 1, &header_type, 1) != 0 || header_type != 3) return -1; // RecordBatch
+    size_t batch = fb_ref(&fb, fb_field(&fb, root, 2));
+    if (batch == 0 || fb_field(&fb, batch, 3) != 0) return -1; // compressed bodies are not supported
+
+    int64_t rows = 0;
+    uint32_t num_nodes, num_buffers;
+    if (fb_scalar(&fb, batch, 0, &rows, 8) != 0 || rows < 0) return -1;
+    size_t nodes = fb_vector(&fb, batch, 1, 16, &num_nodes);
+    size_t buffers = fb_vector(&fb, batch, 2, 16, &num_buffers);
+    if (nodes == 0 || buffers == 0 || num_nodes != 2 || num_buffers != 4) return -1;
+
+    const uint8_t *body = &file->map[offset + meta_length];
+    size_t size = dtype_sizes[file->dtype];
+    const uint8_t *columns[2];
+    for (int i = 0; i < 2; i++) {
+        int64_t node[2], values[2];
+        memcpy(node, &fb.buf[nodes + 16 * i], 16);
+        memcpy(values, &fb.buf[buffers + 16 * (2 * i + 1)], 16);
+        if (node[0] != rows || node[1] != 0) return -1; // no nulls
+        // rows and both values come from the file, so they are compared by division and subtraction
+        if (values[0] < 0 || values[1] < 0 || values[1] / (int64_t) size < rows || values[1] > body_length ||
+            values[0] > body_length - values[1]) {
+            return -1;
+        }
+        columns[i] = &body[values[0]];
+        if ((uintptr_t) columns[i] % size != 0) return -1;
+    }
+
+    out->rows = (size_t) rows;
+    out->x = columns[0];
+    out->y = columns[1];
+    return 0;
+}
+
+// reads the footer of an arrow file, then the metadata of every record batch
+static int open_arrow(struct hilbert_file *file) {
+    const uint8_t *map = file->map;
+    size_t size = file->map_size;
+    if (size < 8 + 10 || memcmp(&map[size - 6], "ARROW1", 6) != 0) return -1;
+
+    int32_t footer_len;
+    memcpy(&footer_len, &map[size - 10], 4);
+    if (footer_len <= 0 || (size_t) footer_len > size - 8 - 10) return -1;
+    struct fb_reader fb = {&map[size - 10 - footer_len], (size_t) footer_len};
+
+    uint32_t root;
+    if (fb_u32(&fb, 0, &root) != 0 || root >= fb.len) return -1;
+    size_t schema = fb_ref(&fb, fb_field(&fb, root, 1));
+    if (schema == 0 || arrow_schema(file, &fb, schema) != 0) return -1;
+
+    uint32_t num_blocks;
+    size_t blocks = fb_vector(&fb, root, 3, 24, &num_blocks);
+    if (blocks == 0 && num_blocks != 0) return -1;
+
+    file->batches = (struct hilbert_file_batch *) malloc((num_blocks + 1) * sizeof(struct hilbert_file_batch));
+    if (file->batches == NULL) return -1;
+    file->num_batches = num_blocks;
+    file->num_points = 0;
+    for (uint32_t i = 0; i < num_blocks; i++) {
+        if (arrow_batch(file, &fb.buf[blocks + 24 * i], &file->batches[i]) != 0) return -1;
+        file->batches[i].first = file->num_points;
+        file->num_points += file->batches[i].rows;
+    }
+    return 0;
+}
+
+/* DELTA */
+
+static uint64_t get_u64(const uint8_t *in) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = v << 8 | in[i];
+    return v;
+}
+
+// reads the header, footer and block index of a delta file
+static int open_delta(struct hilbert_file *file) {
+    const uint8_t *map = file->map;
+    size_t size = file->map_size;
+    if (size < 16 + 24 || memcmp(&map[size - 8], "HILBDLT1", 8) != 0) return -1;
+
+    uint32_t order = map[8] | (uint32_t) map[9] << 8 | (uint32_t) map[10] << 16 | (uint32_t) map[11] << 24;
+    uint32_t block_points = map[12] | (uint32_t) map[13] << 8 | (uint32_t) map[14] << 16 | (uint32_t) map[15] << 24;
+    uint64_t num_points = get_u64(&map[size - 24]);
+    uint64_t index = get_u64(&map[size - 16]);
+    if (order < 1 || order > HILBERT_MAX_ORDER || block_points == 0 || num_points > HILBERT_NUM_POINTS(order)) {
+        return -1;
+    }
+
+    // the index sits between the last block and the footer
+    uint64_t num_blocks = (num_points + block_points - 1) / block_points;
+    if (index < 16 || index > size - 24 || (size - 24 - index) / 8 != num_blocks) return -1;
+
+    file->batches = (struct hilbert_file_batch *) malloc((num_blocks + 1) * sizeof(struct hilbert_file_batch));
+    if (file->batches == NULL) return -1;
+    file->num_batches = (size_t) num_blocks;
+    file->num_points = (size_t) num_points;
+    file->order = (int) order;
+    file->dtype = HILBERT_DTYPE_U4;
+
+    for (size_t b = 0; b < file->num_batches; b++) {
+        uint64_t start = get_u64(&map[index + 8 * b]);
+        uint64_t end = b + 1 < file->num_batches ? get_u64(&map[index + 8 * (b + 1)]) : index;
+        if (start < 16 || start > end || end > index) return -1;
+
+        struct hilbert_file_batch *batch = &file->batches[b];
+        batch->first = b * (size_t) block_points;
+        batch->rows = num_points - batch->first < block_points ? num_points - batch->first : block_points;
+        batch->x = batch->y = &map[start];
+        batch->size = (size_t) (end - start);
+    }
+    return 0;
+}
+
+/* FILES */
+
+// maps a curve file, telling raw, npy and arrow files apart by their magic
+// returns 0 on success, or -1 with errno set (EINVAL when the file isn't a valid curve file)
+int hilbert_file_open(struct hilbert_file *file, const char *path) {
+    memset(file, 0, sizeof(struct hilbert_file));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    file->map_size = (size_t) st.st_size;
+
+    // empty files can't be mapped, and aren't curves anyway
+    if (file->map_size == 0) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    void *map = mmap(NULL, file->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    file->map = (const uint8_t *) map;
+
+    int result;
+    if (file->map_size >= 6 && memcmp(file->map, "\x93NUMPY", 6) == 0) {
+        file->format = HILBERT_FILE_NPY;
+        result = open_npy(file);
+    } else if (file->map_size >= 6 && memcmp(file->map, "ARROW1", 6) == 0) {
+        file->format = HILBERT_FILE_ARROW;
+        result = open_arrow(file);
+    } else if (file->map_size >= 8 && memcmp(file->map, "HILBDLT1", 8) == 0) {
+        file->format = HILBERT_FILE_DELTA;
+        result = open_delta(file);
+    } else {
+        // anything else is an array of space_vec2 like write_hilbert_curve writes
+        file->format = HILBERT_FILE_RAW;
+        file->dtype = HILBERT_DTYPE_F8;
+        file->data = file->map;
+        file->num_points = file->map_size / sizeof(struct space_vec2);
+        result = file->map_size % sizeof(struct space_vec2) == 0 ? 0 : -1;
+    }
+    if (result != 0) {
+        hilbert_file_close(file);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (file->format != HILBERT_FILE_DELTA) file->order = order_of(file->num_points);
+    if (file->format != HILBERT_FILE_ARROW && file->dtype == HILBERT_DTYPE_F8) {
+        file->points = (const struct space_vec2 *) file->data;
+    }
+    return 0;
+}
+
+// unmaps a curve file
+void hilbert_file_close(struct hilbert_file *file) {
+    if (file->map != NULL) munmap((void *) file->map, file->map_size);
+    free(file->batches);
+    memset(file, 0, sizeof(struct hilbert_file));
+}
+
+// tells the kernel how the file is going to be read
+void hilbert_file_advise(const struct hilbert_file *file, enum hilbert_access access) {
+    static const int advice[] = {
+            [HILBERT_ACCESS_NORMAL] = MADV_NORMAL,
+            [HILBERT_ACCESS_SEQUENTIAL] = MADV_SEQUENTIAL,
+            [HILBERT_ACCESS_RANDOM] = MADV_RANDOM,
+            [HILBERT_ACCESS_WILLNEED] = MADV_WILLNEED,
+    };
+    madvise((void *) file->map, file->map_size, advice[access]);
+}
+
+// binary search for the record batch or delta block that holds row 'first'
+static const struct hilbert_file_batch *find_batch(const struct hilbert_file *file, size_t first) {
+    size_t lo = 0, hi = file->num_batches;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (file->batches[mid].first <= first) lo = mid;
+        else hi = mid;
+    }
+    return &file->batches[lo];
+}
+
+// finds the rows starting at 'first' that are stored one after the other, without copying anything
+// returns the number of rows in the view, 0 when 'first' is past the end of the file or the file is delta encoded
+size_t hilbert_file_columns(const struct hilbert_file *file, size_t first, struct hilbert_columns *out) {
+    size_t size = dtype_sizes[file->dtype];
+    memset(out, 0, sizeof(struct hilbert_columns));
+    if (first >= file->num_points || file->format == HILBERT_FILE_DELTA) return 0;
+
+    if (file->format != HILBERT_FILE_ARROW) {
+        // rows of (x, y) pairs
+        out->x = &file->data[first * 2 * size];
+        out->y = &file->data[first * 2 * size + size];
+        out->stride = 2 * size;
+        out->len = file->num_points - first;
+        return out->len;
+    }
+
+    const struct hilbert_file_batch *batch = find_batch(file, first);
+    out->x = &batch->x[(first - batch->first) * size];
+    out->y = &batch->y[(first - batch->first) * size];
+    out->stride = size;
+    out->len = batch->rows - (first - batch->first);
+    return out->len;
+}
+
+// reads one coordinate of a dtype as a point coordinate, 'half_cell' turns integer cells into cell centers
+static space_pos_t decode_coord(const uint8_t *in, enum hilbert_dtype dtype, space_pos_t half_cell) {
+    switch (dtype) {
+        case HILBERT_DTYPE_F4: {
+            float v;
+            memcpy(&v, in, sizeof(v));
+            return (space_pos_t) v;
+        }
+        case HILBERT_DTYPE_U2: {
+            uint16_t v;
+            memcpy(&v, in, sizeof(v));
+            return (2 * (space_pos_t) v + 1) * half_cell;
+        }
+        case HILBERT_DTYPE_U4: {
+            uint32_t v;
+            memcpy(&v, in, sizeof(v));
+            return (2 * (space_pos_t) v + 1) * half_cell;
+        }
+        default: {
+            double v;
+            memcpy(&v, in, sizeof(v));
+            return (space_pos_t) v;
+        }
+    }
+}
+
+// decodes up to 'count' points starting at 'first' into 'out', whatever the file stores them as
+// returns the number of points decoded, or -1 if the file has integer cells but isn't a complete curve,
+// or a delta block is corrupt
+size_t hilbert_file_decode(const struct hilbert_file *file, size_t first, size_t count, struct space_vec2 *out) {
+    if ((file->dtype == HILBERT_DTYPE_U2 || file->dtype == HILBERT_DTYPE_U4) && file->order == 0) return -1;
+    space_pos_t half_cell = (space_pos_t) 1 / (space_pos_t) ((uint64_t) 2 << file->order);
+
+    size_t done = 0;
+    if (file->format == HILBERT_FILE_DELTA) {
+        // every block has to be decoded from its start, the points before 'first' are skipped
+        while (done < count && first + done < file->num_points) {
+            const struct hilbert_file_batch *block = find_batch(file, first + done);
+            size_t skip = first + done - block->first;
+            size_t len = block->rows - skip < count - done ? block->rows - skip : count - done;
+            if (hilbert_delta_decode(file->order, block->x, block->size, skip, len, &out[done]) != len) return -1;
+            done += len;
+        }
+        return done;
+    }
+
+    struct hilbert_columns cols;
+    while (done < count && hilbert_file_columns(file, first + done, &cols) != 0) {
+        size_t len = cols.len < count - done ? cols.len : count - done;
+        if (file->points != NULL) {
+            memcpy(&out[done], &file->points[first + done], len * sizeof(struct space_vec2));
+        } else {
+            const uint8_t *x = (const uint8_t *) cols.x, *y = (const uint8_t *) cols.y;
+            for (size_t i = 0; i < len; i++) {
+                out[done + i].x = decode_coord(&x[i * cols.stride], file->dtype, half_cell);
+                out[done + i].y = decode_coord(&y[i * cols.stride], file->dtype, half_cell);
+            }
+        }
+        done += len;
+    }
+    return done;
+}
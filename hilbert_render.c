@@ -0,0 +1,376 @@
+/*
+ * hilbert_render.c - Streaming raster images of pseudo-hilbert curves
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * The image is rendered in horizontal bands of rows, and only a few bands are held in memory at once.
+ * Worker threads each take the next band to render, and the calling thread writes finished bands to the
+ * stream in order, so memory use only depends on the width of the image and the number of threads.
+ *
+ * Every band walks the curve from the top level down, skipping the blocks of the curve whose square
+ * doesn't touch the band and painting blocks that fit inside a single pixel without visiting their points.
+ * This keeps the work per band proportional to the pixels in it rather than the points in the curve
+*/
+
+#include "hilbert.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* HILBERT CURVE RENDER */
+
+#define RENDER_DEFAULT_BAND_ROWS 16
+
+// a band of rows of the image, every row starts with a png filter byte (always 0) followed by rgb pixels
+struct render_band {
+    const struct hilbert_render_options *options;
+    size_t num_points;
+    uint32_t row; // first row of the image in this band
+    uint32_t rows; // number of rows in this band
+    size_t stride; // bytes in one row, including the filter byte
+    uint8_t *data;
+};
+
+// finds the pixel that the center of a cell falls into, along one axis of the image
+static uint32_t render_pixel(int order, uint32_t cell, uint32_t size) {
+    return (uint32_t) (((2 * (uint64_t) cell + 1) * size) >> (order + 1));
+}
+
+// paints one pixel of a band with the color of the point at 'index'
+static void render_plot(struct render_band *band, int64_t px, int64_t py, size_t index) {
+    if (py < band->row || py >= (int64_t) band->row + band->rows) return;
+    uint8_t *pixel = &band->data[(size_t) (py - band->row) * band->stride + 1 + (size_t) px * 3];
+
+    if (!band->options->gradient) {
+        pixel[0] = pixel[1] = pixel[2] = 0;
+        return;
+    }
+
+    // walk the hue circle once over the whole curve, in 6 * 256 steps
+    unsigned hue = (unsigned) ((double) index / (double) band->num_points * 1536.0);
+    unsigned ramp = hue & 255;
+    uint8_t r, g, b;
+    switch (hue >> 8) {
+        case 0: r = 255; g = ramp; b = 0; break;
+        case 1: r = 255 - ramp; g = 255; b = 0; break;
+        case 2: r = 0; g = 255; b = ramp; break;
+        case 3: r = 0; g = 255 - ramp; b = 255; break;
+        case 4: r = ramp; g = 0; b = 255; break;
+        default: r = 255; g = 0; b = 255 - ramp; break;
+    }
+    pixel[0] = r;
+    pixel[1] = g;
+    pixel[2] = b;
+}
+
+// draws a line between two pixels with bresenham's algorithm, only the part inside the band is painted
+static void render_line(struct render_band *band, int64_t x0, int64_t y0, int64_t x1, int64_t y1, size_t index) {
+    // nothing to do if the whole line is above or below the band
+    int64_t top = band->row, bottom = (int64_t) band->row + band->rows;
+    if ((y0 < top && y1 < top) || (y0 >= bottom && y1 >= bottom)) return;
+
+    int64_t dx = x1 > x0 ? x1 - x0 : x0 - x1, sx = x0 < x1 ? 1 : -1;
+    int64_t dy = y1 > y0 ? y0 - y1 : y1 - y0, sy = y0 < y1 ? 1 : -1;
+    int64_t err = dx + dy;
+    for (;;) {
+        render_plot(band, x0, y0, index);
+        if (x0 == x1 && y0 == y1) break;
+        int64_t e2 = 2 * err;
+        if (e2 >= dy) {
+            err += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y0 += sy;
+        }
+    }
+}
+
+// renders the part of a block of 4^level points starting at 'base' that falls inside the band
+// 'connected' is set when the line from the previous point into 'base' was already drawn
+static void render_block(struct render_band *band, int level, size_t base, int connected) {
+    const struct hilbert_render_options *options = band->options;
+    int order = options->order;
+    uint32_t cx, cy;
+    hilbert_cell(order, base, &cx, &cy);
+    int64_t px = render_pixel(order, cx, options->width), py = render_pixel(order, cy, options->height);
+
+    // the line coming in from the previous point can leave the square of this block
+    if (!connected) {
+        if (base == 0) {
+            render_plot(band, px, py, base);
+        } else {
+            uint32_t prev_x, prev_y;
+            hilbert_cell(order, base - 1, &prev_x, &prev_y);
+            render_line(band, render_pixel(order, prev_x, options->width),
+                        render_pixel(order, prev_y, options->height), px, py, base);
+        }
+    }
+    if (level == 0) return;
+
+    // every other line of this block stays inside its square, which starts at the aligned cell
+    uint32_t mask = ((uint32_t) 1 << level) - 1;
+    uint32_t top = render_pixel(order, cy & ~mask, options->height);
+    uint32_t bottom = render_pixel(order, cy | mask, options->height);
+    if (bottom < band->row || top >= band->row + band->rows) return;
+
+    // the whole block falls into a single pixel, so paint it with the color of its middle point
+    uint32_t left = render_pixel(order, cx & ~mask, options->width);
+    uint32_t right = render_pixel(order, cx | mask, options->width);
+    if (top == bottom && left == right) {
+        render_plot(band, left, top, base + (HILBERT_NUM_POINTS(level) >> 1));
+        return;
+    }
+
+    size_t quadrant_points = HILBERT_NUM_POINTS(level - 1);
+    for (size_t q = 0; q < 4; q++) render_block(band, level - 1, base + q * quadrant_points, q == 0);
+}
+
+/* PNG OUTPUT */
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) crc = crc_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static void put_be32(uint8_t *buf, uint32_t val) {
+    buf[0] = (uint8_t) (val >> 24);
+    buf[1] = (uint8_t) (val >> 16);
+    buf[2] = (uint8_t) (val >> 8);
+    buf[3] = (uint8_t) val;
+}
+
+// writes a complete png chunk
+static void png_chunk(FILE *fp, const char *type, const uint8_t *data, uint32_t len) {
+    uint8_t head[8], tail[4];
+    put_be32(head, len);
+    memcpy(&head[4], type, 4);
+    uint32_t crc = crc_update(0xffffffffu, &head[4], 4);
+    crc = crc_update(crc, data, len) ^ 0xffffffffu;
+    put_be32(tail, crc);
+
+    fwrite(head, 1, 8, fp);
+    if (len > 0) fwrite(data, 1, len, fp); // IEND has no data
+    fwrite(tail, 1, 4, fp);
+}
+
+// png image data is a zlib stream, which is written with uncompressed (stored) deflate blocks
+// so that every band can be turned into its own IDAT chunk without holding the rest of the image
+struct png_stream {
+    uint32_t adler_a, adler_b;
+    uint8_t *chunk; // buffer for one IDAT chunk
+};
+
+// writes one band as an IDAT chunk, the first band starts the zlib stream and the last one ends it
+static void png_band(struct png_stream *png, const struct render_band *band, int first, int last, FILE *fp) {
+    static const size_t max_block = 65535; // largest stored deflate block
+    const uint8_t *data = band->data;
+    size_t len = (size_t) band->rows * band->stride;
+    size_t out = 0;
+
+    if (first) {
+        png->chunk[out++] = 0x78; // deflate with a 32K window
+        png->chunk[out++] = 0x01; // no preset dictionary, lowest compression level
+    }
+
+    for (size_t done = 0; done < len;) {
+        size_t block = len - done > max_block ? max_block : len - done;
+        png->chunk[out++] = last && done + block == len; // BFINAL, BTYPE = stored
+        png->chunk[out++] = (uint8_t) block;
+        png->chunk[out++] = (uint8_t) (block >> 8);
+        png->chunk[out++] = (uint8_t) ~block;
+        png->chunk[out++] = (uint8_t) (~block >> 8);
+        memcpy(&png->chunk[out], &data[done], block);
+        out += block;
+
+        // the adler32 sums only need to be reduced every 5552 bytes to not overflow
+        for (size_t i = done; i < done + block;) {
+            size_t end = i + 5552 < done + block ? i + 5552 : done + block;
+            for (; i < end; i++) {
+                png->adler_a += data[i];
+                png->adler_b += png->adler_a;
+            }
+            png->adler_a %= 65521;
+            png->adler_b %= 65521;
+        }
+        done += block;
+    }
+
+    if (last) {
+        put_be32(&png->chunk[out], (png->adler_b << 16) | png->adler_a);
+        out += 4;
+    }
+    png_chunk(fp, "IDAT", png->chunk, (uint32_t) out);
+}
+
+/* RENDER THREADS */
+
+// state shared between the render threads and the writer
+struct render_job {
+    const struct hilbert_render_options *options;
+    uint32_t num_bands;
+
+    struct render_band *slots; // ring of bands, band b is rendered into slot b % num_slots
+    int *ready; // set when the band in a slot is finished and not yet written
+    uint32_t num_slots;
+    uint32_t next_band; // next band that a thread should render
+    uint32_t written; // number of bands written so far
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+// renders band 'b' of the image into its slot
+static void render_band(struct render_job *job, uint32_t b) {
+    const struct hilbert_render_options *options = job->options;
+    struct render_band *band = &job->slots[b % job->num_slots];
+    band->row = b * options->band_rows;
+    band->rows = options->height - band->row < options->band_rows ? options->height - band->row : options->band_rows;
+    memset(band->data, 255, (size_t) band->rows * band->stride);
+    for (uint32_t r = 0; r < band->rows; r++) band->data[r * band->stride] = 0; // png filter type "none"
+    render_block(band, options->order, 0, 0);
+}
+
+static void *render_thread(void *arg) {
+    struct render_job *job = (struct render_job *) arg;
+
+    pthread_mutex_lock(&job->lock);
+    for (;;) {
+        uint32_t b = job->next_band;
+        if (b >= job->num_bands) break;
+        job->next_band++;
+
+        // wait for the writer to free the slot we are about to render into
+        while (b >= job->written + job->num_slots) pthread_cond_wait(&job->changed, &job->lock);
+        pthread_mutex_unlock(&job->lock);
+
+        render_band(job, b);
+
+        pthread_mutex_lock(&job->lock);
+        job->ready[b % job->num_slots] = 1;
+        pthread_cond_broadcast(&job->changed);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+// renders a curve into an image and writes it to a stream
+// returns 0 on success and -1 with errno set on invalid options (EINVAL) or a failed write
+int hilbert_render(const struct hilbert_render_options *options, FILE *fp) {
+    if (options->order < 1 || options->order > HILBERT_MAX_ORDER ||
+        options->width < 1 || options->width > HILBERT_RENDER_MAX_SIZE ||
+        options->height < 1 || options->height > HILBERT_RENDER_MAX_SIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // fill in the defaults
+    struct hilbert_render_options opts = *options;
+    if (opts.band_rows == 0) opts.band_rows = RENDER_DEFAULT_BAND_ROWS;
+    if (opts.threads <= 0) opts.threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (opts.threads <= 0) opts.threads = 1;
+
+    struct render_job job;
+    job.options = &opts;
+    job.num_bands = (opts.height + opts.band_rows - 1) / opts.band_rows;
+    job.num_slots = (uint32_t) opts.threads * 2;
+    job.next_band = 0;
+    job.written = 0;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.changed, NULL);
+
+    size_t stride = 1 + (size_t) opts.width * 3;
+    job.slots = (struct render_band *) malloc(job.num_slots * sizeof(struct render_band));
+    job.ready = (int *) calloc(job.num_slots, sizeof(int));
+    assert(job.slots != NULL && job.ready != NULL);
+    for (uint32_t i = 0; i < job.num_slots; i++) {
+        job.slots[i].options = &opts;
+        job.slots[i].num_points = HILBERT_NUM_POINTS(opts.order);
+        job.slots[i].stride = stride;
+        job.slots[i].data = (uint8_t *) malloc(opts.band_rows * stride);
+        assert(job.slots[i].data != NULL);
+    }
+
+    // headers go out before any band is finished
+    struct png_stream png = {1, 0, NULL};
+    if (opts.format == HILBERT_IMAGE_PNG) {
+        static const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        uint8_t ihdr[13];
+        put_be32(&ihdr[0], opts.width);
+        put_be32(&ihdr[4], opts.height);
+        ihdr[8] = 8; // bit depth
+        ihdr[9] = 2; // truecolor
+        ihdr[10] = ihdr[11] = ihdr[12] = 0; // deflate, adaptive filtering, no interlace
+
+        pthread_once(&crc_table_once, crc_table_init);
+        fwrite(signature, 1, sizeof(signature), fp);
+        png_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+
+        // room for the zlib header, the adler32 and a 5 byte header for every stored block
+        size_t band_bytes = opts.band_rows * stride;
+        png.chunk = (uint8_t *) malloc(band_bytes + (band_bytes / 65535 + 1) * 5 + 6);
+        assert(png.chunk != NULL);
+    } else {
+        fprintf(fp, "P6\n%u %u\n255\n", (unsigned) opts.width, (unsigned) opts.height);
+    }
+
+    pthread_t *threads = (pthread_t *) malloc(opts.threads * sizeof(pthread_t));
+    assert(threads != NULL);
+    int started = 0;
+    while (started < opts.threads && pthread_create(&threads[started], NULL, render_thread, &job) == 0) started++;
+
+    // write every band as soon as it is done, in order, and render it first when no thread could be started
+    for (uint32_t b = 0; b < job.num_bands; b++) {
+        uint32_t slot = b % job.num_slots;
+        if (started == 0) render_band(&job, b);
+        pthread_mutex_lock(&job.lock);
+        while (started > 0 && !job.ready[slot]) pthread_cond_wait(&job.changed, &job.lock);
+        pthread_mutex_unlock(&job.lock);
+
+        struct render_band *band = &job.slots[slot];
+        if (opts.format == HILBERT_IMAGE_PNG) {
+            png_band(&png, band, b == 0, b + 1 == job.num_bands, fp);
+        } else {
+            for (uint32_t r = 0; r < band->rows; r++) fwrite(&band->data[r * stride + 1], 1, stride - 1, fp);
+        }
+
+        pthread_mutex_lock(&job.lock);
+        job.ready[slot] = 0;
+        job.written++;
+        pthread_cond_broadcast(&job.changed);
+        pthread_mutex_unlock(&job.lock);
+    }
+
+    for (int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+    if (opts.format == HILBERT_IMAGE_PNG) png_chunk(fp, "IEND", NULL, 0);
+    fflush(fp);
+
+    // cleanup
+    free(threads);
+    free(png.chunk);
+    for (uint32_t i = 0; i < job.num_slots; i++) free(job.slots[i].data);
+    free(job.slots);
+    free(job.ready);
+    pthread_cond_destroy(&job.changed);
+    pthread_mutex_destroy(&job.lock);
+    // writes are buffered, so a failed one only shows up in the error flag of the stream
+    return ferror(fp) ? -1 : 0;
+}
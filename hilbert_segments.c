@@ -0,0 +1,75 @@
+/*
+ * hilbert_segments.c - Straight runs of pseudo-hilbert curves
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * Most consecutive points of a curve continue in the same direction as the step before them.
+ * Renderers and plotters only need the points where the direction changes, so this walks the curve
+ * a block of cells at a time with hilbert_range_fixed and merges every run of equal steps into a single segment.
+ * The jumps between quadrants of the pseudo-hilbert curve are segments like any other step
+*/
+
+#include "hilbert.h"
+
+/* HILBERT CURVE SEGMENTS */
+
+// finds the cell of the point at 'index', generating the block of cells from 'index' on when it isn't held yet
+static void segment_cell(struct hilbert_segment_iter *iter, size_t index, uint32_t *x, uint32_t *y) {
+    if (index - iter->block_first >= iter->block_len) {
+        size_t len = iter->num_points - index;
+        if (len > HILBERT_SEGMENT_BLOCK) len = HILBERT_SEGMENT_BLOCK;
+        hilbert_range_fixed(iter->order, index, len, iter->block);
+        iter->block_first = index;
+        iter->block_len = len;
+    }
+    // the numerators of a cell center are 2 * cell + 1
+    *x = (uint32_t) (iter->block[index - iter->block_first].x >> 1);
+    *y = (uint32_t) (iter->block[index - iter->block_first].y >> 1);
+}
+
+// starts walking the segments of a curve of a certain order, returns -1 if the order isn't supported
+int hilbert_segments_begin(struct hilbert_segment_iter *iter, int order) {
+    if (order < 1 || order > HILBERT_MAX_ORDER) return -1;
+
+    iter->order = order;
+    iter->index = 0;
+    iter->num_points = HILBERT_NUM_POINTS(order);
+    iter->block_first = 0;
+    iter->block_len = 0;
+    segment_cell(iter, 0, &iter->x, &iter->y);
+    return 0;
+}
+
+// finds the next segment of the curve, returns 1 if one was found and 0 at the end of the curve
+int hilbert_segments_next(struct hilbert_segment_iter *iter, struct hilbert_segment *out) {
+    // the last point of the curve has no step after it
+    if (iter->index + 1 >= iter->num_points) return 0;
+
+    // the first step decides the direction of the segment
+    uint32_t x, y;
+    segment_cell(iter, iter->index + 1, &x, &y);
+    out->x = iter->x;
+    out->y = iter->y;
+    out->dx = (int32_t) (x - iter->x);
+    out->dy = (int32_t) (y - iter->y);
+    out->length = 1;
+
+    // then keep stepping for as long as the direction stays the same
+    size_t index = iter->index + 1;
+    while (index + 1 < iter->num_points) {
+        uint32_t nx, ny;
+        segment_cell(iter, index + 1, &nx, &ny);
+        if ((int32_t) (nx - x) != out->dx || (int32_t) (ny - y) != out->dy) break;
+        x = nx;
+        y = ny;
+        index++;
+        out->length++;
+    }
+
+    // the end of this segment is where the next one starts
+    iter->index = index;
+    iter->x = x;
+    iter->y = y;
+    return 1;
+}
@@ -0,0 +1,554 @@
+/*
+ * hilbert_service.c - A local daemon that encodes and decodes batches of curve keys for other processes
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * Clients connect to a Unix socket and get a ring of HILBERT_SERVICE_SLOTS slots in shared memory: a memfd that
+ * the server makes for every connection and passes over the socket. A client fills the data of a slot with a
+ * batch, writes the number of the slot to the socket, and the server answers with the same number once the
+ * results are in the slot, in place of the batch. The socket only ever carries slot numbers, so the data is never
+ * copied, and a client can have every slot of its ring in flight at once.
+ *
+ * Every connection belongs to one worker thread, one per core and pinned to it, which waits on all of its
+ * connections with epoll and answers every slot that arrived in one go with a single write. Connections are
+ * handed to the workers through a pipe of their own, so nothing about a connection is ever shared between threads
+ *
+ * SEGMENTS:
+ *  Key Service - The batch operations, the server with its workers and the client
+*/
+
+// for memfd_create, pthread_setaffinity_np and CPU_SET
+#define _GNU_SOURCE
+
+#include "hilbert.h"
+
+#include <stdlib.h>
+#include <memory.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* KEY SERVICE */
+
+// sent with the memfd when a client connects
+#define SERVICE_MAGIC 0x48534b31u // "HSK1"
+// slot numbers read from a connection at once
+#define SERVICE_MAX_BATCH 256
+// events a worker handles per epoll_wait
+#define SERVICE_MAX_EVENTS 64
+
+struct service_hello {
+    uint32_t magic;
+    uint32_t slots;
+    uint64_t slot_bytes;
+};
+
+struct service_conn {
+    int fd;
+    uint8_t *ring;
+    uint8_t partial[4]; // the start of a slot number that was cut off by a read
+    int num_partial;
+    // answers the socket had no room for, nothing more is read from the connection until they are sent
+    uint8_t unsent[4 * SERVICE_MAX_BATCH];
+    size_t num_unsent;
+    struct service_conn *next, *prev; // connections of the worker
+};
+
+struct service_worker {
+    struct hilbert_server *server;
+    int index;
+    pthread_t thread;
+    int epoll;
+    int inbox[2]; // new connections, as pointers
+    struct service_conn *conns;
+};
+
+struct hilbert_server {
+    int listen_fd;
+    int stop[2]; // readable once the server stops, which every worker and the acceptor watch
+    char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    pthread_t acceptor;
+    int num_workers, next_worker;
+    struct service_worker *workers;
+};
+
+struct hilbert_client {
+    int fd;
+    uint8_t *ring;
+    uint8_t partial[4];
+    int num_partial;
+};
+
+// runs the batch of a slot, leaving the results in its data
+// returns the number of results, or -1 for an unknown operation, an order out of range, a batch larger than the
+// slot or an index or cell that isn't in the curve
+static int64_t service_batch(struct hilbert_service_slot *slot) {
+    uint8_t *data = (uint8_t *) slot + sizeof(struct hilbert_service_slot);
+    int order = slot->order;
+    uint64_t count = slot->count;
+    if (order < 1 || order > HILBERT_MAX_ORDER) return -1;
+    uint64_t num_points = HILBERT_NUM_POINTS(order);
+    uint32_t last_cell = (uint32_t) (((uint64_t) 1 << order) - 1);
+
+    switch (slot->op) {
+        case HILBERT_OP_CELLS: {
+            // a cell takes the same 8 bytes as the index it replaces
+            if (count > HILBERT_SERVICE_DATA_BYTES / 8) return -1;
+            for (uint64_t i = 0; i < count; i++) {
+                uint64_t index;
+                uint32_t cell[2];
+                memcpy(&index, &data[8 * i], 8);
+                if (index >= num_points) return -1;
+                hilbert_cell(order, (size_t) index, &cell[0], &cell[1]);
+                memcpy(&data[8 * i], cell, 8);
+            }
+            return (int64_t) count;
+        }
+        case HILBERT_OP_POINTS: {
+            // points are twice the size of indices, so they are made from the back, where point i only covers
+            // indices 2i and 2i + 1 which are already done
+            if (count > HILBERT_SERVICE_DATA_BYTES / sizeof(struct space_vec2)) return -1;
+            for (uint64_t i = 0; i < count; i++) {
+                uint64_t index;
+                memcpy(&index, &data[8 * i], 8);
+                if (index >= num_points) return -1;
+            }
+            for (uint64_t i = count; i-- > 0;) {
+                uint64_t index;
+                memcpy(&index, &data[8 * i], 8);
+                struct space_vec2 point = hilbert_point(order, (size_t) index);
+                memcpy(&data[sizeof(struct space_vec2) * i], &point, sizeof(point));
+            }
+            return (int64_t) count;
+        }
+        case HILBERT_OP_INDICES: {
+            if (count > HILBERT_SERVICE_DATA_BYTES / 8) return -1;
+            for (uint64_t i = 0; i < count; i++) {
+                uint32_t cell[2];
+                memcpy(cell, &data[8 * i], 8);
+                if (cell[0] > last_cell || cell[1] > last_cell) return -1;
+                uint64_t index = hilbert_index(order, cell[0], cell[1]);
+                memcpy(&data[8 * i], &index, 8);
+            }
+            return (int64_t) count;
+        }
+        case HILBERT_OP_DECOMPOSE: {
+            // one rectangle in, as many spans out as the slot holds
+            if (count != 1) return -1;
+            uint32_t rect[4];
+            memcpy(rect, data, sizeof(rect));
+            return (int64_t) hilbert_decompose(order, rect[0], rect[1], rect[2], rect[3], (struct hilbert_span *) data,
+                                               HILBERT_SERVICE_DATA_BYTES / sizeof(struct hilbert_span));
+        }
+    }
+    return -1;
+}
+
+static struct hilbert_service_slot *service_slot(uint8_t *ring, uint32_t slot) {
+    return (struct hilbert_service_slot *) &ring[(size_t) slot * HILBERT_SERVICE_SLOT_BYTES];
+}
+
+static void service_close(struct service_worker *worker, struct service_conn *conn) {
+    epoll_ctl(worker->epoll, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    munmap(conn->ring, HILBERT_SERVICE_SLOTS * HILBERT_SERVICE_SLOT_BYTES);
+    if (conn->prev != NULL) conn->prev->next = conn->next;
+    else worker->conns = conn->next;
+    if (conn->next != NULL) conn->next->prev = conn->prev;
+    free(conn);
+}
+
+// sends the answers that the socket had no room for before, and waits for more room if it still has none
+// returns -1 once the connection is gone
+static int service_flush(struct service_worker *worker, struct service_conn *conn) {
+    size_t done = 0;
+    while (done < conn->num_unsent) {
+        ssize_t n = send(conn->fd, &conn->unsent[done], conn->num_unsent - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) break;
+        if (n <= 0) return -1;
+        done += (size_t) n;
+    }
+    conn->num_unsent -= done;
+    memmove(conn->unsent, &conn->unsent[done], conn->num_unsent);
+
+    // a connection waits either for room to send or for slots to answer, never both
+    struct epoll_event event = {.events = conn->num_unsent ? EPOLLOUT : EPOLLIN, .data.ptr = conn};
+    return epoll_ctl(worker->epoll, EPOLL_CTL_MOD, conn->fd, &event);
+}
+
+// answers every slot that a connection sent since the last time, returns -1 once the connection is gone
+static int service_read(struct service_worker *worker, struct service_conn *conn) {
+    uint8_t buf[4 * SERVICE_MAX_BATCH];
+    memcpy(buf, conn->partial, (size_t) conn->num_partial);
+    ssize_t len = read(conn->fd, &buf[conn->num_partial], sizeof(buf) - (size_t) conn->num_partial);
+    if (len < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+    if (len <= 0) return -1;
+
+    size_t total = (size_t) conn->num_partial + (size_t) len;
+    size_t whole = total / 4 * 4;
+    for (size_t i = 0; i < whole; i += 4) {
+        uint32_t slot;
+        memcpy(&slot, &buf[i], 4);
+        if (slot >= HILBERT_SERVICE_SLOTS) return -1;
+        struct hilbert_service_slot *header = service_slot(conn->ring, slot);
+        HILBERT_TRACE_BEGIN("batch", "count", header->count);
+        header->result = service_batch(header);
+        HILBERT_TRACE_END("batch");
+    }
+    conn->num_partial = (int) (total - whole);
+    memcpy(conn->partial, &buf[whole], (size_t) conn->num_partial);
+
+    // the slot numbers go back as they came, the client matches them up. what the socket has no room for waits
+    // in the connection until it has
+    for (size_t done = 0; done < whole;) {
+        ssize_t n = send(conn->fd, &buf[done], whole - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) {
+            memcpy(conn->unsent, &buf[done], whole - done);
+            conn->num_unsent = whole - done;
+            return service_flush(worker, conn);
+        }
+        if (n <= 0) return -1;
+        done += (size_t) n;
+    }
+    return 0;
+}
+
+static void *service_worker_thread(void *arg) {
+    struct service_worker *worker = (struct service_worker *) arg;
+    struct epoll_event events[SERVICE_MAX_EVENTS];
+
+    for (;;) {
+        int n = epoll_wait(worker->epoll, events, SERVICE_MAX_EVENTS, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+
+        for (int e = 0; e < n; e++) {
+            void *ptr = events[e].data.ptr;
+            if (ptr == worker->server) return NULL; // stopping, the connections are closed by hilbert_server_stop
+            if (ptr == worker) {
+                // a new connection from the acceptor
+                struct service_conn *conn;
+                if (read(worker->inbox[0], &conn, sizeof(conn)) != sizeof(conn)) continue;
+                conn->prev = NULL;
+                conn->next = worker->conns;
+                if (worker->conns != NULL) worker->conns->prev = conn;
+                worker->conns = conn;
+                struct epoll_event event = {.events = EPOLLIN, .data.ptr = conn};
+                if (epoll_ctl(worker->epoll, EPOLL_CTL_ADD, conn->fd, &event) != 0) service_close(worker, conn);
+                continue;
+            }
+            struct service_conn *conn = (struct service_conn *) ptr;
+            int result = conn->num_unsent ? service_flush(worker, conn) : service_read(worker, conn);
+            if (result != 0) service_close(worker, conn);
+        }
+    }
+    return NULL;
+}
+
+// gives a new client its ring and passes it on to a worker
+static void service_accept(struct hilbert_server *server, int fd) {
+    size_t ring_bytes = HILBERT_SERVICE_SLOTS * HILBERT_SERVICE_SLOT_BYTES;
+    int memfd = memfd_create("hilbert_service", MFD_CLOEXEC);
+    if (memfd < 0 || ftruncate(memfd, (off_t) ring_bytes) != 0) {
+        if (memfd >= 0) close(memfd);
+        close(fd);
+        return;
+    }
+    uint8_t *ring = (uint8_t *) mmap(NULL, ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (ring == MAP_FAILED) {
+        close(memfd);
+        close(fd);
+        return;
+    }
+
+    // the ring goes along with the layout, after which the server doesn't need the memfd anymore
+    struct service_hello hello = {SERVICE_MAGIC, HILBERT_SERVICE_SLOTS, HILBERT_SERVICE_SLOT_BYTES};
+    struct iovec iov = {&hello, sizeof(hello)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                         .msg_controllen = sizeof(control.buf)};
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+    ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    close(memfd);
+    if (sent != sizeof(hello)) {
+        munmap(ring, ring_bytes);
+        close(fd);
+        return;
+    }
+
+    struct service_conn *conn = (struct service_conn *) calloc(1, sizeof(struct service_conn));
+    assert(conn != NULL);
+    conn->fd = fd;
+    conn->ring = ring;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    // connections go round the workers, so every core gets its share of the clients
+    struct service_worker *worker = &server->workers[server->next_worker];
+    server->next_worker = (server->next_worker + 1) % server->num_workers;
+    if (write(worker->inbox[1], &conn, sizeof(conn)) != sizeof(conn)) {
+        munmap(ring, ring_bytes);
+        close(fd);
+        free(conn);
+    }
+}
+
+static void *service_accept_thread(void *arg) {
+    struct hilbert_server *server = (struct hilbert_server *) arg;
+    struct pollfd fds[2] = {{server->listen_fd, POLLIN, 0}, {server->stop[0], POLLIN, 0}};
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents) break;
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd >= 0) service_accept(server, fd);
+    }
+    return NULL;
+}
+
+// stops the threads of a server that are running, the first 'started' workers and the acceptor if 'accepting' is
+// set, then closes every connection and everything else the server made and removes its socket
+static void service_destroy(struct hilbert_server *server, int started, int accepting) {
+    char stop = 1;
+    if (started > 0 || accepting) {
+        while (write(server->stop[1], &stop, 1) < 0 && errno == EINTR) continue;
+    }
+    if (accepting) pthread_join(server->acceptor, NULL);
+
+    size_t ring_bytes = HILBERT_SERVICE_SLOTS * HILBERT_SERVICE_SLOT_BYTES;
+    for (int w = 0; w < server->num_workers; w++) {
+        struct service_worker *worker = &server->workers[w];
+        if (w < started) pthread_join(worker->thread, NULL);
+        while (worker->conns != NULL) service_close(worker, worker->conns);
+
+        // connections that were handed to the worker after it stopped
+        struct service_conn *conn;
+        while (worker->inbox[0] >= 0 && read(worker->inbox[0], &conn, sizeof(conn)) == sizeof(conn)) {
+            close(conn->fd);
+            munmap(conn->ring, ring_bytes);
+            free(conn);
+        }
+        if (worker->epoll >= 0) close(worker->epoll);
+        if (worker->inbox[0] >= 0) close(worker->inbox[0]);
+        if (worker->inbox[1] >= 0) close(worker->inbox[1]);
+    }
+    close(server->listen_fd);
+    if (server->stop[0] >= 0) close(server->stop[0]);
+    if (server->stop[1] >= 0) close(server->stop[1]);
+    unlink(server->path);
+    free(server->workers);
+    free(server);
+}
+
+// starts serving batches on a Unix socket at 'path' with 'workers' threads, 0 for one per core
+// returns NULL with errno set if the socket, the pipes and epoll instances or the threads can't be made
+struct hilbert_server *hilbert_server_start(const char *path, int workers) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return NULL;
+    }
+
+    int num_cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus <= 0) num_cpus = 1;
+    if (workers <= 0) workers = num_cpus;
+
+    struct hilbert_server *server = (struct hilbert_server *) calloc(1, sizeof(struct hilbert_server));
+    assert(server != NULL);
+    server->workers = (struct service_worker *) calloc((size_t) workers, sizeof(struct service_worker));
+    assert(server->workers != NULL);
+    server->listen_fd = fd;
+    server->num_workers = workers;
+    server->stop[0] = server->stop[1] = -1;
+    strcpy(server->path, path);
+    for (int w = 0; w < workers; w++) {
+        struct service_worker *worker = &server->workers[w];
+        worker->server = server;
+        worker->index = w;
+        worker->epoll = worker->inbox[0] = worker->inbox[1] = -1;
+    }
+
+    // everything the threads wait on is made before any of them starts. the inboxes don't block, so that a
+    // worker that is behind fails a handover instead of holding up the acceptor
+    int failed = pipe2(server->stop, O_CLOEXEC) != 0;
+    for (int w = 0; w < workers && !failed; w++) {
+        struct service_worker *worker = &server->workers[w];
+        worker->epoll = epoll_create1(EPOLL_CLOEXEC);
+        struct epoll_event stop = {.events = EPOLLIN, .data.ptr = server};
+        struct epoll_event inbox = {.events = EPOLLIN, .data.ptr = worker};
+        failed = worker->epoll < 0 || pipe2(worker->inbox, O_CLOEXEC | O_NONBLOCK) != 0 ||
+                 epoll_ctl(worker->epoll, EPOLL_CTL_ADD, server->stop[0], &stop) != 0 ||
+                 epoll_ctl(worker->epoll, EPOLL_CTL_ADD, worker->inbox[0], &inbox) != 0;
+    }
+
+    int started = 0;
+    for (; started < workers && !failed; started++) {
+        struct service_worker *worker = &server->workers[started];
+        int result = pthread_create(&worker->thread, NULL, service_worker_thread, worker);
+        if (result != 0) {
+            errno = result;
+            failed = 1;
+            break;
+        }
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(started % num_cpus, &cpus);
+        pthread_setaffinity_np(worker->thread, sizeof(cpus), &cpus);
+    }
+    if (!failed) {
+        int result = pthread_create(&server->acceptor, NULL, service_accept_thread, server);
+        if (result == 0) return server;
+        errno = result;
+    }
+
+    int saved = errno;
+    service_destroy(server, started, 0);
+    errno = saved;
+    return NULL;
+}
+
+// stops a server, closing every connection and removing its socket
+void hilbert_server_stop(struct hilbert_server *server) {
+    service_destroy(server, server->num_workers, 1);
+}
+
+// connects to a server and maps the ring it hands out, returns NULL with errno set on failure
+struct hilbert_client *hilbert_client_connect(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return NULL;
+    }
+
+    struct service_hello hello;
+    struct iovec iov = {&hello, sizeof(hello)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                         .msg_controllen = sizeof(control.buf)};
+    ssize_t len = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    int memfd = -1;
+    if (cmsg != NULL && cmsg->cmsg_type == SCM_RIGHTS) memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+
+    // a server of another layout is as good as none
+    uint8_t *ring = MAP_FAILED;
+    size_t ring_bytes = HILBERT_SERVICE_SLOTS * HILBERT_SERVICE_SLOT_BYTES;
+    if (len == sizeof(hello) && memfd >= 0 && hello.magic == SERVICE_MAGIC && hello.slots == HILBERT_SERVICE_SLOTS &&
+        hello.slot_bytes == HILBERT_SERVICE_SLOT_BYTES) {
+        ring = (uint8_t *) mmap(NULL, ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    }
+    if (memfd >= 0) close(memfd);
+    if (ring == MAP_FAILED) {
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    struct hilbert_client *client = (struct hilbert_client *) calloc(1, sizeof(struct hilbert_client));
+    assert(client != NULL);
+    client->fd = fd;
+    client->ring = ring;
+    return client;
+}
+
+// disconnects from a server, every slot of the client goes away with it
+void hilbert_client_close(struct hilbert_client *client) {
+    munmap(client->ring, HILBERT_SERVICE_SLOTS * HILBERT_SERVICE_SLOT_BYTES);
+    close(client->fd);
+    free(client);
+}
+
+// the data of a slot, where a batch goes in and its results come out
+void *hilbert_client_data(struct hilbert_client *client, int slot) {
+    return (uint8_t *) service_slot(client->ring, (uint32_t) slot) + sizeof(struct hilbert_service_slot);
+}
+
+// hands the batch in the data of a slot to the server, returns -1 if the server is gone
+int hilbert_client_submit(struct hilbert_client *client, int slot, enum hilbert_service_op op, int order,
+                          size_t count) {
+    if (slot < 0 || slot >= HILBERT_SERVICE_SLOTS) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct hilbert_service_slot *header = service_slot(client->ring, (uint32_t) slot);
+    header->op = (uint32_t) op;
+    header->order = order;
+    header->count = count;
+    header->result = -1;
+
+    uint32_t num = (uint32_t) slot;
+    for (;;) {
+        ssize_t n = send(client->fd, &num, 4, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        return n == 4 ? 0 : -1;
+    }
+}
+
+// waits for the next batch that the server is done with, whose slot goes into 'slot'
+// returns the result of the batch (see hilbert_service_op), or -1 for a failed batch or a server that is gone
+int64_t hilbert_client_wait(struct hilbert_client *client, int *slot) {
+    while (client->num_partial < 4) {
+        ssize_t n = read(client->fd, &client->partial[client->num_partial], (size_t) (4 - client->num_partial));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        client->num_partial += (int) n;
+    }
+    client->num_partial = 0;
+
+    uint32_t num;
+    memcpy(&num, client->partial, 4);
+    if (num >= HILBERT_SERVICE_SLOTS) return -1;
+    *slot = (int) num;
+    return service_slot(client->ring, num)->result;
+}
+
+// runs a batch and waits for it, which must be the only batch in flight
+int64_t hilbert_client_call(struct hilbert_client *client, int slot, enum hilbert_service_op op, int order,
+                            size_t count) {
+    if (hilbert_client_submit(client, slot, op, order, count) != 0) return -1;
+    int done;
+    return hilbert_client_wait(client, &done);
+}
@@ -0,0 +1,277 @@
+/*
+ * hilbert_shared.c - Curves generated once and shared read only between processes
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * A publisher generates a curve with every thread straight into a memfd, then seals it so that nobody, the
+ * publisher included, can ever write to it or change its size again. The name of a table is a Unix socket: every
+ * process that connects to it is handed the memfd and maps it read only, so however many processes use a table,
+ * its pages are only in memory once, and attaching costs a connect and an mmap instead of generating the curve.
+ *
+ * A table starts with a header of its own, so it can be checked without trusting the publisher, and its
+ * coordinates start 64 bytes in, interleaved x, y in the dtype of the table like hilbert_range_dtype writes them
+ *
+ * SEGMENTS:
+ *  Shared Tables - Publishing sealed tables, and attaching to them
+*/
+
+// for memfd_create and F_ADD_SEALS
+#define _GNU_SOURCE
+
+#include "hilbert.h"
+
+#include <stdlib.h>
+#include <memory.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* SHARED TABLES */
+
+#define SHARED_MAGIC "HILBSHM1"
+// where the coordinates start, after the header
+#define SHARED_DATA_OFFSET 64
+// what an attached table has to be sealed against, so that nobody can change it under the readers
+#define SHARED_SEALS (F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+
+static const char *shared_dtype_names[] = {"f8", "f4", "u2", "u4"};
+
+struct shared_header {
+    char magic[8];
+    uint32_t order;
+    uint32_t dtype;
+    uint64_t num_points;
+};
+
+struct hilbert_publisher {
+    int listen_fd;
+    int memfd;
+    int stop[2];
+    char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    pthread_t acceptor;
+};
+
+// makes the sealed memfd of a table, returns -1 with errno set on failure
+static int shared_create(int order, enum hilbert_dtype dtype, int threads) {
+    size_t num_points = HILBERT_NUM_POINTS(order), point_size = 2 * hilbert_dtype_size(dtype);
+    if (num_points > (SIZE_MAX - SHARED_DATA_OFFSET) / point_size) {
+        errno = ENOMEM;
+        return -1;
+    }
+    size_t size = SHARED_DATA_OFFSET + num_points * point_size;
+
+    char name[32];
+    sprintf(name, "hilbert_o%02d_%s", order, shared_dtype_names[dtype]);
+    int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) return -1;
+    char *map = MAP_FAILED;
+    if (ftruncate(fd, (off_t) size) == 0) map = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    struct shared_header header = {SHARED_MAGIC, (uint32_t) order, (uint32_t) dtype, num_points};
+    memcpy(map, &header, sizeof(header));
+    hilbert_range_dtype_threads(order, dtype, 0, num_points, threads, map + SHARED_DATA_OFFSET);
+
+    // a write seal needs every writable mapping gone first
+    munmap(map, size);
+    if (fcntl(fd, F_ADD_SEALS, SHARED_SEALS) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+// maps a sealed table read only, after checking that it is what its header says
+static int shared_map(int fd, struct hilbert_shared_table *table) {
+    // anything that can't be sealed, such as a regular file, fails to report its seals
+    struct stat st;
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & SHARED_SEALS) != SHARED_SEALS || fstat(fd, &st) != 0) {
+        errno = EPERM;
+        return -1;
+    }
+    size_t size = (size_t) st.st_size;
+    if (size < SHARED_DATA_OFFSET) {
+        errno = EPROTO;
+        return -1;
+    }
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return -1;
+
+    struct shared_header header;
+    memcpy(&header, map, sizeof(header));
+    size_t point_size = 1, data_size = size - SHARED_DATA_OFFSET;
+    if (header.dtype <= HILBERT_DTYPE_U4) point_size = 2 * hilbert_dtype_size((enum hilbert_dtype) header.dtype);
+    if (memcmp(header.magic, SHARED_MAGIC, 8) != 0 || header.order < 1 || header.order > HILBERT_MAX_ORDER ||
+        header.dtype > HILBERT_DTYPE_U4 || header.num_points != HILBERT_NUM_POINTS(header.order) ||
+        data_size % point_size != 0 || data_size / point_size != header.num_points) {
+        munmap(map, size);
+        errno = EPROTO;
+        return -1;
+    }
+    table->order = (int) header.order;
+    table->dtype = (enum hilbert_dtype) header.dtype;
+    table->num_points = header.num_points;
+    table->points = (const char *) map + SHARED_DATA_OFFSET;
+    table->map = map;
+    table->map_bytes = size;
+    return 0;
+}
+
+static void *shared_accept_thread(void *arg) {
+    struct hilbert_publisher *publisher = (struct hilbert_publisher *) arg;
+    struct pollfd fds[2] = {{publisher->listen_fd, POLLIN, 0}, {publisher->stop[0], POLLIN, 0}};
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents) break;
+        int fd = accept(publisher->listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+
+        // the memfd is all a process needs, the connection ends right after
+        char byte = 0;
+        struct iovec iov = {&byte, 1};
+        union {
+            char buf[CMSG_SPACE(sizeof(int))];
+            struct cmsghdr align;
+        } control;
+        struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                             .msg_controllen = sizeof(control.buf)};
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &publisher->memfd, sizeof(int));
+        sendmsg(fd, &msg, MSG_NOSIGNAL);
+        close(fd);
+    }
+    return NULL;
+}
+
+// generates a curve with 'threads' threads (0 for one per core) into a sealed memfd, and hands it to every
+// process that attaches to the Unix socket at 'path'. the publisher can attach to its own table too
+// returns NULL with errno set if the dtype can't hold the order or the memfd, socket or thread can't be made
+struct hilbert_publisher *hilbert_publish_start(const char *path, int order, enum hilbert_dtype dtype, int threads) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (order < 1 || order > HILBERT_MAX_ORDER || hilbert_range_dtype(order, dtype, 0, 0, NULL) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+    int memfd = shared_create(order, dtype, threads);
+    if (memfd < 0) return NULL;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        int saved = errno;
+        if (fd >= 0) close(fd);
+        close(memfd);
+        errno = saved;
+        return NULL;
+    }
+
+    struct hilbert_publisher *publisher = (struct hilbert_publisher *) calloc(1, sizeof(struct hilbert_publisher));
+    assert(publisher != NULL);
+    publisher->listen_fd = fd;
+    publisher->memfd = memfd;
+    strcpy(publisher->path, path);
+    if (pipe2(publisher->stop, O_CLOEXEC) == 0) {
+        int result = pthread_create(&publisher->acceptor, NULL, shared_accept_thread, publisher);
+        if (result == 0) return publisher;
+        close(publisher->stop[0]);
+        close(publisher->stop[1]);
+        errno = result;
+    }
+
+    int saved = errno;
+    close(fd);
+    close(memfd);
+    unlink(path);
+    free(publisher);
+    errno = saved;
+    return NULL;
+}
+
+// stops handing out a table and removes its socket, tables that are already attached stay valid
+void hilbert_publish_stop(struct hilbert_publisher *publisher) {
+    char stop = 1;
+    while (write(publisher->stop[1], &stop, 1) < 0 && errno == EINTR) continue;
+    pthread_join(publisher->acceptor, NULL);
+    close(publisher->listen_fd);
+    close(publisher->memfd);
+    close(publisher->stop[0]);
+    close(publisher->stop[1]);
+    unlink(publisher->path);
+    free(publisher);
+}
+
+// maps the table published at 'path' read only into 'table'
+// returns -1 with errno set if nothing is published there, or EPERM if the table isn't sealed
+int hilbert_shared_attach(const char *path, struct hilbert_shared_table *table) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    char byte;
+    struct iovec iov = {&byte, 1};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                         .msg_controllen = sizeof(control.buf)};
+    ssize_t len = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    close(fd);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (len != 1 || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS) {
+        errno = EPROTO;
+        return -1;
+    }
+    int memfd;
+    memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+
+    int result = shared_map(memfd, table);
+    int saved = errno;
+    close(memfd);
+    errno = saved;
+    return result;
+}
+
+// unmaps an attached table
+void hilbert_shared_detach(struct hilbert_shared_table *table) {
+    munmap(table->map, table->map_bytes);
+    table->map = NULL;
+    table->points = NULL;
+}
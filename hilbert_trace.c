@@ -0,0 +1,138 @@
+/*
+ * hilbert_trace.c - Chrome trace timelines of generation and output
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * Every thread records its begin and end events into a buffer of its own, so recording never takes a lock. A
+ * buffer is made the first time a thread records anything and pushed onto a list of every buffer with a compare
+ * and swap. The list is only walked once every thread is done, by hilbert_trace_write or when the program exits
+ * after hilbert_trace_start, and the events are written as Chrome trace JSON, which chrome://tracing and Perfetto
+ * both open.
+ *
+ * Events are only recorded when the library is built with HILBERT_TRACE (the HILBERT_TRACE option of cmake),
+ * otherwise HILBERT_TRACE_BEGIN and HILBERT_TRACE_END are empty and nothing here is ever called
+*/
+
+#include "hilbert.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+
+/* TRACING */
+
+// events a thread can record, later events of a thread whose buffer is full are dropped and counted
+#define TRACE_BUFFER_EVENTS ((size_t) 1 << 16)
+
+struct trace_event {
+    const char *name;
+    const char *key; // name of the value of a begin event, NULL without one
+    int64_t value;
+    uint64_t ns; // since hilbert_trace_start
+    char phase; // 'B' or 'E'
+};
+
+struct trace_buffer {
+    struct trace_buffer *next;
+    int tid;
+    size_t len;
+    size_t dropped;
+    struct trace_event events[TRACE_BUFFER_EVENTS];
+};
+
+static struct trace_buffer *trace_buffers; // every buffer, pushed with compare and swap
+static int trace_next_tid;
+static int trace_on;
+static uint64_t trace_start_ns;
+static __thread struct trace_buffer *trace_local;
+
+static uint64_t trace_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+// records an event of the calling thread, see HILBERT_TRACE_BEGIN and HILBERT_TRACE_END
+void hilbert_trace_event(const char *name, char phase, const char *key, int64_t value) {
+    if (!__atomic_load_n(&trace_on, __ATOMIC_RELAXED)) return;
+
+    struct trace_buffer *buf = trace_local;
+    if (buf == NULL) {
+        buf = (struct trace_buffer *) malloc(sizeof(struct trace_buffer));
+        assert(buf != NULL);
+        buf->tid = __atomic_fetch_add(&trace_next_tid, 1, __ATOMIC_RELAXED) + 1;
+        buf->len = 0;
+        buf->dropped = 0;
+        buf->next = __atomic_load_n(&trace_buffers, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&trace_buffers, &buf->next, buf, 1, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED));
+        trace_local = buf;
+    }
+
+    if (buf->len == TRACE_BUFFER_EVENTS) {
+        buf->dropped++;
+        return;
+    }
+    struct trace_event *event = &buf->events[buf->len++];
+    event->name = name;
+    event->key = key;
+    event->value = value;
+    event->ns = trace_now() - trace_start_ns;
+    event->phase = phase;
+}
+
+// writes every event recorded so far as Chrome trace JSON, which must only happen once every thread is done
+// returns -1 if the stream failed
+int hilbert_trace_write(FILE *fp) {
+    size_t dropped = 0;
+    fputs("{\"traceEvents\":[\n", fp);
+    int first = 1;
+    for (struct trace_buffer *buf = __atomic_load_n(&trace_buffers, __ATOMIC_ACQUIRE); buf; buf = buf->next) {
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                    "\"args\":{\"name\":\"thread %d\"}}", first ? "" : ",\n", buf->tid, buf->tid);
+        first = 0;
+        for (size_t i = 0; i < buf->len; i++) {
+            const struct trace_event *event = &buf->events[i];
+            // microseconds with the nanoseconds as decimals, which is what the format expects
+            fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":1,\"tid\":%d", event->name,
+                    event->phase, (unsigned long long) (event->ns / 1000), (unsigned) (event->ns % 1000), buf->tid);
+            if (event->key != NULL) fprintf(fp, ",\"args\":{\"%s\":%lld}", event->key, (long long) event->value);
+            fputc('}', fp);
+        }
+        dropped += buf->dropped;
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped_events\":%zu}}\n", dropped);
+    return ferror(fp) ? -1 : 0;
+}
+
+#ifdef HILBERT_TRACE
+static char *trace_path;
+
+static void trace_dump(void) {
+    __atomic_store_n(&trace_on, 0, __ATOMIC_RELAXED);
+    FILE *fp = fopen(trace_path, "w");
+    if (fp == NULL || hilbert_trace_write(fp) != 0) perror(trace_path);
+    if (fp != NULL) fclose(fp);
+}
+#endif
+
+// starts recording events, which are written to the file at 'path' when the program exits
+// returns -1 with errno set to ENOSYS when the library was built without HILBERT_TRACE
+int hilbert_trace_start(const char *path) {
+#ifdef HILBERT_TRACE
+    trace_path = strdup(path);
+    assert(trace_path != NULL);
+    trace_start_ns = trace_now();
+    __atomic_store_n(&trace_on, 1, __ATOMIC_RELEASE);
+    atexit(trace_dump);
+    return 0;
+#else
+    (void) path;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
@@ -0,0 +1,263 @@
+/*
+ * hilbert_validate.c - Checking that curve files hold valid pseudo-hilbert curves
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * A file is checked in chunks of VALIDATE_CHUNK_POINTS by every thread at once, reading the mapping in place
+ * when it holds doubles. Visited cells are marked in a bitmap of one bit per cell with atomic ors, so a cell
+ * that is visited twice is caught whichever threads visit it. The step into the first point of every chunk
+ * can't be checked by the thread that owns the chunk, so every chunk remembers its first and last cell and
+ * those steps are stitched together once all threads are done.
+ *
+ * STEPS:
+ *  hilbert_create never rotates the last quadrant of a block (see hilbert.c), so the curve doesn't always move
+ *  to a neighbouring cell. Entering the last quadrant of a block of 4^k points (an index whose lowest non-zero
+ *  base 4 digit is a 3 at position k >= 1) jumps by (-(2^k - 1), 2^k) or (-2^k, 2^k - 1) instead, and
+ *  every other step moves by exactly one cell
+*/
+
+#include "hilbert.h"
+
+#include <stdlib.h>
+#include <memory.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* HILBERT CURVE VALIDATION */
+
+// number of points checked at once by one thread
+#define VALIDATE_CHUNK_POINTS ((size_t) 1 << 20)
+#define VALIDATE_NONE ((size_t) -1)
+
+// first and last cell of a chunk, for stitching chunks together
+struct validate_chunk {
+    uint32_t first_x, first_y, last_x, last_y;
+    int first_ok, last_ok; // whether the first and last points are cell centers
+};
+
+// state shared between the validating threads
+struct validate_job {
+    const struct hilbert_file *file;
+    int order;
+    size_t num_points;
+    size_t ref_first, ref_last; // points compared with the generator
+    uint64_t *visited; // a bit per cell, indexed by y * 2^order + x
+    struct validate_chunk *chunks;
+    size_t num_chunks;
+    size_t next_chunk;
+
+    struct hilbert_validate_report totals; // counts of every thread, merged under the lock
+    pthread_mutex_t lock;
+};
+
+// finds the cell that a point is the center of, returns 0 if it isn't the center of any cell
+static int validate_cell(space_pos_t val, int order, uint32_t *out) {
+    space_pos_t cells = (space_pos_t) ((uint64_t) 1 << order);
+    if (!(val > 0 && val < 1)) return 0;
+    uint32_t cell = (uint32_t) (val * cells);
+    *out = cell;
+    return val == (2 * (space_pos_t) cell + 1) / (2 * cells);
+}
+
+// checks the step from one cell to the next, which arrives at point 'index'
+static int validate_step(size_t index, uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+    int64_t dx = (int64_t) x1 - x0, dy = (int64_t) y1 - y0;
+
+    // the lowest non-zero base 4 digit of the index tells seams apart from ordinary steps
+    int k = __builtin_ctzll((unsigned long long) index) / 2;
+    if (k >= 1 && (index >> (2 * k) & 3) == 3) {
+        int64_t a = ((int64_t) 1 << k) - 1, b = (int64_t) 1 << k;
+        return (dx == -a && dy == b) || (dx == -b && dy == a);
+    }
+    return (dx == 0 && (dy == 1 || dy == -1)) || (dy == 0 && (dx == 1 || dx == -1));
+}
+
+static void validate_error(struct hilbert_validate_report *report, size_t index) {
+    if (report->first_error == VALIDATE_NONE || index < report->first_error) report->first_error = index;
+}
+
+// checks every point of a chunk against the properties of a curve, counting into 'report'
+static void validate_chunk(struct validate_job *job, size_t chunk, struct space_vec2 *buf, struct space_vec2 *ref,
+                           struct hilbert_validate_report *report) {
+    size_t first = chunk * VALIDATE_CHUNK_POINTS;
+    size_t len = job->num_points - first < VALIDATE_CHUNK_POINTS ? job->num_points - first : VALIDATE_CHUNK_POINTS;
+    uint64_t side = (uint64_t) 1 << job->order;
+    struct validate_chunk *c = &job->chunks[chunk];
+
+    // doubles are checked right in the mapping, anything else is decoded first
+    const struct space_vec2 *points = buf;
+    if (job->file->points != NULL) {
+        points = &job->file->points[first];
+    } else if (hilbert_file_decode(job->file, first, len, buf) != len) {
+        // a corrupt delta block, every point of the chunk is lost
+        report->bad_points += len;
+        validate_error(report, first);
+        c->first_ok = c->last_ok = 0;
+        return;
+    }
+
+    uint32_t px = 0, py = 0;
+    int prev_ok = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint32_t x = 0, y = 0;
+        int ok = validate_cell(points[i].x, job->order, &x) & validate_cell(points[i].y, job->order, &y);
+        if (!ok) {
+            report->bad_points++;
+            validate_error(report, first + i);
+        } else {
+            // mark the cell, and see if someone got there first
+            uint64_t bit = (uint64_t) y * side + x;
+            uint64_t mask = (uint64_t) 1 << (bit & 63);
+            if (__atomic_fetch_or(&job->visited[bit >> 6], mask, __ATOMIC_RELAXED) & mask) {
+                report->repeated++;
+                validate_error(report, first + i);
+            }
+
+            if (i > 0 && prev_ok && !validate_step(first + i, px, py, x, y)) {
+                report->bad_steps++;
+                validate_error(report, first + i);
+            }
+        }
+
+        if (i == 0) {
+            c->first_x = x;
+            c->first_y = y;
+            c->first_ok = ok;
+        }
+        px = x;
+        py = y;
+        prev_ok = ok;
+    }
+    c->last_x = px;
+    c->last_y = py;
+    c->last_ok = prev_ok;
+
+    // compare the part of the chunk that overlaps the reference range with freshly generated points
+    size_t ref_begin = first > job->ref_first ? first : job->ref_first;
+    size_t ref_end = first + len < job->ref_last ? first + len : job->ref_last;
+    if (ref_begin < ref_end) {
+        hilbert_range(job->order, ref_begin, ref_end - ref_begin, ref);
+        for (size_t i = ref_begin; i < ref_end; i++) {
+            if (memcmp(&points[i - first], &ref[i - ref_begin], sizeof(struct space_vec2)) != 0) {
+                report->mismatched++;
+                validate_error(report, i);
+            }
+        }
+    }
+}
+
+static void *validate_thread(void *arg) {
+    struct validate_job *job = (struct validate_job *) arg;
+    struct hilbert_validate_report report;
+    memset(&report, 0, sizeof(report));
+    report.first_error = VALIDATE_NONE;
+
+    // room for decoding points and generating the reference, only when they are needed
+    struct space_vec2 *buf = NULL, *ref = NULL;
+    if (job->file->points == NULL) {
+        buf = (struct space_vec2 *) malloc(VALIDATE_CHUNK_POINTS * sizeof(struct space_vec2));
+        assert(buf != NULL);
+    }
+    if (job->ref_first < job->ref_last) {
+        ref = (struct space_vec2 *) malloc(VALIDATE_CHUNK_POINTS * sizeof(struct space_vec2));
+        assert(ref != NULL);
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t chunk = job->next_chunk++;
+        pthread_mutex_unlock(&job->lock);
+        if (chunk >= job->num_chunks) break;
+
+        validate_chunk(job, chunk, buf, ref, &report);
+    }
+
+    pthread_mutex_lock(&job->lock);
+    job->totals.bad_points += report.bad_points;
+    job->totals.bad_steps += report.bad_steps;
+    job->totals.repeated += report.repeated;
+    job->totals.mismatched += report.mismatched;
+    if (report.first_error != VALIDATE_NONE) validate_error(&job->totals, report.first_error);
+    pthread_mutex_unlock(&job->lock);
+
+    free(buf);
+    free(ref);
+    return NULL;
+}
+
+// checks that a file holds a complete curve: the right number of points, every point the center of a cell,
+// every step the one the generator takes and every cell visited exactly once, and compares the reference range
+// of the options with the generator. returns 0 if the file is valid, otherwise -1 with the problems in 'report'
+int hilbert_validate(const struct hilbert_file *file, const struct hilbert_validate_options *options,
+                     struct hilbert_validate_report *report) {
+    memset(report, 0, sizeof(struct hilbert_validate_report));
+    report->first_error = VALIDATE_NONE;
+    report->num_points = file->num_points;
+    report->order = options->order ? options->order : file->order;
+
+    // the number of points has to be a power of 4, and match the order we were asked for
+    if (file->order == 0 || report->order != file->order) {
+        report->wrong_count = 1;
+        return -1;
+    }
+
+    int threads = options->threads;
+    if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+
+    struct validate_job job;
+    job.file = file;
+    job.order = file->order;
+    job.num_points = file->num_points;
+    job.ref_first = options->ref_first < file->num_points ? options->ref_first : file->num_points;
+    job.ref_last = options->ref_count < file->num_points - job.ref_first ? job.ref_first + options->ref_count
+                                                                          : file->num_points;
+    job.num_chunks = (job.num_points + VALIDATE_CHUNK_POINTS - 1) / VALIDATE_CHUNK_POINTS;
+    job.next_chunk = 0;
+    job.totals = *report;
+    job.visited = (uint64_t *) calloc((job.num_points + 63) / 64, sizeof(uint64_t));
+    job.chunks = (struct validate_chunk *) malloc(job.num_chunks * sizeof(struct validate_chunk));
+    assert(job.visited != NULL && job.chunks != NULL);
+    pthread_mutex_init(&job.lock, NULL);
+
+    hilbert_file_advise(file, HILBERT_ACCESS_SEQUENTIAL);
+    if (threads == 1) {
+        validate_thread(&job);
+    } else {
+        pthread_t *workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+        assert(workers != NULL);
+        int started = 0;
+        while (started < threads && pthread_create(&workers[started], NULL, validate_thread, &job) == 0) started++;
+        // chunks are taken one at a time, so without any thread the calling thread checks them all
+        if (started == 0) validate_thread(&job);
+        for (int t = 0; t < started; t++) pthread_join(workers[t], NULL);
+        free(workers);
+    }
+    pthread_mutex_destroy(&job.lock);
+    *report = job.totals;
+
+    // stitch the chunks together with the steps between them
+    for (size_t c = 1; c < job.num_chunks; c++) {
+        const struct validate_chunk *prev = &job.chunks[c - 1], *next = &job.chunks[c];
+        if (prev->last_ok && next->first_ok &&
+            !validate_step(c * VALIDATE_CHUNK_POINTS, prev->last_x, prev->last_y, next->first_x, next->first_y)) {
+            report->bad_steps++;
+            validate_error(report, c * VALIDATE_CHUNK_POINTS);
+        }
+    }
+
+    // every cell that wasn't visited shows up as a missing bit
+    size_t visited = 0;
+    for (size_t w = 0; w < (job.num_points + 63) / 64; w++) visited += (size_t) __builtin_popcountll(job.visited[w]);
+    report->missing = job.num_points - visited;
+
+    free(job.visited);
+    free(job.chunks);
+
+    int valid = !report->bad_points && !report->bad_steps && !report->repeated && !report->missing &&
+                !report->mismatched;
+    return valid ? 0 : -1;
+}
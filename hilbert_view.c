@@ -0,0 +1,182 @@
+/*
+ * hilbert_view.c - Lazy random access into pseudo-hilbert curves
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * A view never holds the whole curve. Points are decoded with hilbert_range in tiles of
+ * HILBERT_VIEW_TILE_POINTS points, and the most recently used tiles are kept in a fixed size cache.
+ * Lookups go through a small hash table and a doubly linked LRU list, so every access is O(1)
+*/
+
+#include "hilbert.h"
+
+#include <stdlib.h>
+#include <memory.h>
+#include <assert.h>
+
+/* HILBERT CURVE VIEW */
+
+#define VIEW_NONE ((size_t) -1)
+
+// a single decoded tile in the cache
+struct view_slot {
+    size_t tile; // index of the tile held in this slot, VIEW_NONE when empty
+    size_t prev, next; // neighbours in the LRU list (prev is more recently used)
+    size_t chain; // next slot in the same hash bucket
+    struct space_vec2 *points;
+};
+
+struct hilbert_view {
+    int order;
+    size_t num_points;
+
+    struct view_slot *slots;
+    size_t num_slots;
+    size_t head, tail; // most and least recently used slots
+
+    size_t *buckets; // first slot of every hash bucket
+    size_t bucket_mask;
+
+    size_t last; // slot of the last lookup, checked before the hash table
+};
+
+// creates a view of a curve of a certain order using at most (roughly) 'cache_bytes' for decoded tiles
+struct hilbert_view *hilbert_view_create(int order, size_t cache_bytes) {
+    // make sure we got valid input
+    if (order < 1 || order > HILBERT_MAX_ORDER) return NULL;
+
+    struct hilbert_view *view = (struct hilbert_view *) malloc(sizeof(struct hilbert_view));
+    assert(view != NULL);
+    view->order = order;
+    view->num_points = HILBERT_NUM_POINTS(order);
+
+    // there is no point in caching more tiles than the curve has, and we always need at least one
+    size_t tile_size = HILBERT_VIEW_TILE_POINTS * sizeof(struct space_vec2);
+    size_t num_tiles = (view->num_points + HILBERT_VIEW_TILE_POINTS - 1) / HILBERT_VIEW_TILE_POINTS;
+    view->num_slots = cache_bytes / tile_size;
+    if (view->num_slots > num_tiles) view->num_slots = num_tiles;
+    if (view->num_slots < 1) view->num_slots = 1;
+
+    // the hash table gets at least twice as many buckets as slots to keep chains short
+    size_t num_buckets = 2;
+    while (num_buckets < view->num_slots * 2) num_buckets <<= 1;
+    view->bucket_mask = num_buckets - 1;
+    view->buckets = (size_t *) malloc(num_buckets * sizeof(size_t));
+    assert(view->buckets != NULL);
+    for (size_t i = 0; i < num_buckets; i++) view->buckets[i] = VIEW_NONE;
+
+    // every slot starts empty and the LRU list just goes through them in order
+    view->slots = (struct view_slot *) malloc(view->num_slots * sizeof(struct view_slot));
+    assert(view->slots != NULL);
+    for (size_t i = 0; i < view->num_slots; i++) {
+        view->slots[i].tile = VIEW_NONE;
+        view->slots[i].prev = i == 0 ? VIEW_NONE : i - 1;
+        view->slots[i].next = i + 1 == view->num_slots ? VIEW_NONE : i + 1;
+        view->slots[i].chain = VIEW_NONE;
+        view->slots[i].points = NULL; // allocated the first time the slot is used
+    }
+    view->head = 0;
+    view->tail = view->num_slots - 1;
+    view->last = 0;
+
+    return view;
+}
+
+// destroys a view and all of its cached tiles
+void hilbert_view_destroy(struct hilbert_view *view) {
+    if (view == NULL) return;
+    for (size_t i = 0; i < view->num_slots; i++) free(view->slots[i].points);
+    free(view->slots);
+    free(view->buckets);
+    free(view);
+}
+
+// number of points in the curve behind a view
+size_t hilbert_view_size(const struct hilbert_view *view) {
+    return view->num_points;
+}
+
+// moves a slot to the front of the LRU list
+static void view_touch(struct hilbert_view *view, size_t slot) {
+    struct view_slot *s = &view->slots[slot];
+    if (view->head == slot) return;
+
+    // unlink from where it is now (it can't be the head, so prev always exists)
+    view->slots[s->prev].next = s->next;
+    if (s->next != VIEW_NONE) view->slots[s->next].prev = s->prev;
+    else view->tail = s->prev;
+
+    // and link it back in as the head
+    s->prev = VIEW_NONE;
+    s->next = view->head;
+    view->slots[view->head].prev = slot;
+    view->head = slot;
+}
+
+// removes a slot from the hash chain of the tile it currently holds
+static void view_unhash(struct hilbert_view *view, size_t slot) {
+    size_t *link = &view->buckets[view->slots[slot].tile & view->bucket_mask];
+    while (*link != slot) link = &view->slots[*link].chain;
+    *link = view->slots[slot].chain;
+}
+
+// finds the decoded points of a tile, decoding it into the least recently used slot if it isn't cached
+static const struct space_vec2 *view_tile(struct hilbert_view *view, size_t tile) {
+    // fast path for repeated access to the same tile
+    if (view->slots[view->last].tile == tile) return view->slots[view->last].points;
+
+    size_t slot = view->buckets[tile & view->bucket_mask];
+    while (slot != VIEW_NONE && view->slots[slot].tile != tile) slot = view->slots[slot].chain;
+
+    if (slot == VIEW_NONE) {
+        // evict the least recently used tile and decode the new one in its place
+        slot = view->tail;
+        struct view_slot *s = &view->slots[slot];
+        if (s->tile != VIEW_NONE) view_unhash(view, slot);
+        if (s->points == NULL) {
+            s->points = (struct space_vec2 *) malloc(HILBERT_VIEW_TILE_POINTS * sizeof(struct space_vec2));
+            assert(s->points != NULL);
+        }
+
+        // the last tile is shorter than the others for curves smaller than one tile
+        size_t first = tile * HILBERT_VIEW_TILE_POINTS;
+        size_t len = view->num_points - first;
+        if (len > HILBERT_VIEW_TILE_POINTS) len = HILBERT_VIEW_TILE_POINTS;
+        hilbert_range(view->order, first, len, s->points);
+
+        s->tile = tile;
+        s->chain = view->buckets[tile & view->bucket_mask];
+        view->buckets[tile & view->bucket_mask] = slot;
+    }
+
+    view_touch(view, slot);
+    view->last = slot;
+    return view->slots[slot].points;
+}
+
+// finds the point at 'index', returns 0 on success and -1 if the index is out of range
+int hilbert_view_get(struct hilbert_view *view, size_t index, struct space_vec2 *out) {
+    if (index >= view->num_points) return -1;
+    *out = view_tile(view, index / HILBERT_VIEW_TILE_POINTS)[index % HILBERT_VIEW_TILE_POINTS];
+    return 0;
+}
+
+// copies up to 'count' points starting at 'first' into 'out', returns the number of points copied
+size_t hilbert_view_get_range(struct hilbert_view *view, size_t first, size_t count, struct space_vec2 *out) {
+    if (first >= view->num_points) return 0;
+    if (count > view->num_points - first) count = view->num_points - first;
+
+    // copy tile by tile, each tile is decoded at most once
+    size_t done = 0;
+    while (done < count) {
+        size_t index = first + done;
+        size_t offset = index % HILBERT_VIEW_TILE_POINTS;
+        size_t len = HILBERT_VIEW_TILE_POINTS - offset;
+        if (len > count - done) len = count - done;
+
+        memcpy(&out[done], &view_tile(view, index / HILBERT_VIEW_TILE_POINTS)[offset], len * sizeof(struct space_vec2));
+        done += len;
+    }
+    return done;
+}
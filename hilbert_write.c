@@ -0,0 +1,953 @@
+/*
+ * hilbert_write.c - Writing pseudo-hilbert curves to streams
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * Writers either take an array of points made by hilbert_create, or take an order and stream the
+ * points straight from the index based generator so the curve never has to fit in memory.
+ *
+ * The npy and arrow writers are laid out so that readers can mmap the files and use the coordinates
+ * in place: npy data starts on a 64 byte boundary, and every arrow buffer is padded to 64 bytes
+*/
+
+// for fallocate, vmsplice and F_SETPIPE_SZ
+#define _GNU_SOURCE
+
+#include "hilbert.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+/* HILBERT CURVE OUTPUT */
+
+// writes coordinates of a hilbert curve to a stream in binary format
+void write_hilbert_curve(struct space_vec2 *hc, size_t len, FILE *fp) {
+    static size_t max_write = 65536; // amount of element to write in one go
+
+    size_t write_left; // length of array that's left to write
+    size_t to_write; // the length of array to write to the stream
+    for (size_t i = 0; i < len; i += max_write) {
+        // how much length left to write from the hilbert curve
+        write_left = (len - i);
+        // figure out how much we should write this go (branchless)
+        to_write = (write_left > max_write) * max_write +
+                   (write_left <= max_write) * write_left;
+
+        // use the to_write as the length of how much to write
+        HILBERT_TRACE_BEGIN("fwrite", "points", to_write);
+        fwrite(&hc[i], sizeof(struct space_vec2), to_write, fp);
+        HILBERT_TRACE_END("fwrite");
+    }
+    HILBERT_TRACE_BEGIN("fflush", NULL, 0);
+    fflush(fp);
+    HILBERT_TRACE_END("fflush");
+}
+
+// number of points generated and written at once by one thread of write_hilbert_curve_fd, unless a plan says less
+#define POSITIONAL_CHUNK_POINTS ((size_t) 1 << 18)
+
+// state shared between the threads of write_hilbert_curve_fd
+struct positional_job {
+    int order;
+    enum hilbert_dtype dtype; // f8 for space_vec2, f4 for space_vec2f
+    size_t point_size;
+    size_t num_points;
+    int fd;
+    off_t base; // file offset of the first point
+    size_t chunk_points;
+    size_t next_chunk, num_chunks;
+    int error; // errno of a failed write, stored atomically by whichever thread failed, 0 if none did
+    pthread_mutex_t lock;
+};
+
+static void *positional_thread(void *arg) {
+    struct positional_job *job = (struct positional_job *) arg;
+    char *points = (char *) malloc(job->chunk_points * job->point_size);
+    assert(points != NULL);
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t c = job->next_chunk++;
+        pthread_mutex_unlock(&job->lock);
+        // there is no point in writing the rest once a write has failed
+        if (c >= job->num_chunks || __atomic_load_n(&job->error, __ATOMIC_RELAXED) != 0) break;
+
+        // every point is the same size, so the offset of a chunk is known up front
+        size_t first = c * job->chunk_points;
+        size_t count = job->num_points - first < job->chunk_points ? job->num_points - first : job->chunk_points;
+        HILBERT_TRACE_BEGIN("generate", "first", first);
+        hilbert_range_dtype(job->order, job->dtype, first, count, points);
+        HILBERT_TRACE_END("generate");
+
+        const char *data = points;
+        size_t len = count * job->point_size;
+        off_t offset = job->base + (off_t) (first * job->point_size);
+        HILBERT_TRACE_BEGIN("pwrite", "bytes", len);
+        for (size_t done = 0; done < len;) {
+            ssize_t n = pwrite(job->fd, &data[done], len - done, offset + (off_t) done);
+            if (n <= 0) {
+                __atomic_store_n(&job->error, n < 0 ? errno : EIO, __ATOMIC_RELAXED);
+                break;
+            }
+            done += (size_t) n;
+        }
+        HILBERT_TRACE_END("pwrite");
+    }
+
+    free(points);
+    return NULL;
+}
+
+// writes a curve in binary format (points of doubles or floats, by dtype) into a file, see write_hilbert_curve_fd
+// every thread holds one chunk of 'chunk_points' points at a time
+static size_t write_curve_fd(int order, enum hilbert_dtype dtype, int threads, size_t chunk_points, int preallocate,
+                             int fd) {
+    if (order < 1 || order > HILBERT_MAX_ORDER) return -1;
+    if (dtype == HILBERT_DTYPE_F4 && order > HILBERT_FLOAT_MAX_ORDER) return -1;
+
+    struct positional_job job;
+    job.order = order;
+    job.dtype = dtype;
+    job.point_size = 2 * hilbert_dtype_size(dtype);
+    job.num_points = HILBERT_NUM_POINTS(order);
+    job.fd = fd;
+    job.chunk_points = chunk_points;
+    job.next_chunk = 0;
+    job.num_chunks = (job.num_points + chunk_points - 1) / chunk_points;
+    job.error = 0;
+
+    job.base = lseek(fd, 0, SEEK_CUR);
+    if (job.base < 0) return -1;
+    off_t len = (off_t) (job.num_points * job.point_size);
+
+    // allocating everything at once keeps the file contiguous, filesystems that can't do it are skipped
+    if (preallocate && fallocate(fd, 0, job.base, len) != 0 && errno != EOPNOTSUPP) return -1;
+
+    if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_t *workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    assert(workers != NULL);
+    // threads take chunks until there are none left, so fewer threads than asked for only make it slower
+    int started = 0;
+    while (started < threads && pthread_create(&workers[started], NULL, positional_thread, &job) == 0) started++;
+    if (started == 0) positional_thread(&job);
+    for (int t = 0; t < started; t++) pthread_join(workers[t], NULL);
+    free(workers);
+    pthread_mutex_destroy(&job.lock);
+
+    lseek(fd, job.base + len, SEEK_SET);
+    if (job.error != 0) {
+        errno = job.error;
+        return -1;
+    }
+    return job.num_points;
+}
+
+// writes a curve in binary format straight from the generator into a file, starting at the current offset of 'fd'
+// every thread generates its own chunks and writes them with pwrite at the offset they belong at, and with
+// 'preallocate' set the whole file is allocated up front. the offset is moved to the end of what was written
+// returns the number of points written or -1 on invalid input or a failed write or allocation, with errno set for those
+size_t write_hilbert_curve_fd(int order, int threads, int preallocate, int fd) {
+    return write_curve_fd(order, HILBERT_DTYPE_F8, threads, POSITIONAL_CHUNK_POINTS, preallocate, fd);
+}
+
+// the same as write_hilbert_curve_fd with space_vec2f points, returns -1 if floats can't hold the order
+size_t write_hilbert_curve_float_fd(int order, int threads, int preallocate, int fd) {
+    return write_curve_fd(order, HILBERT_DTYPE_F4, threads, POSITIONAL_CHUNK_POINTS, preallocate, fd);
+}
+
+/*
+ * When the output is a pipe, write_hilbert_curve_stream hands the pages of its buffers to the pipe with vmsplice
+ * instead of copying them. The pipe keeps referring to the pages until the reader consumes them, so a buffer
+ * can only be refilled once its data has left the pipe. Two buffers of exactly the pipe capacity guarantee that:
+ * once the second buffer has been spliced completely, the pipe holds nothing but the second buffer, so the first
+ * one is free again. The buffers are mmap'd and unmapped at the end rather than freed, so pages that are still
+ * in the pipe when we return are never handed out again by malloc
+*/
+
+// size of the buffers of write_hilbert_curve_stream when the output is not a pipe
+#define STREAM_WRITE_BYTES ((size_t) 4 << 20)
+// pipe capacity that write_hilbert_curve_stream asks for, the kernel may give less
+#define STREAM_PIPE_BYTES (1 << 20)
+
+// writes all of a buffer with write(), returns -1 on failure
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+// splices all of a buffer into a pipe, returns -1 on failure
+static int splice_all(int fd, char *data, size_t len) {
+    while (len > 0) {
+        struct iovec iov = {data, len};
+        ssize_t n = vmsplice(fd, &iov, 1, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+// writes a curve in binary format (points of doubles or floats, by dtype) to a descriptor, see
+// write_hilbert_curve_stream. each of the two buffers is at most 'max_buf' bytes, a power of two of at least a page
+static size_t write_curve_stream(int order, enum hilbert_dtype dtype, size_t max_buf, int fd) {
+    if (order < 1 || order > HILBERT_MAX_ORDER) return -1;
+    if (dtype == HILBERT_DTYPE_F4 && order > HILBERT_FLOAT_MAX_ORDER) return -1;
+    size_t point_size = 2 * hilbert_dtype_size(dtype);
+
+    // find out if we can splice, and how much the pipe can hold
+    struct stat st;
+    int use_splice = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    size_t buf_size = max_buf;
+    if (use_splice) {
+        // resizing fails above pipe-max-size or with more in the pipe than the new size, and the pipe keeps what
+        // it had. reusing a buffer is only safe when it is as big as the pipe, so a pipe that is still bigger
+        // than 'max_buf' is written to with write() instead of growing the buffers past what was planned
+        fcntl(fd, F_SETPIPE_SZ, STREAM_PIPE_BYTES < max_buf ? STREAM_PIPE_BYTES : (int) max_buf);
+        int capacity = fcntl(fd, F_GETPIPE_SZ);
+        if (capacity > 0 && (size_t) capacity <= max_buf) buf_size = (size_t) capacity;
+        else use_splice = 0;
+    }
+
+    char *bufs[2];
+    for (int i = 0; i < 2; i++) {
+        bufs[i] = (char *) mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(bufs[i] != MAP_FAILED);
+    }
+
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    size_t chunk_points = buf_size / point_size;
+    int failed = 0;
+    for (size_t i = 0, k = 0; i < num_points && !failed; i += chunk_points, k++) {
+        // alternate between the buffers, see above for why that is safe
+        char *buf = bufs[k & 1];
+        size_t count = num_points - i < chunk_points ? num_points - i : chunk_points;
+        HILBERT_TRACE_BEGIN("generate", "first", i);
+        hilbert_range_dtype(order, dtype, i, count, buf);
+        HILBERT_TRACE_END("generate");
+
+        size_t len = count * point_size;
+        HILBERT_TRACE_BEGIN("write", "bytes", len);
+        if (use_splice && splice_all(fd, buf, len) != 0) {
+            // only fall back to write() if nothing was spliced yet, otherwise part of the buffer is in the pipe
+            if (i != 0 || (errno != EINVAL && errno != ENOSYS)) {
+                failed = 1;
+                HILBERT_TRACE_END("write");
+                break;
+            }
+            use_splice = 0;
+        }
+        if (!use_splice && write_all(fd, buf, len) != 0) failed = 1;
+        HILBERT_TRACE_END("write");
+    }
+
+    munmap(bufs[0], buf_size);
+    munmap(bufs[1], buf_size);
+    return failed ? (size_t) -1 : num_points;
+}
+
+// writes a curve in binary format straight from the generator to a pipe, socket or file descriptor
+// pipes are fed with vmsplice so the points are never copied, anything else gets large write() calls
+// returns the number of points written or -1 on invalid input or a failed write
+size_t write_hilbert_curve_stream(int order, int fd) {
+    return write_curve_stream(order, HILBERT_DTYPE_F8, STREAM_WRITE_BYTES, fd);
+}
+
+// the same as write_hilbert_curve_stream with space_vec2f points, returns -1 if floats can't hold the order
+size_t write_hilbert_curve_float_stream(int order, int fd) {
+    return write_curve_stream(order, HILBERT_DTYPE_F4, STREAM_WRITE_BYTES, fd);
+}
+
+/*
+ * A plan picks one of the binary writers above for a memory budget. Files are written by every thread at once,
+ * which is the fastest and only needs a chunk per thread, so the chunks are made smaller first (down to
+ * PLAN_MIN_CHUNK_POINTS, below which the pwrite calls start to cost more than generating) and threads are
+ * dropped after that. Anything that can't seek is either generated whole in parallel and written at once, when
+ * the curve fits, or streamed through two buffers by one thread
+*/
+
+// smallest chunk that a plan gives a thread of write_hilbert_curve_fd
+#define PLAN_MIN_CHUNK_POINTS ((size_t) 4096)
+// smallest buffer of write_hilbert_curve_stream, a page
+#define PLAN_MIN_STREAM_BYTES ((size_t) 4096)
+
+// state shared between the threads generating a range in memory
+struct memory_job {
+    int order;
+    enum hilbert_dtype dtype;
+    size_t point_size;
+    size_t first;
+    size_t count;
+    int threads;
+    char *points;
+};
+
+struct memory_part {
+    struct memory_job *job;
+    int part;
+};
+
+static void *memory_thread(void *arg) {
+    struct memory_part *part = (struct memory_part *) arg;
+    struct memory_job *job = part->job;
+    size_t first = job->count / job->threads * part->part;
+    size_t last = part->part == job->threads - 1 ? job->count : job->count / job->threads * (part->part + 1);
+    HILBERT_TRACE_BEGIN("generate", "first", job->first + first);
+    char *out = &job->points[first * job->point_size];
+    hilbert_range_dtype(job->order, job->dtype, job->first + first, last - first, out);
+    HILBERT_TRACE_END("generate");
+    return NULL;
+}
+
+// hilbert_range_dtype with the range split evenly between 'threads' threads, 0 for one per core
+// returns -1 if the dtype can't hold the order, otherwise 0
+int hilbert_range_dtype_threads(int order, enum hilbert_dtype dtype, size_t first, size_t count, int threads,
+                                void *out) {
+    if (hilbert_range_dtype(order, dtype, first, 0, out) != 0) return -1;
+    if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+    // every thread gets at least a chunk worth starting a thread for
+    if ((size_t) threads > count / PLAN_MIN_CHUNK_POINTS) threads = (int) (count / PLAN_MIN_CHUNK_POINTS);
+    if (threads <= 1) return hilbert_range_dtype(order, dtype, first, count, out);
+
+    struct memory_job job = {order, dtype, 2 * hilbert_dtype_size(dtype), first, count, threads, (char *) out};
+    pthread_t *workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    struct memory_part *parts = (struct memory_part *) malloc(threads * sizeof(struct memory_part));
+    assert(workers != NULL && parts != NULL);
+    // a part whose thread can't be started is generated by the calling thread instead
+    int started = 0;
+    for (int t = 0; t < threads; t++) {
+        parts[t].job = &job;
+        parts[t].part = t;
+        if (pthread_create(&workers[started], NULL, memory_thread, &parts[t]) == 0) started++;
+        else memory_thread(&parts[t]);
+    }
+    for (int t = 0; t < started; t++) pthread_join(workers[t], NULL);
+    free(workers);
+    free(parts);
+    return 0;
+}
+
+// generates a whole curve with every thread at once and writes it with as few write() calls as possible
+static size_t write_curve_memory(int order, enum hilbert_dtype dtype, int threads, int fd) {
+    size_t num_points = HILBERT_NUM_POINTS(order), size = num_points * 2 * hilbert_dtype_size(dtype);
+    char *points = (char *) malloc(size);
+    assert(points != NULL);
+    hilbert_range_dtype_threads(order, dtype, 0, num_points, threads, points);
+
+    HILBERT_TRACE_BEGIN("write", "bytes", size);
+    int failed = write_all(fd, points, size) != 0;
+    HILBERT_TRACE_END("write");
+    free(points);
+    return failed ? (size_t) -1 : num_points;
+}
+
+// picks the fastest binary writer for a curve whose buffers fit in 'max_memory' bytes (0 for no limit), for
+// writing to 'fd': positional writes for regular files, and otherwise a whole curve or a stream
+// returns -1 if the dtype isn't f8 or f4 or can't hold the order, or if not even one chunk of one thread fits
+int hilbert_plan_curve(int order, enum hilbert_dtype dtype, int threads, int fd, size_t max_memory,
+                       struct hilbert_plan *plan) {
+    if (order < 1 || order > HILBERT_MAX_ORDER || (dtype != HILBERT_DTYPE_F8 && dtype != HILBERT_DTYPE_F4)) return -1;
+    if (dtype == HILBERT_DTYPE_F4 && order > HILBERT_FLOAT_MAX_ORDER) return -1;
+    if (max_memory == 0) max_memory = (size_t) -1;
+    if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+
+    size_t point_size = 2 * hilbert_dtype_size(dtype);
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    plan->order = order;
+    plan->dtype = dtype;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) return -1;
+    if (S_ISREG(st.st_mode)) {
+        // never more in a chunk than the curve, or more threads than chunks
+        size_t chunk = num_points < POSITIONAL_CHUNK_POINTS ? num_points : POSITIONAL_CHUNK_POINTS;
+        size_t min_chunk = num_points < PLAN_MIN_CHUNK_POINTS ? num_points : PLAN_MIN_CHUNK_POINTS;
+        while ((size_t) threads * chunk * point_size > max_memory) {
+            if (chunk > min_chunk) chunk /= 2;
+            else if (threads > 1) threads--;
+            else return -1;
+        }
+        if ((size_t) threads > num_points / chunk) threads = (int) (num_points / chunk);
+        plan->strategy = HILBERT_STRATEGY_POSITIONAL;
+        plan->threads = threads;
+        plan->chunk_points = chunk;
+        plan->memory = (size_t) threads * chunk * point_size;
+    } else if (threads > 1 && num_points <= max_memory / point_size) {
+        plan->strategy = HILBERT_STRATEGY_MEMORY;
+        plan->threads = threads;
+        plan->chunk_points = num_points;
+        plan->memory = num_points * point_size;
+    } else {
+        // two buffers of a power of two, which is what pipes round their capacity to
+        size_t buf = S_ISFIFO(st.st_mode) ? STREAM_PIPE_BYTES : STREAM_WRITE_BYTES;
+        while (2 * buf > max_memory && buf > PLAN_MIN_STREAM_BYTES) buf /= 2;
+        if (2 * buf > max_memory) return -1;
+        plan->strategy = HILBERT_STRATEGY_STREAM;
+        plan->threads = 1;
+        plan->chunk_points = buf / point_size;
+        plan->memory = 2 * buf;
+    }
+    return 0;
+}
+
+// writes a curve the way a plan of hilbert_plan_curve says, returns the number of points written or -1 on failure
+size_t write_hilbert_curve_plan(const struct hilbert_plan *plan, int preallocate, int fd) {
+    switch (plan->strategy) {
+        case HILBERT_STRATEGY_POSITIONAL:
+            return write_curve_fd(plan->order, plan->dtype, plan->threads, plan->chunk_points, preallocate, fd);
+        case HILBERT_STRATEGY_MEMORY:
+            return write_curve_memory(plan->order, plan->dtype, plan->threads, fd);
+        case HILBERT_STRATEGY_STREAM:
+            return write_curve_stream(plan->order, plan->dtype, plan->memory / 2, fd);
+    }
+    return -1;
+}
+
+// writes the turning points of a hilbert curve to a stream in binary format, straight from the generator
+// every point is a space_vec2 like write_hilbert_curve, returns the number of points written or -1 on an
+// unsupported order or a failed write
+size_t write_hilbert_turns(int order, FILE *fp) {
+    static size_t max_write = 65536; // amount of element to buffer before writing
+    struct space_vec2 *buf = (struct space_vec2 *) malloc(max_write * sizeof(struct space_vec2));
+    assert(buf != NULL);
+
+    struct hilbert_segment_iter iter;
+    struct hilbert_segment seg;
+    if (hilbert_segments_begin(&iter, order) != 0) goto fail;
+
+    // every segment contributes the point it starts at, the end of the curve is added afterwards
+    size_t buffered = 0, written = 0;
+    while (hilbert_segments_next(&iter, &seg)) {
+        buf[buffered++] = hilbert_cell_point(order, seg.x, seg.y);
+        if (buffered == max_write) {
+            fwrite(buf, sizeof(struct space_vec2), buffered, fp);
+            written += buffered;
+            buffered = 0;
+        }
+    }
+    buf[buffered++] = hilbert_cell_point(order, iter.x, iter.y);
+    fwrite(buf, sizeof(struct space_vec2), buffered, fp);
+    written += buffered;
+    fflush(fp);
+
+    free(buf);
+    // writes are buffered, so a failed one only shows up in the error flag of the stream
+    return ferror(fp) ? (size_t) -1 : written;
+
+    fail:
+    free(buf);
+    return -1;
+}
+
+/* COLUMNAR OUTPUT */
+
+// number of points converted at once by the streaming writers
+#define WRITE_CHUNK_POINTS ((size_t) 65536)
+// number of rows in one arrow record batch
+#define ARROW_BATCH_ROWS ((size_t) 1 << 20)
+
+static const struct {
+    const char *npy_descr; // numpy type, without the byte order
+    size_t size; // bytes of one coordinate
+    int max_order; // highest order this type holds exactly
+} dtype_info[] = {
+        [HILBERT_DTYPE_F8] = {"f8", 8, 52},
+        [HILBERT_DTYPE_F4] = {"f4", 4, 23},
+        [HILBERT_DTYPE_U2] = {"u2", 2, 16},
+        [HILBERT_DTYPE_U4] = {"u4", 4, 32},
+};
+
+// size of one coordinate of a dtype in bytes
+size_t hilbert_dtype_size(enum hilbert_dtype dtype) {
+    return dtype_info[dtype].size;
+}
+
+static int host_is_little_endian(void) {
+    const uint16_t probe = 1;
+    return *(const uint8_t *) &probe == 1;
+}
+
+// stores one coordinate as a dtype, integer types hold the cell and floating point types hold the center
+static void convert_coord(space_pos_t val, enum hilbert_dtype dtype, space_pos_t cells, uint8_t *out) {
+    switch (dtype) {
+        case HILBERT_DTYPE_F8: {
+            double v = (double) val;
+            memcpy(out, &v, sizeof(v));
+            break;
+        }
+        case HILBERT_DTYPE_F4: {
+            float v = (float) val;
+            memcpy(out, &v, sizeof(v));
+            break;
+        }
+        case HILBERT_DTYPE_U2: {
+            // the center of a cell times the cells per side is the cell plus a half, which floors to the cell
+            uint16_t v = (uint16_t) (val * cells);
+            memcpy(out, &v, sizeof(v));
+            break;
+        }
+        case HILBERT_DTYPE_U4: {
+            uint32_t v = (uint32_t) (val * cells);
+            memcpy(out, &v, sizeof(v));
+            break;
+        }
+    }
+}
+
+// checks the arguments shared by the columnar writers
+static int columnar_valid(int order, enum hilbert_dtype dtype) {
+    if (order < 1 || order > HILBERT_MAX_ORDER) return 0;
+    if ((unsigned) dtype >= sizeof(dtype_info) / sizeof(dtype_info[0])) return 0;
+    return order <= dtype_info[dtype].max_order;
+}
+
+// writes 'count' points starting at 'first' of a curve into 'out' as interleaved x, y coordinates of a dtype
+// returns -1 if the dtype can't hold the order, otherwise 0
+int hilbert_range_dtype(int order, enum hilbert_dtype dtype, size_t first, size_t count, void *out) {
+    if (!columnar_valid(order, dtype)) return -1;
+    if (order <= HILBERT_KERNEL_MAX_ORDER) {
+        hilbert_kernels[order][dtype](first, count, out);
+        return 0;
+    }
+
+    // higher orders go through the generic generator a chunk at a time
+    size_t size = dtype_info[dtype].size;
+    space_pos_t cells = (space_pos_t) ((uint64_t) 1 << order);
+    struct space_vec2 chunk[256];
+    uint8_t *coords = (uint8_t *) out;
+    for (size_t i = 0; i < count; i += 256) {
+        size_t len = count - i < 256 ? count - i : 256;
+        hilbert_range(order, first + i, len, chunk);
+        for (size_t p = 0; p < len; p++) {
+            convert_coord(chunk[p].x, dtype, cells, &coords[(2 * (i + p)) * size]);
+            convert_coord(chunk[p].y, dtype, cells, &coords[(2 * (i + p) + 1) * size]);
+        }
+    }
+    return 0;
+}
+
+// starts an npy file of 'num_points' rows of (x, y) in a dtype, returns -1 if the dtype can't hold the order
+int hilbert_npy_begin(struct hilbert_npy_writer *writer, FILE *fp, int order, enum hilbert_dtype dtype,
+                      size_t num_points) {
+    if (!columnar_valid(order, dtype)) return -1;
+
+    writer->fp = fp;
+    writer->order = order;
+    writer->dtype = dtype;
+    writer->buf = (uint8_t *) malloc(WRITE_CHUNK_POINTS * 2 * dtype_info[dtype].size);
+    assert(writer->buf != NULL);
+
+    // version 1.0 header, the dictionary is padded with spaces so the data starts 64 byte aligned
+    char header[128];
+    int len = sprintf(&header[10], "{'descr': '%c%s', 'fortran_order': False, 'shape': (%zu, 2), }",
+                      host_is_little_endian() ? '<' : '>', dtype_info[dtype].npy_descr, num_points);
+    size_t total = (10 + (size_t) len + 1 + 63) & ~(size_t) 63;
+    memcpy(header, "\x93NUMPY\x01\x00", 8);
+    header[8] = (char) ((total - 10) & 0xff);
+    header[9] = (char) ((total - 10) >> 8);
+    memset(&header[10 + len], ' ', total - 10 - len - 1);
+    header[total - 1] = '\n';
+
+    fwrite(header, 1, total, fp);
+    return 0;
+}
+
+// appends points to an npy file, in the order given
+void hilbert_npy_write(struct hilbert_npy_writer *writer, const struct space_vec2 *points, size_t len) {
+    size_t size = dtype_info[writer->dtype].size;
+    space_pos_t cells = (space_pos_t) ((uint64_t) 1 << writer->order);
+
+    for (size_t i = 0; i < len; i += WRITE_CHUNK_POINTS) {
+        size_t chunk = len - i < WRITE_CHUNK_POINTS ? len - i : WRITE_CHUNK_POINTS;
+        for (size_t p = 0; p < chunk; p++) {
+            convert_coord(points[i + p].x, writer->dtype, cells, &writer->buf[(2 * p) * size]);
+            convert_coord(points[i + p].y, writer->dtype, cells, &writer->buf[(2 * p + 1) * size]);
+        }
+        fwrite(writer->buf, size * 2, chunk, writer->fp);
+    }
+}
+
+// finishes an npy file, every row promised to hilbert_npy_begin must have been written
+void hilbert_npy_end(struct hilbert_npy_writer *writer) {
+    fflush(writer->fp);
+    free(writer->buf);
+    writer->buf = NULL;
+}
+
+// writes a curve as an npy file of shape [4^order, 2] straight from the generator
+// returns the number of points written or -1 if the dtype can't hold the order or a write failed
+size_t write_hilbert_npy(int order, enum hilbert_dtype dtype, FILE *fp) {
+    struct hilbert_npy_writer writer;
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    if (hilbert_npy_begin(&writer, fp, order, dtype, num_points) != 0) return -1;
+
+    // the rows are generated in the dtype of the file, which is already the buffer of the writer
+    size_t row_size = 2 * dtype_info[dtype].size;
+    for (size_t i = 0; i < num_points; i += WRITE_CHUNK_POINTS) {
+        size_t len = num_points - i < WRITE_CHUNK_POINTS ? num_points - i : WRITE_CHUNK_POINTS;
+        HILBERT_TRACE_BEGIN("generate", "first", i);
+        hilbert_range_dtype(order, dtype, i, len, writer.buf);
+        HILBERT_TRACE_END("generate");
+        HILBERT_TRACE_BEGIN("fwrite", "points", len);
+        fwrite(writer.buf, row_size, len, fp);
+        HILBERT_TRACE_END("fwrite");
+    }
+
+    hilbert_npy_end(&writer);
+    // writes are buffered, so a failed one only shows up in the error flag of the stream
+    return ferror(fp) ? (size_t) -1 : num_points;
+}
+
+/*
+ * Arrow IPC files describe their schema and batches with flatbuffers. Only a handful of tables are needed,
+ * so instead of depending on the flatbuffers library this is a minimal builder that works the same way:
+ * the buffer is filled from the back, every object is referred to by its distance from the end of the
+ * buffer, and a table must be finished before anything that refers to it is started
+*/
+
+struct fb_builder {
+    uint8_t *buf;
+    size_t cap;
+    size_t len; // bytes in use at the end of buf
+    size_t table_start; // len when the current table was started
+    size_t fields[8]; // positions of the fields of the current table, 0 when not present
+};
+
+static void fb_init(struct fb_builder *fb) {
+    fb->cap = 1024;
+    fb->len = 0;
+    fb->buf = (uint8_t *) malloc(fb->cap);
+    assert(fb->buf != NULL);
+}
+
+// makes room for 'size' more bytes in front of what is already in the buffer
+static uint8_t *fb_grow(struct fb_builder *fb, size_t size) {
+    while (fb->len + size > fb->cap) {
+        size_t cap = fb->cap * 2;
+        uint8_t *buf = (uint8_t *) malloc(cap);
+        assert(buf != NULL);
+        memcpy(&buf[cap - fb->len], &fb->buf[fb->cap - fb->len], fb->len);
+        free(fb->buf);
+        fb->buf = buf;
+        fb->cap = cap;
+    }
+    fb->len += size;
+    return &fb->buf[fb->cap - fb->len];
+}
+
+// pads so that 'align' is satisfied once another 'size' bytes are pushed
+static void fb_align(struct fb_builder *fb, size_t align, size_t size) {
+    size_t pad = (align - ((fb->len + size) & (align - 1))) & (align - 1);
+    memset(fb_grow(fb, pad), 0, pad);
+}
+
+static size_t fb_push(struct fb_builder *fb, const void *data, size_t size) {
+    fb_align(fb, size > 8 ? 8 : size, size);
+    memcpy(fb_grow(fb, size), data, size);
+    return fb->len;
+}
+
+// pushes a reference to an earlier object, which is stored as the distance from the reference itself
+static size_t fb_push_offset(struct fb_builder *fb, size_t target) {
+    fb_align(fb, 4, 4);
+    uint32_t off = (uint32_t) (fb->len + 4 - target);
+    return fb_push(fb, &off, 4);
+}
+
+static size_t fb_string(struct fb_builder *fb, const char *str) {
+    uint32_t len = (uint32_t) strlen(str);
+    fb_align(fb, 4, len + 1);
+    memcpy(fb_grow(fb, len + 1), str, len + 1);
+    return fb_push(fb, &len, 4);
+}
+
+// vector of structs (or scalars), stored in order
+static size_t fb_struct_vector(struct fb_builder *fb, const void *elems, size_t elem_size, uint32_t count) {
+    fb_align(fb, 8, elem_size * count);
+    memcpy(fb_grow(fb, elem_size * count), elems, elem_size * count);
+    return fb_push(fb, &count, 4);
+}
+
+// vector of references to tables
+static size_t fb_table_vector(struct fb_builder *fb, const size_t *tables, uint32_t count) {
+    for (uint32_t i = count; i > 0; i--) fb_push_offset(fb, tables[i - 1]);
+    return fb_push(fb, &count, 4);
+}
+
+static void fb_start_table(struct fb_builder *fb) {
+    fb->table_start = fb->len;
+    memset(fb->fields, 0, sizeof(fb->fields));
+}
+
+static void fb_add_scalar(struct fb_builder *fb, int field, const void *data, size_t size) {
+    fb->fields[field] = fb_push(fb, data, size);
+}
+
+static void fb_add_offset(struct fb_builder *fb, int field, size_t target) {
+    fb->fields[field] = fb_push_offset(fb, target);
+}
+
+// finishes the current table by writing its vtable right in front of it
+static size_t fb_end_table(struct fb_builder *fb) {
+    int32_t placeholder = 0;
+    size_t table = fb_push(fb, &placeholder, 4);
+
+    uint16_t vtable[2 + 8];
+    int num_fields = 0;
+    for (int i = 0; i < 8; i++) {
+        vtable[2 + i] = fb->fields[i] ? (uint16_t) (table - fb->fields[i]) : 0;
+        if (fb->fields[i]) num_fields = i + 1;
+    }
+    vtable[0] = (uint16_t) ((2 + num_fields) * 2);
+    vtable[1] = (uint16_t) (table - fb->table_start);
+    memcpy(fb_grow(fb, vtable[0]), vtable, vtable[0]);
+
+    // the table points back to its vtable with a signed offset
+    int32_t soffset = (int32_t) (fb->len - table);
+    memcpy(&fb->buf[fb->cap - table], &soffset, 4);
+    return table;
+}
+
+// finishes the buffer with a reference to the root table, returns the start of the finished buffer
+static const uint8_t *fb_finish(struct fb_builder *fb, size_t root) {
+    fb_align(fb, 8, 4);
+    fb_push_offset(fb, root);
+    return &fb->buf[fb->cap - fb->len];
+}
+
+static void fb_free(struct fb_builder *fb) {
+    free(fb->buf);
+}
+
+// arrow metadata constants from Schema.fbs and Message.fbs
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FLOATING_POINT 3
+
+// location of a record batch in the file, as the arrow Block struct
+struct arrow_block {
+    int64_t offset;
+    int32_t meta_data_length;
+    int32_t pad;
+    int64_t body_length;
+};
+
+// builds the arrow schema table, with non-nullable 'x' and 'y' columns of a dtype
+static size_t arrow_schema(struct fb_builder *fb, enum hilbert_dtype dtype) {
+    static const char *names[] = {"x", "y"};
+    size_t fields[2];
+    for (int i = 0; i < 2; i++) {
+        size_t name = fb_string(fb, names[i]);
+        size_t children = fb_table_vector(fb, NULL, 0);
+
+        uint8_t type_type;
+        fb_start_table(fb);
+        if (dtype == HILBERT_DTYPE_F8 || dtype == HILBERT_DTYPE_F4) {
+            int16_t precision = dtype == HILBERT_DTYPE_F8 ? 2 : 1; // DOUBLE or SINGLE
+            fb_add_scalar(fb, 0, &precision, 2);
+            type_type = ARROW_TYPE_FLOATING_POINT;
+        } else {
+            int32_t bit_width = (int32_t) dtype_info[dtype].size * 8;
+            uint8_t is_signed = 0;
+            fb_add_scalar(fb, 0, &bit_width, 4);
+            fb_add_scalar(fb, 1, &is_signed, 1);
+            type_type = ARROW_TYPE_INT;
+        }
+        size_t type = fb_end_table(fb);
+
+        uint8_t nullable = 0;
+        fb_start_table(fb);
+        fb_add_offset(fb, 0, name);
+        fb_add_offset(fb, 3, type);
+        fb_add_offset(fb, 5, children);
+        fb_add_scalar(fb, 1, &nullable, 1);
+        fb_add_scalar(fb, 2, &type_type, 1);
+        fields[i] = fb_end_table(fb);
+    }
+    size_t field_vec = fb_table_vector(fb, fields, 2);
+
+    int16_t endianness = host_is_little_endian() ? 0 : 1;
+    fb_start_table(fb);
+    fb_add_offset(fb, 1, field_vec);
+    fb_add_scalar(fb, 0, &endianness, 2);
+    return fb_end_table(fb);
+}
+
+// writes an encapsulated arrow message (continuation marker, length and metadata padded to 8 bytes)
+// returns the number of bytes written, which is the metaDataLength of a block
+static size_t arrow_message(struct hilbert_arrow_writer *writer, struct fb_builder *fb, size_t header,
+                            uint8_t header_type, int64_t body_length) {
+    int16_t version = ARROW_METADATA_V5;
+    fb_start_table(fb);
+    fb_add_offset(fb, 2, header);
+    fb_add_scalar(fb, 3, &body_length, 8);
+    fb_add_scalar(fb, 0, &version, 2);
+    fb_add_scalar(fb, 1, &header_type, 1);
+    const uint8_t *data = fb_finish(fb, fb_end_table(fb));
+
+    uint32_t prefix[2] = {0xffffffffu, (uint32_t) ((fb->len + 7) & ~(size_t) 7)};
+    static const uint8_t zeros[8] = {0};
+    fwrite(prefix, 4, 2, writer->fp);
+    fwrite(data, 1, fb->len, writer->fp);
+    fwrite(zeros, 1, prefix[1] - fb->len, writer->fp);
+    writer->pos += 8 + prefix[1];
+    return 8 + prefix[1];
+}
+
+// writes the buffered rows as one record batch, with the x values followed by the y values
+static void arrow_flush(struct hilbert_arrow_writer *writer) {
+    static const uint8_t zeros[64] = {0};
+    if (writer->rows == 0) return;
+
+    size_t bytes = writer->rows * dtype_info[writer->dtype].size;
+    size_t padded = (bytes + 63) & ~(size_t) 63;
+    int64_t nodes[2][2] = {{(int64_t) writer->rows, 0}, {(int64_t) writer->rows, 0}};
+    // every column has an (empty) validity buffer followed by its values
+    int64_t buffers[4][2] = {{0, 0}, {0, (int64_t) bytes}, {(int64_t) padded, 0}, {(int64_t) padded, (int64_t) bytes}};
+
+    struct fb_builder fb;
+    fb_init(&fb);
+    size_t buffer_vec = fb_struct_vector(&fb, buffers, sizeof(buffers[0]), 4);
+    size_t node_vec = fb_struct_vector(&fb, nodes, sizeof(nodes[0]), 2);
+    int64_t length = (int64_t) writer->rows;
+    fb_start_table(&fb);
+    fb_add_scalar(&fb, 0, &length, 8);
+    fb_add_offset(&fb, 1, node_vec);
+    fb_add_offset(&fb, 2, buffer_vec);
+    size_t batch = fb_end_table(&fb);
+
+    // remember where the batch is for the footer
+    if (writer->num_blocks == writer->cap_blocks) {
+        writer->cap_blocks = writer->cap_blocks ? writer->cap_blocks * 2 : 64;
+        writer->blocks = (struct arrow_block *) realloc(writer->blocks, writer->cap_blocks * sizeof(struct arrow_block));
+        assert(writer->blocks != NULL);
+    }
+    struct arrow_block *block = &writer->blocks[writer->num_blocks++];
+    block->offset = (int64_t) writer->pos;
+    block->meta_data_length = (int32_t) arrow_message(writer, &fb, batch, ARROW_HEADER_RECORD_BATCH, 2 * padded);
+    block->pad = 0;
+    block->body_length = (int64_t) (2 * padded);
+    fb_free(&fb);
+
+    HILBERT_TRACE_BEGIN("fwrite", "points", writer->rows);
+    fwrite(writer->columns[0], 1, bytes, writer->fp);
+    fwrite(zeros, 1, padded - bytes, writer->fp);
+    fwrite(writer->columns[1], 1, bytes, writer->fp);
+    fwrite(zeros, 1, padded - bytes, writer->fp);
+    HILBERT_TRACE_END("fwrite");
+    writer->pos += 2 * padded;
+    writer->rows = 0;
+}
+
+// starts an arrow IPC file with 'x' and 'y' columns of a dtype, returns -1 if the dtype can't hold the order
+// the stream must be at the start of the file, since the footer records absolute offsets
+int hilbert_arrow_begin(struct hilbert_arrow_writer *writer, FILE *fp, int order, enum hilbert_dtype dtype) {
+    if (!columnar_valid(order, dtype)) return -1;
+
+    writer->fp = fp;
+    writer->order = order;
+    writer->dtype = dtype;
+    writer->rows = 0;
+    writer->pos = 0;
+    writer->blocks = NULL;
+    writer->num_blocks = writer->cap_blocks = 0;
+    for (int i = 0; i < 2; i++) {
+        writer->columns[i] = (uint8_t *) malloc(ARROW_BATCH_ROWS * dtype_info[dtype].size);
+        assert(writer->columns[i] != NULL);
+    }
+
+    // magic padded to 8 bytes, then the schema
+    fwrite("ARROW1\0\0", 1, 8, fp);
+    writer->pos = 8;
+    struct fb_builder fb;
+    fb_init(&fb);
+    arrow_message(writer, &fb, arrow_schema(&fb, dtype), ARROW_HEADER_SCHEMA, 0);
+    fb_free(&fb);
+    return 0;
+}
+
+// appends points to an arrow file, rows are written out in record batches of ARROW_BATCH_ROWS
+void hilbert_arrow_write(struct hilbert_arrow_writer *writer, const struct space_vec2 *points, size_t len) {
+    size_t size = dtype_info[writer->dtype].size;
+    space_pos_t cells = (space_pos_t) ((uint64_t) 1 << writer->order);
+
+    for (size_t i = 0; i < len; i++) {
+        convert_coord(points[i].x, writer->dtype, cells, &writer->columns[0][writer->rows * size]);
+        convert_coord(points[i].y, writer->dtype, cells, &writer->columns[1][writer->rows * size]);
+        if (++writer->rows == ARROW_BATCH_ROWS) arrow_flush(writer);
+    }
+}
+
+// finishes an arrow file by writing the last batch, the end of stream marker and the footer
+void hilbert_arrow_end(struct hilbert_arrow_writer *writer) {
+    arrow_flush(writer);
+
+    static const uint32_t eos[2] = {0xffffffffu, 0};
+    fwrite(eos, 4, 2, writer->fp);
+
+    struct fb_builder fb;
+    fb_init(&fb);
+    size_t blocks = fb_struct_vector(&fb, writer->blocks, sizeof(struct arrow_block), (uint32_t) writer->num_blocks);
+    size_t schema = arrow_schema(&fb, writer->dtype);
+    int16_t version = ARROW_METADATA_V5;
+    fb_start_table(&fb);
+    fb_add_offset(&fb, 1, schema);
+    fb_add_offset(&fb, 3, blocks);
+    fb_add_scalar(&fb, 0, &version, 2);
+    const uint8_t *footer = fb_finish(&fb, fb_end_table(&fb));
+
+    int32_t footer_len = (int32_t) fb.len;
+    fwrite(footer, 1, fb.len, writer->fp);
+    fwrite(&footer_len, 4, 1, writer->fp);
+    fwrite("ARROW1", 1, 6, writer->fp);
+    fflush(writer->fp);
+    fb_free(&fb);
+
+    free(writer->columns[0]);
+    free(writer->columns[1]);
+    free(writer->blocks);
+    writer->blocks = NULL;
+}
+
+// writes a curve as an arrow IPC file with 'x' and 'y' columns straight from the generator
+// returns the number of points written or -1 if the dtype can't hold the order or a write failed
+size_t write_hilbert_arrow(int order, enum hilbert_dtype dtype, FILE *fp) {
+    struct hilbert_arrow_writer writer;
+    if (hilbert_arrow_begin(&writer, fp, order, dtype) != 0) return -1;
+
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    struct space_vec2 *chunk = (struct space_vec2 *) malloc(WRITE_CHUNK_POINTS * sizeof(struct space_vec2));
+    assert(chunk != NULL);
+    for (size_t i = 0; i < num_points; i += WRITE_CHUNK_POINTS) {
+        size_t len = num_points - i < WRITE_CHUNK_POINTS ? num_points - i : WRITE_CHUNK_POINTS;
+        hilbert_range(order, i, len, chunk);
+        hilbert_arrow_write(&writer, chunk, len);
+    }
+    free(chunk);
+
+    hilbert_arrow_end(&writer);
+    return ferror(fp) ? (size_t) -1 : num_points;
+}
@@ -5,13 +5,15 @@
  * This piece of work is unlicensed, and can be used commercially
  *
  * This code will generate a psuedo-hilbert curve of a specified order in a space between (0) and (1)
- * It uses long doubles as stored integers, so the larger the order, the less precision you're going to get
+ * Points are doubles, which hold the center of every cell exactly up to order 52 (and so every order supported),
+ * but text only keeps 15 digits by default. --precision=exact writes all order + 1 digits of every coordinate
  * In terms of how space is layed out, (0, 0) is top left and (1, 1) is bottom right
  *
  * SEGMENTS:
- *  Geometry - Contains basic geometric functions revolving around points in space and translating their position
- *  Hilbert Curves - Code for generation of pseudo-hilbert curves, built on-top of the geometric functions
+ *  Geometry, Hilbert Curves & Hilbert Curve View - Live in hilbert.c and hilbert_view.c, declared in hilbert.h
+ *  Conversion between curve file formats lives in the separate hilbert_convert program (convert.c)
  *  Main - Entry point of program, generates the hilbert curve and writes the file with all points
+ *  The key service daemon of --serve lives in hilbert_service.c, the shared tables of --publish in hilbert_shared.c
  *
  * WARNING:
  *  This is code that I wrote myself as a challenge and most likely isn't the most efficient in performance OR memory
@@ -21,225 +23,377 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <memory.h>
+#include <string.h>
 #include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/resource.h>
 
-/* GEOMETRY */
+#include "hilbert.h"
 
-typedef double space_pos_t;
-// Simple structure for a point in 2d space
-struct space_vec2 {
-    space_pos_t x, y;
-};
-// macro for easily assigning space_vec2 variables
-#define POINT_AT(px, py) { .x = px, .y = py }
-
-// swap the x and y values in a point
-#define SPACE_SWAP_POINT(point) { \
-    space_pos_t tmp = point.x; \
-    point.x = point.y; \
-    point.y = tmp; \
-}
-
-// macro for defining an operation between two points that is the same for the x and y values
-#define SPACE_OP_POINTS(pointA, op, pointB) \
-    pointA.x op pointB.x; \
-    pointA.y op pointB.y
-
-// macro for reflecting a single value across an origin value
-#define SPACE_REFLECT_POINT(val, origin) {\
-    val -= origin; \
-    val *= -1; \
-    val += origin; \
-}
+/* MAIN */
 
-// reflects all points in a space_vec2 array across a given vertical line at 'origin'
-void space_reflect_y(struct space_vec2 *arr, size_t len, space_pos_t origin) {
-    for (size_t i = 0; i < len; i++) SPACE_REFLECT_POINT(arr[i].x, origin);
-}
+// formats that the program can write, selected with --format
+enum output_format {
+    FORMAT_BINARY, // write_hilbert_curve_fd
+    FORMAT_TXT, // write_hilbert_text_fd
+    FORMAT_TURNS, // write_hilbert_turns
+    FORMAT_SEGMENTS_TXT, // write_hilbert_segments_txt
+    FORMAT_PPM, // hilbert_render
+    FORMAT_PNG, // hilbert_render
+    FORMAT_NPY, // write_hilbert_npy
+    FORMAT_ARROW, // write_hilbert_arrow
+    FORMAT_CSV, // write_hilbert_text_fd
+    FORMAT_JSON, // write_hilbert_text
+    FORMAT_PLY, // write_hilbert_text
+    FORMAT_SVG, // write_hilbert_text
+    FORMAT_DELTA, // write_hilbert_delta
+};
 
-// reflects all points in a space_vec2 array across a given horizontal line at 'origin'
-void space_reflect_x(struct space_vec2 *arr, size_t len, space_pos_t origin) {
-    for (size_t i = 0; i < len; i++) SPACE_REFLECT_POINT(arr[i].y, origin);
-}
+static const struct {
+    const char *name; // name given to --format
+    const char *suffix; // appended to the oNN_hilbert file name
+} output_formats[] = {
+        [FORMAT_BINARY] = {"binary", ""},
+        [FORMAT_TXT] = {"txt", ".txt"},
+        [FORMAT_TURNS] = {"turns", "_turns"},
+        [FORMAT_SEGMENTS_TXT] = {"segments-txt", "_segments.txt"},
+        [FORMAT_PPM] = {"ppm", ".ppm"},
+        [FORMAT_PNG] = {"png", ".png"},
+        [FORMAT_NPY] = {"npy", ".npy"},
+        [FORMAT_ARROW] = {"arrow", ".arrow"},
+        [FORMAT_CSV] = {"csv", ".csv"},
+        [FORMAT_JSON] = {"json", ".json"},
+        [FORMAT_PLY] = {"ply", ".ply"},
+        [FORMAT_SVG] = {"svg", ".svg"},
+        [FORMAT_DELTA] = {"delta", ".delta"},
+};
 
-/*
- * Little explanation on how rotations work:
- * 90 degree counter-clockwise rotation is (A, B) -> (-y, x)
- * 270 degree counter-clockwise rotation (essentially 90 degree clockwise) is (x, y) -> (y, -x)
- *
- * This is what the macro and functions below are doing in essence.
- * It also takes into account a point of origin so it doesn't just rotate around (0, 0)
- *
- * P.S. x/y negates below are swapped because positive y's are down instead of up
- * which flips the rotation order (cc becomes c, vice versa)
-*/
+// coordinate types for npy and arrow files, selected with --dtype
+static const char *dtype_names[] = {
+        [HILBERT_DTYPE_F8] = "f8",
+        [HILBERT_DTYPE_F4] = "f4",
+        [HILBERT_DTYPE_U2] = "u2",
+        [HILBERT_DTYPE_U4] = "u4",
+};
 
-// helper macro for the rotate functions
-#define SPACE_ROTATE_POINT_ABOUT_ORIGIN(point, neg_mult, origin) { \
-    SPACE_OP_POINTS(point, -=, origin); \
-    SPACE_SWAP_POINT(point); \
-    point.neg_mult *= -1; \
-    SPACE_OP_POINTS(point, +=, origin); \
-}
+// names of the strategies of a plan, for reporting what --max-memory picked
+static const char *strategy_names[] = {
+        [HILBERT_STRATEGY_POSITIONAL] = "positional writes",
+        [HILBERT_STRATEGY_STREAM] = "streaming",
+        [HILBERT_STRATEGY_MEMORY] = "in memory generation",
+};
 
-// rotates all points in a space_vec2 array 90 degress around an origin point clockwise
-void space_rotate_c(struct space_vec2 *arr, size_t len, struct space_vec2 origin) {
-    for (size_t i = 0; i < len; i++) SPACE_ROTATE_POINT_ABOUT_ORIGIN(arr[i], x, origin);
+// parses a number of bytes with an optional K, M or G suffix, returns 0 if it isn't one
+static size_t parse_size(const char *str) {
+    char *end;
+    unsigned long long size = strtoull(str, &end, 10);
+    if (end == str) return 0;
+    if (*end == 'K' || *end == 'k') size <<= 10, end++;
+    else if (*end == 'M' || *end == 'm') size <<= 20, end++;
+    else if (*end == 'G' || *end == 'g') size <<= 30, end++;
+    return *end == '\0' ? (size_t) size : 0;
 }
 
-// rotates all points in a space_vec2 array 90 degress around an origin point counter-clockwise
-void space_rotate_cc(struct space_vec2 *arr, size_t len, struct space_vec2 origin) {
-    for (size_t i = 0; i < len; i++) SPACE_ROTATE_POINT_ABOUT_ORIGIN(arr[i], y, origin);
+// the most memory the process has held so far, in bytes
+static size_t peak_rss(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (size_t) usage.ru_maxrss * 1024;
 }
 
-// scales all point sin a space_vec2 array a multiplier around an origin point
-void space_scale(struct space_vec2 *arr, size_t len, space_pos_t scale, struct space_vec2 origin) {
-    // define a space_vec2 for the scale so that we can easily multiply the values
-    struct space_vec2 scale_p = POINT_AT(scale, scale);
-    for (size_t i = 0; i < len; i++) {
-        SPACE_OP_POINTS(arr[i], -=, origin);
-        SPACE_OP_POINTS(arr[i], *=, scale_p);
-        SPACE_OP_POINTS(arr[i], +=, origin);
-    }
+static void print_usage(const char *program) {
+    fprintf(stderr, "usage: %s [--format=FORMAT] [--order=N] [--size=PIXELS] [--gradient] [--threads=N] "
+                    "[--preallocate] [--stdout] [--dtype=TYPE] [--precision=N] [--resume]\n"
+                    "       [--max-memory=SIZE] [--trace=FILE] [--serve=SOCKET]\n"
+                    "       [--publish=SOCKET]\n", program);
+    fprintf(stderr, "  --format=FORMAT  one of binary (default), txt, turns, segments-txt, ppm, png, npy, arrow,\n"
+                    "                   csv, json, ply, svg, delta\n");
+    fprintf(stderr, "  --order=N        only write the order N curve instead of orders 1 to 15\n");
+    fprintf(stderr, "  --size=PIXELS    width and height of ppm and png images (default 1024)\n");
+    fprintf(stderr, "  --gradient       color ppm and png images by index instead of drawing in black\n");
+    fprintf(stderr, "  --threads=N      number of threads to use, 0 for one per core (default)\n");
+    fprintf(stderr, "  --preallocate    allocate binary files up front before writing\n");
+    fprintf(stderr, "  --stdout         write to stdout instead of files, one order after the other\n");
+    fprintf(stderr, "  --dtype=TYPE     coordinates of npy and arrow files, one of f8 (default), f4, u2, u4\n"
+                    "                   binary files can be f8 or f4 (single precision, in oNN_hilbert_f4)\n");
+    fprintf(stderr, "  --precision=N    digits after the decimal point in text files (default 15), or exact for\n"
+                    "                   every digit of every coordinate\n");
+    fprintf(stderr, "  --resume         write binary files in checksummed blocks, recorded in oNN_hilbert.ckpt, and\n"
+                    "                   keep the blocks that an interrupted run already finished\n");
+    fprintf(stderr, "  --max-memory=SIZE\n"
+                    "                   pick the fastest way to write binary curves that stays under SIZE bytes of\n"
+                    "                   memory (with an optional K, M or G suffix), and report it with the peak RSS\n");
+    fprintf(stderr, "  --trace=FILE     write a chrome trace of what every thread did to FILE at exit, needs a build\n"
+                    "                   with -DHILBERT_TRACE=ON\n");
+    fprintf(stderr, "  --serve=SOCKET   instead of writing curves, serve batches of keys to other processes on the\n"
+                    "                   Unix socket SOCKET until interrupted, with a worker per thread\n");
+    fprintf(stderr, "  --publish=SOCKET generate the curve of --order in --dtype once into sealed shared memory, and\n"
+                    "                   hand it to every process that attaches to SOCKET until interrupted\n");
 }
 
-/* HILBERT CURVE */
-
-// every pseudo-hilbert curve has 4^order points
-// this essentially returns that, but uses bitshifting instead
-#define HILBERT_NUM_POINTS(order) (size_t) (1 << ((size_t) order * 2))
-
-// recursively creates an pseudo-hilbert curve of a certain order
-size_t hilbert_create(int order, struct space_vec2 **out) {
-    // statically defined order 1 pseudo-hilbert curve
-    // this is upside-down to how you usually see it
-    const static struct space_vec2 o1_hilbert[] = {
-            POINT_AT(0.25, 0.75), // bottom left
-            POINT_AT(0.25, 0.25), // top left
-            POINT_AT(0.75, 0.25), // top right
-            POINT_AT(0.75, 0.75), // bottom right
-    };
-    // space_vec2 origins for where to scale lower order pseudo-hilbert curves
-    // must be same order as order 1 pseudo-hilbert curve
-    const static struct space_vec2 scale_origins[] = {
-            POINT_AT(0.0, 1.0), // bottom left
-            POINT_AT(0.0, 0.0), // top left
-            POINT_AT(1.0, 0.0), // top right
-            POINT_AT(1.0, 1.0), // bottom right
-    };
-
-    // make sure we got valid input
-    if (out == NULL && order >= 1) goto fail;
-
-    // find the number of points this hilber curve requires, then allocate the space
-    size_t num_points = HILBERT_NUM_POINTS(order);
-    struct space_vec2 *arr = (struct space_vec2 *) malloc(num_points * sizeof(struct space_vec2));
-    assert(arr != NULL);
-
-    // if it's an order 1 hilbert curve, just use the statically allocated o1_hilbert
-    // this will break the process of recursion
-    if (order == 1) {
-        // with order 1 hilbert curves, num_points will always be 4 so this is safe
-        memcpy(arr, o1_hilbert, num_points * sizeof(struct space_vec2));
-        *out = arr;
-        return num_points;
+int main(int argc, char **argv) {
+    enum output_format format = FORMAT_BINARY;
+    int min_order = 1, max_order = 15;
+    struct hilbert_render_options render = {.width = 1024, .height = 1024};
+    enum hilbert_dtype dtype = HILBERT_DTYPE_F8;
+    struct hilbert_text_options text = {0};
+    int threads = 0, preallocate = 0, to_stdout = 0, resume = 0;
+    size_t max_memory = 0;
+    const char *serve = NULL, *publish = NULL;
+
+    // parse the options, everything is optional and defaults to writing orders 1-15 in binary
+    for (int arg = 1; arg < argc; arg++) {
+        if (strncmp(argv[arg], "--format=", 9) == 0) {
+            size_t f;
+            for (f = 0; f < sizeof(output_formats) / sizeof(output_formats[0]); f++) {
+                if (strcmp(argv[arg] + 9, output_formats[f].name) == 0) break;
+            }
+            if (f == sizeof(output_formats) / sizeof(output_formats[0])) goto usage;
+            format = (enum output_format) f;
+        } else if (strncmp(argv[arg], "--order=", 8) == 0) {
+            min_order = max_order = atoi(argv[arg] + 8);
+            if (min_order < 1 || min_order > HILBERT_MAX_ORDER) goto usage;
+        } else if (strncmp(argv[arg], "--size=", 7) == 0) {
+            render.width = render.height = (uint32_t) strtoul(argv[arg] + 7, NULL, 10);
+        } else if (strcmp(argv[arg], "--gradient") == 0) {
+            render.gradient = 1;
+        } else if (strncmp(argv[arg], "--threads=", 10) == 0) {
+            threads = render.threads = text.threads = atoi(argv[arg] + 10);
+        } else if (strcmp(argv[arg], "--stdout") == 0) {
+            to_stdout = 1;
+        } else if (strncmp(argv[arg], "--max-memory=", 13) == 0) {
+            max_memory = parse_size(argv[arg] + 13);
+            if (max_memory == 0) goto usage;
+        } else if (strncmp(argv[arg], "--trace=", 8) == 0) {
+            if (hilbert_trace_start(argv[arg] + 8) != 0) {
+                fprintf(stderr, "--trace needs the library built with -DHILBERT_TRACE=ON\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[arg], "--serve=", 8) == 0) {
+            serve = argv[arg] + 8;
+        } else if (strncmp(argv[arg], "--publish=", 10) == 0) {
+            publish = argv[arg] + 10;
+        } else if (strcmp(argv[arg], "--resume") == 0) {
+            resume = 1;
+        } else if (strcmp(argv[arg], "--preallocate") == 0) {
+            preallocate = 1;
+        } else if (strncmp(argv[arg], "--dtype=", 8) == 0) {
+            size_t d;
+            for (d = 0; d < sizeof(dtype_names) / sizeof(dtype_names[0]); d++) {
+                if (strcmp(argv[arg] + 8, dtype_names[d]) == 0) break;
+            }
+            if (d == sizeof(dtype_names) / sizeof(dtype_names[0])) goto usage;
+            dtype = (enum hilbert_dtype) d;
+        } else if (strcmp(argv[arg], "--precision=exact") == 0) {
+            text.precision = HILBERT_TEXT_EXACT;
+        } else if (strncmp(argv[arg], "--precision=", 12) == 0) {
+            text.precision = atoi(argv[arg] + 12);
+            if (text.precision < 1 || text.precision > HILBERT_FORMAT_MAX_PRECISION) goto usage;
+        } else {
+            goto usage;
+        }
     }
 
-    // find the pseudo-hilbert curve of the order below this and store it as memoization
-    // lo = lower order
-    struct space_vec2 *lo = NULL;
-    size_t lo_points = hilbert_create(order - 1, &lo);
-    size_t lo_size = lo_points * sizeof(struct space_vec2);
-
-    // variables used in the loop below
-    struct space_vec2 center_point = POINT_AT(0.5, 0.5); // point defining the center of space
-    struct space_vec2 *work; // working copy of lo
-
-    // create this version of the pseudo-hilbert curve from the others
-    for (size_t i = 0; i < sizeof(scale_origins) / sizeof(struct space_vec2); i++) {
-        // create another allocation for the pseudo-hilbert curve we're going to work with in this loop
-        work = (struct space_vec2 *) malloc(lo_size);
-        assert(work != NULL);
-        memcpy(work, lo, lo_size);
-
-        // perform transformations based on current i value
-        if (i == 0) { // bottom left
-            space_reflect_y(work, lo_points, 0.5);
-            space_rotate_c(work, lo_points, center_point);
-        } else if (i == 4) { // bottom right
-            space_reflect_y(work, lo_points, 0.5);
-            space_rotate_cc(work, lo_points, center_point);
+    if (serve != NULL || publish != NULL) {
+        // a table is a single curve, in any dtype that holds it
+        if (publish != NULL && (min_order != max_order || hilbert_range_dtype(min_order, dtype, 0, 0, NULL) != 0)) {
+            goto usage;
         }
-        // scale it to 1/4 total area, also moves it in the quadrant we want (because of origin)
-        space_scale(work, lo_points, 0.5, scale_origins[i]);
-
-        // copy our one quadrant into the total list of hilbert curve coordinates
-        memcpy(&arr[lo_points * i], work, lo_points * sizeof(struct space_vec2));
-
-        // cleanup working hilbert-curve
-        free(work);
+        // the signals are blocked before any thread starts, so they all go to sigwait
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+        struct hilbert_server *server = NULL;
+        struct hilbert_publisher *publisher = NULL;
+        if (publish != NULL) {
+            publisher = hilbert_publish_start(publish, min_order, dtype, threads);
+            if (publisher == NULL) {
+                perror(publish);
+                return EXIT_FAILURE;
+            }
+            printf("publishing order %d as %s (%.1f MiB) on %s\n", min_order, dtype_names[dtype],
+                   HILBERT_NUM_POINTS(min_order) * 2 * hilbert_dtype_size(dtype) / 1048576.0, publish);
+        }
+        if (serve != NULL) {
+            server = hilbert_server_start(serve, threads);
+            if (server == NULL) {
+                perror(serve);
+                if (publisher != NULL) hilbert_publish_stop(publisher);
+                return EXIT_FAILURE;
+            }
+            printf("serving keys on %s\n", serve);
+        }
+        fflush(stdout);
+        int signal;
+        sigwait(&signals, &signal);
+        if (server != NULL) hilbert_server_stop(server);
+        if (publisher != NULL) hilbert_publish_stop(publisher);
+        return EXIT_SUCCESS;
     }
-    // cleanup lower order hilbert-curve memoization
-    free(lo);
-
-    // finally return this value
-    *out = arr;
-    return num_points;
 
-    fail:
-    *out = NULL;
-    return -1;
-}
-
-/* MAIN */
-
-// writes coordinates of a hilbert curve to a stream in binary format
-void write_hilbert_curve(struct space_vec2 *hc, size_t len, FILE *fp) {
-    static size_t max_write = 65536; // amount of element to write in one go
-
-    size_t write_left; // length of array that's left to write
-    size_t to_write; // the length of array to write to the stream
-    for (size_t i = 0; i < len; i += max_write) {
-        // how much length left to write from the hilbert curve
-        write_left = (len - i);
-        // figure out how much we should write this go (branchless)
-        to_write = (write_left > max_write) * max_write +
-                   (write_left <= max_write) * write_left;
-
-        // use the to_write as the length of how much to write
-        fwrite(&hc[i], sizeof(struct space_vec2), to_write, fp);
-        fflush(fp);
+    // binary files hold points, not cells, and floats only hold the points of lower orders
+    if (format == FORMAT_BINARY && dtype != HILBERT_DTYPE_F8 && dtype != HILBERT_DTYPE_F4) goto usage;
+    if (format == FORMAT_BINARY && dtype == HILBERT_DTYPE_F4 && max_order > HILBERT_FLOAT_MAX_ORDER) goto usage;
+    // npy and arrow files take any dtype that holds the highest order
+    if ((format == FORMAT_NPY || format == FORMAT_ARROW) && hilbert_range_dtype(max_order, dtype, 0, 0, NULL) != 0) {
+        goto usage;
+    }
+    // only binary files are made of blocks that can be checked and written again in place
+    if (resume && (format != FORMAT_BINARY || to_stdout)) goto usage;
+    // the other formats have small fixed buffers, only binary output has a choice of how much to hold at once
+    if (max_memory && format != FORMAT_BINARY) goto usage;
+    // images need at least a pixel, and no more than the renderer takes
+    if ((format == FORMAT_PPM || format == FORMAT_PNG) &&
+        (render.width < 1 || render.width > HILBERT_RENDER_MAX_SIZE)) {
+        goto usage;
     }
-}
 
-// writes coordinates of a hilbert curve to a stream in a txt format
-void write_hilbert_curve_txt(struct space_vec2 *hc, size_t len, FILE *fp) {
-    for (size_t i = 0; i < len; i++) {
-        fprintf(fp, "(%.15lf,%.15lf)\n", (double) hc[i].x, (double) hc[i].y);
+    // the budget is for the buffers of the writers, on top of what the program already holds
+    size_t baseline = peak_rss();
+    if (max_memory && max_memory <= baseline) {
+        fprintf(stderr, "--max-memory is below the %.1f MiB the program needs to start\n", baseline / 1048576.0);
+        return EXIT_FAILURE;
+    }
+    size_t budget = max_memory ? max_memory - baseline : 0;
+    if (resume && budget) {
+        // every thread of a resumable file holds a whole block
+        if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        size_t fits = budget / (HILBERT_CHECKPOINT_BLOCK_POINTS * 2 * hilbert_dtype_size(dtype));
+        if (fits == 0) {
+            fprintf(stderr, "--max-memory doesn't leave room for one block of a resumable file\n");
+            return EXIT_FAILURE;
+        }
+        if ((size_t) threads > fits) threads = (int) fits;
     }
-    fflush(fp);
-}
 
-int main(void) {
-    // generate 1-15 pseudo-hilbert curves
-    struct space_vec2 *hilbert_curve;
-    for (size_t order = 1; order < 16; order++) {
-        size_t len = hilbert_create(order, &hilbert_curve);
-        assert(len != -1);
+    // generate the pseudo-hilbert curves
+    for (int order = min_order; order <= max_order; order++) {
+        char file_name[64];
+        sprintf(file_name, "o%02d_hilbert%s", order, output_formats[format].suffix);
+        if (format == FORMAT_BINARY && dtype == HILBERT_DTYPE_F4) strcat(file_name, "_f4");
+
+        if (resume) {
+            // the file is opened in place, so whatever an earlier run left in it can be kept
+            char checkpoint_name[72];
+            sprintf(checkpoint_name, "%s.ckpt", file_name);
+            struct hilbert_resume_report report;
+            if (write_hilbert_curve_resumable(order, dtype, threads, file_name, checkpoint_name, &report) != 0) {
+                perror(file_name);
+                return EXIT_FAILURE;
+            }
+            printf("order %d pseudo-hilbert curve written, %zu of %zu blocks kept from an earlier run "
+                   "(%zu damaged)\n", order, report.verified, report.num_blocks, report.damaged);
+            if (max_memory) {
+                printf("order %d plan: resumable blocks, %d threads, peak RSS %.1f MiB of %.1f MiB\n", order, threads,
+                       peak_rss() / 1048576.0, max_memory / 1048576.0);
+            }
+            continue;
+        }
 
-        char file_name[] = "oxx_hilbert";
-        sprintf(file_name, "o%02lli_hilbert", order);
+        if (format == FORMAT_BINARY && max_memory) {
+            FILE *fp = to_stdout ? stdout : fopen(file_name, "wb+");
+            assert(fp != NULL);
+            fflush(fp);
+
+            // the plan goes to stderr when stdout carries the curve, like the progress
+            struct hilbert_plan plan;
+            FILE *report = to_stdout ? stderr : stdout;
+            if (hilbert_plan_curve(order, dtype, threads, fileno(fp), budget, &plan) != 0) {
+                fprintf(stderr, "--max-memory is too small to write the order %d curve\n", order);
+                return EXIT_FAILURE;
+            }
+            fprintf(report, "order %d plan: %s, %d thread%s, %zu points at once, %.1f MiB of buffers\n", order,
+                    strategy_names[plan.strategy], plan.threads, plan.threads == 1 ? "" : "s", plan.chunk_points,
+                    plan.memory / 1048576.0);
+
+            if (write_hilbert_curve_plan(&plan, preallocate, fileno(fp)) == -1) {
+                fprintf(stderr, "failed to write the order %d curve: %s\n", order, strerror(errno));
+                if (!to_stdout) fclose(fp);
+                return EXIT_FAILURE;
+            }
+            if (!to_stdout) fclose(fp);
+            fprintf(report, "order %d pseudo-hilbert curve written, peak RSS %.1f MiB of %.1f MiB\n", order,
+                    peak_rss() / 1048576.0, max_memory / 1048576.0);
+            continue;
+        }
 
-        // write the contents of the hilbert curve to a file
-        FILE *fp = fopen(file_name, "wb+");
+        // write the contents of the hilbert curve to a file, or straight to stdout
+        FILE *fp = to_stdout ? stdout : fopen(file_name, "wb+");
         assert(fp != NULL);
-        write_hilbert_curve(hilbert_curve, len, fp);
-        fclose(fp);
-
-        free(hilbert_curve);
+        if (format == FORMAT_BINARY && to_stdout) {
+            // stdout is usually a pipe into another program, which gets the points without any copies
+            fflush(stdout);
+            size_t len = dtype == HILBERT_DTYPE_F4 ? write_hilbert_curve_float_stream(order, fileno(stdout))
+                                                   : write_hilbert_curve_stream(order, fileno(stdout));
+            if (len == -1) return EXIT_FAILURE; // the reader went away
+        } else if (format == FORMAT_BINARY) {
+            // every thread generates and writes its own part of the file, the curve is never held in memory
+            size_t len = dtype == HILBERT_DTYPE_F4
+                         ? write_hilbert_curve_float_fd(order, threads, preallocate, fileno(fp))
+                         : write_hilbert_curve_fd(order, threads, preallocate, fileno(fp));
+            if (len == -1) {
+                fprintf(stderr, "failed to write the order %d curve: %s\n", order, strerror(errno));
+                return EXIT_FAILURE;
+            }
+        } else if (format == FORMAT_TURNS || format == FORMAT_SEGMENTS_TXT) {
+            size_t len = format == FORMAT_TURNS ? write_hilbert_turns(order, fp)
+                                                : write_hilbert_segments_txt(order, fp);
+            if (len == -1) {
+                fprintf(stderr, "failed to write the order %d curve: %s\n", order, strerror(errno));
+                return EXIT_FAILURE;
+            }
+        } else if (format == FORMAT_NPY || format == FORMAT_ARROW) {
+            size_t len = format == FORMAT_NPY ? write_hilbert_npy(order, dtype, fp)
+                                              : write_hilbert_arrow(order, dtype, fp);
+            if (len == -1) {
+                fprintf(stderr, "failed to write the order %d curve: %s\n", order, strerror(errno));
+                return EXIT_FAILURE;
+            }
+        } else if (format == FORMAT_DELTA) {
+            if (write_hilbert_delta(order, threads, fp) == -1) {
+                fprintf(stderr, "failed to write the order %d curve: %s\n", order, strerror(errno));
+                return EXIT_FAILURE;
+            }
+        } else if (format == FORMAT_TXT || (format >= FORMAT_CSV && format <= FORMAT_SVG)) {
+            static const enum hilbert_text_format text_formats[] = {
+                    [FORMAT_TXT] = HILBERT_TEXT_TXT,
+                    [FORMAT_CSV] = HILBERT_TEXT_CSV,
+                    [FORMAT_JSON] = HILBERT_TEXT_JSON,
+                    [FORMAT_PLY] = HILBERT_TEXT_PLY,
+                    [FORMAT_SVG] = HILBERT_TEXT_SVG,
+            };
+            text.order = order;
+            text.format = text_formats[format];
+            // fixed width formats are written by every thread at once, straight into the file
+            size_t len = (format == FORMAT_TXT || format == FORMAT_CSV) && !to_stdout
+                         ? write_hilbert_text_fd(&text, fileno(fp)) : write_hilbert_text(&text, fp);
+            if (len == -1) {
+                fprintf(stderr, "failed to write the order %d curve: %s\n", order, strerror(errno));
+                return EXIT_FAILURE;
+            }
+        } else {
+            render.order = order;
+            render.format = format == FORMAT_PNG ? HILBERT_IMAGE_PNG : HILBERT_IMAGE_PPM;
+            if (hilbert_render(&render, fp) != 0) {
+                fprintf(stderr, "failed to write the order %d curve: %s\n", order, strerror(errno));
+                return EXIT_FAILURE;
+            }
+        }
+        if (!to_stdout) fclose(fp);
 
-        printf("order %lli pseudo-hilbert curve written\n", order);
+        // progress goes to stderr when stdout carries the curve
+        fprintf(to_stdout ? stderr : stdout, "order %d pseudo-hilbert curve written\n", order);
     }
 
     return EXIT_SUCCESS;
+
+    usage:
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
 }
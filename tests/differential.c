@@ -0,0 +1,1633 @@
+/*
+ * differential.c - Differential tests of every curve engine against hilbert_create
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * hilbert_create is the reference: everything else that produces points (the index based generator, the
+ * generated kernels of every dtype, views, segments, and every writer once its output is read back) has to
+ * match it bit for bit. Orders 1 to DIFF_EXHAUSTIVE_ORDER are compared point by point over the whole curve.
+ * Higher orders can't be created, so random ranges are compared against reference_point, which follows the
+ * same recursion as hilbert_create for a single point with the same geometry functions.
+ *
+ * Keys are checked the other way around: hilbert_index has to undo hilbert_cell, ranges from hilbert_decompose
+ * have to cover exactly the cells of their rectangle, and the key service has to answer like the functions it
+ * serves. Shared tables are attached like another process would, and have to hold the curve. Geographic keys
+ * have to decode to their own cells at every level and lay the curve out on every face of the cube.
+ *
+ * Point engines are compared in chunks on every core. The program prints a line per order and exits with a
+ * failure if anything differs, so it runs under ctest
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <math.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "hilbert.h"
+
+/* DIFFERENTIAL TESTS */
+
+// highest order compared over the whole curve
+#define DIFF_EXHAUSTIVE_ORDER 12
+// highest order whose text output is compared, text is much bigger than binary
+#define DIFF_TEXT_ORDER 10
+// points compared at once by one thread
+#define DIFF_CHUNK_POINTS ((size_t) 1 << 16)
+// highest order whose decompositions are compared with every cell of the curve
+#define DIFF_DECOMPOSE_ORDER 8
+// random places given geographic keys
+#define DIFF_GEO_POINTS 100000
+// level whose cells are compared with hilbert_cell on every face
+#define DIFF_GEO_LEVEL 4
+// random indices given string keys for every order, and rectangles given prefixes for every order up to
+// DIFF_KEY_PREFIX_ORDER
+#define DIFF_KEYS 4096
+#define DIFF_KEY_PREFIX_ORDER 6
+// order and size of the rendered images, with cells a few pixels across and several bands
+#define DIFF_RENDER_ORDER 4
+#define DIFF_RENDER_WIDTH 50
+#define DIFF_RENDER_HEIGHT 37
+// order of the files given to the validator, big enough for several of its chunks of 2^20 points
+#define DIFF_VALIDATE_ORDER 11
+// random rectangles decomposed for every order up to DIFF_DECOMPOSE_ORDER
+#define DIFF_RECTS 64
+// random ranges compared for every order above DIFF_EXHAUSTIVE_ORDER
+#define DIFF_RANGES 16
+#define DIFF_RANGE_POINTS ((size_t) 4096)
+
+static int failures = 0;
+
+// engines run on several threads at once, so failures are counted atomically
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED); \
+        fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fputc('\n', stderr); \
+    } \
+} while (0)
+
+/* REFERENCE */
+
+// finds a single point the way hilbert_create places it: the point of the order below, transformed into its quadrant
+static struct space_vec2 reference_point(int order, size_t index) {
+    static const struct space_vec2 o1_hilbert[] = {
+            POINT_AT(0.25, 0.75),
+            POINT_AT(0.25, 0.25),
+            POINT_AT(0.75, 0.25),
+            POINT_AT(0.75, 0.75),
+    };
+    static const struct space_vec2 scale_origins[] = {
+            POINT_AT(0.0, 1.0),
+            POINT_AT(0.0, 0.0),
+            POINT_AT(1.0, 0.0),
+            POINT_AT(1.0, 1.0),
+    };
+    if (order == 1) return o1_hilbert[index];
+
+    size_t lo_points = HILBERT_NUM_POINTS(order - 1);
+    size_t quadrant = index / lo_points;
+    struct space_vec2 center_point = POINT_AT(0.5, 0.5);
+    struct space_vec2 point = reference_point(order - 1, index % lo_points);
+    if (quadrant == 0) {
+        space_reflect_y(&point, 1, 0.5);
+        space_rotate_c(&point, 1, center_point);
+    }
+    space_scale(&point, 1, 0.5, scale_origins[quadrant]);
+    return point;
+}
+
+/* POINT ENGINES */
+
+// fills 'out' with 'count' points of a curve starting at 'first'
+typedef void (*engine_fn)(int order, size_t first, size_t count, struct space_vec2 *out);
+
+static void engine_range(int order, size_t first, size_t count, struct space_vec2 *out) {
+    hilbert_range(order, first, count, out);
+}
+
+// ranges of every length up to a few tiles, so that kernels start and end in the middle of their tiles
+static void engine_range_pieces(int order, size_t first, size_t count, struct space_vec2 *out) {
+    size_t len = 1;
+    for (size_t i = 0; i < count; i += len, len = len % 601 + 1) {
+        if (len > count - i) len = count - i;
+        hilbert_range(order, first + i, len, &out[i]);
+    }
+}
+
+static void engine_point(int order, size_t first, size_t count, struct space_vec2 *out) {
+    for (size_t i = 0; i < count; i++) out[i] = hilbert_point(order, first + i);
+}
+
+static void engine_cell(int order, size_t first, size_t count, struct space_vec2 *out) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t x, y;
+        hilbert_cell(order, first + i, &x, &y);
+        out[i] = hilbert_cell_point(order, x, y);
+    }
+}
+
+// a view with room for a single tile, so that ranges cross tiles and evict them
+static void engine_view_range(int order, size_t first, size_t count, struct space_vec2 *out) {
+    struct hilbert_view *view = hilbert_view_create(order, 0);
+    assert(view != NULL);
+    size_t len = hilbert_view_get_range(view, first, count, out);
+    CHECK(len == count, "hilbert_view_get_range order %d: %zu of %zu points from %zu", order, len, count, first);
+    hilbert_view_destroy(view);
+}
+
+// single points of a view, backwards so that every tile is decoded from its end
+static void engine_view_get(int order, size_t first, size_t count, struct space_vec2 *out) {
+    struct hilbert_view *view = hilbert_view_create(order, 2 * HILBERT_VIEW_TILE_POINTS * sizeof(struct space_vec2));
+    assert(view != NULL);
+    for (size_t i = count; i-- > 0;) {
+        int result = hilbert_view_get(view, first + i, &out[i]);
+        CHECK(result == 0, "hilbert_view_get order %d failed at %zu", order, first + i);
+    }
+    hilbert_view_destroy(view);
+}
+
+// fixed point from integer math only, converted at the end
+static void engine_fixed(int order, size_t first, size_t count, struct space_vec2 *out) {
+    struct hilbert_fixed_vec2 *fixed = (struct hilbert_fixed_vec2 *) malloc(count * sizeof(struct hilbert_fixed_vec2));
+    assert(fixed != NULL);
+    hilbert_range_fixed(order, first, count, fixed);
+    for (size_t i = 0; i < count; i++) out[i] = hilbert_fixed_point(order, fixed[i]);
+    free(fixed);
+}
+
+// single precision, which holds every point of these orders exactly
+static void engine_float(int order, size_t first, size_t count, struct space_vec2 *out) {
+    struct space_vec2f *points = (struct space_vec2f *) malloc(count * sizeof(struct space_vec2f));
+    assert(points != NULL);
+    int result = hilbert_range_float(order, first, count, points);
+    for (size_t i = 0; i < count; i++) {
+        struct space_vec2 point = POINT_AT(result == 0 ? points[i].x : -1, result == 0 ? points[i].y : -1);
+        out[i] = point;
+    }
+    free(points);
+}
+
+static const struct {
+    const char *name;
+    engine_fn fill;
+} engines[] = {
+        {"hilbert_range", engine_range},
+        {"hilbert_range (pieces)", engine_range_pieces},
+        {"hilbert_point", engine_point},
+        {"hilbert_cell", engine_cell},
+        {"hilbert_view_get_range", engine_view_range},
+        {"hilbert_range_fixed", engine_fixed},
+        {"hilbert_range_float", engine_float},
+        {"hilbert_view_get", engine_view_get},
+};
+
+// ranges of a curve compared by several threads
+struct compare_job {
+    engine_fn fill;
+    int order;
+    const struct space_vec2 *ref; // the whole reference curve, NULL to use reference_point
+    const size_t *firsts, *counts; // the ranges to compare
+    size_t num_ranges;
+    size_t next_range;
+    size_t mismatches;
+    size_t first_mismatch;
+    pthread_mutex_t lock;
+};
+
+static void *compare_thread(void *arg) {
+    struct compare_job *job = (struct compare_job *) arg;
+    struct space_vec2 *got = (struct space_vec2 *) malloc(DIFF_CHUNK_POINTS * sizeof(struct space_vec2));
+    assert(got != NULL);
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t r = job->next_range++;
+        pthread_mutex_unlock(&job->lock);
+        if (r >= job->num_ranges) break;
+
+        size_t first = job->firsts[r], count = job->counts[r];
+        assert(count <= DIFF_CHUNK_POINTS);
+        job->fill(job->order, first, count, got);
+
+        size_t mismatches = 0, first_mismatch = (size_t) -1;
+        for (size_t i = 0; i < count; i++) {
+            struct space_vec2 want = job->ref != NULL ? job->ref[first + i] : reference_point(job->order, first + i);
+            if (memcmp(&got[i], &want, sizeof(struct space_vec2)) != 0) {
+                if (mismatches++ == 0) first_mismatch = first + i;
+            }
+        }
+
+        pthread_mutex_lock(&job->lock);
+        job->mismatches += mismatches;
+        if (first_mismatch < job->first_mismatch) job->first_mismatch = first_mismatch;
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    free(got);
+    return NULL;
+}
+
+// compares ranges of an engine against the reference on every core
+static void compare_ranges(const char *name, engine_fn fill, int order, const struct space_vec2 *ref,
+                           const size_t *firsts, const size_t *counts, size_t num_ranges) {
+    int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+
+    struct compare_job job = {fill, order, ref, firsts, counts, num_ranges, 0, 0, (size_t) -1,
+                              PTHREAD_MUTEX_INITIALIZER};
+    pthread_t *workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    assert(workers != NULL);
+    for (int t = 0; t < threads; t++) pthread_create(&workers[t], NULL, compare_thread, &job);
+    for (int t = 0; t < threads; t++) pthread_join(workers[t], NULL);
+    free(workers);
+    pthread_mutex_destroy(&job.lock);
+
+    CHECK(job.mismatches == 0, "%s order %d: %zu points differ, the first at %zu", name, order, job.mismatches,
+          job.first_mismatch);
+}
+
+// compares every point of an engine against the reference curve, chunk by chunk
+static void compare_engine(const char *name, engine_fn fill, int order, const struct space_vec2 *ref) {
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    size_t num_chunks = (num_points + DIFF_CHUNK_POINTS - 1) / DIFF_CHUNK_POINTS;
+    size_t *firsts = (size_t *) malloc(num_chunks * sizeof(size_t));
+    size_t *counts = (size_t *) malloc(num_chunks * sizeof(size_t));
+    assert(firsts != NULL && counts != NULL);
+    for (size_t c = 0; c < num_chunks; c++) {
+        firsts[c] = c * DIFF_CHUNK_POINTS;
+        counts[c] = num_points - firsts[c] < DIFF_CHUNK_POINTS ? num_points - firsts[c] : DIFF_CHUNK_POINTS;
+    }
+    compare_ranges(name, fill, order, ref, firsts, counts, num_chunks);
+    free(firsts);
+    free(counts);
+}
+
+// compares the points of a curve walked one segment at a time
+static void compare_segments(int order, const struct space_vec2 *ref) {
+    struct hilbert_segment_iter iter;
+    struct hilbert_segment seg;
+    size_t num_points = HILBERT_NUM_POINTS(order), index = 0, mismatches = 0;
+    CHECK(hilbert_segments_begin(&iter, order) == 0, "hilbert_segments_begin order %d", order);
+
+    uint32_t x = 0, y = 0;
+    while (hilbert_segments_next(&iter, &seg)) {
+        if (index == 0) {
+            x = seg.x;
+            y = seg.y;
+            struct space_vec2 point = hilbert_cell_point(order, x, y);
+            mismatches += memcmp(&ref[index++], &point, sizeof(struct space_vec2)) != 0;
+        }
+        mismatches += seg.x != x || seg.y != y;
+        for (size_t s = 0; s < seg.length && index < num_points; s++) {
+            x += (uint32_t) seg.dx;
+            y += (uint32_t) seg.dy;
+            struct space_vec2 point = hilbert_cell_point(order, x, y);
+            mismatches += memcmp(&ref[index++], &point, sizeof(struct space_vec2)) != 0;
+        }
+    }
+    CHECK(index == num_points && mismatches == 0, "segments order %d: %zu of %zu points, %zu differ", order, index,
+          num_points, mismatches);
+}
+
+// compares the generated kernels of every dtype, through hilbert_range_dtype, against reference points
+static void compare_dtypes(int order, size_t first, size_t count, const struct space_vec2 *ref) {
+    static const enum hilbert_dtype dtypes[] = {HILBERT_DTYPE_F8, HILBERT_DTYPE_F4, HILBERT_DTYPE_U2, HILBERT_DTYPE_U4};
+    static const char *names[] = {"f8", "f4", "u2", "u4"};
+    space_pos_t cells = (space_pos_t) ((uint64_t) 1 << order);
+    uint8_t *got = (uint8_t *) malloc(count * 2 * sizeof(double));
+    assert(got != NULL);
+
+    for (size_t d = 0; d < sizeof(dtypes) / sizeof(dtypes[0]); d++) {
+        if (hilbert_range_dtype(order, dtypes[d], first, count, got) != 0) continue; // the dtype can't hold the order
+        size_t mismatches = 0;
+        for (size_t i = 0; i < 2 * count; i++) {
+            space_pos_t want = i % 2 ? ref[i / 2].y : ref[i / 2].x;
+            switch (dtypes[d]) {
+                case HILBERT_DTYPE_F8:
+                    mismatches += ((double *) got)[i] != want;
+                    break;
+                case HILBERT_DTYPE_F4:
+                    mismatches += ((float *) got)[i] != (float) want;
+                    break;
+                case HILBERT_DTYPE_U2:
+                    mismatches += ((uint16_t *) got)[i] != (uint16_t) (want * cells);
+                    break;
+                case HILBERT_DTYPE_U4:
+                    mismatches += ((uint32_t *) got)[i] != (uint32_t) (want * cells);
+                    break;
+            }
+        }
+        CHECK(mismatches == 0, "hilbert_range_dtype (%s) order %d: %zu coordinates differ from %zu", names[d], order,
+              mismatches, first);
+    }
+    free(got);
+}
+
+/* OUTPUT ENGINES */
+
+// creates a temporary file, its name goes into 'path'
+static FILE *temp_file(char *path, size_t size) {
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, size, "%s/hilbert_differential_XXXXXX", dir != NULL ? dir : "/tmp");
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    FILE *fp = fdopen(fd, "w+b");
+    assert(fp != NULL);
+    return fp;
+}
+
+// finds an unused path for a socket next to the temporary files, short enough for the address of a socket
+static void temp_socket(char *path, size_t size) {
+    FILE *fp = temp_file(path, size);
+    fclose(fp);
+    unlink(path);
+}
+
+// reads everything from the start of a file
+static uint8_t *read_all(FILE *fp, size_t *size) {
+    fflush(fp);
+    fseek(fp, 0, SEEK_END);
+    *size = (size_t) ftell(fp);
+    rewind(fp);
+    uint8_t *data = (uint8_t *) malloc(*size + 1);
+    assert(data != NULL);
+    size_t len = fread(data, 1, *size, fp);
+    CHECK(len == *size, "fread: %zu of %zu bytes", len, *size);
+    return data;
+}
+
+// checks that a file holds exactly 'expected'
+static void compare_bytes(const char *name, int order, FILE *fp, const void *expected, size_t expected_size) {
+    size_t size;
+    uint8_t *data = read_all(fp, &size);
+    CHECK(size == expected_size && memcmp(data, expected, size) == 0, "%s order %d: %zu bytes instead of %zu%s",
+          name, order, size, expected_size, size == expected_size ? ", contents differ" : "");
+    free(data);
+}
+
+// writes a curve in a text format with printf, the way every exporter has to write it
+static void printf_text(enum hilbert_text_format format, const struct space_vec2 *ref, size_t num_points, FILE *fp) {
+    if (format == HILBERT_TEXT_CSV) fputs("x,y\n", fp);
+    if (format == HILBERT_TEXT_JSON) fputs("[\n", fp);
+    if (format == HILBERT_TEXT_PLY) {
+        fprintf(fp, "ply\nformat ascii 1.0\ncomment pseudo-hilbert curve\nelement vertex %zu\nproperty double x\n"
+                    "property double y\nproperty double z\nelement edge %zu\nproperty uint vertex1\n"
+                    "property uint vertex2\nend_header\n", num_points, num_points - 1);
+    }
+    if (format == HILBERT_TEXT_SVG) {
+        fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"1024\" "
+              "height=\"1024\" viewBox=\"0 0 1 1\">\n<path fill=\"none\" stroke=\"black\" stroke-width=\"1\" "
+              "vector-effect=\"non-scaling-stroke\" d=\"", fp);
+    }
+    for (size_t i = 0; i < num_points; i++) {
+        double x = ref[i].x, y = ref[i].y;
+        if (format == HILBERT_TEXT_CSV) fprintf(fp, "%.15f,%.15f\n", x, y);
+        if (format == HILBERT_TEXT_JSON) fprintf(fp, "[%.15f,%.15f]%s\n", x, y, i + 1 < num_points ? "," : "");
+        if (format == HILBERT_TEXT_PLY) fprintf(fp, "%.15f %.15f 0\n", x, y);
+        if (format == HILBERT_TEXT_SVG) fprintf(fp, "%s%.15f %.15f", i == 0 ? "M" : "\nL", x, y);
+    }
+    for (size_t i = 0; format == HILBERT_TEXT_PLY && i + 1 < num_points; i++) fprintf(fp, "%zu %zu\n", i, i + 1);
+    if (format == HILBERT_TEXT_JSON) fputs("]\n", fp);
+    if (format == HILBERT_TEXT_SVG) fputs("\"/>\n</svg>\n", fp);
+}
+
+// checks the points that the reader decodes out of a file
+static void compare_file(const char *name, int order, const char *path, const struct space_vec2 *ref) {
+    struct hilbert_file file;
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    if (hilbert_file_open(&file, path) != 0) {
+        CHECK(0, "%s order %d: the reader can't open it", name, order);
+        return;
+    }
+    CHECK(file.num_points == num_points && file.order == order, "%s order %d: read back %zu points of order %d",
+          name, order, file.num_points, file.order);
+
+    struct space_vec2 *got = (struct space_vec2 *) malloc(DIFF_CHUNK_POINTS * sizeof(struct space_vec2));
+    assert(got != NULL);
+    size_t mismatches = 0;
+    for (size_t first = 0; first < num_points && file.num_points == num_points; first += DIFF_CHUNK_POINTS) {
+        size_t len = num_points - first < DIFF_CHUNK_POINTS ? num_points - first : DIFF_CHUNK_POINTS;
+        if (hilbert_file_decode(&file, first, len, got) != len) {
+            mismatches += len;
+            continue;
+        }
+        for (size_t i = 0; i < len; i++) mismatches += memcmp(&got[i], &ref[first + i], sizeof(struct space_vec2)) != 0;
+    }
+    CHECK(mismatches == 0, "%s order %d: %zu points differ", name, order, mismatches);
+    free(got);
+    hilbert_file_close(&file);
+}
+
+// reads a pipe until the writer closes it
+struct pipe_reader {
+    int fd;
+    uint8_t *data;
+    size_t size, cap;
+};
+
+static void *pipe_thread(void *arg) {
+    struct pipe_reader *reader = (struct pipe_reader *) arg;
+    for (;;) {
+        if (reader->cap - reader->size < 65536) {
+            reader->cap = reader->cap ? reader->cap * 2 : 1 << 20;
+            reader->data = (uint8_t *) realloc(reader->data, reader->cap);
+            assert(reader->data != NULL);
+        }
+        ssize_t len = read(reader->fd, &reader->data[reader->size], reader->cap - reader->size);
+        if (len <= 0) break;
+        reader->size += (size_t) len;
+    }
+    return NULL;
+}
+
+// the pixel of the center of a cell along one axis, the way the renderer picks it
+static int64_t render_reference_pixel(int order, uint32_t cell, uint32_t size) {
+    return (int64_t) (((2 * (uint64_t) cell + 1) * size) >> (order + 1));
+}
+
+// draws the curve line by line with bresenham's algorithm into rgb pixels, black on white
+static void render_reference(int order, uint32_t width, uint32_t height, uint8_t *pixels) {
+    memset(pixels, 255, (size_t) width * height * 3);
+    uint32_t cx, cy;
+    hilbert_cell(order, 0, &cx, &cy);
+    int64_t x1 = render_reference_pixel(order, cx, width), y1 = render_reference_pixel(order, cy, height);
+    memset(&pixels[((size_t) y1 * width + (size_t) x1) * 3], 0, 3);
+    for (size_t i = 1; i < HILBERT_NUM_POINTS(order); i++) {
+        int64_t x0 = x1, y0 = y1;
+        hilbert_cell(order, i, &cx, &cy);
+        x1 = render_reference_pixel(order, cx, width);
+        y1 = render_reference_pixel(order, cy, height);
+        int64_t dx = x1 > x0 ? x1 - x0 : x0 - x1, sx = x0 < x1 ? 1 : -1;
+        int64_t dy = y1 > y0 ? y0 - y1 : y1 - y0, sy = y0 < y1 ? 1 : -1;
+        for (int64_t err = dx + dy;;) {
+            memset(&pixels[((size_t) y0 * width + (size_t) x0) * 3], 0, 3);
+            if (x0 == x1 && y0 == y1) break;
+            int64_t e2 = 2 * err;
+            if (e2 >= dy) {
+                err += dy;
+                x0 += sx;
+            }
+            if (e2 <= dx) {
+                err += dx;
+                y0 += sy;
+            }
+        }
+    }
+}
+
+static uint32_t get_be32(const uint8_t *in) {
+    return (uint32_t) in[0] << 24 | (uint32_t) in[1] << 16 | (uint32_t) in[2] << 8 | in[3];
+}
+
+static uint32_t png_crc(const uint8_t *data, size_t len) {
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int k = 0; k < 8; k++) crc = crc & 1 ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+    }
+    return crc ^ 0xffffffffu;
+}
+
+// reads the pixels of a png with stored deflate blocks and no filtering, the way hilbert_render writes them,
+// checking the signature, the crc of every chunk and the adler32 of the image data. returns -1 if anything is off
+static int png_pixels(const uint8_t *png, size_t size, uint32_t width, uint32_t height, uint8_t *pixels) {
+    static const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    if (size < 8 || memcmp(png, signature, 8) != 0) return -1;
+
+    // every chunk, with the image data of the IDAT chunks gathered together
+    uint8_t *zlib = (uint8_t *) malloc(size);
+    assert(zlib != NULL);
+    size_t zlib_len = 0, pos = 8;
+    int ended = 0, result = -1;
+    while (!ended && pos + 12 <= size) {
+        uint32_t len = get_be32(&png[pos]);
+        if (len > size - pos - 12 || png_crc(&png[pos + 4], len + 4) != get_be32(&png[pos + 8 + len])) break;
+        const uint8_t *type = &png[pos + 4], *data = &png[pos + 8];
+        if (memcmp(type, "IHDR", 4) == 0 && (len != 13 || get_be32(data) != width || get_be32(&data[4]) != height ||
+                                             data[8] != 8 || data[9] != 2)) {
+            break;
+        }
+        if (memcmp(type, "IDAT", 4) == 0) {
+            memcpy(&zlib[zlib_len], data, len);
+            zlib_len += len;
+        }
+        ended = memcmp(type, "IEND", 4) == 0 && len == 0;
+        pos += 12 + len;
+    }
+
+    // stored blocks hold the rows as they are, each after its filter byte
+    size_t stride = 1 + (size_t) width * 3, raw_len = 0, zpos = 2;
+    uint8_t *raw = (uint8_t *) malloc(stride * height);
+    assert(raw != NULL);
+    int final = 0;
+    if (ended && pos == size && zlib_len >= 6 && zlib[0] == 0x78) {
+        while (!final && zpos + 5 <= zlib_len) {
+            final = zlib[zpos] & 1;
+            size_t block = zlib[zpos + 1] | (size_t) zlib[zpos + 2] << 8;
+            if ((zlib[zpos] >> 1) != 0 || (block ^ 0xffff) != (zlib[zpos + 3] | (size_t) zlib[zpos + 4] << 8) ||
+                block > zlib_len - zpos - 5 || block > stride * height - raw_len) {
+                break;
+            }
+            memcpy(&raw[raw_len], &zlib[zpos + 5], block);
+            raw_len += block;
+            zpos += 5 + block;
+        }
+    }
+    if (final && raw_len == stride * height && zpos + 4 == zlib_len) {
+        uint32_t a = 1, b = 0;
+        for (size_t i = 0; i < raw_len; i++) {
+            a = (a + raw[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        result = get_be32(&zlib[zpos]) == (b << 16 | a) ? 0 : -1;
+        for (uint32_t r = 0; r < height && result == 0; r++) {
+            if (raw[r * stride] != 0) result = -1;
+            memcpy(&pixels[r * (stride - 1)], &raw[r * stride + 1], stride - 1);
+        }
+    }
+    free(raw);
+    free(zlib);
+    return result;
+}
+
+// an image in both formats, over several bands and threads, against the curve drawn line by line
+static void compare_render(void) {
+    const uint32_t width = DIFF_RENDER_WIDTH, height = DIFF_RENDER_HEIGHT;
+    size_t pixels_size = (size_t) width * height * 3;
+    uint8_t *ref = (uint8_t *) malloc(pixels_size), *pixels = (uint8_t *) malloc(pixels_size);
+    assert(ref != NULL && pixels != NULL);
+    render_reference(DIFF_RENDER_ORDER, width, height, ref);
+
+    char path[256];
+    struct hilbert_render_options options = {DIFF_RENDER_ORDER, width, height, 0, 3, 4, HILBERT_IMAGE_PPM};
+    FILE *fp = temp_file(path, sizeof(path));
+    CHECK(hilbert_render(&options, fp) == 0, "hilbert_render (ppm) failed");
+    size_t size;
+    uint8_t *ppm = read_all(fp, &size);
+    fclose(fp);
+    char header[32];
+    int header_len = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", width, height);
+    CHECK(size == (size_t) header_len + pixels_size && memcmp(ppm, header, (size_t) header_len) == 0 &&
+          memcmp(&ppm[header_len], ref, pixels_size) == 0, "hilbert_render (ppm): the image isn't the curve");
+
+    fp = fopen(path, "w+b");
+    assert(fp != NULL);
+    options.format = HILBERT_IMAGE_PNG;
+    CHECK(hilbert_render(&options, fp) == 0, "hilbert_render (png) failed");
+    uint8_t *png = read_all(fp, &size);
+    fclose(fp);
+    unlink(path);
+    int result = png_pixels(png, size, width, height, pixels);
+    CHECK(result == 0, "hilbert_render (png): not a valid png of stored blocks");
+    CHECK(result != 0 || memcmp(pixels, &ppm[header_len], pixels_size) == 0,
+          "hilbert_render (png): the pixels differ from the ppm");
+
+    // a full disk has to be reported, and so do options that make no image
+    fp = fopen("/dev/full", "wb");
+    if (fp != NULL) {
+        CHECK(hilbert_render(&options, fp) == -1, "hilbert_render ignored a full disk");
+        fclose(fp);
+    }
+    options.width = 0;
+    CHECK(hilbert_render(&options, stdout) == -1 && errno == EINVAL, "hilbert_render took a width of 0");
+
+    free(png);
+    free(ppm);
+    free(pixels);
+    free(ref);
+}
+
+// validates a file, after changing 'count' points from 'index' on and cutting it to 'num_points' points
+static int validate_changed(const char *path, size_t num_points, size_t index, const struct space_vec2 *points,
+                            size_t count, int threads, struct hilbert_validate_report *report) {
+    int fd = open(path, O_RDWR);
+    assert(fd >= 0);
+    ssize_t len = 0;
+    if (count > 0) len = pwrite(fd, points, count * sizeof(struct space_vec2), (off_t) (index * sizeof(*points)));
+    int result = ftruncate(fd, (off_t) (num_points * sizeof(struct space_vec2)));
+    close(fd);
+    CHECK(len == (ssize_t) (count * sizeof(struct space_vec2)) && result == 0, "changing %s failed", path);
+
+    struct hilbert_file file;
+    if (hilbert_file_open(&file, path) != 0) {
+        CHECK(0, "hilbert_file_open can't open %s", path);
+        return 0;
+    }
+    struct hilbert_validate_options options = {0, threads, 0, 0};
+    result = hilbert_validate(&file, &options, report);
+    hilbert_file_close(&file);
+    return result;
+}
+
+// the validator against a valid file and files with one thing wrong with them, where chunks meet
+static void compare_validate(void) {
+    const int order = DIFF_VALIDATE_ORDER;
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    // a chunk of the validator starts here, and it is a seam of the curve, entering the last quadrant of 4^10
+    size_t seam = 3 * ((size_t) 1 << 20);
+    char path[256];
+    FILE *fp = temp_file(path, sizeof(path));
+    size_t written = write_hilbert_curve_fd(order, 0, 0, fileno(fp));
+    fclose(fp);
+    CHECK(written == num_points, "write_hilbert_curve_fd order %d for the validator", order);
+
+    struct hilbert_validate_report report;
+    struct space_vec2 points[2], moved;
+    hilbert_range(order, seam - 1, 2, points);
+    int result;
+    for (int threads = 1; threads <= 3; threads += 2) {
+        result = validate_changed(path, num_points, 0, NULL, 0, threads, &report);
+        CHECK(result == 0 && report.bad_points + report.bad_steps + report.repeated + report.missing == 0 &&
+              report.first_error == (size_t) -1, "hilbert_validate (%d threads) rejected a valid file", threads);
+    }
+
+    // the two points either side of where chunks meet, swapped
+    struct space_vec2 swapped[2] = {points[1], points[0]};
+    result = validate_changed(path, num_points, seam - 1, swapped, 2, 3, &report);
+    CHECK(result != 0 && report.bad_steps > 0 && report.repeated == 0 && report.missing == 0 &&
+          report.first_error >= seam - 2 && report.first_error <= seam, "hilbert_validate took swapped points");
+    validate_changed(path, num_points, seam - 1, points, 2, 3, &report);
+
+    // two whole chunks swapped, where every step inside them is still right and only the stitching can tell
+    size_t chunk = (size_t) 1 << 20;
+    struct space_vec2 *chunks = (struct space_vec2 *) malloc(2 * chunk * sizeof(struct space_vec2));
+    assert(chunks != NULL);
+    hilbert_range(order, 2 * chunk, chunk, chunks);
+    hilbert_range(order, chunk, chunk, &chunks[chunk]);
+    result = validate_changed(path, num_points, chunk, chunks, 2 * chunk, 3, &report);
+    CHECK(result != 0 && report.bad_steps == 3 && report.repeated == 0 && report.bad_points == 0,
+          "hilbert_validate took swapped chunks, %zu bad steps", report.bad_steps);
+    hilbert_range(order, chunk, 2 * chunk, chunks);
+    validate_changed(path, num_points, chunk, chunks, 2 * chunk, 3, &report);
+    free(chunks);
+
+    // the first point of a chunk in the cell of the last point of the one before
+    result = validate_changed(path, num_points, seam, points, 1, 3, &report);
+    CHECK(result != 0 && report.repeated == 1 && report.missing == 1, "hilbert_validate took a duplicated point");
+    validate_changed(path, num_points, seam, &points[1], 1, 3, &report);
+
+    // a point a little off the center of its cell
+    moved = points[1];
+    moved.x += 1e-9;
+    result = validate_changed(path, num_points, seam, &moved, 1, 3, &report);
+    CHECK(result != 0 && report.bad_points == 1 && report.first_error == seam,
+          "hilbert_validate took an off-center point");
+    validate_changed(path, num_points, seam, &points[1], 1, 3, &report);
+
+    // one point short
+    result = validate_changed(path, num_points - 1, 0, NULL, 0, 3, &report);
+    CHECK(result != 0 && report.wrong_count, "hilbert_validate took a truncated file");
+    unlink(path);
+}
+
+// a file whose sizes were changed to wrap the reader's bounds checks has to be rejected, not read past its end
+static void compare_corrupt(const char *name, const uint8_t *data, size_t size) {
+    char path[256];
+    FILE *fp = temp_file(path, sizeof(path));
+    fwrite(data, 1, size, fp);
+    fclose(fp);
+    struct hilbert_file file;
+    int opened = hilbert_file_open(&file, path) == 0;
+    CHECK(!opened, "hilbert_file_open (%s): opened a file with %zu points", name, opened ? file.num_points : 0);
+    if (opened) hilbert_file_close(&file);
+    unlink(path);
+}
+
+// arrow and delta files with row and point counts that overflow the sizes computed from them
+static void compare_corrupt_files(void) {
+    const int order = 4;
+    const uint64_t num_points = HILBERT_NUM_POINTS(order), huge = (uint64_t) 1 << 61;
+    char path[256];
+    size_t size;
+
+    // every count of rows of the record batch, which the metadata holds as a 64 bit integer
+    FILE *fp = temp_file(path, sizeof(path));
+    write_hilbert_arrow(order, HILBERT_DTYPE_F8, fp);
+    uint8_t *data = read_all(fp, &size);
+    fclose(fp);
+    unlink(path);
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+        uint64_t value;
+        memcpy(&value, &data[i], 8);
+        if (value == num_points) memcpy(&data[i], &huge, 8);
+    }
+    compare_corrupt("arrow rows", data, size);
+    free(data);
+
+    // the point count of a delta file, which the footer holds 24 bytes from the end
+    fp = temp_file(path, sizeof(path));
+    write_hilbert_delta(order, 1, fp);
+    data = read_all(fp, &size);
+    fclose(fp);
+    unlink(path);
+    // a count just short of 2^64, whose rounding up to whole blocks wraps around to no blocks, with an empty index
+    uint64_t wrapping = ~(uint64_t) 0, index = size - 24;
+    memcpy(&data[size - 24], &wrapping, 8);
+    memcpy(&data[size - 16], &index, 8);
+    compare_corrupt("delta points", data, size);
+    free(data);
+
+    // resumable files whose bytes don't fit in a file offset, refused before either file is opened
+    char checkpoint[272];
+    fp = temp_file(path, sizeof(path));
+    fclose(fp);
+    unlink(path);
+    snprintf(checkpoint, sizeof(checkpoint), "%s.ckpt", path);
+    struct hilbert_resume_report report;
+    int result = write_hilbert_curve_resumable(HILBERT_MAX_ORDER, HILBERT_DTYPE_F8, 1, path, checkpoint, &report);
+    CHECK(result == -1 && errno == EFBIG && access(path, F_OK) != 0,
+          "write_hilbert_curve_resumable took order %d", HILBERT_MAX_ORDER);
+    unlink(path);
+    unlink(checkpoint);
+
+    // a record that a worker can't append reports the errno of that worker: the order 1 f4 curve and the header
+    // of its checkpoint are both 32 bytes, so with files limited to 32 bytes only the record fails to be written
+    result = write_hilbert_curve_resumable(1, HILBERT_DTYPE_F4, 1, path, checkpoint, &report);
+    CHECK(result == 0 && truncate(checkpoint, 32) == 0, "write_hilbert_curve_resumable order 1 (f4) failed");
+    struct rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    struct rlimit small = {32, limit.rlim_max};
+    void (*handler)(int) = signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &small);
+    errno = 0;
+    result = write_hilbert_curve_resumable(1, HILBERT_DTYPE_F4, 3, path, checkpoint, &report);
+    int error = errno;
+    setrlimit(RLIMIT_FSIZE, &limit);
+    signal(SIGXFSZ, handler);
+    CHECK(result == -1 && error == EFBIG, "write_hilbert_curve_resumable with a record past the file size limit: %s",
+          strerror(error));
+    unlink(path);
+    unlink(checkpoint);
+}
+
+// checks the turning points and the straight segments that the writers find against those of the reference points
+static void compare_turns(int order, const struct space_vec2 *ref) {
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    double cells = (double) ((uint64_t) 1 << order);
+    struct space_vec2 *turns = (struct space_vec2 *) malloc(num_points * sizeof(struct space_vec2));
+    assert(turns != NULL);
+    char path[4096];
+    FILE *fp = temp_file(path, sizeof(path));
+
+    // a segment runs from 'start' for as long as every step goes the same way, the last point ends the curve
+    size_t start = 0, num_turns = 0, num_segments = 0;
+    for (size_t i = 1; i < num_points; i++) {
+        int64_t dx = (int64_t) (ref[i].x * cells) - (int64_t) (ref[i - 1].x * cells);
+        int64_t dy = (int64_t) (ref[i].y * cells) - (int64_t) (ref[i - 1].y * cells);
+        if (i + 1 < num_points && (int64_t) (ref[i + 1].x * cells) - (int64_t) (ref[i].x * cells) == dx &&
+            (int64_t) (ref[i + 1].y * cells) - (int64_t) (ref[i].y * cells) == dy) {
+            continue;
+        }
+        turns[num_turns++] = ref[start];
+        fprintf(fp, "(%.15f,%.15f) %d %d %zu\n", ref[start].x, ref[start].y, (int) dx, (int) dy, i - start);
+        num_segments++;
+        start = i;
+    }
+    turns[num_turns++] = ref[start];
+    size_t txt_size;
+    uint8_t *txt = read_all(fp, &txt_size);
+    fclose(fp);
+
+    fp = fopen(path, "w+b");
+    assert(fp != NULL);
+    size_t len = write_hilbert_turns(order, fp);
+    CHECK(len == num_turns, "write_hilbert_turns order %d: %zu turns instead of %zu", order, len, num_turns);
+    compare_bytes("write_hilbert_turns", order, fp, turns, num_turns * sizeof(struct space_vec2));
+    fclose(fp);
+
+    fp = fopen(path, "w+b");
+    assert(fp != NULL);
+    len = write_hilbert_segments_txt(order, fp);
+    CHECK(len == num_segments, "write_hilbert_segments_txt order %d: %zu segments instead of %zu", order, len,
+          num_segments);
+    compare_bytes("write_hilbert_segments_txt", order, fp, txt, txt_size);
+    fclose(fp);
+
+    // a full disk has to be reported by both
+    fp = fopen("/dev/full", "wb");
+    if (fp != NULL) {
+        CHECK(write_hilbert_turns(order, fp) == (size_t) -1, "write_hilbert_turns order %d ignored a full disk", order);
+        fclose(fp);
+    }
+    fp = fopen("/dev/full", "wb");
+    if (fp != NULL) {
+        CHECK(write_hilbert_segments_txt(order, fp) == (size_t) -1,
+              "write_hilbert_segments_txt order %d ignored a full disk", order);
+        fclose(fp);
+    }
+    unlink(path);
+    free(txt);
+    free(turns);
+}
+
+// compares everything that writes a curve against the bytes of write_hilbert_curve and the reference points
+static void compare_writers(int order, struct space_vec2 *ref) {
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    size_t size = num_points * sizeof(struct space_vec2);
+    char path[4096];
+
+    // write_hilbert_curve is the reference for every binary writer
+    FILE *fp = temp_file(path, sizeof(path));
+    write_hilbert_curve(ref, num_points, fp);
+    compare_bytes("write_hilbert_curve", order, fp, ref, size);
+    compare_file("hilbert_file_open (raw)", order, path, ref);
+    fclose(fp);
+    unlink(path);
+
+    // positional writes from every thread, with and without preallocation
+    static const int thread_counts[] = {1, 3};
+    for (int t = 0; t < 2; t++) {
+        for (int preallocate = 0; preallocate < 2; preallocate++) {
+            fp = temp_file(path, sizeof(path));
+            size_t len = write_hilbert_curve_fd(order, thread_counts[t], preallocate, fileno(fp));
+            CHECK(len == num_points, "write_hilbert_curve_fd order %d: %zu points", order, len);
+            compare_bytes("write_hilbert_curve_fd", order, fp, ref, size);
+            fclose(fp);
+            unlink(path);
+        }
+    }
+
+    // streaming into a file, then into a pipe with vmsplice
+    fp = temp_file(path, sizeof(path));
+    CHECK(write_hilbert_curve_stream(order, fileno(fp)) == num_points, "write_hilbert_curve_stream order %d", order);
+    compare_bytes("write_hilbert_curve_stream (file)", order, fp, ref, size);
+    fclose(fp);
+    unlink(path);
+
+    int fds[2];
+    int result = pipe(fds);
+    CHECK(result == 0, "pipe: %s", strerror(errno));
+    if (result != 0) return;
+    struct pipe_reader reader = {fds[0], NULL, 0, 0};
+    pthread_t thread;
+    pthread_create(&thread, NULL, pipe_thread, &reader);
+    size_t len = write_hilbert_curve_stream(order, fds[1]);
+    close(fds[1]);
+    pthread_join(thread, NULL);
+    close(fds[0]);
+    CHECK(len == num_points && reader.size == size && memcmp(reader.data, ref, size) == 0,
+          "write_hilbert_curve_stream (pipe) order %d: %zu bytes instead of %zu", order, reader.size, size);
+    free(reader.data);
+
+    // every strategy that a plan can pick, into a file under a tight budget and into a pipe with and without room
+    // for the whole curve
+    struct hilbert_plan plan;
+    fp = temp_file(path, sizeof(path));
+    result = hilbert_plan_curve(order, HILBERT_DTYPE_F8, 3, fileno(fp), 3 * 4096 * sizeof(struct space_vec2), &plan);
+    CHECK(result == 0 && plan.strategy == HILBERT_STRATEGY_POSITIONAL, "hilbert_plan_curve (file) order %d", order);
+    len = write_hilbert_curve_plan(&plan, 0, fileno(fp));
+    CHECK(len == num_points, "write_hilbert_curve_plan (positional) order %d: %zu points", order, len);
+    compare_bytes("write_hilbert_curve_plan (positional)", order, fp, ref, size);
+    fclose(fp);
+    unlink(path);
+
+    static const size_t pipe_budgets[] = {0, 65536};
+    for (int b = 0; b < 2; b++) {
+        result = pipe(fds);
+        CHECK(result == 0, "pipe: %s", strerror(errno));
+        if (result != 0) continue;
+        result = hilbert_plan_curve(order, HILBERT_DTYPE_F8, 3, fds[1], pipe_budgets[b], &plan);
+        CHECK(result == 0, "hilbert_plan_curve (pipe) order %d", order);
+        struct pipe_reader planned = {fds[0], NULL, 0, 0};
+        pthread_create(&thread, NULL, pipe_thread, &planned);
+        len = write_hilbert_curve_plan(&plan, 0, fds[1]);
+        close(fds[1]);
+        pthread_join(thread, NULL);
+        close(fds[0]);
+        CHECK(len == num_points && planned.size == size && memcmp(planned.data, ref, size) == 0,
+              "write_hilbert_curve_plan (%s) order %d: %zu bytes instead of %zu",
+              plan.strategy == HILBERT_STRATEGY_MEMORY ? "memory" : "stream", order, planned.size, size);
+        free(planned.data);
+    }
+
+    // the same in single precision, against the reference points rounded to floats (which is exact)
+    struct space_vec2f *floats = (struct space_vec2f *) malloc(num_points * sizeof(struct space_vec2f));
+    assert(floats != NULL);
+    for (size_t i = 0; i < num_points; i++) {
+        floats[i].x = (float) ref[i].x;
+        floats[i].y = (float) ref[i].y;
+    }
+    fp = temp_file(path, sizeof(path));
+    len = write_hilbert_curve_float_fd(order, 3, 0, fileno(fp));
+    CHECK(len == num_points, "write_hilbert_curve_float_fd order %d: %zu points", order, len);
+    compare_bytes("write_hilbert_curve_float_fd", order, fp, floats, num_points * sizeof(struct space_vec2f));
+    fclose(fp);
+    unlink(path);
+
+    fp = temp_file(path, sizeof(path));
+    len = write_hilbert_curve_float_stream(order, fileno(fp));
+    CHECK(len == num_points, "write_hilbert_curve_float_stream order %d: %zu points", order, len);
+    compare_bytes("write_hilbert_curve_float_stream", order, fp, floats, num_points * sizeof(struct space_vec2f));
+    fclose(fp);
+    unlink(path);
+    free(floats);
+
+    // resumable output, written from scratch and then again after damaging its last block
+    char checkpoint[4112];
+    fp = temp_file(path, sizeof(path));
+    snprintf(checkpoint, sizeof(checkpoint), "%s.ckpt", path);
+    struct hilbert_resume_report report;
+    result = write_hilbert_curve_resumable(order, HILBERT_DTYPE_F8, 3, path, checkpoint, &report);
+    CHECK(result == 0 && report.generated == report.num_blocks, "write_hilbert_curve_resumable order %d: %zu of "
+          "%zu blocks written", order, report.generated, report.num_blocks);
+    compare_bytes("write_hilbert_curve_resumable", order, fp, ref, size);
+
+    fseek(fp, (long) (size - 1), SEEK_SET);
+    fputc(0x55, fp);
+    fflush(fp);
+    result = write_hilbert_curve_resumable(order, HILBERT_DTYPE_F8, 3, path, checkpoint, &report);
+    CHECK(result == 0 && report.damaged == 1 && report.verified == report.num_blocks - 1,
+          "write_hilbert_curve_resumable (resumed) order %d: %zu blocks kept, %zu damaged", order, report.verified,
+          report.damaged);
+    compare_bytes("write_hilbert_curve_resumable (resumed)", order, fp, ref, size);
+    fclose(fp);
+    unlink(path);
+    unlink(checkpoint);
+
+    // file formats that the reader decodes back into points
+    fp = temp_file(path, sizeof(path));
+    write_hilbert_npy(order, HILBERT_DTYPE_F8, fp);
+    compare_file("write_hilbert_npy", order, path, ref);
+    fclose(fp);
+    unlink(path);
+
+    fp = temp_file(path, sizeof(path));
+    write_hilbert_arrow(order, HILBERT_DTYPE_F8, fp);
+    compare_file("write_hilbert_arrow", order, path, ref);
+    fclose(fp);
+    unlink(path);
+
+    fp = temp_file(path, sizeof(path));
+    write_hilbert_delta(order, 0, fp);
+    compare_file("write_hilbert_delta", order, path, ref);
+    fclose(fp);
+    unlink(path);
+
+    // integer cells only hold the curve exactly up to the order of their type
+    if (order <= 16) {
+        fp = temp_file(path, sizeof(path));
+        write_hilbert_npy(order, HILBERT_DTYPE_U2, fp);
+        compare_file("write_hilbert_npy (u2)", order, path, ref);
+        fclose(fp);
+        unlink(path);
+    }
+
+    // text straight from the generator has to match the text of the reference points
+    if (order <= DIFF_TEXT_ORDER) {
+        fp = temp_file(path, sizeof(path));
+        write_hilbert_curve_txt(ref, num_points, fp);
+        size_t txt_size;
+        uint8_t *txt = read_all(fp, &txt_size);
+        fclose(fp);
+        unlink(path);
+
+        fp = temp_file(path, sizeof(path));
+        struct hilbert_text_options text = {order, HILBERT_TEXT_TXT, 0, 0};
+        write_hilbert_text(&text, fp);
+        compare_bytes("write_hilbert_text", order, fp, txt, txt_size);
+        fclose(fp);
+
+        fp = fopen(path, "w+b");
+        assert(fp != NULL);
+        write_hilbert_text_fd(&text, fileno(fp));
+        compare_bytes("write_hilbert_text_fd", order, fp, txt, txt_size);
+        fclose(fp);
+
+        fp = fopen(path, "w+b");
+        assert(fp != NULL);
+        write_hilbert_curve_txt_parallel(ref, num_points, 3, fp);
+        compare_bytes("write_hilbert_curve_txt_parallel", order, fp, txt, txt_size);
+        fclose(fp);
+        free(txt);
+
+        // every digit of every coordinate, which printf also gets exactly right
+        fp = fopen(path, "w+b");
+        assert(fp != NULL);
+        fputs("x,y\n", fp);
+        for (size_t i = 0; i < num_points; i++) fprintf(fp, "%.*f,%.*f\n", order + 1, ref[i].x, order + 1, ref[i].y);
+        txt = read_all(fp, &txt_size);
+        fclose(fp);
+
+        fp = fopen(path, "w+b");
+        assert(fp != NULL);
+        text.format = HILBERT_TEXT_CSV;
+        text.precision = HILBERT_TEXT_EXACT;
+        write_hilbert_text_fd(&text, fileno(fp));
+        compare_bytes("write_hilbert_text_fd (exact)", order, fp, txt, txt_size);
+        fclose(fp);
+        free(txt);
+
+        // every exporter, formatted on several threads
+        static const char *format_names[] = {"txt", "csv", "json", "ply", "svg"};
+        for (int format = HILBERT_TEXT_CSV; format <= HILBERT_TEXT_SVG; format++) {
+            fp = fopen(path, "w+b");
+            assert(fp != NULL);
+            printf_text((enum hilbert_text_format) format, ref, num_points, fp);
+            txt = read_all(fp, &txt_size);
+            fclose(fp);
+
+            char name[64];
+            snprintf(name, sizeof(name), "write_hilbert_text (%s)", format_names[format]);
+            fp = fopen(path, "w+b");
+            assert(fp != NULL);
+            struct hilbert_text_options options = {order, (enum hilbert_text_format) format, 0, 3};
+            CHECK(write_hilbert_text(&options, fp) == num_points, "%s order %d failed", name, order);
+            compare_bytes(name, order, fp, txt, txt_size);
+            fclose(fp);
+            free(txt);
+        }
+        unlink(path);
+
+        // a full disk has to be reported, even though every write is buffered
+        fp = fopen("/dev/full", "wb");
+        if (fp != NULL) {
+            CHECK(write_hilbert_text(&text, fp) == (size_t) -1, "write_hilbert_text order %d ignored a full disk",
+                  order);
+            fclose(fp);
+        }
+        fp = fopen("/dev/full", "wb");
+        if (fp != NULL) {
+            CHECK(write_hilbert_npy(order, HILBERT_DTYPE_F8, fp) == (size_t) -1,
+                  "write_hilbert_npy order %d ignored a full disk", order);
+            fclose(fp);
+        }
+        fp = fopen("/dev/full", "wb");
+        if (fp != NULL) {
+            CHECK(write_hilbert_arrow(order, HILBERT_DTYPE_F8, fp) == (size_t) -1,
+                  "write_hilbert_arrow order %d ignored a full disk", order);
+            fclose(fp);
+        }
+        fp = fopen("/dev/full", "wb");
+        if (fp != NULL) {
+            CHECK(write_hilbert_delta(order, 3, fp) == (size_t) -1, "write_hilbert_delta order %d ignored a full disk",
+                  order);
+            fclose(fp);
+        }
+    }
+}
+
+// compares exact formatting of the numerators of a range of a curve with printf
+static void compare_exact(int order, size_t first, size_t count) {
+    struct hilbert_fixed_vec2 *fixed = (struct hilbert_fixed_vec2 *) malloc(count * sizeof(struct hilbert_fixed_vec2));
+    assert(fixed != NULL);
+    hilbert_range_fixed(order, first, count, fixed);
+
+    size_t mismatches = 0;
+    char got[HILBERT_FORMAT_FIXED_MAX], want[HILBERT_FORMAT_FIXED_MAX];
+    for (size_t i = 0; i < count; i++) {
+        size_t len = hilbert_format_exact(got, fixed[i].x, order + 1);
+        got[len] = '\0';
+        snprintf(want, sizeof(want), "%.*f", order + 1, hilbert_fixed_point(order, fixed[i]).x);
+        mismatches += strcmp(got, want) != 0;
+    }
+    CHECK(mismatches == 0, "hilbert_format_exact order %d: %zu coordinates differ from %zu", order, mismatches, first);
+    free(fixed);
+}
+
+static uint64_t next_random(uint64_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return *seed;
+}
+
+// hilbert_index has to give back the index of every cell of a range
+static void compare_index(int order, size_t first, size_t count) {
+    size_t mismatches = 0;
+    for (size_t i = first; i < first + count; i++) {
+        uint32_t x, y;
+        hilbert_cell(order, i, &x, &y);
+        mismatches += hilbert_index(order, x, y) != i;
+    }
+    CHECK(mismatches == 0, "hilbert_index order %d: %zu indices differ from %zu", order, mismatches, first);
+}
+
+// the ranges of random rectangles have to be sorted, apart and hold exactly the cells inside the rectangle
+static void compare_decompose(int order, uint64_t *seed) {
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    uint32_t side = (uint32_t) 1 << order;
+    uint8_t *inside = (uint8_t *) malloc(num_points);
+    struct hilbert_span *spans = (struct hilbert_span *) malloc(num_points * sizeof(struct hilbert_span));
+    assert(inside != NULL && spans != NULL);
+
+    for (int r = 0; r < DIFF_RECTS; r++) {
+        // the first rectangle is the whole grid, the rest are random and may reach past it
+        uint32_t x0 = 0, y0 = 0, x1 = side - 1, y1 = side - 1;
+        if (r != 0) {
+            x0 = (uint32_t) (next_random(seed) % side);
+            y0 = (uint32_t) (next_random(seed) % side);
+            x1 = x0 + (uint32_t) (next_random(seed) % (side + 1 - x0 / 2));
+            y1 = y0 + (uint32_t) (next_random(seed) % (side + 1 - y0 / 2));
+        }
+        size_t num_spans = hilbert_decompose(order, x0, y0, x1, y1, spans, num_points);
+        CHECK(num_spans <= num_points, "hilbert_decompose order %d: %zu ranges", order, num_spans);
+        if (num_spans > num_points) continue;
+
+        memset(inside, 0, num_points);
+        size_t covered = 0, end = 0, bad = 0;
+        for (size_t s = 0; s < num_spans; s++) {
+            // ranges next to each other would have been one range
+            bad = spans[s].count == 0 || (s != 0 && spans[s].first <= end) ||
+                  spans[s].first + spans[s].count > num_points;
+            if (bad) break;
+            memset(&inside[spans[s].first], 1, spans[s].count);
+            covered += spans[s].count;
+            end = spans[s].first + spans[s].count;
+        }
+        CHECK(bad == 0, "hilbert_decompose order %d: ranges of (%u %u) - (%u %u) overlap or touch", order, x0, y0,
+              x1, y1);
+        if (bad) continue;
+
+        size_t mismatches = 0, cells = 0;
+        for (size_t i = 0; i < num_points; i++) {
+            uint32_t x, y;
+            hilbert_cell(order, i, &x, &y);
+            int in_rect = x >= x0 && x <= x1 && y >= y0 && y <= y1;
+            cells += in_rect;
+            mismatches += in_rect != inside[i];
+        }
+        CHECK(mismatches == 0 && cells == covered, "hilbert_decompose order %d: (%u %u) - (%u %u) misses %zu cells",
+              order, x0, y0, x1, y1, mismatches);
+    }
+    free(inside);
+    free(spans);
+}
+
+// every operation of the key service, through a real server, against the functions it calls
+// submits the same batch over and over without waiting for any of them
+struct flood {
+    struct hilbert_client *client;
+    size_t count;
+    size_t submitted;
+};
+
+static void *flood_thread(void *arg) {
+    struct flood *flood = (struct flood *) arg;
+    while (flood->submitted < flood->count &&
+           hilbert_client_submit(flood->client, 2, HILBERT_OP_CELLS, 4, 1) == 0) {
+        flood->submitted++;
+    }
+    return NULL;
+}
+
+static void compare_service(void) {
+    char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    temp_socket(path, sizeof(path));
+    struct hilbert_server *server = hilbert_server_start(path, 2);
+    CHECK(server != NULL, "hilbert_server_start failed");
+    if (server == NULL) return;
+    struct hilbert_client *client = hilbert_client_connect(path);
+    CHECK(client != NULL, "hilbert_client_connect failed");
+    if (client == NULL) {
+        hilbert_server_stop(server);
+        return;
+    }
+
+    // a full batch in every slot at once, answered in any order
+    const size_t count = HILBERT_SERVICE_DATA_BYTES / sizeof(struct space_vec2);
+    const int orders[HILBERT_SERVICE_SLOTS] = {1, 2, 5, 8, 12, 16, 20, 24, 28, 31, 3, 7, 11, 15, 19, 23};
+    for (int slot = 0; slot < HILBERT_SERVICE_SLOTS; slot++) {
+        uint64_t *indices = (uint64_t *) hilbert_client_data(client, slot);
+        for (size_t i = 0; i < count; i++) indices[i] = (i * 2654435761u) % HILBERT_NUM_POINTS(orders[slot]);
+        CHECK(hilbert_client_submit(client, slot, HILBERT_OP_POINTS, orders[slot], count) == 0, "submit failed");
+    }
+    size_t mismatches = 0;
+    for (int done = 0; done < HILBERT_SERVICE_SLOTS; done++) {
+        int slot = -1;
+        int64_t result = hilbert_client_wait(client, &slot);
+        CHECK(result == (int64_t) count, "HILBERT_OP_POINTS slot %d: result %lld", slot, (long long) result);
+        if (result != (int64_t) count) continue;
+        const struct space_vec2 *points = (const struct space_vec2 *) hilbert_client_data(client, slot);
+        for (size_t i = 0; i < count; i++) {
+            struct space_vec2 want = hilbert_point(orders[slot], (i * 2654435761u) % HILBERT_NUM_POINTS(orders[slot]));
+            mismatches += memcmp(&want, &points[i], sizeof(want)) != 0;
+        }
+    }
+    CHECK(mismatches == 0, "HILBERT_OP_POINTS: %zu points differ", mismatches);
+
+    // cells and back to indices in the same slot
+    const int order = 20;
+    const size_t num_keys = HILBERT_SERVICE_DATA_BYTES / 8;
+    uint64_t *keys = (uint64_t *) hilbert_client_data(client, 0);
+    for (size_t i = 0; i < num_keys; i++) keys[i] = (uint64_t) i * 251;
+    int64_t result = hilbert_client_call(client, 0, HILBERT_OP_CELLS, order, num_keys);
+    CHECK(result == (int64_t) num_keys, "HILBERT_OP_CELLS: result %lld", (long long) result);
+    const uint32_t *cells = (const uint32_t *) keys;
+    mismatches = 0;
+    for (size_t i = 0; i < num_keys; i++) {
+        uint32_t x, y;
+        hilbert_cell(order, i * 251, &x, &y);
+        mismatches += cells[2 * i] != x || cells[2 * i + 1] != y;
+    }
+    CHECK(mismatches == 0, "HILBERT_OP_CELLS: %zu cells differ", mismatches);
+    result = hilbert_client_call(client, 0, HILBERT_OP_INDICES, order, num_keys);
+    CHECK(result == (int64_t) num_keys, "HILBERT_OP_INDICES: result %lld", (long long) result);
+    mismatches = 0;
+    for (size_t i = 0; i < num_keys; i++) mismatches += keys[i] != (uint64_t) i * 251;
+    CHECK(mismatches == 0, "HILBERT_OP_INDICES: %zu indices differ", mismatches);
+
+    // a rectangle, and batches that don't fit the curve or the slot
+    uint32_t *rect = (uint32_t *) hilbert_client_data(client, 1);
+    rect[0] = 1000, rect[1] = 2000, rect[2] = 3000, rect[3] = 2500;
+    struct hilbert_span want[64];
+    size_t num_spans = hilbert_decompose(order, 1000, 2000, 3000, 2500, want, 64);
+    result = hilbert_client_call(client, 1, HILBERT_OP_DECOMPOSE, order, 1);
+    size_t compared = num_spans < 64 ? num_spans : 64;
+    CHECK(result == (int64_t) num_spans && memcmp(rect, want, compared * sizeof(want[0])) == 0,
+          "HILBERT_OP_DECOMPOSE: %lld ranges instead of %zu", (long long) result, num_spans);
+    keys[0] = HILBERT_NUM_POINTS(4);
+    CHECK(hilbert_client_call(client, 0, HILBERT_OP_CELLS, 4, 1) == -1,
+          "HILBERT_OP_CELLS took an index past the curve");
+    CHECK(hilbert_client_call(client, 0, HILBERT_OP_CELLS, 0, 1) == -1, "HILBERT_OP_CELLS took order 0");
+    CHECK(hilbert_client_call(client, 0, HILBERT_OP_INDICES, 4, num_keys + 1) == -1,
+          "HILBERT_OP_INDICES took more than a slot");
+
+    // far more answers than the socket holds before the client reads any of them, which the server has to keep
+    // until there is room instead of dropping the client
+    struct flood flood = {client, (size_t) 1 << 18, 0};
+    ((uint64_t *) hilbert_client_data(client, 2))[0] = 0;
+    pthread_t thread;
+    pthread_create(&thread, NULL, flood_thread, &flood);
+    usleep(200000);
+    size_t answered = 0;
+    for (; answered < flood.count; answered++) {
+        int slot = -1;
+        hilbert_client_wait(client, &slot);
+        if (slot != 2) break;
+    }
+    pthread_join(thread, NULL);
+    CHECK(flood.submitted == flood.count && answered == flood.count, "key service: %zu of %zu batches answered",
+          answered, flood.count);
+
+    hilbert_client_close(client);
+    hilbert_server_stop(server);
+    CHECK(access(path, F_OK) != 0, "hilbert_server_stop left %s behind", path);
+}
+
+// hands a plain file to one process the way a publisher hands out its sealed memfd
+struct fake_publisher {
+    int listen_fd;
+    int fd;
+};
+
+static void *fake_publisher_thread(void *arg) {
+    struct fake_publisher *fake = (struct fake_publisher *) arg;
+    int fd = accept(fake->listen_fd, NULL, NULL);
+    if (fd < 0) return NULL;
+    char byte = 0;
+    struct iovec iov = {&byte, 1};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                         .msg_controllen = sizeof(control.buf)};
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fake->fd, sizeof(int));
+    sendmsg(fd, &msg, MSG_NOSIGNAL);
+    close(fd);
+    return NULL;
+}
+
+// a published table, attached the way another process would, has to hold the curve and refuse to be written
+static void compare_shared(int order, const struct space_vec2 *ref) {
+    char path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    temp_socket(path, sizeof(path));
+    struct hilbert_publisher *publisher = hilbert_publish_start(path, order, HILBERT_DTYPE_F8, 0);
+    CHECK(publisher != NULL, "hilbert_publish_start order %d failed", order);
+    if (publisher == NULL) return;
+
+    struct hilbert_shared_table table;
+    int result = hilbert_shared_attach(path, &table);
+    CHECK(result == 0, "hilbert_shared_attach order %d failed", order);
+    if (result == 0) {
+        size_t num_points = HILBERT_NUM_POINTS(order);
+        CHECK(table.order == order && table.dtype == HILBERT_DTYPE_F8 && table.num_points == num_points &&
+              memcmp(table.points, ref, num_points * sizeof(struct space_vec2)) == 0,
+              "shared table order %d differs", order);
+        CHECK(mprotect(table.map, table.map_bytes, PROT_READ | PROT_WRITE) != 0,
+              "shared table order %d can be made writable", order);
+    }
+    // attached tables outlive their publisher
+    hilbert_publish_stop(publisher);
+    if (result == 0) {
+        CHECK(memcmp(table.points, ref, sizeof(struct space_vec2)) == 0, "shared table order %d went away", order);
+        hilbert_shared_detach(&table);
+    }
+    CHECK(hilbert_shared_attach(path, &table) != 0, "hilbert_shared_attach order %d after stopping", order);
+
+    // a plain file holding a valid table can still be written by whoever handed it out, so it is refused
+    char file_path[4096];
+    size_t num_points = HILBERT_NUM_POINTS(order);
+    uint8_t header[64] = "HILBSHM1";
+    uint32_t fields[2] = {(uint32_t) order, HILBERT_DTYPE_F8};
+    uint64_t count = num_points;
+    memcpy(&header[8], fields, sizeof(fields));
+    memcpy(&header[16], &count, sizeof(count));
+    FILE *fp = temp_file(file_path, sizeof(file_path));
+    fwrite(header, 1, sizeof(header), fp);
+    fwrite(ref, sizeof(struct space_vec2), num_points, fp);
+    fflush(fp);
+    unlink(file_path);
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strcpy(addr.sun_path, path);
+    struct fake_publisher fake = {socket(AF_UNIX, SOCK_STREAM, 0), fileno(fp)};
+    assert(fake.listen_fd >= 0);
+    result = bind(fake.listen_fd, (struct sockaddr *) &addr, sizeof(addr));
+    CHECK(result == 0 && listen(fake.listen_fd, 1) == 0, "fake publisher: %s", strerror(errno));
+    if (result == 0) {
+        pthread_t thread;
+        pthread_create(&thread, NULL, fake_publisher_thread, &fake);
+        result = hilbert_shared_attach(path, &table);
+        CHECK(result == -1 && errno == EPERM, "hilbert_shared_attach order %d took an unsealed file", order);
+        if (result == 0) hilbert_shared_detach(&table);
+        pthread_join(thread, NULL);
+        unlink(path);
+    }
+    close(fake.listen_fd);
+    fclose(fp);
+}
+
+// the center of a cell of a face at a level, as S2 projects it and hilbert_geo_decode has to find it
+static void geo_reference(int face, int level, uint32_t cx, uint32_t cy, double *lat, double *lon) {
+    double st[2] = {(cx + 0.5) / (1 << level), (cy + 0.5) / (1 << level)}, uv[2];
+    for (int i = 0; i < 2; i++) {
+        uv[i] = st[i] >= 0.5 ? (4 * st[i] * st[i] - 1) / 3 : (1 - 4 * (1 - st[i]) * (1 - st[i])) / 3;
+    }
+    double u = uv[0], v = uv[1];
+    double xyz[6][3] = {{1, u, v}, {-u, 1, v}, {-u, -v, 1}, {-1, -v, -u}, {v, -1, -u}, {v, u, -1}};
+    double *p = xyz[face];
+    *lat = atan2(p[2], sqrt(p[0] * p[0] + p[1] * p[1])) * 180 / M_PI;
+    *lon = atan2(p[1], p[0]) * 180 / M_PI;
+}
+
+// geographic keys of random places, and of every cell of a low level
+static void compare_geo(uint64_t *seed) {
+    double *latlon = (double *) malloc(DIFF_GEO_POINTS * 2 * sizeof(double));
+    uint64_t *keys = (uint64_t *) malloc(DIFF_GEO_POINTS * sizeof(uint64_t));
+    assert(latlon != NULL && keys != NULL);
+    for (size_t i = 0; i < DIFF_GEO_POINTS; i++) {
+        // uniform over the sphere, with the poles, the date line and the edges of faces among them
+        latlon[2 * i] = asin((double) (next_random(seed) >> 11) / (1ull << 52) - 1) * 180 / M_PI;
+        latlon[2 * i + 1] = (double) (next_random(seed) >> 11) / (1ull << 53) * 360 - 180;
+    }
+    const double edges[][2] = {{90, 0}, {-90, 0}, {0, 180}, {0, -180}, {0, 45}, {35.26438968275465, 45}, {0, 0}};
+    for (size_t e = 0; e < sizeof(edges) / sizeof(edges[0]); e++) {
+        latlon[2 * e] = edges[e][0];
+        latlon[2 * e + 1] = edges[e][1];
+    }
+    CHECK(hilbert_geo_encode_batch(latlon, DIFF_GEO_POINTS, HILBERT_GEO_MAX_LEVEL, keys) == 0, "batch failed");
+    CHECK(hilbert_geo_encode(0, 0, HILBERT_GEO_MAX_LEVEL + 1) == 0, "hilbert_geo_encode took level 31");
+
+    size_t mismatches = 0, far = 0, hierarchy = 0;
+    for (size_t i = 0; i < DIFF_GEO_POINTS; i++) {
+        double lat = latlon[2 * i], lon = latlon[2 * i + 1];
+        uint64_t leaf = hilbert_geo_encode(lat, lon, HILBERT_GEO_MAX_LEVEL);
+        mismatches += leaf != keys[i];
+
+        // a leaf is about a centimeter across, 1e-6 degrees is about 10 centimeters
+        double center_lat, center_lon;
+        hilbert_geo_decode(leaf, &center_lat, &center_lon);
+        double dlon = fabs(center_lon - lon);
+        dlon = dlon > 180 ? 360 - dlon : dlon;
+        far += fabs(center_lat - lat) > 1e-6 || dlon * cos(lat * M_PI / 180) > 1e-6;
+
+        // every level is a prefix of the leaf, and its own center is inside it
+        for (int level = 0; level <= HILBERT_GEO_MAX_LEVEL; level++) {
+            uint64_t key = hilbert_geo_encode(lat, lon, level);
+            hilbert_geo_decode(key, &center_lat, &center_lon);
+            hierarchy += key != hilbert_geo_parent(leaf, level) || hilbert_geo_level(key) != level ||
+                         hilbert_geo_face(key) != hilbert_geo_face(leaf) || leaf < hilbert_geo_range_min(key) ||
+                         leaf > hilbert_geo_range_max(key) || hilbert_geo_encode(center_lat, center_lon, level) != key;
+        }
+    }
+    CHECK(mismatches == 0, "hilbert_geo_encode_batch: %zu keys differ from hilbert_geo_encode", mismatches);
+    CHECK(far == 0, "hilbert_geo_decode: %zu leaves are far from where they were encoded", far);
+    CHECK(hierarchy == 0, "geographic keys: %zu levels aren't nested", hierarchy);
+
+    // every cell of a level on every face, in the order of the curve
+    size_t cells = 0;
+    mismatches = 0;
+    for (int face = 0; face < 6; face++) {
+        for (size_t index = 0; index < HILBERT_NUM_POINTS(DIFF_GEO_LEVEL); index++) {
+            uint32_t cx, cy;
+            hilbert_cell(DIFF_GEO_LEVEL, index, &cx, &cy);
+            double lat, lon, center_lat, center_lon;
+            geo_reference(face, DIFF_GEO_LEVEL, cx, cy, &lat, &lon);
+            uint64_t key = hilbert_geo_encode(lat, lon, DIFF_GEO_LEVEL);
+            uint64_t lsb = (uint64_t) 1 << (2 * (HILBERT_GEO_MAX_LEVEL - DIFF_GEO_LEVEL));
+            hilbert_geo_decode(key, &center_lat, &center_lon);
+            mismatches += key != ((uint64_t) face << 61 | (2 * index + 1) * lsb) || fabs(center_lat - lat) > 1e-9 ||
+                          fabs(center_lon - lon) > 1e-9;
+            cells++;
+        }
+    }
+    CHECK(mismatches == 0, "geographic keys: %zu of %zu cells of level %d are off the curve", mismatches, cells,
+          DIFF_GEO_LEVEL);
+    free(latlon);
+    free(keys);
+}
+
+// string keys of random indices of every order in both bases, and the prefixes of random rectangles against every
+// cell of the curve
+static void compare_keys(uint64_t *seed) {
+    const enum hilbert_key_base bases[] = {HILBERT_KEY_BASE4, HILBERT_KEY_BASE32};
+    uint64_t *indices = (uint64_t *) malloc(DIFF_KEYS * sizeof(uint64_t));
+    uint64_t *decoded = (uint64_t *) malloc(DIFF_KEYS * sizeof(uint64_t));
+    char *keys = (char *) malloc(DIFF_KEYS * HILBERT_KEY_MAX);
+    assert(indices != NULL && decoded != NULL && keys != NULL);
+
+    for (int order = 1; order <= HILBERT_MAX_ORDER; order++) {
+        uint64_t num_points = HILBERT_NUM_POINTS(order);
+        for (size_t i = 0; i < DIFF_KEYS; i++) {
+            indices[i] = i == 0 ? 0 : i == 1 ? num_points - 1 : next_random(seed) % num_points;
+        }
+        for (size_t b = 0; b < 2; b++) {
+            enum hilbert_key_base base = bases[b];
+            size_t width = hilbert_key_width(order, base);
+            CHECK(width < HILBERT_KEY_MAX && width * (base == HILBERT_KEY_BASE4 ? 2 : 5) >= (size_t) (2 * order),
+                  "hilbert_key_width order %d base %zu: %zu", order, b, width);
+            CHECK(hilbert_key_encode_batch(order, base, indices, DIFF_KEYS, keys) == 0 &&
+                  hilbert_key_decode_batch(order, base, keys, DIFF_KEYS, decoded) == 0,
+                  "key batch order %d base %zu failed", order, b);
+
+            size_t mismatches = 0, unordered = 0, unnested = 0;
+            for (size_t i = 0; i < DIFF_KEYS; i++) {
+                char key[HILBERT_KEY_MAX], prefix[HILBERT_KEY_MAX];
+                uint64_t index = ~(uint64_t) 0;
+                mismatches += hilbert_key_encode(order, base, indices[i], key) != width || strlen(key) != width ||
+                              memcmp(key, &keys[i * width], width) != 0 || decoded[i] != indices[i] ||
+                              hilbert_key_decode(order, base, key, width, &index) != 0 || index != indices[i];
+
+                // keys sort like their indices
+                if (i > 0) {
+                    int cmp = memcmp(&keys[(i - 1) * width], &keys[i * width], width);
+                    unordered += (cmp < 0) != (indices[i - 1] < indices[i]) ||
+                                 (cmp == 0) != (indices[i - 1] == indices[i]);
+                }
+                // a base 4 key starts with the key of every quadrant that holds it
+                for (int k = 1; base == HILBERT_KEY_BASE4 && k < order; k++) {
+                    hilbert_key_encode(k, base, indices[i] >> 2 * (order - k), prefix);
+                    unnested += memcmp(prefix, key, (size_t) k) != 0;
+                }
+            }
+            CHECK(mismatches == 0, "string keys order %d base %zu: %zu don't round trip", order, b, mismatches);
+            CHECK(unordered == 0, "string keys order %d base %zu: %zu out of order", order, b, unordered);
+            CHECK(unnested == 0, "string keys order %d: %zu don't start with their quadrants", order, unnested);
+
+            // keys of other widths, digits outside the base, and padding that isn't zero
+            char key[HILBERT_KEY_MAX];
+            uint64_t index;
+            hilbert_key_encode(order, base, num_points - 1, key);
+            CHECK(hilbert_key_decode(order, base, key, width - 1, &index) != 0, "short key taken, order %d", order);
+            key[0] = base == HILBERT_KEY_BASE4 ? '4' : 'w';
+            CHECK(hilbert_key_decode(order, base, key, width, &index) != 0, "bad digit taken, order %d", order);
+            if ((2 * order) % 5 != 0 && base == HILBERT_KEY_BASE32) {
+                hilbert_key_encode(order, base, 0, key);
+                key[width - 1] = '1';
+                CHECK(hilbert_key_decode(order, base, key, width, &index) != 0, "padding taken, order %d", order);
+            }
+            CHECK(hilbert_key_encode(order, base, num_points, key) == 0, "index past the curve taken, order %d", order);
+        }
+    }
+
+    // every cell of the curve is inside a rectangle exactly when its key starts with one of its prefixes
+    for (int order = 1; order <= DIFF_KEY_PREFIX_ORDER; order++) {
+        uint32_t side = (uint32_t) 1 << order;
+        for (int r = 0; r < DIFF_RECTS; r++) {
+            // random, and may reach past the grid
+            uint32_t x0 = (uint32_t) (next_random(seed) % side), y0 = (uint32_t) (next_random(seed) % side);
+            uint32_t x1 = x0 + (uint32_t) (next_random(seed) % (side + 1 - x0 / 2));
+            uint32_t y1 = y0 + (uint32_t) (next_random(seed) % (side + 1 - y0 / 2));
+            for (size_t b = 0; b < 2; b++) {
+                enum hilbert_key_base base = bases[b];
+                size_t width = hilbert_key_width(order, base);
+                size_t num = hilbert_key_prefixes(order, base, x0, y0, x1, y1, NULL, 0);
+                char *prefixes = (char *) malloc((num + 1) * (width + 1));
+                assert(prefixes != NULL);
+                CHECK(hilbert_key_prefixes(order, base, x0, y0, x1, y1, prefixes, num) == num,
+                      "hilbert_key_prefixes order %d counted differently", order);
+
+                size_t wrong = 0;
+                for (uint64_t index = 0; index < HILBERT_NUM_POINTS(order); index++) {
+                    char key[HILBERT_KEY_MAX];
+                    uint32_t cx, cy;
+                    hilbert_cell(order, index, &cx, &cy);
+                    hilbert_key_encode(order, base, index, key);
+                    size_t matches = 0;
+                    for (size_t p = 0; p < num; p++) {
+                        const char *prefix = &prefixes[p * (width + 1)];
+                        matches += strncmp(prefix, key, strlen(prefix)) == 0;
+                    }
+                    wrong += matches != (size_t) (cx >= x0 && cx <= x1 && cy >= y0 && cy <= y1);
+                }
+                CHECK(wrong == 0, "hilbert_key_prefixes order %d base %zu: %zu cells wrong in %u,%u to %u,%u", order,
+                      b, wrong, x0, y0, x1, y1);
+                free(prefixes);
+            }
+        }
+    }
+    CHECK(hilbert_key_prefixes(0, HILBERT_KEY_BASE4, 0, 0, 0, 0, NULL, 0) == (size_t) -1, "order 0 took prefixes");
+    free(indices);
+    free(decoded);
+    free(keys);
+}
+
+/* MAIN */
+
+int main(void) {
+    uint64_t seed = 0x9e3779b97f4a7c15u;
+
+    // every engine against the whole reference curve
+    for (int order = 1; order <= DIFF_EXHAUSTIVE_ORDER; order++) {
+        struct space_vec2 *ref;
+        size_t num_points = hilbert_create(order, &ref);
+        CHECK(num_points == HILBERT_NUM_POINTS(order), "hilbert_create order %d: %zu points", order, num_points);
+
+        // the single point reference has to agree with the real one, it is what the higher orders rely on
+        size_t step = num_points / 4096 + 1;
+        for (size_t i = 0; i < num_points; i += step) {
+            struct space_vec2 point = reference_point(order, i);
+            CHECK(memcmp(&point, &ref[i], sizeof(point)) == 0, "reference_point order %d differs at %zu", order, i);
+        }
+
+        for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+            compare_engine(engines[e].name, engines[e].fill, order, ref);
+        }
+        compare_segments(order, ref);
+        if (order <= DIFF_TEXT_ORDER) compare_turns(order, ref);
+        compare_dtypes(order, 0, num_points, ref);
+        compare_writers(order, ref);
+        compare_index(order, 0, num_points);
+        if (order <= DIFF_TEXT_ORDER) compare_shared(order, ref);
+        if (order <= DIFF_DECOMPOSE_ORDER) compare_decompose(order, &seed);
+
+        free(ref);
+        printf("order %2d: %zu points compared exhaustively\n", order, num_points);
+        fflush(stdout);
+    }
+
+    // random ranges of the orders that are too big to create, always including both ends of the curve
+    for (int order = DIFF_EXHAUSTIVE_ORDER + 1; order <= HILBERT_MAX_ORDER; order++) {
+        size_t num_points = HILBERT_NUM_POINTS(order);
+        size_t firsts[DIFF_RANGES], counts[DIFF_RANGES];
+        for (int r = 0; r < DIFF_RANGES; r++) {
+            next_random(&seed);
+            counts[r] = DIFF_RANGE_POINTS;
+            firsts[r] = r == 0 ? 0 : r == 1 ? num_points - DIFF_RANGE_POINTS
+                                            : (size_t) (seed % (num_points - DIFF_RANGE_POINTS + 1));
+        }
+        for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+            if (engines[e].fill == engine_float && order > HILBERT_FLOAT_MAX_ORDER) continue;
+            compare_ranges(engines[e].name, engines[e].fill, order, NULL, firsts, counts, DIFF_RANGES);
+        }
+        struct space_vec2 *ref = (struct space_vec2 *) malloc(DIFF_RANGE_POINTS * sizeof(struct space_vec2));
+        assert(ref != NULL);
+        for (int r = 0; r < DIFF_RANGES; r++) {
+            for (size_t i = 0; i < counts[r]; i++) ref[i] = reference_point(order, firsts[r] + i);
+            compare_dtypes(order, firsts[r], counts[r], ref);
+            compare_exact(order, firsts[r], counts[r]);
+            compare_index(order, firsts[r], counts[r]);
+        }
+        free(ref);
+        printf("order %2d: %d random ranges of %zu points compared\n", order, DIFF_RANGES, DIFF_RANGE_POINTS);
+        fflush(stdout);
+    }
+
+    compare_corrupt_files();
+    printf("arrow, delta and resumable files with overflowing sizes are rejected\n");
+    compare_render();
+    printf("ppm and png images match the curve drawn line by line\n");
+    compare_validate();
+    printf("the validator takes a valid file and finds swapped, duplicated, off-center and missing points\n");
+    compare_service();
+    printf("key service matches hilbert_cell, hilbert_point, hilbert_index and hilbert_decompose\n");
+    compare_geo(&seed);
+    printf("geographic keys match their cells at every level\n");
+    compare_keys(&seed);
+    printf("string keys round trip, sort like the curve and their prefixes cover exactly their rectangles\n");
+
+    if (failures != 0) {
+        printf("%d differences found\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("every engine matches hilbert_create\n");
+    return EXIT_SUCCESS;
+}
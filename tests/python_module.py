@@ -0,0 +1,119 @@
+#
+# python_module.py - Checks the hilbert Python module against hilbert_curve
+# Copyright (C) 2020 Jacob Parker
+# Unlicensed - Public Domain work
+# This piece of work is unlicensed, and can be used commercially
+#
+# Run by ctest when cmake is configured with -DHILBERT_PYTHON=ON, with the module on PYTHONPATH and the path of
+# hilbert_curve as the only argument. Every dtype that curve() and range() write has to match the npy file that
+# hilbert_curve writes for it byte for byte, and encode() and decode() have to turn the u4 cells of that file into
+# their indices and back. Buffers passed as 'out' are written in place, and bad keys, orders and buffers raise
+#
+
+import array
+import subprocess
+import sys
+
+import hilbert
+
+# highest order compared exhaustively, with enough keys to be split over several threads
+PYTHON_ORDER = 10
+
+failures = 0
+
+
+def check(ok, message):
+    global failures
+    if not ok:
+        print("FAIL " + message)
+        failures += 1
+
+
+def raises(error, fn, *args, **kwargs):
+    try:
+        fn(*args, **kwargs)
+    except error:
+        return True
+    except Exception:
+        return False
+    return False
+
+
+# the points of a curve as hilbert_curve writes them, without the npy header
+def c_points(order, dtype):
+    data = subprocess.run([sys.argv[1], "--format=npy", "--dtype=" + dtype, "--order=%d" % order, "--stdout"],
+                          stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, check=True).stdout
+    header = int.from_bytes(data[8:10], "little")
+    return data[10 + header:]
+
+
+# array module types of every dtype, for buffers passed as 'out'
+typecodes = {"f8": "d", "f4": "f", "u2": "H", "u4": "I"}
+sizes = {"f8": 8, "f4": 4, "u2": 2, "u4": 4}
+
+for order in range(1, PYTHON_ORDER + 1):
+    num_points = hilbert.num_points(order)
+    check(num_points == 4 ** order, "num_points order %d: %d" % (order, num_points))
+
+    for dtype in ("f8", "f4", "u2", "u4"):
+        expected = c_points(order, dtype)
+        item = 2 * sizes[dtype]
+        check(hilbert.curve(order, dtype=dtype).tobytes() == expected, "curve order %d %s" % (order, dtype))
+        check(hilbert.curve(order, dtype=dtype, threads=3).tobytes() == expected,
+              "curve order %d %s on 3 threads" % (order, dtype))
+
+        # both ends of the curve and a piece from the middle, into new buffers and into 'out'
+        for first, count in ((0, 1), (num_points - 3, 3), (num_points // 3, num_points // 2)):
+            got = hilbert.range(order, first, count, dtype=dtype)
+            check(got.tobytes() == expected[first * item:(first + count) * item],
+                  "range order %d %s from %d" % (order, dtype, first))
+            out = array.array(typecodes[dtype], bytes(count * item))
+            check(hilbert.range(order, first, count, dtype=dtype, out=out) is out and
+                  out.tobytes() == expected[first * item:(first + count) * item],
+                  "range order %d %s from %d into out" % (order, dtype, first))
+
+    # decode turns every index into the u4 cell of hilbert_curve, encode turns those cells back
+    cells = c_points(order, "u4")
+    indices = array.array("Q", range(num_points))
+    check(hilbert.decode(order, indices, threads=4).tobytes() == cells, "decode order %d" % order)
+    check(hilbert.encode(order, array.array("I", cells), threads=4).tobytes() == indices.tobytes(),
+          "encode order %d" % order)
+    out = array.array("I", bytes(len(cells)))
+    check(hilbert.decode(order, indices, out=out) is out and out.tobytes() == cells, "decode order %d into out" % order)
+    out = array.array("Q", bytes(len(indices) * 8))
+    check(hilbert.encode(order, array.array("I", cells), out=out) is out and out == indices,
+          "encode order %d into out" % order)
+
+# a key outside of the curve in the last part of a batch split over several threads
+order = PYTHON_ORDER
+num_points = hilbert.num_points(order)
+indices = array.array("Q", range(num_points))
+indices[-1] = num_points
+check(raises(ValueError, hilbert.decode, order, indices, threads=4), "decode took an index past the curve")
+cells = array.array("I", bytes(num_points * 8))
+cells[-1] = 1 << order
+check(raises(ValueError, hilbert.encode, order, cells, threads=4), "encode took a cell outside of the curve")
+check(raises(ValueError, hilbert.encode, order, array.array("I", [0, 0, 0])), "encode took half a cell")
+
+# orders, dtypes and ranges that don't exist
+check(raises(ValueError, hilbert.curve, 0), "curve took order 0")
+check(raises(ValueError, hilbert.curve, hilbert.MAX_ORDER + 1), "curve took an order above MAX_ORDER")
+check(raises(ValueError, hilbert.curve, 2, dtype="i8"), "curve took an unknown dtype")
+check(raises(ValueError, hilbert.range, 17, 0, 1, dtype="u2"), "range took u2 for order 17")
+check(raises(ValueError, hilbert.range, 2, 15, 2), "range took points past the end of the curve")
+check(raises(ValueError, hilbert.num_points, 0), "num_points took order 0")
+
+# buffers of the wrong type, size or mutability
+check(raises(TypeError, hilbert.curve, 2, out=array.array("f", bytes(128))), "curve wrote f8 into an f4 buffer")
+check(raises(TypeError, hilbert.curve, 2, dtype="u4", out=array.array("d", bytes(256))),
+      "curve wrote u4 into an f8 buffer")
+check(raises(ValueError, hilbert.curve, 2, out=array.array("d", bytes(248))), "curve wrote into a buffer too small")
+check(raises(BufferError, hilbert.curve, 2, out=bytes(256)), "curve wrote into a read only buffer")
+check(raises(TypeError, hilbert.decode, 2, array.array("I", [0, 1])), "decode took u4 indices")
+check(raises(ValueError, hilbert.decode, 2, array.array("Q", [0, 1]), out=array.array("I", [0, 0])),
+      "decode wrote into a buffer too small")
+
+if failures:
+    print("%d checks failed" % failures)
+    sys.exit(1)
+print("the python module matches hilbert_curve")
@@ -0,0 +1,100 @@
+/*
+ * validate.c - Program for checking pseudo-hilbert curve files
+ * Copyright (C) 2020 Jacob Parker
+ * Unlicensed - Public Domain work
+ * This piece of work is unlicensed, and can be used commercially
+ *
+ * Checks every file given on the command line with hilbert_validate and prints what was found.
+ * The exit status is 0 only if every file holds a valid curve, so it can be used after copying files around
+ *
+ * SEGMENTS:
+ *  Validate - Parses the options and reports on every file
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "hilbert.h"
+
+/* VALIDATE */
+
+static void print_usage(const char *program) {
+    fprintf(stderr, "usage: %s [--order=N] [--threads=N] [--reference[=FIRST:COUNT]] FILE...\n", program);
+    fprintf(stderr, "  FILE             a raw (oNN_hilbert), npy, arrow or delta curve file\n");
+    fprintf(stderr, "  --order=N        require curves of order N instead of any order\n");
+    fprintf(stderr, "  --threads=N      number of threads to use, 0 for one per core (default)\n");
+    fprintf(stderr, "  --reference      also compare every point with the generator\n");
+    fprintf(stderr, "  --reference=FIRST:COUNT\n"
+                    "                   only compare COUNT points from index FIRST with the generator\n");
+}
+
+int main(int argc, char **argv) {
+    struct hilbert_validate_options options = {0};
+    int num_files = 0, failed = 0;
+
+    for (int arg = 1; arg < argc; arg++) {
+        if (strncmp(argv[arg], "--order=", 8) == 0) {
+            options.order = atoi(argv[arg] + 8);
+            if (options.order < 1 || options.order > HILBERT_MAX_ORDER) goto usage;
+        } else if (strncmp(argv[arg], "--threads=", 10) == 0) {
+            options.threads = atoi(argv[arg] + 10);
+        } else if (strcmp(argv[arg], "--reference") == 0) {
+            options.ref_first = 0;
+            options.ref_count = (size_t) -1;
+        } else if (strncmp(argv[arg], "--reference=", 12) == 0) {
+            unsigned long long first, count;
+            if (sscanf(argv[arg] + 12, "%llu:%llu", &first, &count) != 2) goto usage;
+            options.ref_first = (size_t) first;
+            options.ref_count = (size_t) count;
+        } else if (argv[arg][0] == '-') {
+            goto usage;
+        } else {
+            num_files++;
+        }
+    }
+    if (num_files == 0) goto usage;
+
+    for (int arg = 1; arg < argc; arg++) {
+        if (argv[arg][0] == '-') continue;
+
+        struct hilbert_file file;
+        if (hilbert_file_open(&file, argv[arg]) != 0) {
+            printf("%s: %s\n", argv[arg], errno == EINVAL ? "not a curve file" : strerror(errno));
+            failed = 1;
+            continue;
+        }
+
+        struct timespec start, end;
+        struct hilbert_validate_report report;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int result = hilbert_validate(&file, &options, &report);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        if (report.wrong_count && options.order) {
+            printf("%s: %zu points are not a curve of order %d\n", argv[arg], report.num_points, options.order);
+        } else if (report.wrong_count) {
+            printf("%s: %zu points are not a complete curve\n", argv[arg], report.num_points);
+        } else if (result == 0) {
+            printf("%s: valid order %d curve, %zu points checked in %.2fs (%.1f M points/s)\n", argv[arg],
+                   report.order, report.num_points, seconds, seconds > 0 ? report.num_points / seconds / 1e6 : 0.0);
+        } else {
+            printf("%s: invalid order %d curve, first problem at point %zu\n", argv[arg], report.order,
+                   report.first_error);
+            printf("  %zu points off cell centers, %zu bad steps, %zu repeated cells, %zu missing cells, "
+                   "%zu reference mismatches\n", report.bad_points, report.bad_steps, report.repeated,
+                   report.missing, report.mismatched);
+        }
+        if (result != 0) failed = 1;
+        hilbert_file_close(&file);
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    usage:
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+}